@@ -0,0 +1,283 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <libgen.h>
+#include <time.h>
+
+#include "optiga/ifx_i2c/ifx_i2c_config.h"
+#include "optiga/optiga_util.h"
+
+#include "trustm_helper.h"
+#include "trustm_tools.h"
+
+#define MAX_RUNNER_LINE     2048
+#define MAX_RUNNER_ARGS     64
+
+typedef struct runner_tool_str
+{
+    const char *name;
+    int (*run)(int argc, char **argv);
+} runner_tool_t;
+
+static const runner_tool_t runner_tools[] = {
+    {"trustm_cert", trustm_cert_run},
+    {"trustm_chipinfo", trustm_chipinfo_run},
+    {"trustm_data", trustm_data_run},
+    {"trustm_ecc_keygen", trustm_ecc_keygen_run},
+    {"trustm_ecc_sign", trustm_ecc_sign_run},
+    {"trustm_ecc_verify", trustm_ecc_verify_run},
+    {"trustm_envelope", trustm_envelope_run},
+    {"trustm_hkdf", trustm_hkdf_run},
+    {"trustm_hmac", trustm_hmac_run},
+    {"trustm_metadata", trustm_metadata_run},
+    {"trustm_monotonic_counter", trustm_monotonic_counter_run},
+    {"trustm_read_data", trustm_read_data_run},
+    {"trustm_read_status", trustm_read_status_run},
+    {"trustm_readmetadata_data", trustm_readmetadata_data_run},
+    {"trustm_readmetadata_private", trustm_readmetadata_private_run},
+    {"trustm_readmetadata_status", trustm_readmetadata_status_run},
+    {"trustm_rsa_dec", trustm_rsa_dec_run},
+    {"trustm_rsa_enc", trustm_rsa_enc_run},
+    {"trustm_rsa_keygen", trustm_rsa_keygen_run},
+    {"trustm_rsa_sign", trustm_rsa_sign_run},
+    {"trustm_rsa_verify", trustm_rsa_verify_run},
+    {"trustm_symmetric_dec", trustm_symmetric_dec_run},
+    {"trustm_symmetric_enc", trustm_symmetric_enc_run},
+    {"trustm_symmetric_keygen", trustm_symmetric_keygen_run},
+};
+
+static void helpmenu(void)
+{
+    printf("\nHelp menu: trustm <option> ...<option>\n");
+    printf("option:- \n");
+    printf("-f <filename> : Command file, one tool command per line\n");
+    printf("                [default stdin]\n");
+    printf("-l            : List available tools\n");
+    printf("-h            : Print this help \n");
+}
+
+/**********************************************************************
+* runner_find()
+* Accepts the tool name with or without path and "trustm_" prefix, so
+* lines from existing shell scripts can be used as they are.
+**********************************************************************/
+static const runner_tool_t *runner_find(char *name)
+{
+    char *base = basename(name);
+    uint16_t i;
+
+    for (i = 0; i < sizeof(runner_tools)/sizeof(runner_tools[0]); i++)
+    {
+        if ((strcmp(base, runner_tools[i].name) == 0) ||
+            (strcmp(base, runner_tools[i].name + strlen("trustm_")) == 0))
+            return &runner_tools[i];
+    }
+    return NULL;
+}
+
+/**********************************************************************
+* runner_split()
+* Splits a command line into arguments. Single and double quotes group
+* words, a backslash escapes the next character and '#' starts a
+* comment outside of quotes.
+**********************************************************************/
+static int runner_split(char *line, char **argv, int max)
+{
+    char *src = line;
+    char *dst = line;
+    char quote;
+    int argc = 0;
+
+    while (*src != '\0')
+    {
+        while ((*src == ' ') || (*src == '\t') || (*src == '\r') || (*src == '\n'))
+            src++;
+        if ((*src == '\0') || (*src == '#'))
+            break;
+        if (argc == max - 1)
+            return -1;
+
+        argv[argc++] = dst;
+        quote = 0;
+        while (*src != '\0')
+        {
+            if (quote)
+            {
+                if (*src == quote)
+                    quote = 0;
+                else
+                    *dst++ = *src;
+                src++;
+            }
+            else if ((*src == '\'') || (*src == '"'))
+                quote = *src++;
+            else if ((*src == '\\') && (src[1] != '\0'))
+            {
+                *dst++ = src[1];
+                src += 2;
+            }
+            else if ((*src == ' ') || (*src == '\t') || (*src == '\r') || (*src == '\n'))
+                break;
+            else
+                *dst++ = *src++;
+        }
+        if (quote)
+            return -1;
+        if (*src != '\0')
+            src++;
+        *dst++ = '\0';
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+static uint64_t runner_elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return ((uint64_t)(end->tv_sec - start->tv_sec) * 1000000) +
+            ((end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+int main (int argc, char **argv)
+{
+    optiga_lib_status_t return_status;
+    const runner_tool_t *tool;
+    char line[MAX_RUNNER_LINE];
+    char *args[MAX_RUNNER_ARGS];
+    int nargs;
+    int ret;
+    uint32_t step = 0;
+    uint32_t lineNo = 0;
+    int failed = 0;
+    uint64_t us;
+    struct timespec runStart, runEnd, start, end;
+    char *cmdFile = NULL;
+    FILE *fp = stdin;
+    uint16_t i;
+
+    int option = 0;                    // Command line option.
+
+    opterr = 0; // Disable getopt error messages in case of unknown parameters
+    while (-1 != (option = getopt(argc, argv, "f:lh")))
+    {
+        switch (option)
+        {
+            case 'f': // Command file
+                cmdFile = optarg;
+                break;
+            case 'l': // List tools
+                for (i = 0; i < sizeof(runner_tools)/sizeof(runner_tools[0]); i++)
+                    printf("%s\n", runner_tools[i].name);
+                exit(0);
+                break;
+            case 'h': // Print Help Menu
+            default:  // Any other command Print Help Menu
+                helpmenu();
+                exit(0);
+                break;
+        }
+    }
+
+    if ((cmdFile != NULL) && (strcmp(cmdFile, "-") != 0))
+    {
+        fp = fopen(cmdFile, "r");
+        if (!fp)
+        {
+            printf("error opening file : %s\n", cmdFile);
+            exit(1);
+        }
+    }
+
+    // One session and one IPC lock hold for all steps
+    trustm_hibernate_flag = 0;
+    return_status = trustm_Open();
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        exit(1);
+    trustm_session_hold = 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        lineNo++;
+        nargs = runner_split(line, args, MAX_RUNNER_ARGS);
+        if (nargs == 0)
+            continue;
+        if (nargs < 0)
+        {
+            printf("line %u : syntax error\n", lineNo);
+            failed = 1;
+            break;
+        }
+        tool = runner_find(args[0]);
+        if (tool == NULL)
+        {
+            printf("line %u : unknown tool %s\n", lineNo, args[0]);
+            failed = 1;
+            break;
+        }
+
+        step++;
+        printf("[step %u] %s", step, tool->name);
+        for (i = 1; i < nargs; i++)
+            printf(" %s", args[i]);
+        printf("\n");
+        fflush(stdout);
+
+        optind = 0; // full getopt reset for the next tool
+        trustm_last_error = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = tool->run(nargs, args);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        us = runner_elapsed_us(&start, &end);
+        if ((ret != 0) || (trustm_last_error != 0))
+        {
+            printf("[step %u] %s : Failed (%lu.%03lu ms)\n", step, tool->name,
+                    (unsigned long)(us / 1000), (unsigned long)(us % 1000));
+            failed = 1;
+            break;
+        }
+        printf("[step %u] %s : Success (%lu.%03lu ms)\n", step, tool->name,
+                (unsigned long)(us / 1000), (unsigned long)(us % 1000));
+        fflush(stdout);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &runEnd);
+
+    if (fp != stdin)
+        fclose(fp);
+
+    us = runner_elapsed_us(&runStart, &runEnd);
+    printf("========================================================\n");
+    printf("Steps            : %u %s\n", step, failed ? "(stopped at first error)" : "completed");
+    printf("Total time       : %lu.%03lu ms\n", (unsigned long)(us / 1000), (unsigned long)(us % 1000));
+
+    trustm_session_hold = 0;
+    trustm_Close();
+    trustm_hibernate_flag = 0; // Disable hibernate Context Save
+    return failed;
+}
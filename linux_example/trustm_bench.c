@@ -0,0 +1,970 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+#include <openssl/engine.h>
+
+#include "optiga/ifx_i2c/ifx_i2c_config.h"
+#include "optiga/optiga_util.h"
+#include "optiga/optiga_crypt.h"
+
+#include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+
+#define BENCH_MAX_THREADS       32
+#define BENCH_MAX_PROCESSES     32
+#define BENCH_MAX_CTRL          8
+#define BENCH_MAX_DATA          1728
+#define BENCH_DIGEST_SIZE       32
+
+// Log-linear histogram of the latency in us, 64 sub buckets per power of
+// two (2 significant digits) up to 2^31 us
+#define BENCH_SUB_BUCKETS       64
+#define BENCH_HIST_BUCKETS      (25 * BENCH_SUB_BUCKETS + BENCH_SUB_BUCKETS)
+#define BENCH_HIST_MAX          ((1ULL << 31) - 1)
+
+#define BENCH_OP_SIGN           0
+#define BENCH_OP_DEC            1
+#define BENCH_OP_RAND           2
+#define BENCH_OP_READ           3
+#define BENCH_OP_LOAD           4
+
+typedef struct _OPTFLAG {
+    uint16_t    engine      : 1;
+    uint16_t    session     : 1;
+    uint16_t    json        : 1;
+    uint16_t    bypass      : 1;
+    uint16_t    dummy4      : 1;
+    uint16_t    dummy5      : 1;
+    uint16_t    dummy6      : 1;
+    uint16_t    dummy7      : 1;
+    uint16_t    dummy8      : 1;
+    uint16_t    dummy9      : 1;
+    uint16_t    dummy10     : 1;
+    uint16_t    dummy11     : 1;
+    uint16_t    dummy12     : 1;
+    uint16_t    dummy13     : 1;
+    uint16_t    dummy14     : 1;
+    uint16_t    dummy15     : 1;
+}OPTFLAG;
+
+union _uOptFlag {
+    OPTFLAG flags;
+    uint16_t    all;
+} uOptFlag;
+
+typedef struct bench_hist_str
+{
+    uint64_t    count[BENCH_HIST_BUCKETS];
+    uint64_t    total;
+    uint64_t    min;
+    uint64_t    max;
+    double      sum;
+    double      sumsq;
+} bench_hist_t;
+
+// One per worker thread, in memory shared with the worker processes
+typedef struct bench_slot_str
+{
+    bench_hist_t    hist;
+    uint64_t        ops;
+    uint64_t        errors;
+    uint64_t        start;      // CLOCK_MONOTONIC us, same clock in all processes
+    uint64_t        end;
+    uint16_t        lastError;
+} bench_slot_t;
+
+static const char *bench_op_name[] = {"sign", "dec", "rand", "read", "load"};
+
+// Configuration
+static uint8_t bench_op = BENCH_OP_SIGN;
+static char *bench_keyId = "0xe0f0";
+static uint16_t bench_keyOid = 0xE0F0;
+static uint16_t bench_dataOid = 0xE0E0;
+static uint16_t bench_size = 32;
+static uint32_t bench_duration = 10;
+static uint32_t bench_count = 0;
+static uint32_t bench_threads = 1;
+static uint32_t bench_processes = 1;
+static char *bench_engineId = NULL;
+static char *bench_ctrl[BENCH_MAX_CTRL];
+static uint32_t bench_ctrlCount = 0;
+
+// Per process state
+static bench_slot_t *bench_slot;
+static pthread_mutex_t bench_chip_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ENGINE *bench_engine = NULL;
+static EVP_PKEY *bench_pkey = NULL;
+static uint8_t bench_digest[BENCH_DIGEST_SIZE];
+static uint8_t bench_cipher[512];
+static size_t bench_cipherLen = 0;
+
+void helpmenu(void)
+{
+    printf("\nHelp menu: trustm_bench <option> ...<option>\n");
+    printf("option:- \n");
+    printf("-o <operation> : sign, dec, rand, read (helper) or load (engine)\n");
+    printf("                 [default sign]\n");
+    printf("-k <key>       : Key OID for sign and dec [default 0xe0f0]\n");
+    printf("                 with -e any engine key id, e.g. 0xe0fc:^\n");
+    printf("-r <OID>       : Data object OID for read [default 0xe0e0]\n");
+    printf("-b <bytes>     : Bytes per rand or read [default 32, read all: 0]\n");
+    printf("-d <seconds>   : Duration [default 10]\n");
+    printf("-n <count>     : Operations per thread, ends before the duration\n");
+    printf("-t <threads>   : Threads per process [default 1, max %d]\n", BENCH_MAX_THREADS);
+    printf("-p <processes> : Processes [default 1, max %d]\n", BENCH_MAX_PROCESSES);
+    printf("-s             : Keep the application open for the whole run\n");
+    printf("                 [default open and close for every operation]\n");
+    printf("                 with -e use the engine control SESSION=1\n");
+    printf("-e <engine>    : Benchmark the OpenSSL engine (id or .so path)\n");
+    printf("                 instead of the helper API\n");
+    printf("-c <CMD=value> : Engine control command, e.g. SESSION=1 [max %d]\n", BENCH_MAX_CTRL);
+    printf("-j <filename>  : Write the results in JSON format\n");
+    printf("-X             : Bypass Shielded Communication \n");
+    printf("-h             : Print this help \n");
+}
+
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* bench_hist_index() / bench_hist_value()
+* Bucket of a value and highest value counted in a bucket.
+**********************************************************************/
+static uint32_t bench_hist_index(uint64_t value)
+{
+    uint32_t shift = 0;
+
+    if (value > BENCH_HIST_MAX)
+        value = BENCH_HIST_MAX;
+    while ((value >> shift) >= (2 * BENCH_SUB_BUCKETS))
+        shift++;
+    if (shift == 0)
+        return (uint32_t)value;
+    return (shift * BENCH_SUB_BUCKETS) + (uint32_t)(value >> shift);
+}
+
+static uint64_t bench_hist_value(uint32_t index)
+{
+    uint32_t shift;
+
+    if (index < (2 * BENCH_SUB_BUCKETS))
+        return index;
+    shift = (index / BENCH_SUB_BUCKETS) - 1;
+    return ((uint64_t)(index - (shift * BENCH_SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+static void bench_hist_record(bench_hist_t *hist, uint64_t value)
+{
+    hist->count[bench_hist_index(value)]++;
+    if ((hist->total == 0) || (value < hist->min))
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->total++;
+    hist->sum += (double)value;
+    hist->sumsq += (double)value * value;
+}
+
+static void bench_hist_merge(bench_hist_t *to, const bench_hist_t *from)
+{
+    uint32_t i;
+
+    if (from->total == 0)
+        return;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+        to->count[i] += from->count[i];
+    if ((to->total == 0) || (from->min < to->min))
+        to->min = from->min;
+    if (from->max > to->max)
+        to->max = from->max;
+    to->total += from->total;
+    to->sum += from->sum;
+    to->sumsq += from->sumsq;
+}
+
+/**********************************************************************
+* bench_hist_percentile()
+* Value at percentile (0-100), within the bucket resolution.
+**********************************************************************/
+static uint64_t bench_hist_percentile(const bench_hist_t *hist, double percentile, uint64_t *below)
+{
+    uint64_t target, count = 0;
+    uint64_t value;
+    uint32_t i;
+
+    if (hist->total == 0)
+        return 0;
+    target = (uint64_t)ceil((percentile / 100.0) * hist->total);
+    if (target == 0)
+        target = 1;
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+    {
+        count += hist->count[i];
+        if (count >= target)
+            break;
+    }
+    if (below != NULL)
+        *below = count;
+    value = bench_hist_value(i);
+    if (value > hist->max)
+        value = hist->max;
+    if (value < hist->min)
+        value = hist->min;
+    return value;
+}
+
+/**********************************************************************
+* bench_hist_print()
+* Percentile distribution in HdrHistogram format, values in ms.
+**********************************************************************/
+static void bench_hist_print(const bench_hist_t *hist)
+{
+    double percentile, low, step;
+    double mean, stddev;
+    uint64_t value, below = 0;
+    uint32_t half, tick;
+
+    if (hist->total == 0)
+        return;
+
+    printf("%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    for (half = 0; below < hist->total; half++)
+    {
+        low = 100.0 - (100.0 / (double)(1ULL << half));
+        step = (100.0 / (double)(1ULL << (half + 1))) / 5;
+        for (tick = 0; (tick < 5) && (below < hist->total); tick++)
+        {
+            percentile = low + (tick * step);
+            value = bench_hist_percentile(hist, percentile, &below);
+            printf("%12.3f %14.12f %10llu %14.2f\n", value / 1000.0, percentile / 100.0,
+                    (unsigned long long)below, 1.0 / (1.0 - (percentile / 100.0)));
+        }
+    }
+    printf("%12.3f %14.12f %10llu\n", hist->max / 1000.0, 1.0, (unsigned long long)hist->total);
+
+    mean = hist->sum / hist->total;
+    stddev = sqrt((hist->sumsq / hist->total) - (mean * mean));
+    printf("#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / 1000.0, stddev / 1000.0);
+    printf("#[Max     = %12.3f, Total count    = %12llu]\n", hist->max / 1000.0,
+            (unsigned long long)hist->total);
+    printf("#[Buckets = %12d, SubBuckets     = %12d]\n", BENCH_HIST_BUCKETS / BENCH_SUB_BUCKETS,
+            BENCH_SUB_BUCKETS);
+}
+
+/**********************************************************************
+* bench_json()
+**********************************************************************/
+static uint16_t bench_json(const char *filename, const bench_hist_t *hist, uint64_t ops, uint64_t errors,
+                            double elapsed)
+{
+    FILE *fp;
+    uint32_t i, n = 0;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        printf("Error opening file %s\n", filename);
+        return 1;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"mode\": \"%s\",\n", uOptFlag.flags.engine ? "engine" : "helper");
+    fprintf(fp, "  \"operation\": \"%s\",\n", bench_op_name[bench_op]);
+    fprintf(fp, "  \"key\": \"%s\",\n", bench_keyId);
+    fprintf(fp, "  \"data_oid\": \"0x%.4X\",\n", bench_dataOid);
+    fprintf(fp, "  \"bytes\": %u,\n", bench_size);
+    fprintf(fp, "  \"session\": %d,\n", uOptFlag.flags.session);
+    fprintf(fp, "  \"processes\": %u,\n", bench_processes);
+    fprintf(fp, "  \"threads\": %u,\n", bench_threads);
+    fprintf(fp, "  \"engine_ctrl\": [");
+    for (i = 0; i < bench_ctrlCount; i++)
+        fprintf(fp, "%s\"%s\"", (i == 0) ? "" : ", ", bench_ctrl[i]);
+    fprintf(fp, "],\n");
+    fprintf(fp, "  \"elapsed_s\": %.6f,\n", elapsed);
+    fprintf(fp, "  \"operations\": %llu,\n", (unsigned long long)ops);
+    fprintf(fp, "  \"errors\": %llu,\n", (unsigned long long)errors);
+    fprintf(fp, "  \"ops_per_sec\": %.3f,\n", (elapsed > 0) ? (ops / elapsed) : 0.0);
+    fprintf(fp, "  \"latency_us\": {\"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+                "\"p99\": %llu, \"p99_9\": %llu, \"max\": %llu},\n",
+                (unsigned long long)hist->min, (hist->total != 0) ? (hist->sum / hist->total) : 0.0,
+                (unsigned long long)bench_hist_percentile(hist, 50, NULL),
+                (unsigned long long)bench_hist_percentile(hist, 90, NULL),
+                (unsigned long long)bench_hist_percentile(hist, 99, NULL),
+                (unsigned long long)bench_hist_percentile(hist, 99.9, NULL),
+                (unsigned long long)hist->max);
+    // Non empty buckets as [highest value in us, count]
+    fprintf(fp, "  \"histogram\": [");
+    for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+    {
+        if (hist->count[i] == 0)
+            continue;
+        fprintf(fp, "%s[%llu, %llu]", (n++ == 0) ? "" : ", ",
+                (unsigned long long)bench_hist_value(i), (unsigned long long)hist->count[i]);
+    }
+    fprintf(fp, "]\n}\n");
+    fclose(fp);
+    return 0;
+}
+
+/**********************************************************************
+* bench_rsa_cipher()
+* Encrypts a random message with the public key in software, input of
+* the decrypt benchmark.
+**********************************************************************/
+static uint16_t bench_rsa_cipher(EVP_PKEY *pubkey)
+{
+    EVP_PKEY_CTX *ctx;
+    uint8_t msg[BENCH_DIGEST_SIZE];
+    uint16_t ret = 1;
+
+    if (EVP_PKEY_base_id(pubkey) != EVP_PKEY_RSA)
+    {
+        printf("Decrypt benchmark needs an RSA key!!!\n");
+        return 1;
+    }
+    RAND_bytes(msg, sizeof(msg));
+    bench_cipherLen = sizeof(bench_cipher);
+    ctx = EVP_PKEY_CTX_new(pubkey, NULL);
+    if ((ctx != NULL) && (EVP_PKEY_encrypt_init(ctx) > 0) &&
+        (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) > 0) &&
+        (EVP_PKEY_encrypt(ctx, bench_cipher, &bench_cipherLen, msg, sizeof(msg)) > 0))
+        ret = 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ret;
+}
+
+/**********************************************************************
+* bench_helper_setup()
+* Reads the public key of the RSA key from <key OID + 0x10E4> for the
+* decrypt benchmark. Application must be open.
+**********************************************************************/
+static optiga_lib_status_t bench_helper_setup(void)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+    uint8_t buf[BENCH_MAX_DATA];
+    uint16_t len = sizeof(buf);
+    const unsigned char *p = buf;
+    EVP_PKEY *pubkey;
+
+    if (bench_op != BENCH_OP_DEC)
+        return OPTIGA_LIB_SUCCESS;
+
+    optiga_lib_status = OPTIGA_LIB_BUSY;
+    return_status = optiga_util_read_data(me_util, bench_keyOid + 0x10E4, 0, buf, &len);
+    if (OPTIGA_LIB_SUCCESS != return_status)
+        return return_status;
+    trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+    return_status = optiga_lib_status;
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        return return_status;
+
+    pubkey = d2i_PUBKEY(NULL, &p, len);
+    if (pubkey == NULL)
+    {
+        printf("No public key in 0x%.4X, generate the key with -s!!!\n", bench_keyOid + 0x10E4);
+        return OPTIGA_CRYPT_ERROR;
+    }
+    if (bench_rsa_cipher(pubkey) != 0)
+        return_status = OPTIGA_CRYPT_ERROR;
+    EVP_PKEY_free(pubkey);
+    return return_status;
+}
+
+/**********************************************************************
+* bench_helper_op()
+* One operation through the helper API. Threads of a process share the
+* helper instances, the caller holds bench_chip_mutex.
+**********************************************************************/
+static optiga_lib_status_t bench_helper_op(void)
+{
+    optiga_lib_status_t return_status;
+    uint8_t buf[BENCH_MAX_DATA];
+    uint16_t len = sizeof(buf);
+
+    if (uOptFlag.flags.session != 1)
+    {
+        return_status = trustm_Open();
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            return return_status;
+    }
+
+    do
+    {
+        if (uOptFlag.flags.bypass != 1)
+        {
+            // OPTIGA Comms Shielded connection settings to enable the protection
+            if ((bench_op == BENCH_OP_SIGN) || (bench_op == BENCH_OP_DEC) || (bench_op == BENCH_OP_RAND))
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+            else
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+        }
+
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        switch (bench_op)
+        {
+            case BENCH_OP_SIGN:
+                if ((bench_keyOid == 0xE0FC) || (bench_keyOid == 0xE0FD))
+                    return_status = optiga_crypt_rsa_sign(me_crypt, OPTIGA_RSASSA_PKCS1_V15_SHA256,
+                                                            bench_digest, sizeof(bench_digest),
+                                                            bench_keyOid, buf, &len, 0x0000);
+                else
+                    return_status = optiga_crypt_ecdsa_sign(me_crypt, bench_digest, sizeof(bench_digest),
+                                                            bench_keyOid, buf, &len);
+                break;
+            case BENCH_OP_DEC:
+                return_status = optiga_crypt_rsa_decrypt_and_export(me_crypt, OPTIGA_RSAES_PKCS1_V15,
+                                                                    bench_cipher, (uint16_t)bench_cipherLen,
+                                                                    NULL, 0, bench_keyOid, buf, &len);
+                break;
+            case BENCH_OP_RAND:
+                return_status = optiga_crypt_random(me_crypt, OPTIGA_RNG_TYPE_TRNG, buf, bench_size);
+                break;
+            case BENCH_OP_READ:
+            default:
+                if (bench_size != 0)
+                    len = bench_size;
+                return_status = optiga_util_read_data(me_util, bench_dataOid, 0, buf, &len);
+                break;
+        }
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            break;
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        return_status = optiga_lib_status;
+    }while(FALSE);
+
+    if (uOptFlag.flags.session != 1)
+        trustm_Close();
+    return return_status;
+}
+
+/**********************************************************************
+* bench_engine_loadkey()
+* The engine tokenizes the key id in place, pass a copy.
+**********************************************************************/
+static EVP_PKEY *bench_engine_loadkey(void)
+{
+    char keyId[256];
+
+    strncpy(keyId, bench_keyId, sizeof(keyId) - 1);
+    keyId[sizeof(keyId) - 1] = '\0';
+    return ENGINE_load_private_key(bench_engine, keyId, NULL, NULL);
+}
+
+/**********************************************************************
+* bench_engine_setup()
+* Loads the engine and the key in the worker process.
+**********************************************************************/
+static uint16_t bench_engine_setup(void)
+{
+    EVP_PKEY *pubkey = NULL;
+    unsigned char *der = NULL;
+    const unsigned char *p;
+    char cmd[64];
+    char *value;
+    uint32_t i;
+    int len;
+
+    ENGINE_load_dynamic();
+    if (strchr(bench_engineId, '/') != NULL)
+    {
+        bench_engine = ENGINE_by_id("dynamic");
+        if ((bench_engine != NULL) &&
+            (!ENGINE_ctrl_cmd_string(bench_engine, "SO_PATH", bench_engineId, 0) ||
+             !ENGINE_ctrl_cmd_string(bench_engine, "LOAD", NULL, 0)))
+        {
+            ENGINE_free(bench_engine);
+            bench_engine = NULL;
+        }
+    }
+    else
+    {
+        bench_engine = ENGINE_by_id(bench_engineId);
+    }
+    if (bench_engine == NULL)
+    {
+        printf("Error loading engine %s\n", bench_engineId);
+        return 1;
+    }
+
+    // Thread safe mode for several threads, can be overridden with -c
+    if ((bench_threads > 1) && !ENGINE_ctrl_cmd_string(bench_engine, "THREADS", "1", 0))
+        printf("Engine has no THREADS control command\n");
+    if ((uOptFlag.flags.session == 1) && !ENGINE_ctrl_cmd_string(bench_engine, "SESSION", "1", 0))
+        printf("Engine has no SESSION control command\n");
+    for (i = 0; i < bench_ctrlCount; i++)
+    {
+        strncpy(cmd, bench_ctrl[i], sizeof(cmd) - 1);
+        cmd[sizeof(cmd) - 1] = '\0';
+        value = strchr(cmd, '=');
+        if (value != NULL)
+            *value++ = '\0';
+        if (!ENGINE_ctrl_cmd_string(bench_engine, cmd, value, 0))
+        {
+            printf("Engine control command %s failed\n", bench_ctrl[i]);
+            return 1;
+        }
+    }
+    // Same as -engine of the openssl tools, the key methods are taken
+    // from the default engine
+    if (!ENGINE_init(bench_engine) || !ENGINE_set_default(bench_engine, ENGINE_METHOD_ALL))
+    {
+        printf("Error initializing engine %s\n", bench_engineId);
+        return 1;
+    }
+
+    if ((bench_op == BENCH_OP_RAND) || (bench_op == BENCH_OP_LOAD))
+        return 0;
+
+    bench_pkey = bench_engine_loadkey();
+    if (bench_pkey == NULL)
+    {
+        printf("Error loading key %s\n", bench_keyId);
+        return 1;
+    }
+    if (bench_op != BENCH_OP_DEC)
+        return 0;
+
+    // Software copy of the public key
+    len = i2d_PUBKEY(bench_pkey, &der);
+    p = der;
+    if (len > 0)
+        pubkey = d2i_PUBKEY(NULL, &p, len);
+    OPENSSL_free(der);
+    if (pubkey == NULL)
+    {
+        printf("Error reading public key of %s\n", bench_keyId);
+        return 1;
+    }
+    i = bench_rsa_cipher(pubkey);
+    EVP_PKEY_free(pubkey);
+    return (uint16_t)i;
+}
+
+/**********************************************************************
+* bench_engine_op()
+* One operation through the engine, returns 1 on success.
+**********************************************************************/
+static int bench_engine_op(void)
+{
+    const RAND_METHOD *rand;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey;
+    uint8_t buf[BENCH_MAX_DATA];
+    size_t len = sizeof(buf);
+    int ret = 0;
+
+    switch (bench_op)
+    {
+        case BENCH_OP_RAND:
+            rand = ENGINE_get_RAND(bench_engine);
+            return (rand != NULL) && (rand->bytes(buf, bench_size) == 1);
+        case BENCH_OP_LOAD:
+            pkey = bench_engine_loadkey();
+            EVP_PKEY_free(pkey);
+            return (pkey != NULL);
+        default:
+            break;
+    }
+
+    do
+    {
+        ctx = EVP_PKEY_CTX_new(bench_pkey, NULL);
+        if (ctx == NULL)
+            break;
+        if (bench_op == BENCH_OP_SIGN)
+        {
+            if (EVP_PKEY_sign_init(ctx) <= 0)
+                break;
+            if ((EVP_PKEY_base_id(bench_pkey) == EVP_PKEY_RSA) &&
+                ((EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+                 (EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) <= 0)))
+                break;
+            ret = (EVP_PKEY_sign(ctx, buf, &len, bench_digest, sizeof(bench_digest)) > 0);
+        }
+        else
+        {
+            if ((EVP_PKEY_decrypt_init(ctx) <= 0) ||
+                (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0))
+                break;
+            ret = (EVP_PKEY_decrypt(ctx, buf, &len, bench_cipher, bench_cipherLen) > 0);
+        }
+    }while(FALSE);
+
+    EVP_PKEY_CTX_free(ctx);
+    return ret;
+}
+
+/**********************************************************************
+* bench_worker()
+* Runs operations until the duration or the count is reached and
+* records the latency of each, including waiting for the chip.
+**********************************************************************/
+static void *bench_worker(void *arg)
+{
+    bench_slot_t *slot = (bench_slot_t *)arg;
+    optiga_lib_status_t return_status;
+    uint64_t start, deadline, t0, t1;
+
+    start = bench_now();
+    slot->start = start;
+    deadline = start + ((uint64_t)bench_duration * 1000000);
+    while (((bench_count == 0) || ((slot->ops + slot->errors) < bench_count)) && (bench_now() < deadline))
+    {
+        t0 = bench_now();
+        if (uOptFlag.flags.engine == 1)
+        {
+            return_status = bench_engine_op() ? OPTIGA_LIB_SUCCESS : OPTIGA_CRYPT_ERROR;
+        }
+        else
+        {
+            pthread_mutex_lock(&bench_chip_mutex);
+            return_status = bench_helper_op();
+            pthread_mutex_unlock(&bench_chip_mutex);
+        }
+        t1 = bench_now();
+
+        if (return_status != OPTIGA_LIB_SUCCESS)
+        {
+            slot->errors++;
+            slot->lastError = return_status;
+            continue;
+        }
+        slot->ops++;
+        bench_hist_record(&slot->hist, t1 - t0);
+    }
+    slot->end = bench_now();
+    return NULL;
+}
+
+/**********************************************************************
+* bench_process()
+* Sets up the helper session or the engine and runs the worker threads
+* of one process.
+**********************************************************************/
+static int bench_process(bench_slot_t *slot)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+    pthread_t thread[BENCH_MAX_THREADS];
+    uint32_t i;
+
+    RAND_bytes(bench_digest, sizeof(bench_digest));
+
+    if (uOptFlag.flags.engine == 1)
+    {
+        if (bench_engine_setup() != 0)
+            return 1;
+    }
+    else
+    {
+        return_status = trustm_Open();
+        if (return_status == OPTIGA_LIB_SUCCESS)
+            return_status = bench_helper_setup();
+        if ((return_status == OPTIGA_LIB_SUCCESS) && (uOptFlag.flags.session == 1))
+            trustm_session_hold = 1;
+        else
+            trustm_Close();
+        if (return_status != OPTIGA_LIB_SUCCESS)
+        {
+            trustmPrintErrorCode(return_status);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < bench_threads; i++)
+    {
+        if (pthread_create(&thread[i], NULL, bench_worker, &slot[i]) != 0)
+        {
+            printf("Error creating thread %d\n", i);
+            break;
+        }
+    }
+    bench_threads = i;
+    for (i = 0; i < bench_threads; i++)
+        pthread_join(thread[i], NULL);
+
+    if (uOptFlag.flags.engine == 1)
+    {
+        EVP_PKEY_free(bench_pkey);
+        ENGINE_finish(bench_engine);
+        ENGINE_free(bench_engine);
+    }
+    else if (trustm_session_hold == 1)
+    {
+        trustm_session_hold = 0;
+        trustm_Close();
+    }
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    bench_hist_t *hist = NULL;
+    uint64_t ops = 0, errors = 0, elapsed = 0;
+    uint64_t start = 0, end = 0;
+    uint16_t lastError = 0;
+    char *jsonFile = NULL;
+    size_t slotSize;
+    pid_t pid[BENCH_MAX_PROCESSES];
+    uint32_t i, n;
+    int status;
+    int ret = 1;
+
+    int option = 0;                    // Command line option.
+
+    uOptFlag.all = 0;
+
+    printf("\n");
+    do // Begin of DO WHILE(FALSE) for error handling.
+    {
+        // ---------- Command line parsing with getopt ----------
+        opterr = 0; // Disable getopt error messages in case of unknown parameters
+
+        // Loop through parameters with getopt.
+        while (-1 != (option = getopt(argc, argv, "o:k:r:b:d:n:t:p:se:c:j:Xh")))
+        {
+            switch (option)
+            {
+                case 'o': // Operation
+                    for (i = 0; i < (sizeof(bench_op_name) / sizeof(bench_op_name[0])); i++)
+                    {
+                        if (strcmp(optarg, bench_op_name[i]) == 0)
+                            break;
+                    }
+                    if (i == (sizeof(bench_op_name) / sizeof(bench_op_name[0])))
+                    {
+                        printf("Invalid operation!!!\n");
+                        exit(1);
+                    }
+                    bench_op = (uint8_t)i;
+                    break;
+                case 'k': // Key
+                    bench_keyId = optarg;
+                    bench_keyOid = trustmHexorDec(optarg);
+                    break;
+                case 'r': // Data object
+                    bench_dataOid = trustmHexorDec(optarg);
+                    break;
+                case 'b': // Bytes
+                    bench_size = trustmHexorDec(optarg);
+                    if (bench_size > BENCH_MAX_DATA)
+                    {
+                        printf("Size too large, max %d!!!\n", BENCH_MAX_DATA);
+                        exit(1);
+                    }
+                    break;
+                case 'd': // Duration
+                    bench_duration = trustmHexorDec(optarg);
+                    break;
+                case 'n': // Count
+                    bench_count = trustmHexorDec(optarg);
+                    break;
+                case 't': // Threads
+                    bench_threads = trustmHexorDec(optarg);
+                    if ((bench_threads == 0) || (bench_threads > BENCH_MAX_THREADS))
+                    {
+                        printf("Invalid number of threads!!!\n");
+                        exit(1);
+                    }
+                    break;
+                case 'p': // Processes
+                    bench_processes = trustmHexorDec(optarg);
+                    if ((bench_processes == 0) || (bench_processes > BENCH_MAX_PROCESSES))
+                    {
+                        printf("Invalid number of processes!!!\n");
+                        exit(1);
+                    }
+                    break;
+                case 's': // Session held
+                    uOptFlag.flags.session = 1;
+                    break;
+                case 'e': // Engine
+                    uOptFlag.flags.engine = 1;
+                    bench_engineId = optarg;
+                    break;
+                case 'c': // Engine control command
+                    if (bench_ctrlCount == BENCH_MAX_CTRL)
+                    {
+                        printf("Too many control commands!!!\n");
+                        exit(1);
+                    }
+                    bench_ctrl[bench_ctrlCount++] = optarg;
+                    break;
+                case 'j': // JSON output
+                    uOptFlag.flags.json = 1;
+                    jsonFile = optarg;
+                    break;
+                case 'X': // Bypass Shielded Communication
+                    uOptFlag.flags.bypass = 1;
+                    printf("Bypass Shielded Communication. \n");
+                    break;
+                case 'h': // Print Help Menu
+                default:  // Any other command Print Help Menu
+                    helpmenu();
+                    exit(0);
+                break;
+            }
+        }
+    } while (FALSE); // End of DO WHILE FALSE loop.
+
+    do
+    {
+        if ((uOptFlag.flags.engine == 1) && (bench_op == BENCH_OP_READ))
+        {
+            printf("read is only available with the helper API!!!\n");
+            break;
+        }
+        if ((uOptFlag.flags.engine != 1) && (bench_op == BENCH_OP_LOAD))
+        {
+            printf("load is only available with the engine (-e)!!!\n");
+            break;
+        }
+        if ((uOptFlag.flags.engine != 1) && (bench_op == BENCH_OP_RAND) && (bench_size < 8))
+        {
+            printf("rand needs at least 8 bytes!!!\n");
+            break;
+        }
+
+        // Slots are shared with the worker processes
+        slotSize = sizeof(bench_slot_t) * bench_processes * bench_threads;
+        bench_slot = mmap(NULL, slotSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        hist = calloc(1, sizeof(bench_hist_t));
+        if ((bench_slot == MAP_FAILED) || (hist == NULL))
+        {
+            printf("Out of memory!!!\n");
+            bench_slot = NULL;
+            break;
+        }
+        memset(bench_slot, 0, slotSize);
+
+        printf("========================================================\n");
+        printf("Mode             : %s\n", (uOptFlag.flags.engine == 1) ? bench_engineId : "helper API");
+        printf("Operation        : %s\n", bench_op_name[bench_op]);
+        if ((bench_op == BENCH_OP_SIGN) || (bench_op == BENCH_OP_DEC) || (bench_op == BENCH_OP_LOAD))
+            printf("Key              : %s\n", bench_keyId);
+        if (bench_op == BENCH_OP_READ)
+            printf("Data OID         : 0x%.4X\n", bench_dataOid);
+        printf("Processes        : %u x %u threads\n", bench_processes, bench_threads);
+        if (uOptFlag.flags.engine != 1)
+            printf("Session          : %s\n", (uOptFlag.flags.session == 1) ? "held" : "per operation");
+        for (i = 0; i < bench_ctrlCount; i++)
+            printf("Engine control   : %s\n", bench_ctrl[i]);
+        if (bench_count != 0)
+            printf("Count            : %u per thread, max %u s\n", bench_count, bench_duration);
+        else
+            printf("Duration         : %u s\n", bench_duration);
+        fflush(stdout);
+
+        if (bench_processes == 1)
+        {
+            if (bench_process(bench_slot) != 0)
+                break;
+        }
+        else
+        {
+            for (n = 0; n < bench_processes; n++)
+            {
+                pid[n] = fork();
+                if (pid[n] == 0)
+                    exit(bench_process(&bench_slot[n * bench_threads]));
+                if (pid[n] < 0)
+                {
+                    printf("Error creating process %d\n", n);
+                    break;
+                }
+            }
+            for (i = 0; i < n; i++)
+            {
+                if ((waitpid(pid[i], &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+                    printf("Process %d failed\n", i);
+            }
+        }
+
+        for (i = 0; i < (bench_processes * bench_threads); i++)
+        {
+            bench_hist_merge(hist, &bench_slot[i].hist);
+            ops += bench_slot[i].ops;
+            errors += bench_slot[i].errors;
+            if (bench_slot[i].errors != 0)
+                lastError = bench_slot[i].lastError;
+            if (bench_slot[i].end == 0)
+                continue;
+            if ((start == 0) || (bench_slot[i].start < start))
+                start = bench_slot[i].start;
+            if (bench_slot[i].end > end)
+                end = bench_slot[i].end;
+        }
+        elapsed = end - start;
+
+        printf("========================================================\n");
+        bench_hist_print(hist);
+        printf("========================================================\n");
+        printf("Elapsed          : %.3f s\n", elapsed / 1000000.0);
+        printf("Operations       : %llu\n", (unsigned long long)ops);
+        printf("Errors           : %llu\n", (unsigned long long)errors);
+        printf("Throughput       : %.2f ops/s\n", (elapsed != 0) ? (ops * 1000000.0 / elapsed) : 0.0);
+        if (hist->total != 0)
+        {
+            printf("Latency [ms]     : min %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f max %.3f\n",
+                    hist->min / 1000.0,
+                    bench_hist_percentile(hist, 50, NULL) / 1000.0,
+                    bench_hist_percentile(hist, 90, NULL) / 1000.0,
+                    bench_hist_percentile(hist, 99, NULL) / 1000.0,
+                    bench_hist_percentile(hist, 99.9, NULL) / 1000.0,
+                    hist->max / 1000.0);
+        }
+        if ((lastError != 0) && (uOptFlag.flags.engine != 1))
+            trustmPrintErrorCode(lastError);
+
+        if ((uOptFlag.flags.json == 1) &&
+            (bench_json(jsonFile, hist, ops, errors, elapsed / 1000000.0) == 0))
+            printf("Results written to %s\n", jsonFile);
+        printf("========================================================\n");
+
+        ret = (errors != 0) ? 1 : 0;
+    }while(FALSE);
+
+    if (bench_slot != NULL)
+        munmap(bench_slot, sizeof(bench_slot_t) * bench_processes * bench_threads);
+    free(hist);
+    return ret;
+}
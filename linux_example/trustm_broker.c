@@ -0,0 +1,585 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include "optiga/ifx_i2c/ifx_i2c_config.h"
+#include "optiga/optiga_util.h"
+#include "optiga/optiga_crypt.h"
+
+#include "trustm_helper.h"
+#include "trustm_helper_ipc_lock.h"
+#include "trustm_helper_shield.h"
+#include "trustm_broker.h"
+
+#define MAX_CLIENTS     64
+#define MAX_MOCK_KEYS   8
+
+typedef struct _OPTFLAG {
+    uint16_t    socket      : 1;
+    uint16_t    mock        : 1;
+    uint16_t    bypass      : 1;
+    uint16_t    dummy3      : 1;
+    uint16_t    dummy4      : 1;
+    uint16_t    dummy5      : 1;
+    uint16_t    dummy6      : 1;
+    uint16_t    dummy7      : 1;
+    uint16_t    dummy8      : 1;
+    uint16_t    dummy9      : 1;
+    uint16_t    dummy10     : 1;
+    uint16_t    dummy11     : 1;
+    uint16_t    dummy12     : 1;
+    uint16_t    dummy13     : 1;
+    uint16_t    dummy14     : 1;
+    uint16_t    dummy15     : 1;
+}OPTFLAG;
+
+union _uOptFlag {
+    OPTFLAG flags;
+    uint16_t    all;
+} uOptFlag;
+
+typedef struct mock_key_str
+{
+    uint16_t  oid;
+    EVP_PKEY *pkey;
+} mock_key_t;
+
+static volatile sig_atomic_t broker_stop = 0;
+
+// Chip backend state
+static uint8_t  chip_open = 0;
+static uint32_t chip_session = 0;
+
+// Mock backend state
+static mock_key_t mock_key[MAX_MOCK_KEYS];
+static uint8_t mock_cert[TRUSTM_BROKER_MAX_DATA];
+static uint16_t mock_certLen = 0;
+
+void helpmenu(void)
+{
+    printf("\nHelp menu: trustm_broker <option> ...<option>\n");
+    printf("option:- \n");
+    printf("-s <socket> : Socket path (default %s)\n", TRUSTM_BROKER_SOCKET);
+    printf("-m          : Use the OpenSSL mock backend instead of OPTIGA\n");
+    printf("-X          : Bypass Shield Communication \n");
+    printf("-h          : Print this help \n");
+}
+
+static void broker_signal(int sig)
+{
+    broker_stop = 1;
+}
+
+/**********************************************************************
+* chip_begin() / chip_end()
+* The application stays open between requests but the IPC lock is only
+* held while a request is processed, so the CLI tools keep working.
+* The application is re-opened if another process opened it meanwhile.
+**********************************************************************/
+static optiga_lib_status_t chip_begin(void)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+
+    if (trustm_ipc_acquire() != 0)
+        return OPTIGA_LIB_BUSY;
+    if ((chip_open == 0) || (chip_session != trustm_ipc_session_get()))
+    {
+        TRUSTM_HELPER_DBGFN("Open application");
+        chip_open = 0;
+        return_status = trustm_Open();
+        if (return_status == OPTIGA_LIB_SUCCESS)
+        {
+            // trustm_Open() may have released the lock while closing
+            if (trustm_ipc_acquire() != 0)
+                return OPTIGA_LIB_BUSY;
+            chip_open = 1;
+            chip_session = trustm_ipc_session_get();
+        }
+    }
+    return return_status;
+}
+
+static void chip_end(optiga_lib_status_t return_status)
+{
+    // Start from a fresh application after any error
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        chip_open = 0;
+    trustm_ipc_release();
+}
+
+/**********************************************************************
+* chip_process()
+**********************************************************************/
+static optiga_lib_status_t chip_process(trustm_broker_hdr_t *req, uint8_t *data, uint8_t *out, uint16_t *outLen)
+{
+    optiga_lib_status_t return_status;
+
+    return_status = chip_begin();
+    do
+    {
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        switch (req->cmd)
+        {
+            case TRUSTM_BROKER_CMD_RANDOM:
+                if (req->param > *outLen)
+                {
+                    return_status = OPTIGA_COMMS_ERROR_INVALID_INPUT;
+                    break;
+                }
+                *outLen = req->param;
+                return_status = optiga_crypt_random(me_crypt, OPTIGA_RNG_TYPE_TRNG, out, *outLen);
+                break;
+
+            case TRUSTM_BROKER_CMD_READ_DATA:
+                if(uOptFlag.flags.bypass != 1)
+                {
+                    TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                }
+                return_status = optiga_util_read_data(me_util, req->oid, req->param, out, outLen);
+                break;
+
+            case TRUSTM_BROKER_CMD_READ_METADATA:
+                return_status = optiga_util_read_metadata(me_util, req->oid, out, outLen);
+                break;
+
+            case TRUSTM_BROKER_CMD_ECDSA_SIGN:
+                if(uOptFlag.flags.bypass != 1)
+                {
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                }
+                return_status = optiga_crypt_ecdsa_sign(me_crypt, data, req->len, req->oid, out, outLen);
+                break;
+
+            case TRUSTM_BROKER_CMD_RSA_SIGN:
+                if(uOptFlag.flags.bypass != 1)
+                {
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
+                }
+                return_status = optiga_crypt_rsa_sign(me_crypt, req->param, data, req->len, req->oid,
+                                                      out, outLen, 0x0000);
+                break;
+
+            case TRUSTM_BROKER_CMD_RSA_DECRYPT:
+                if(uOptFlag.flags.bypass != 1)
+                {
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                }
+                return_status = optiga_crypt_rsa_decrypt_and_export(me_crypt, req->param, data, req->len,
+                                                                    NULL, 0, req->oid, out, outLen);
+                break;
+
+            default:
+                return_status = OPTIGA_COMMS_ERROR_INVALID_INPUT;
+        }
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            break;
+        //Wait until the operation is completed
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        return_status = optiga_lib_status;
+    }while(FALSE);
+    chip_end(return_status);
+
+    // Capture OPTIGA Trust M error
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        trustmPrintErrorCode(return_status);
+
+    return return_status;
+}
+
+/**********************************************************************
+* mock_getkey()
+* Returns the key of oid, generated on first use. 0xE0F0-0xE0F3 are ECC
+* NIST P-256 keys, all other OIDs RSA 2048 keys.
+**********************************************************************/
+static EVP_PKEY *mock_getkey(uint16_t oid)
+{
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    int i;
+
+    for (i = 0; i < MAX_MOCK_KEYS; i++)
+    {
+        if (mock_key[i].pkey == NULL)
+            break;
+        if (mock_key[i].oid == oid)
+            return mock_key[i].pkey;
+    }
+    if (i == MAX_MOCK_KEYS)
+        return NULL;
+
+    do
+    {
+        if ((oid >= 0xE0F0) && (oid <= 0xE0F3))
+        {
+            ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+            if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+                (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) <= 0))
+                break;
+        }
+        else
+        {
+            ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+            if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+                (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0))
+                break;
+        }
+        if (EVP_PKEY_keygen(ctx, &pkey) <= 0)
+            break;
+
+        printf("Mock key generated for OID 0x%.4X\n", oid);
+        mock_key[i].oid = oid;
+        mock_key[i].pkey = pkey;
+    }while(FALSE);
+    EVP_PKEY_CTX_free(ctx);
+    return pkey;
+}
+
+/**********************************************************************
+* mock_getcert()
+* Self-signed device certificate of the 0xE0F0 key, stored as on the
+* chip : 9 bytes of tag/length header followed by the DER certificate.
+**********************************************************************/
+static optiga_lib_status_t mock_getcert(void)
+{
+    optiga_lib_status_t return_status = OPTIGA_COMMS_ERROR;
+    EVP_PKEY *pkey;
+    X509 *x509 = NULL;
+    X509_NAME *name;
+    uint8_t *p;
+    int len;
+
+    if (mock_certLen != 0)
+        return OPTIGA_LIB_SUCCESS;
+
+    do
+    {
+        pkey = mock_getkey(0xE0F0);
+        x509 = X509_new();
+        if ((pkey == NULL) || (x509 == NULL))
+            break;
+
+        X509_set_version(x509, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+        X509_gmtime_adj(X509_getm_notAfter(x509), 365L*24*60*60);
+        name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"trustm_broker mock", -1, -1, 0);
+        X509_set_issuer_name(x509, name);
+        X509_set_pubkey(x509, pkey);
+        if (!X509_sign(x509, pkey, EVP_sha256()))
+            break;
+
+        len = i2d_X509(x509, NULL);
+        if ((len <= 0) || (len > (int)sizeof(mock_cert) - 9))
+            break;
+        mock_cert[0] = 0xC0;
+        mock_cert[1] = (len + 6) >> 8;
+        mock_cert[2] = (len + 6) & 0xFF;
+        mock_cert[3] = 0xC1;
+        mock_cert[4] = (len + 3) >> 8;
+        mock_cert[5] = (len + 3) & 0xFF;
+        mock_cert[6] = 0xC2;
+        mock_cert[7] = len >> 8;
+        mock_cert[8] = len & 0xFF;
+        p = mock_cert + 9;
+        i2d_X509(x509, &p);
+        mock_certLen = len + 9;
+        return_status = OPTIGA_LIB_SUCCESS;
+    }while(FALSE);
+    X509_free(x509);
+    return return_status;
+}
+
+/**********************************************************************
+* mock_process()
+* Software implementation of the broker commands, used for testing
+* without OPTIGA. Output formats match the OPTIGA APIs.
+**********************************************************************/
+static optiga_lib_status_t mock_process(trustm_broker_hdr_t *req, uint8_t *data, uint8_t *out, uint16_t *outLen)
+{
+    optiga_lib_status_t return_status = OPTIGA_COMMS_ERROR;
+    EVP_PKEY_CTX *ctx = NULL;
+    const EVP_MD *md;
+    EVP_PKEY *pkey;
+    uint8_t sig[512];
+    size_t len;
+    int hdrLen;
+
+    do
+    {
+        switch (req->cmd)
+        {
+            case TRUSTM_BROKER_CMD_RANDOM:
+                if ((req->param > *outLen) || (RAND_bytes(out, req->param) != 1))
+                    break;
+                *outLen = req->param;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            case TRUSTM_BROKER_CMD_READ_DATA:
+                if ((req->oid != 0xE0E0) || (mock_getcert() != OPTIGA_LIB_SUCCESS) ||
+                    (req->param > mock_certLen))
+                    break;
+                len = mock_certLen - req->param;
+                if (len > *outLen)
+                    len = *outLen;
+                memcpy(out, mock_cert + req->param, len);
+                *outLen = len;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            case TRUSTM_BROKER_CMD_READ_METADATA:
+                // Algorithm and key usage of the keys of mock_getkey()
+                if (*outLen < 8)
+                    break;
+                out[0] = 0x20;
+                out[1] = 6;
+                out[2] = 0xE0;
+                out[3] = 1;
+                out[5] = 0xE1;
+                out[6] = 1;
+                if ((req->oid >= 0xE0F0) && (req->oid <= 0xE0F3))
+                {
+                    out[4] = OPTIGA_ECC_CURVE_NIST_P_256;
+                    out[7] = OPTIGA_KEY_USAGE_AUTHENTICATION | OPTIGA_KEY_USAGE_SIGN;
+                }
+                else
+                {
+                    out[4] = OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL;
+                    out[7] = OPTIGA_KEY_USAGE_AUTHENTICATION | OPTIGA_KEY_USAGE_ENCRYPTION;
+                }
+                *outLen = 8;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            case TRUSTM_BROKER_CMD_ECDSA_SIGN:
+                // Signature without the SEQUENCE header, as optiga_crypt_ecdsa_sign()
+                len = sizeof(sig);
+                pkey = mock_getkey(req->oid);
+                ctx = EVP_PKEY_CTX_new(pkey, NULL);
+                if ((pkey == NULL) || (ctx == NULL) || (EVP_PKEY_sign_init(ctx) <= 0) ||
+                    (EVP_PKEY_sign(ctx, sig, &len, data, req->len) <= 0))
+                    break;
+                hdrLen = (sig[1] & 0x80) ? 2 + (sig[1] & 0x7F) : 2;
+                if (len - hdrLen > *outLen)
+                    break;
+                memcpy(out, sig + hdrLen, len - hdrLen);
+                *outLen = len - hdrLen;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            case TRUSTM_BROKER_CMD_RSA_SIGN:
+                if (req->param == OPTIGA_RSASSA_PKCS1_V15_SHA384)
+                    md = EVP_sha384();
+                else if (req->param == OPTIGA_RSASSA_PKCS1_V15_SHA512)
+                    md = EVP_sha512();
+                else
+                    md = EVP_sha256();
+                len = *outLen;
+                pkey = mock_getkey(req->oid);
+                ctx = EVP_PKEY_CTX_new(pkey, NULL);
+                if ((pkey == NULL) || (ctx == NULL) || (EVP_PKEY_sign_init(ctx) <= 0) ||
+                    (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+                    (EVP_PKEY_CTX_set_signature_md(ctx, md) <= 0) ||
+                    (EVP_PKEY_sign(ctx, out, &len, data, req->len) <= 0))
+                    break;
+                *outLen = len;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            case TRUSTM_BROKER_CMD_RSA_DECRYPT:
+                len = *outLen;
+                pkey = mock_getkey(req->oid);
+                ctx = EVP_PKEY_CTX_new(pkey, NULL);
+                if ((pkey == NULL) || (ctx == NULL) || (EVP_PKEY_decrypt_init(ctx) <= 0) ||
+                    (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+                    (EVP_PKEY_decrypt(ctx, out, &len, data, req->len) <= 0))
+                    break;
+                *outLen = len;
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+
+            default:
+                return_status = OPTIGA_COMMS_ERROR_INVALID_INPUT;
+        }
+    }while(FALSE);
+    EVP_PKEY_CTX_free(ctx);
+
+    TRUSTM_HELPER_DBGFN("Mock cmd %d oid 0x%.4X : 0x%.4X", req->cmd, req->oid, return_status);
+    return return_status;
+}
+
+int main (int argc, char **argv)
+{
+    optiga_lib_status_t return_status;
+    struct pollfd pfd[MAX_CLIENTS + 1];
+    trustm_broker_hdr_t req;
+    uint8_t data[TRUSTM_BROKER_MAX_DATA];
+    uint8_t out[TRUSTM_BROKER_MAX_DATA];
+    uint16_t outLen;
+    char *socketname = NULL;
+    int nfds = 1;
+    int fd, i, j;
+
+    int option = 0;                    // Command line option.
+
+    uOptFlag.all = 0;
+
+    printf("\n");
+    do // Begin of DO WHILE(FALSE) for error handling.
+    {
+        // ---------- Command line parsing with getopt ----------
+        opterr = 0; // Disable getopt error messages in case of unknown parameters
+
+        // Loop through parameters with getopt.
+        while (-1 != (option = getopt(argc, argv, "s:mXh")))
+        {
+            switch (option)
+            {
+                case 's': // Socket path
+                    uOptFlag.flags.socket = 1;
+                    socketname = optarg;
+                    break;
+                case 'm': // Mock backend
+                    uOptFlag.flags.mock = 1;
+                    break;
+                case 'X': // Bypass Shielded Communication
+                    uOptFlag.flags.bypass = 1;
+                    printf("Bypass Shielded Communication. \n");
+                    break;
+                case 'h': // Print Help Menu
+                default:  // Any other command Print Help Menu
+                    helpmenu();
+                    exit(0);
+                break;
+            }
+        }
+    } while (FALSE); // End of DO WHILE FALSE loop.
+
+    signal(SIGINT, broker_signal);
+    signal(SIGTERM, broker_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    // The broker keeps the application open, no hibernate in between
+    trustm_hibernate_flag = 0;
+
+    if (socketname == NULL)
+        socketname = getenv(TRUSTM_BROKER_SOCKET_ENV);
+    if (socketname == NULL)
+        socketname = TRUSTM_BROKER_SOCKET;
+
+    pfd[0].fd = trustm_broker_listen(socketname);
+    pfd[0].events = POLLIN;
+    if (pfd[0].fd == -1)
+    {
+        printf("Error creating broker socket\n");
+        exit(1);
+    }
+    printf("trustm_broker listening on %s (%s backend)\n",
+           socketname, (uOptFlag.flags.mock == 1) ? "mock" : "OPTIGA");
+
+    // Requests are served one at a time in poll order, the broker
+    // queue serializes all clients. A client which stalls in the middle
+    // of a request is dropped after TRUSTM_BROKER_MSG_TIMEOUT.
+    while (!broker_stop)
+    {
+        if (poll(pfd, nfds, -1) < 0)
+            continue;
+
+        if (pfd[0].revents & POLLIN)
+        {
+            fd = trustm_broker_accept(pfd[0].fd);
+            if ((fd != -1) && (nfds > MAX_CLIENTS))
+            {
+                TRUSTM_HELPER_ERRFN("Too many clients");
+                close(fd);
+            }
+            else if (fd != -1)
+            {
+                pfd[nfds].fd = fd;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                nfds++;
+            }
+        }
+
+        for (i = 1; i < nfds; i++)
+        {
+            if (pfd[i].revents == 0)
+                continue;
+
+            if ((pfd[i].revents & POLLIN) &&
+                (trustm_broker_recv(pfd[i].fd, &req, data) == 0))
+            {
+                outLen = sizeof(out);
+                if (uOptFlag.flags.mock == 1)
+                    return_status = mock_process(&req, data, out, &outLen);
+                else
+                    return_status = chip_process(&req, data, out, &outLen);
+                if (return_status != OPTIGA_LIB_SUCCESS)
+                    outLen = 0;
+                if (trustm_broker_send(pfd[i].fd, req.cmd, return_status, out, outLen) == 0)
+                    continue;
+            }
+
+            // Client gone or protocol error
+            close(pfd[i].fd);
+            for (j = i; j < nfds - 1; j++)
+                pfd[j] = pfd[j + 1];
+            nfds--;
+            i--;
+        }
+    }
+
+    printf("trustm_broker exit\n");
+    for (i = 0; i < nfds; i++)
+        close(pfd[i].fd);
+    unlink(socketname);
+    if (chip_open && (trustm_ipc_acquire() == 0))
+    {
+        if (chip_session == trustm_ipc_session_get())
+            trustm_Close();
+        trustm_ipc_release();
+    }
+    for (i = 0; i < MAX_MOCK_KEYS; i++)
+        EVP_PKEY_free(mock_key[i].pkey);
+    return 0;
+}
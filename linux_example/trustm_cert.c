@@ -36,6 +36,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #define MAX_OID_PUB_CERT_SIZE   1728
 
@@ -58,13 +61,13 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_cert <option> ...<option>\n");
     printf("option:- \n");
@@ -77,7 +80,7 @@ void helpmenu(void)
     printf("-h              : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_cert_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t offset, bytes_to_read;
@@ -89,7 +92,8 @@ int main (int argc, char **argv)
     char *outFile = NULL;
     char *inFile = NULL;
     
-    X509 *x509Cert;
+    X509 *x509Cert = NULL;
+    uint8_t *derCert = NULL;
 
     pCert = NULL;
     certLen = 0;
@@ -105,7 +109,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -147,7 +151,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -163,7 +167,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
         
     printf("========================================================\n");    
     
@@ -186,8 +190,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);      
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -236,6 +239,8 @@ int main (int argc, char **argv)
                             printf("Write file error!!!!\n");
                         else    
                             printf("Success!!!\n");
+                        X509_free(x509Cert);
+                        x509Cert = NULL;
                     }
                 }
                 else
@@ -256,15 +261,15 @@ int main (int argc, char **argv)
             ret = trustmReadX509PEM(&x509Cert, inFile);
             if (ret == 0)
             {
-                certLen = i2d_X509(x509Cert, &pCert);
+                certLen = i2d_X509(x509Cert, &derCert);
                 if(certLen != 0)
                 {
+                    offset = 0;
                     
                     if(uOptFlag.flags.bypass != 1)
                     {
                         // OPTIGA Comms Shielded connection settings to enable the protection
-                        OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);      
-                        OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                        TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
                     }
                     
                     optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -272,13 +277,14 @@ int main (int argc, char **argv)
                                                             optiga_oid,
                                                             OPTIGA_UTIL_ERASE_AND_WRITE,
                                                             offset,
-                                                            pCert, 
+                                                            derCert, 
                                                             certLen);
                     if (OPTIGA_LIB_SUCCESS != return_status)
                         break;          
                     //Wait until the optiga_util_read_metadata operation is completed
                     trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
                     return_status = optiga_lib_status;
+                    trustm_cache_invalidate(optiga_oid);
                     if (return_status != OPTIGA_LIB_SUCCESS)
                         break;
                     else
@@ -304,8 +310,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);       
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -320,6 +325,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_oid);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -333,7 +339,16 @@ int main (int argc, char **argv)
 
     printf("========================================================\n");    
         
+    OPENSSL_free(derCert);
+    X509_free(x509Cert);
     trustm_Close();
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_cert_run(argc, argv);
+}
+#endif
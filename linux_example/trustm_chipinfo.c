@@ -29,15 +29,16 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_tools.h"
 
-int main (int argc, char **argv)
+int trustm_chipinfo_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     utrustm_UID_t UID;
 
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     return_status = trustm_readUID(&UID);
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -107,3 +108,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_chipinfo_run(argc, argv);
+}
+#endif
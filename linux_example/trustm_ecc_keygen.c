@@ -31,6 +31,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -59,13 +62,13 @@ typedef struct _OPTFLAG {
         uint16_t        dummy15         : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
         OPTFLAG flags;
         uint16_t        all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_ecc_keygen <option> ...<option>\n");
     printf("option:- \n");
@@ -84,7 +87,7 @@ void helpmenu(void)
     printf("-h              : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_ecc_keygen_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     optiga_key_id_t optiga_key_id;
@@ -145,7 +148,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -162,7 +165,7 @@ int main (int argc, char **argv)
                         if((optiga_key_id < 0xE0F1) || (optiga_key_id > 0xE0F3))
                         {
                                 printf("Invalid ECC key OID!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 't': // Key Type
@@ -171,7 +174,7 @@ int main (int argc, char **argv)
                         if ((keyType == 0x00) || (keyType & 0xc0))
                         {
                                 printf("Key Type Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'k': // Key Size
@@ -180,7 +183,7 @@ int main (int argc, char **argv)
                         if ((keySize != 0x03) && (keySize != 0x04)&& (keySize != 0x05)&& (keySize != 0x13)&& (keySize != 0x15)&& (keySize != 0x16))
                         {
                                 printf("Key Size Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'o': // Output
@@ -197,7 +200,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                         helpmenu();
-                        exit(0);
+                        return 0;
                         break;
             }
         }
@@ -213,7 +216,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     printf("========================================================\n");
 
@@ -277,8 +280,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
             
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -294,6 +296,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_key_id);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -315,8 +318,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -340,9 +342,12 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(((keySize == 0x05) || (keySize == 0x16)) ? (optiga_key_id+0x10ED) : (optiga_key_id+0x10E0));
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else{
+            trustm_cache_pubkey_put(((keySize == 0x05) || (keySize == 0x16)) ? (optiga_key_id+0x10ED) : (optiga_key_id+0x10E0),
+                                    pubKey, pubKeyLen+i);
             if((keySize == 0x05) || (keySize == 0x16)){
                 printf("Write Success to OID: 0x%.4X.\n",(optiga_key_id+0x10ED));}
             else{
@@ -360,3 +365,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_ecc_keygen_run(argc, argv);
+}
+#endif
@@ -26,11 +26,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 #include "optiga/ifx_i2c/ifx_i2c_config.h"
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -40,6 +44,7 @@
 
 
 #define MAX_OID_PUB_CERT_SIZE   1728
+#define MAX_BATCH_LINE          1024
 
 typedef struct _OPTFLAG {
     uint16_t    sign        : 1;
@@ -48,7 +53,7 @@ typedef struct _OPTFLAG {
     uint16_t    outputssl   : 1;
     uint16_t    hash        : 1;
     uint16_t    bypass      : 1;
-    uint16_t    dummy6      : 1;
+    uint16_t    batch       : 1;
     uint16_t    dummy7      : 1;
     uint16_t    dummy8      : 1;
     uint16_t    dummy9      : 1;
@@ -60,12 +65,12 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
-void _helpmenu(void)
+static void _helpmenu(void)
 {
     printf("\nHelp menu: trustm_ecc_sign <option> ...<option>\n");
     printf("option:- \n");
@@ -74,11 +79,286 @@ void _helpmenu(void)
     printf("-O <filename> : Output to file without header\n");    
     printf("-i <filename> : Input Data file\n");
     printf("-H            : Hash before sign\n");
+    printf("-b <manifest> : Batch sign all inputs listed in manifest (- for stdin)\n");
     printf("-X            : Bypass Shielded Communication \n");
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+/**********************************************************************
+* _sigheader()
+* Wraps the raw r,s signature from the chip into a DER SEQUENCE.
+* Returns the new signature length.
+**********************************************************************/
+static uint16_t _sigheader(uint8_t *signature, uint16_t signature_length)
+{
+    ECDSA_SIG  *ecdsa_sig = NULL;
+    const unsigned char *sig_p1 = NULL;
+    unsigned char *sig_p2 = NULL;
+    int sig_len=0;
+    int i;
+
+    if(signature_length<0x7F){
+        for(i=signature_length-1; i >= 0; i--)
+        {
+            signature[i+2] = signature[i]; 
+        }
+        signature[0] = 0x30; // Insert SEQUENCE
+        signature[1] = signature_length; // insert length
+        signature_length += 2;
+    }
+    else{
+        for(i=signature_length-1; i >= 0; i--)
+        {
+            signature[i+3] = signature[i]; 
+        }
+        signature[0] = 0x30; // Insert SEQUENCE
+        signature[1] = 0x81; // insert length
+        signature[2] = signature_length; // insert length
+        signature_length += 3;
+
+        sig_p1=signature;
+        ecdsa_sig = d2i_ECDSA_SIG(NULL, &sig_p1, signature_length);
+        if (ecdsa_sig != NULL)
+        {
+            sig_p2=signature;
+            sig_len=i2d_ECDSA_SIG(ecdsa_sig, &sig_p2);
+            ECDSA_SIG_free(ecdsa_sig);
+            if (sig_len > 0)
+                signature_length = sig_len;
+        }
+    }
+    return signature_length;
+}
+
+/**********************************************************************
+* _hashfile()
+* SHA256 of the whole file. Returns the digest length or 0 on error.
+**********************************************************************/
+static uint16_t _hashfile(const char *filename, uint8_t *digest)
+{
+    SHA256_CTX sha256;
+    uint8_t buffer[4096];
+    size_t bytesRead;
+    FILE *fp;
+
+    fp = fopen(filename,"rb");
+    if (!fp)
+        return 0;
+
+    SHA256_Init(&sha256);
+    while((bytesRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        SHA256_Update(&sha256, buffer, bytesRead);
+    }
+    fclose(fp);
+    SHA256_Final(digest, &sha256);
+    return SHA256_DIGEST_LENGTH;
+}
+
+/**********************************************************************
+* _batchdigest()
+* Resolves one manifest input into a digest. The input is either
+* "hex:<digest>" or a file holding the digest (hashed with -H).
+* Returns the digest length or 0 on error.
+**********************************************************************/
+static uint16_t _batchdigest(const char *input, uint8_t *digest, uint16_t maxLen)
+{
+    uint8_t buf[64+1];
+    uint16_t len = 0;
+    size_t hexLen;
+    FILE *fp;
+
+    if (strncmp(input, "hex:", 4) == 0)
+    {
+        input += 4;
+        hexLen = strlen(input);
+        if ((hexLen == 0) || (hexLen % 2) || ((hexLen / 2) > maxLen))
+            return 0;
+        for (len = 0; len < hexLen / 2; len++)
+        {
+            if (sscanf(input + (len * 2), "%2hhx", &digest[len]) != 1)
+                return 0;
+        }
+        return len;
+    }
+
+    if (uOptFlag.flags.hash == 1)
+        return _hashfile(input, digest);
+
+    fp = fopen(input,"rb");
+    if (!fp)
+        return 0;
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    if ((len == 0) || (len > maxLen))
+        return 0;
+    memcpy(digest, buf, len);
+    return len;
+}
+
+static uint64_t _elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return ((uint64_t)(end->tv_sec - start->tv_sec) * 1000000) +
+            ((end->tv_nsec - start->tv_nsec) / 1000);
+}
+
+/**********************************************************************
+* _batchsign()
+* Signs every input listed in the manifest with one key under the
+* session (and IPC lock) opened by the caller. Each manifest line is
+* "<input> [<output>]"; empty lines and lines starting with '#' are
+* skipped. Without an output the signature goes to <input>.sig, or to
+* stdout as hex for "hex:" inputs and for output "-".
+* A status line is printed per item as soon as it is signed, followed
+* by a throughput and latency summary.
+* Returns the number of failed items.
+**********************************************************************/
+static uint32_t _batchsign(optiga_key_id_t optiga_key_id, const char *manifest)
+{
+    optiga_lib_status_t return_status;
+    uint8_t signature [300];
+    uint16_t signature_length;
+    uint8_t digest[32];
+    uint16_t digestLen;
+
+    char line[MAX_BATCH_LINE];
+    char defOutput[MAX_BATCH_LINE+8];
+    char *input;
+    char *output;
+    char *saveptr;
+    FILE *fp;
+
+    uint32_t count = 0;
+    uint32_t failed = 0;
+    uint64_t latency;
+    uint64_t minLatency = 0;
+    uint64_t maxLatency = 0;
+    uint64_t sumLatency = 0;
+    uint64_t total;
+    struct timespec batchStart, batchEnd, start, end;
+    uint16_t j;
+
+    if (strcmp(manifest, "-") == 0)
+        fp = stdin;
+    else
+        fp = fopen(manifest, "r");
+    if (!fp)
+    {
+        printf("error opening manifest : %s\n", manifest);
+        return 1;
+    }
+
+    printf("OID Key          : 0x%.4X\n",optiga_key_id);
+    printf("Manifest         : %s \n", manifest);
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &batchStart);
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        input = strtok_r(line, " \t\r\n", &saveptr);
+        if ((input == NULL) || (input[0] == '#'))
+            continue;
+        output = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (output == NULL)
+        {
+            if (strncmp(input, "hex:", 4) == 0)
+                output = "-";
+            else
+            {
+                snprintf(defOutput, sizeof(defOutput), "%s.sig", input);
+                output = defOutput;
+            }
+        }
+        count++;
+
+        digestLen = _batchdigest(input, digest, sizeof(digest));
+        if (digestLen == 0)
+        {
+            failed++;
+            printf("[%u] %s : Error reading input\n", count, input);
+            fflush(stdout);
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(uOptFlag.flags.bypass != 1)
+        {
+            // OPTIGA Comms Shielded connection settings to enable the protection
+            TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+        }
+
+        signature_length = sizeof(signature) - 3; // room for the DER header
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        return_status = optiga_crypt_ecdsa_sign(me_crypt,
+                                                digest,
+                                                digestLen,
+                                                optiga_key_id,
+                                                signature,
+                                                &signature_length);
+        if (OPTIGA_LIB_SUCCESS == return_status)
+        {
+            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+            return_status = optiga_lib_status;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (return_status != OPTIGA_LIB_SUCCESS)
+        {
+            failed++;
+            printf("[%u] %s : Error 0x%.4X\n", count, input, return_status);
+            fflush(stdout);
+            continue;
+        }
+
+        latency = _elapsed_us(&start, &end);
+        if ((minLatency == 0) || (latency < minLatency))
+            minLatency = latency;
+        if (latency > maxLatency)
+            maxLatency = latency;
+        sumLatency += latency;
+
+        signature_length = _sigheader(signature, signature_length);
+        if (strcmp(output, "-") == 0)
+        {
+            printf("[%u] %s : Success %lu.%03lu ms : ", count, input,
+                    (unsigned long)(latency / 1000), (unsigned long)(latency % 1000));
+            for (j = 0; j < signature_length; j++)
+                printf("%.2x", signature[j]);
+            printf("\n");
+        }
+        else if (trustmwriteTo(signature, signature_length, output) != 0)
+        {
+            failed++;
+            printf("[%u] %s : Error writing %s\n", count, input, output);
+        }
+        else
+        {
+            printf("[%u] %s : Success %lu.%03lu ms -> %s\n", count, input,
+                    (unsigned long)(latency / 1000), (unsigned long)(latency % 1000), output);
+        }
+        fflush(stdout);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &batchEnd);
+
+    if (fp != stdin)
+        fclose(fp);
+
+    total = _elapsed_us(&batchStart, &batchEnd);
+    printf("Signed           : %u of %u (%u failed)\n", count - failed, count, failed);
+    printf("Total time       : %lu.%03lu ms\n",
+            (unsigned long)(total / 1000), (unsigned long)(total % 1000));
+    if ((count > failed) && (total > 0))
+    {
+        printf("Throughput       : %.2f sign/s\n", (double)(count - failed) * 1000000 / total);
+        printf("Latency min/avg/max : %.3f / %.3f / %.3f ms\n",
+                minLatency / 1000.0,
+                (double)sumLatency / (count - failed) / 1000.0,
+                maxLatency / 1000.0);
+    }
+    return failed;
+}
+
+int trustm_ecc_sign_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
 
@@ -98,14 +378,10 @@ int main (int argc, char **argv)
     char *inFile = NULL;
     FILE *fp = NULL;
     
-    int i;
+    char *manifest = NULL;
+    int exit_status = 0;
 
     int option = 0;                    // Command line option.
-    ECDSA_SIG  *ecdsa_sig = NULL;
-    const unsigned char *sig_p1 = NULL;
-    unsigned char *sig_p2 = NULL;
-    
-    int sig_len=0;
 /***************************************************************
  * Getting Input from CLI
  **************************************************************/
@@ -118,14 +394,14 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
         opterr = 0; // Disable getopt error messages in case of unknown parameters
 
         // Loop through parameters with getopt.
-        while (-1 != (option = getopt(argc, argv, "k:o:O:i:HXh")))
+        while (-1 != (option = getopt(argc, argv, "k:o:O:i:b:HXh")))
         {
             switch (option)
             {
@@ -148,6 +424,10 @@ int main (int argc, char **argv)
                 case 'H': // Input
                     uOptFlag.flags.hash = 1;
                     break;
+                case 'b': // Batch manifest
+                    uOptFlag.flags.batch = 1;
+                    manifest = optarg;
+                    break;
                 case 'X': // Bypass Shielded Communication
                     uOptFlag.flags.bypass = 1;
                     printf("Bypass Shielded Communication. \n");
@@ -155,7 +435,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -176,13 +456,18 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-        exit(1);
+        return 1;
 
     printf("========================================================\n");
 
     do
     {
-        if(uOptFlag.flags.sign == 1)
+        if((uOptFlag.flags.sign == 1) && (uOptFlag.flags.batch == 1))
+        {
+            if (_batchsign(optiga_key_id, manifest) != 0)
+                exit_status = 1;
+        }
+        else if(uOptFlag.flags.sign == 1)
         {
             if((uOptFlag.flags.output != 1) && (uOptFlag.flags.outputssl != 1))
             {
@@ -207,7 +492,8 @@ int main (int argc, char **argv)
                 if (!fp)
                 {
                     printf("error opening file : %s\n",inFile);
-                    exit(1);
+                    exit_status = 1;
+                    break;
                 }
 		
 
@@ -216,11 +502,16 @@ int main (int argc, char **argv)
                   const int bufSize = 32768;
                   char* buffer = malloc(bufSize);
                   int bytesRead = 0;
-                  if(!buffer) return -1;
+                  if(!buffer)
+                  {
+                      exit_status = 1;
+                      break;
+                  }
                   while((bytesRead = fread(buffer, 1, bufSize, fp)))
                   {
                       SHA256_Update(&sha256, buffer, bytesRead);
                   }
+                  free(buffer);
                   SHA256_Final(digest, &sha256);
                   digestLen = sizeof(digest);
                   printf("Hash Success : SHA256\n");
@@ -251,8 +542,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
                 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -273,34 +563,9 @@ int main (int argc, char **argv)
             {
                 if(uOptFlag.flags.outputssl == 1)
                 {
-                if(signature_length<0x7F){
-                    for(i=signature_length-1; i >= 0; i--)
-                    {
-                        signature[i+2] = signature[i]; 
-                    }
-                    signature[0] = 0x30; // Insert SEQUENCE
-                    signature[1] = signature_length; // insert length
-                    signature_length += 2;
+                    signature_length = _sigheader(signature, signature_length);
                     trustmwriteTo(signature, signature_length, outFile);
                 }
-                else{
-                    for(i=signature_length-1; i >= 0; i--)
-                    {
-                        signature[i+3] = signature[i]; 
-                    }
-                    signature[0] = 0x30; // Insert SEQUENCE
-                    signature[1] = 0x81; // insert length
-                    signature[2] = signature_length; // insert length
-                    signature_length += 3;
-
-                    sig_p1=signature;
-                    ecdsa_sig = d2i_ECDSA_SIG(NULL, &sig_p1, signature_length+3);
-                    sig_p2=signature;
-                    sig_len=i2d_ECDSA_SIG(ecdsa_sig, &sig_p2);
-                    trustmwriteTo(signature, sig_len, outFile);
-
-                }
-            }
                 //trustmwriteTo(signature, signature_length, outFile);
                 printf("Success\n");
             }
@@ -314,7 +579,16 @@ int main (int argc, char **argv)
 
     printf("========================================================\n");
 
+    if (fp)
+        fclose(fp);
     trustm_Close();
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
-    return 0;
+    return exit_status;
+}
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_ecc_sign_run(argc, argv);
 }
+#endif
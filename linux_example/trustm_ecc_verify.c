@@ -31,6 +31,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -56,12 +58,12 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
-void _helpmenu(void)
+static void _helpmenu(void)
 {
     printf("\nHelp menu: trustm_ecc_verify <option> ...<option>\n");
     printf("option:- \n");
@@ -74,7 +76,7 @@ void _helpmenu(void)
     printf("-h             : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_ecc_verify_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     optiga_hash_context_t hash_context;
@@ -101,6 +103,7 @@ int main (int argc, char **argv)
     char *pubkeyFile = NULL;
     char name[100];
     FILE *fp = NULL;
+    int exit_status = 0;
     uint16_t filesize;
     uint16_t i;
     uint16_t nid = 0;
@@ -120,7 +123,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -157,7 +160,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -178,7 +181,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-        exit(1);
+        return 1;
 
     printf("========================================================\n");
 
@@ -228,7 +231,8 @@ int main (int argc, char **argv)
             if (!fp)
             {
                 printf("error opening file : %s\n",inFile);
-                exit(1);
+                exit_status = 1;
+                break;
             }
 
             hash_context.context_buffer = hash_context_buffer;
@@ -239,8 +243,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -261,8 +264,7 @@ int main (int argc, char **argv)
                 if(uOptFlag.flags.bypass != 1)
                 {
                     // OPTIGA Comms Shielded connection settings to enable the protection
-                    OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                    OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
                 }
 
                 optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -291,8 +293,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -336,8 +337,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -420,8 +420,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -450,7 +449,16 @@ int main (int argc, char **argv)
 
     printf("========================================================\n");
 
+    if (fp)
+        fclose(fp);
     trustm_Close();
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
-    return 0;
+    return exit_status;
+}
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_ecc_verify_run(argc, argv);
 }
+#endif
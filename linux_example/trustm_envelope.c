@@ -0,0 +1,315 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "optiga/ifx_i2c/ifx_i2c_config.h"
+#include "optiga/optiga_util.h"
+
+#include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_envelope.h"
+#include "trustm_tools.h"
+
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+
+typedef struct _OPTFLAG {
+    uint16_t    enc         : 1;
+    uint16_t    dec         : 1;
+    uint16_t    key         : 1;
+    uint16_t    input       : 1;
+    uint16_t    output      : 1;
+    uint16_t    pubkey      : 1;
+    uint16_t    bypass      : 1;
+    uint16_t    dummy7      : 1;
+    uint16_t    dummy8      : 1;
+    uint16_t    dummy9      : 1;
+    uint16_t    dummy10     : 1;
+    uint16_t    dummy11     : 1;
+    uint16_t    dummy12     : 1;
+    uint16_t    dummy13     : 1;
+    uint16_t    dummy14     : 1;
+    uint16_t    dummy15     : 1;
+}OPTFLAG;
+
+static union _uOptFlag {
+    OPTFLAG flags;
+    uint16_t    all;
+} uOptFlag;
+
+static void _helpmenu(void)
+{
+    printf("\nHelp menu: trustm_envelope <option> ...<option>\n");
+    printf("option:- \n");
+    printf("-e            : Encrypt input with a new data key\n");
+    printf("-d            : Decrypt input, data key is unwrapped by the chip\n");
+    printf("-k <OID Key>  : Wrap data key for RSA key OID (0xE0FC-0xE0FD)\n");
+    printf("                [default Pubkey from <OID Key + 0x10E4>]\n");
+    printf("-p <pubkey>   : Use Pubkey file for -k\n");
+    printf("-i <filename> : Input file\n");
+    printf("-o <filename> : Output file\n");
+    printf("-X            : Bypass Shielded Communication \n");
+    printf("-h            : Print this help \n");
+}
+
+/**********************************************************************
+* _readpubkey()
+* Loads the RSA public key used to wrap the data key, from a PEM file
+* or from the public key object written by trustm_rsa_keygen -s.
+**********************************************************************/
+static EVP_PKEY *_readpubkey(optiga_key_id_t optiga_key_id, const char *pubkeyFile)
+{
+    optiga_lib_status_t return_status;
+    uint8_t pubkey[TRUSTM_CACHE_PUBKEY_SIZE];
+    uint16_t pubkeyLen = sizeof(pubkey);
+    const unsigned char *p;
+    EVP_PKEY *pkey = NULL;
+    FILE *fp;
+
+    if (pubkeyFile != NULL)
+    {
+        fp = fopen(pubkeyFile, "r");
+        if (!fp)
+        {
+            printf("error opening file : %s\n", pubkeyFile);
+            return NULL;
+        }
+        pkey = PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+        fclose(fp);
+        return pkey;
+    }
+
+    if (trustm_cache_pubkey_get(optiga_key_id+0x10E4, pubkey, &pubkeyLen) != 0)
+    {
+        pubkeyLen = sizeof(pubkey);
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        return_status = optiga_util_read_data(me_util,
+                                                optiga_key_id+0x10E4,
+                                                0,
+                                                pubkey,
+                                                &pubkeyLen);
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            return NULL;
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        if (optiga_lib_status != OPTIGA_LIB_SUCCESS)
+        {
+            trustmPrintErrorCode(optiga_lib_status);
+            return NULL;
+        }
+        trustm_cache_pubkey_put(optiga_key_id+0x10E4, pubkey, pubkeyLen);
+    }
+
+    p = pubkey;
+    pkey = d2i_PUBKEY(NULL, &p, pubkeyLen);
+    return pkey;
+}
+
+static void _printstats(trustm_envelope_stats_t *stats)
+{
+    printf("Payload          : %llu bytes\n", (unsigned long long)stats->bytes);
+    printf("Chip time        : %llu.%03llu ms\n",
+            (unsigned long long)(stats->chip_us / 1000), (unsigned long long)(stats->chip_us % 1000));
+    printf("AES-GCM time     : %llu.%03llu ms",
+            (unsigned long long)(stats->bulk_us / 1000), (unsigned long long)(stats->bulk_us % 1000));
+    if (stats->bulk_us > 0)
+        printf(" (%.1f MB/s)", (double)stats->bytes / stats->bulk_us);
+    printf("\n");
+}
+
+int trustm_envelope_run (int argc, char **argv)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+    optiga_key_id_t optiga_key_id = 0;
+    trustm_envelope_stats_t stats;
+    EVP_PKEY *pkey = NULL;
+
+    char *outFile = NULL;
+    char *inFile = NULL;
+    char *pubkeyFile = NULL;
+
+    int option = 0;                    // Command line option.
+
+/***************************************************************
+ * Getting Input from CLI
+ **************************************************************/
+    uOptFlag.all = 0;
+    printf("\n");
+    do // Begin of DO WHILE(FALSE) for error handling.
+    {
+        // ---------- Check for command line parameters ----------
+        if (argc < 2)
+        {
+            _helpmenu();
+            return 0;
+        }
+
+        // ---------- Command line parsing with getopt ----------
+        opterr = 0; // Disable getopt error messages in case of unknown parameters
+
+        // Loop through parameters with getopt.
+        while (-1 != (option = getopt(argc, argv, "edk:p:i:o:Xh")))
+        {
+            switch (option)
+            {
+                case 'e': // Encrypt
+                    uOptFlag.flags.enc = 1;
+                    break;
+                case 'd': // Decrypt
+                    uOptFlag.flags.dec = 1;
+                    break;
+                case 'k': // OID Key
+                    uOptFlag.flags.key = 1;
+                    optiga_key_id = trustmHexorDec(optarg);
+                    if((optiga_key_id < 0xE0FC) || (optiga_key_id > 0xE0FD))
+                    {
+                        printf("Invalid RSA key OID!!!\n");
+                        return 0;
+                    }
+                    break;
+                case 'p': // Host Pubkey
+                    uOptFlag.flags.pubkey = 1;
+                    pubkeyFile = optarg;
+                    break;
+                case 'i': // Input
+                    uOptFlag.flags.input = 1;
+                    inFile = optarg;
+                    break;
+                case 'o': // Output
+                    uOptFlag.flags.output = 1;
+                    outFile = optarg;
+                    break;
+                case 'X': // Bypass Shielded Communication
+                    uOptFlag.flags.bypass = 1;
+                    printf("Bypass Shielded Communication. \n");
+                    break;
+                case 'h': // Print Help Menu
+                default:  // Any other command Print Help Menu
+                    _helpmenu();
+                    return 0;
+                    break;
+            }
+        }
+    } while (0); // End of DO WHILE FALSE loop.
+
+/***************************************************************
+ * Example
+ **************************************************************/
+    if(uOptFlag.flags.bypass != 1)
+    #ifdef HIBERNATE_ENABLE
+        trustm_hibernate_flag = 1; // Enable hibernate Context Save
+    #else
+        trustm_hibernate_flag = 0; // disable hibernate Context Save
+    #endif 
+    else
+        trustm_hibernate_flag = 0; // disable hibernate Context Save
+
+    return_status = trustm_Open();
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        return 1;
+
+    printf("========================================================\n");
+
+    do
+    {
+        if((uOptFlag.flags.enc == 1) || (uOptFlag.flags.dec == 1))
+        {
+            if(uOptFlag.flags.output != 1)
+            {
+                printf("Output filename missing!!!\n");
+                break;
+            }
+
+            if(uOptFlag.flags.input != 1)
+            {
+                printf("Input filename missing!!!\n");
+                break;
+            }
+        }
+
+        if(uOptFlag.flags.enc == 1)
+        {
+            if(uOptFlag.flags.key != 1)
+            {
+                printf("RSA key OID missing!!!\n");
+                break;
+            }
+
+            printf("OID Key          : 0x%.4X\n",optiga_key_id);
+            if(uOptFlag.flags.pubkey == 1)
+                printf("Pubkey file      : %s \n",pubkeyFile);
+            printf("Output File Name : %s \n", outFile);
+            printf("Input File Name  : %s \n", inFile);
+
+            pkey = _readpubkey(optiga_key_id, pubkeyFile);
+            if ((pkey == NULL) || (EVP_PKEY_id(pkey) != EVP_PKEY_RSA))
+            {
+                printf("Invalid RSA Pubkey!!!\n");
+                break;
+            }
+
+            return_status = trustmEnvelopeSeal(optiga_key_id, pkey, (uOptFlag.flags.bypass != 1),
+                                                inFile, outFile, &stats);
+            if (return_status != OPTIGA_LIB_SUCCESS)
+                break;
+            _printstats(&stats);
+            printf("Success\n");
+        }
+        else if(uOptFlag.flags.dec == 1)
+        {
+            printf("Output File Name : %s \n", outFile);
+            printf("Input File Name  : %s \n", inFile);
+
+            return_status = trustmEnvelopeOpen((uOptFlag.flags.bypass != 1),
+                                                inFile, outFile, &stats);
+            if (return_status != OPTIGA_LIB_SUCCESS)
+                break;
+            _printstats(&stats);
+            printf("Success\n");
+        }
+    }while(FALSE);
+
+    if (pkey != NULL)
+        EVP_PKEY_free(pkey);
+
+    // Capture OPTIGA Trust M error
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        trustmPrintErrorCode(return_status);
+
+    printf("========================================================\n");
+
+    trustm_Close();
+    trustm_hibernate_flag = 0; // Disable hibernate Context Save
+    return (return_status != OPTIGA_LIB_SUCCESS);
+}
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_envelope_run(argc, argv);
+}
+#endif
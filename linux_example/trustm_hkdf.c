@@ -31,6 +31,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -58,13 +60,13 @@ typedef struct _OPTFLAG {
         uint16_t        dummy15         : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
         OPTFLAG flags;
         uint16_t        all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_hkdf <option> ...<option>\n");
     printf("option:- \n");
@@ -79,7 +81,7 @@ void helpmenu(void)
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_hkdf_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t optiga_oid;
@@ -107,7 +109,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -126,7 +128,7 @@ int main (int argc, char **argv)
                         /*if((optiga_oid < 0xF1D0) || (optiga_oid > 0xF1DB))
                         {
                                 printf("Invalid Input Secret OID!!!\n");
-                                exit(0);
+                                return 0;
                         }*/
                         break;
                 case 'H': // Save pubkey
@@ -155,7 +157,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                         helpmenu();
-                        exit(0);
+                        return 0;
                         break;
             }
         }
@@ -171,7 +173,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     printf("========================================================\n");
 
@@ -226,8 +228,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             { 
             // OPTIGA Comms Shielded connection settings to enable the protection
-            OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-            OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+            TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
             
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -274,3 +275,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_hkdf_run(argc, argv);
+}
+#endif
@@ -31,6 +31,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_stream.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -58,13 +60,13 @@ typedef struct _OPTFLAG {
         uint16_t        dummy15         : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
         OPTFLAG flags;
         uint16_t        all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_hmac <option> ...<option>\n");
     printf("option:- \n");
@@ -78,7 +80,7 @@ void helpmenu(void)
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_hmac_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t optiga_oid;
@@ -87,8 +89,7 @@ int main (int argc, char **argv)
     //uint16_t i;
     uint8_t hmac_type=0x20;// default HMAC_SHA256
     optiga_oid=0xF1D0;// default OID
-    uint8_t message[300];     
-    uint32_t messagelen = sizeof(message);
+    trustm_stream_stats_t stats;
     
     char *outFile = NULL;
     char *inFile = NULL;
@@ -103,7 +104,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -122,7 +123,7 @@ int main (int argc, char **argv)
                         if((optiga_oid < 0xF1D0) || (optiga_oid > 0xF1DB))
                         {
                                 printf("Invalid Input Secret OID!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'H': // HMAC_SHA_Type
@@ -146,7 +147,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                         helpmenu();
-                        exit(0);
+                        return 0;
                         break;
             }
         }
@@ -164,7 +165,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-     {exit(1);}
+     {return 1;}
 
     printf("========================================================\n");
 
@@ -188,42 +189,19 @@ int main (int argc, char **argv)
             printf("Output File Name : %s \n", outFile);
             printf("Input File Name  : %s \n", inFile);
 
-            messagelen = trustmreadFrom(message, (uint8_t *) inFile);
-            if (messagelen == 0)
-            {
-                printf("Error reading file!!!\n");
-                break;
-            }
-
-            printf("Input data : \n");
-            trustmHexDump(message,messagelen);
-            if(uOptFlag.flags.bypass != 1)
-            { 
-            
-            // OPTIGA Comms Shielded connection settings to enable the protection
-            OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-            OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
-            }
-            
-            optiga_lib_status = OPTIGA_LIB_BUSY;
-
-            return_status = optiga_crypt_hmac(me_crypt, 
-                                      hmac_type, 
-                                      optiga_oid, 
-                                      message, 
-                                      messagelen, 
-                                      mac_buffer, 
-                                      &mac_buffer_length);
-                                          
-            if (OPTIGA_LIB_SUCCESS != return_status)
-                break;
-            //Wait until the optiga_util_read_metadata operation is completed
-            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-            return_status = optiga_lib_status;
+            // Inputs of any size are streamed through the chip
+            return_status = trustmHmacStream(hmac_type,
+                                                optiga_oid,
+                                                (uOptFlag.flags.bypass != 1),
+                                                inFile,
+                                                mac_buffer,
+                                                &mac_buffer_length,
+                                                &stats);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
             {
+                trustmPrintStreamStats(&stats);
                 printf("MAC data :\n");
                 trustmHexDump(mac_buffer, mac_buffer_length);
 
@@ -246,3 +224,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_hmac_run(argc, argv);
+}
+#endif
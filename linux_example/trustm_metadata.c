@@ -30,6 +30,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 static const uint8_t __bALW[] = {0x01,0x00}; // alway read or write
 static const uint8_t __bNEV[] = {0x01,0xff}; // disable read or write
@@ -59,7 +62,7 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
@@ -97,7 +100,7 @@ static void _helpmenu(void)
     printf("-h        : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_metadata_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t bytes_to_read;
@@ -112,6 +115,7 @@ int main (int argc, char **argv)
     uint8_t tempData[20];
 
     char    messagebuf[500];
+    int exit_status = 0;
 
     int option = 0;                    // Command line option.
 
@@ -127,7 +131,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -154,7 +158,7 @@ int main (int argc, char **argv)
                         (lcsChange[0] != 't')&&(lcsChange[0] != 'f'))
                     {
                         _helpmenu();
-                        exit(0);
+                        return 0;
                     }
                     break;
                 case 'R': // Read setting
@@ -165,7 +169,7 @@ int main (int argc, char **argv)
                         (lcsRead[0] != 'n')&&(lcsRead[0] != 'f'))
                     {
                         _helpmenu();
-                        exit(0);
+                        return 0;
                     }
                     break;
                 case 'E': // Execute setting
@@ -176,7 +180,7 @@ int main (int argc, char **argv)
                         (lcsExecute[0] != 't')&&(lcsExecute[0] != 'f'))
                     {
                         _helpmenu();
-                        exit(0);
+                        return 0;
                     }
                     break;
                 case 'I': // IN
@@ -199,7 +203,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -218,7 +222,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     trustmGetOIDName(optiga_oid, messagebuf);
     printf("========================================================\n");
@@ -236,21 +240,13 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             bytes_to_read = sizeof(read_data_buffer);
-            optiga_lib_status = OPTIGA_LIB_BUSY;
-            return_status = optiga_util_read_metadata(me_util,
-                                                        optiga_oid,
-                                                        read_data_buffer,
-                                                        &bytes_to_read);
-            if (OPTIGA_LIB_SUCCESS != return_status)
-                break;
-            //Wait until the optiga_util_read_metadata operation is completed
-            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-            return_status = optiga_lib_status;
+            return_status = trustmReadMetadataRaw(optiga_oid,
+                                                  read_data_buffer,
+                                                  &bytes_to_read);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -270,7 +266,8 @@ int main (int argc, char **argv)
                 (uOptFlag.flags.lcsexecute != 1)&&(uOptFlag.flags.lcsread != 1))
             {
                 printf ("\nMust at least contain input -F,-I,-O,-T,-C,-R or -E!!! \n");
-                exit(1);
+                exit_status = 1;
+                break;
             }
 
             if (uOptFlag.flags.custom == 1)
@@ -341,16 +338,18 @@ int main (int argc, char **argv)
                                 else
                                 {
                                     printf ("\nInvalid input!!! \n");
-                                    exit(1);
+                                    exit_status = 1;
                                 }
                             }
                             else
                             {
                                 printf ("\nInvalid f parameter input!!! \n");
-                                exit(1);
+                                exit_status = 1;
                             }
                             break;
                     }
+                    if (exit_status != 0)
+                        break;
                 }
 
                 if (uOptFlag.flags.lcsread == 1)
@@ -390,16 +389,18 @@ int main (int argc, char **argv)
                                 else
                                 {
                                     printf ("\nInvalid input!!! \n");
-                                    exit(1);
+                                    exit_status = 1;
                                 }
                             }
                             else
                             {
                                 printf ("\nInvalid f parameter input!!! \n");
-                                exit(1);
+                                exit_status = 1;
                             }
                             break;
                     }
+                    if (exit_status != 0)
+                        break;
                 }
 
                 if (uOptFlag.flags.lcsexecute == 1)
@@ -439,16 +440,18 @@ int main (int argc, char **argv)
                                 else
                                 {
                                     printf ("\nInvalid input!!! \n");
-                                    exit(1);
+                                    exit_status = 1;
                                 }
                             }
                             else
                             {
                                 printf ("\nInvalid f parameter input!!! \n");
-                                exit(1);
+                                exit_status = 1;
                             }
                             break;
                     }
+                    if (exit_status != 0)
+                        break;
                 }
                 mode[1] = modeLen-2;
             }
@@ -461,8 +464,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -475,6 +477,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_oid);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -491,5 +494,12 @@ int main (int argc, char **argv)
 
     trustm_Close();
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
-    return 0;
+    return exit_status;
+}
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_metadata_run(argc, argv);
 }
+#endif
@@ -35,6 +35,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 typedef struct _OPTFLAG {
     uint16_t    read        : 1;
@@ -55,7 +58,7 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG    flags;
     uint16_t    all;
 } uOptFlag;
@@ -73,7 +76,7 @@ static void _helpmenu(void)
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_monotonic_counter_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint32_t inValue = 0;
@@ -97,7 +100,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -150,7 +153,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -169,7 +172,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     printf("========================================================\n");
 
@@ -188,8 +191,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -201,6 +203,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_oid);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -230,8 +233,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -246,6 +248,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_oid);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -259,8 +262,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             bytes_to_read = sizeof(read_data_buffer);
@@ -310,3 +312,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_monotonic_counter_run(argc, argv);
+}
+#endif
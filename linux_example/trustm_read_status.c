@@ -29,6 +29,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 typedef struct _OPTFLAG {
     uint16_t    bypass      : 1;
@@ -49,13 +51,13 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_read_status <option> ...<option>\n");
     printf("option:- \n");
@@ -63,7 +65,7 @@ void helpmenu(void)
     printf("-h : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_read_status_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t i;
@@ -98,7 +100,7 @@ int main (int argc, char **argv)
                     break;
                 case 'h': // Print Help Menu
                     helpmenu();
-                    exit(0);
+                    return 0;
                 break;
             }
         }
@@ -114,7 +116,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
         
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     printf("========================================================\n");
     for (i = 0; i < sizeof(arrayOID)/2; i++)
@@ -132,8 +134,7 @@ int main (int argc, char **argv)
                 if(uOptFlag.flags.bypass != 1)
                 {
                     // OPTIGA Comms Shielded connection settings to enable the protection
-                    OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                    OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                    TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
                 }
 
                 bytes_to_read = sizeof(read_data_buffer);
@@ -170,3 +171,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_read_status_run(argc, argv);
+}
+#endif
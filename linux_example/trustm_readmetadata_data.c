@@ -29,6 +29,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 typedef struct _OPTFLAG {
     uint16_t    bypass      : 1;
@@ -49,13 +51,13 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_readmetadata_data <option> ...<option>\n");
     printf("option:- \n");
@@ -63,7 +65,7 @@ void helpmenu(void)
     printf("-h : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_readmetadata_data_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     uint16_t i;
@@ -102,7 +104,7 @@ int main (int argc, char **argv)
                     break;
                 case 'h': // Print Help Menu
                     helpmenu();
-                    exit(0);
+                    return 0;
                 break;
             }
         }
@@ -119,7 +121,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-        exit(1);
+        return 1;
 
     for (i = 0; i < sizeof(arrayOID)/2; i++) // Limit to Obj
     {
@@ -136,21 +138,13 @@ int main (int argc, char **argv)
                 if(uOptFlag.flags.bypass != 1)
                 {
                     // OPTIGA Comms Shielded connection settings to enable the protection
-                    OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                    OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                    TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
                 }
 
                 bytes_to_read = sizeof(read_data_buffer);
-                optiga_lib_status = OPTIGA_LIB_BUSY;
-                return_status = optiga_util_read_metadata(me_util,
-                                                            optiga_oid,
-                                                            read_data_buffer,
-                                                            &bytes_to_read);
-                if (OPTIGA_LIB_SUCCESS != return_status)
-                    break;
-                //Wait until the optiga_util_read_metadata operation is completed
-                trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-                return_status = optiga_lib_status;
+                return_status = trustmReadMetadataRaw(optiga_oid,
+                                                      read_data_buffer,
+                                                      &bytes_to_read);
                 if (return_status != OPTIGA_LIB_SUCCESS)
                     break;
                 else
@@ -175,3 +169,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_readmetadata_data_run(argc, argv);
+}
+#endif
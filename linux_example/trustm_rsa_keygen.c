@@ -31,6 +31,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -59,13 +62,13 @@ typedef struct _OPTFLAG {
         uint16_t        dummy15         : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
         OPTFLAG flags;
         uint16_t        all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_rsa_keygen <option> ...<option>\n");
     printf("option:- \n");
@@ -80,7 +83,7 @@ void helpmenu(void)
     printf("-h              : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_rsa_keygen_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     optiga_key_id_t optiga_key_id;
@@ -116,7 +119,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -133,7 +136,7 @@ int main (int argc, char **argv)
                         if((optiga_key_id < 0xE0FC) || (optiga_key_id > 0xE0FD))
                         {
                                 printf("Invalid RSA key OID!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 't': // Key Type
@@ -142,7 +145,7 @@ int main (int argc, char **argv)
                         if ((keyType == 0x00) || (keyType & 0xc0))
                         {
                                 printf("Key Type Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'k': // Key Size
@@ -151,7 +154,7 @@ int main (int argc, char **argv)
                         if ((keySize != 0x41) && (keySize != 0x42))
                         {
                                 printf("Key Size Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'o': // Output
@@ -168,7 +171,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                         helpmenu();
-                        exit(0);
+                        return 0;
                         break;
             }
         }
@@ -185,7 +188,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-            exit(1);
+            return 1;
 
     printf("========================================================\n");
 
@@ -220,8 +223,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -238,6 +240,7 @@ int main (int argc, char **argv)
             printf("Generating RSA Key ........\n");
             trustm_WaitForCompletion(MAX_RSA_KEY_GEN_TIME);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(optiga_key_id);
             if (return_status != OPTIGA_LIB_SUCCESS)
                     break;
             else
@@ -259,8 +262,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me_util, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
             }
             
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -275,10 +277,11 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate((optiga_key_id+0x10E4));
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
-            else
-                printf("Write Success to OID: 0x%.4X.\n",(optiga_key_id+0x10E4));
+            trustm_cache_pubkey_put((optiga_key_id+0x10E4), pubKey, pubKeyLen+i);
+            printf("Write Success to OID: 0x%.4X.\n",(optiga_key_id+0x10E4));
         }
 
     }while(FALSE);
@@ -293,3 +296,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_rsa_keygen_run(argc, argv);
+}
+#endif
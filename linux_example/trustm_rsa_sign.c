@@ -31,6 +31,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -58,12 +60,12 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
-void _helpmenu(void)
+static void _helpmenu(void)
 {
     printf("\nHelp menu: trustm_rsa_sign <option> ...<option>\n");
     printf("option:- \n");
@@ -75,7 +77,7 @@ void _helpmenu(void)
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_rsa_sign_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
 
@@ -94,6 +96,7 @@ int main (int argc, char **argv)
     char *outFile = NULL;
     char *inFile = NULL;
     FILE *fp = NULL;
+    int exit_status = 0;
     uint16_t filesize;
 
     int option = 0;                    // Command line option.
@@ -111,7 +114,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -144,7 +147,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -165,7 +168,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-        exit(1);
+        return 1;
 
     printf("========================================================\n");
 
@@ -196,7 +199,8 @@ int main (int argc, char **argv)
                 if (!fp)
                 {
                     printf("error opening file : %s\n",inFile);
-                    exit(1);
+                    exit_status = 1;
+                    break;
                 }
 
                 hash_context.context_buffer = hash_context_buffer;
@@ -207,8 +211,7 @@ int main (int argc, char **argv)
                 if(uOptFlag.flags.bypass != 1)
                 {
                     // OPTIGA Comms Shielded connection settings to enable the protection
-                    OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                    OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
                 }
 
                 optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -229,8 +232,7 @@ int main (int argc, char **argv)
                     if(uOptFlag.flags.bypass != 1)
                     {
                         // OPTIGA Comms Shielded connection settings to enable the protection
-                        OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                        OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
+                        TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
                     }
 
                     optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -258,8 +260,7 @@ int main (int argc, char **argv)
                 if(uOptFlag.flags.bypass != 1)
                 {
                     // OPTIGA Comms Shielded connection settings to enable the protection
-                    OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                    OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
+                    TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
                 }
 
                 optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -308,8 +309,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_COMMAND_PROTECTION);
             }
 
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -343,7 +343,16 @@ int main (int argc, char **argv)
 
     printf("========================================================\n");
 
+    if (fp)
+        fclose(fp);
     trustm_Close();
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
-    return 0;
+    return exit_status;
+}
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_rsa_sign_run(argc, argv);
 }
+#endif
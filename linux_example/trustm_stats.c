@@ -0,0 +1,404 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_sec.h"
+#include "trustm_helper_shield.h"
+#include "trustm_engine_stats.h"
+
+typedef struct _OPTFLAG {
+    uint16_t    process     : 1;
+    uint16_t    interval    : 1;
+    uint16_t    reset       : 1;
+    uint16_t    dummy3      : 1;
+    uint16_t    dummy4      : 1;
+    uint16_t    dummy5      : 1;
+    uint16_t    dummy6      : 1;
+    uint16_t    dummy7      : 1;
+    uint16_t    dummy8      : 1;
+    uint16_t    dummy9      : 1;
+    uint16_t    dummy10     : 1;
+    uint16_t    dummy11     : 1;
+    uint16_t    dummy12     : 1;
+    uint16_t    dummy13     : 1;
+    uint16_t    dummy14     : 1;
+    uint16_t    dummy15     : 1;
+}OPTFLAG;
+
+union _uOptFlag {
+    OPTFLAG flags;
+    uint16_t    all;
+} uOptFlag;
+
+static const char *stats_op_name[TRUSTM_STATS_OP_MAX] = TRUSTM_STATS_OP_NAMES;
+static const char *stats_phase_name[TRUSTM_STATS_PHASE_MAX] = TRUSTM_STATS_PHASE_NAMES;
+
+static trustm_stats_shm_t *stats_shm = NULL;
+
+void helpmenu(void)
+{
+    printf("\nHelp menu: trustm_stats <option> ...<option>\n");
+    printf("option:- \n");
+    printf("-p             : Also print every process\n");
+    printf("-i <seconds>   : Print the operations of every interval\n");
+    printf("-n <count>     : Number of intervals [default until Ctrl-C]\n");
+    printf("-r             : Reset the statistics of all processes\n");
+    printf("-h             : Print this help \n");
+}
+
+/**********************************************************************
+* stats_map()
+* Maps the segment created by the engine, read only unless resetting
+**********************************************************************/
+static int stats_map(int writable)
+{
+    int fd;
+    void *shm;
+
+    if ((fd = shm_open(TRUSTM_STATS_SHM_NAME, writable ? O_RDWR : O_RDONLY, 0)) == -1)
+    {
+        if (errno == ENOENT)
+            printf("No statistics, enable them with the engine control STATS=1\n");
+        else
+            printf("Cannot open statistics : %s\n", strerror(errno));
+        return -1;
+    }
+    shm = mmap(NULL, sizeof(trustm_stats_shm_t), writable ? (PROT_READ|PROT_WRITE) : PROT_READ,
+               MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        printf("Cannot map statistics : %s\n", strerror(errno));
+        return -1;
+    }
+    stats_shm = shm;
+    if (__atomic_load_n(&stats_shm->magic, __ATOMIC_ACQUIRE) != TRUSTM_STATS_MAGIC)
+    {
+        printf("Statistics of an other engine version\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* stats_reset()
+**********************************************************************/
+static void stats_reset(void)
+{
+    int i;
+
+    if (pthread_mutex_lock(&stats_shm->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&stats_shm->lock);
+    // Operations finishing meanwhile may leave partial counts
+    memset(stats_shm->retired.op, 0, sizeof(stats_shm->retired.op));
+    for (i = 0; i < TRUSTM_STATS_PROCS; i++)
+        memset(stats_shm->proc[i].op, 0, sizeof(stats_shm->proc[i].op));
+    stats_shm->dropped = 0;
+    pthread_mutex_unlock(&stats_shm->lock);
+}
+
+/**********************************************************************
+* stats_add()
+* to += from, or to -= from with sign -1 for the difference of two
+* snapshots. The max of a difference is not known, it is taken from the
+* highest bucket used.
+**********************************************************************/
+static void stats_add(trustm_stats_proc_t *to, const trustm_stats_proc_t *from, int sign)
+{
+    trustm_stats_hist_t *hto;
+    const trustm_stats_hist_t *hfrom;
+    int i, j, k;
+
+    for (i = 0; i < TRUSTM_STATS_OP_MAX; i++)
+    {
+        to->op[i].errors += sign * from->op[i].errors;
+        for (j = 0; j < TRUSTM_STATS_PHASE_MAX; j++)
+        {
+            hto = &to->op[i].phase[j];
+            hfrom = &from->op[i].phase[j];
+            hto->count += sign * hfrom->count;
+            hto->sum += sign * hfrom->sum;
+            for (k = 0; k < TRUSTM_STATS_BUCKETS; k++)
+                hto->bucket[k] += sign * hfrom->bucket[k];
+            if ((sign > 0) && (hfrom->max > hto->max))
+                hto->max = hfrom->max;
+        }
+    }
+
+    if (sign > 0)
+        return;
+    for (i = 0; i < TRUSTM_STATS_OP_MAX; i++)
+    {
+        for (j = 0; j < TRUSTM_STATS_PHASE_MAX; j++)
+        {
+            hto = &to->op[i].phase[j];
+            for (k = TRUSTM_STATS_BUCKETS - 1; (k > 0) && (hto->bucket[k] == 0); k--)
+            {}
+            if (trustm_stats_bucket_top(k) < hto->max)
+                hto->max = trustm_stats_bucket_top(k);
+        }
+    }
+}
+
+/**********************************************************************
+* stats_snapshot()
+* Totals of all processes, the retired ones included
+**********************************************************************/
+static void stats_snapshot(trustm_stats_proc_t *total)
+{
+    int i;
+
+    memset(total, 0, sizeof(trustm_stats_proc_t));
+    stats_add(total, &stats_shm->retired, 1);
+    for (i = 0; i < TRUSTM_STATS_PROCS; i++)
+    {
+        if (__atomic_load_n(&stats_shm->proc[i].pid, __ATOMIC_ACQUIRE) != 0)
+            stats_add(total, &stats_shm->proc[i], 1);
+    }
+}
+
+/**********************************************************************
+* stats_percentile()
+* Latency in us at percentile (0-100), within the bucket resolution
+**********************************************************************/
+static uint64_t stats_percentile(const trustm_stats_hist_t *hist, uint32_t percentile)
+{
+    uint64_t total = 0, target, count = 0;
+    int i;
+
+    for (i = 0; i < TRUSTM_STATS_BUCKETS; i++)
+        total += hist->bucket[i];
+    if (total == 0)
+        return 0;
+    target = ((total * percentile) + 99) / 100;
+    for (i = 0; i < TRUSTM_STATS_BUCKETS - 1; i++)
+    {
+        count += hist->bucket[i];
+        if (count >= target)
+            break;
+    }
+    if (trustm_stats_bucket_top(i) > hist->max)
+        return hist->max;
+    return trustm_stats_bucket_top(i);
+}
+
+/**********************************************************************
+* stats_print()
+* One block per operation used, latencies in ms
+**********************************************************************/
+static void stats_print(const trustm_stats_proc_t *stats)
+{
+    const trustm_stats_hist_t *hist;
+    int i, j;
+
+    printf("%-13s %9s %7s  %-9s %9s %9s %9s %9s %9s\n", "Operation", "Count", "Errors",
+            "Phase", "Mean", "p50", "p90", "p99", "Max(ms)");
+    for (i = 0; i < TRUSTM_STATS_OP_MAX; i++)
+    {
+        if (stats->op[i].phase[TRUSTM_STATS_TOTAL].count == 0)
+            continue;
+        for (j = 0; j < TRUSTM_STATS_PHASE_MAX; j++)
+        {
+            hist = &stats->op[i].phase[j];
+            if (j == 0)
+                printf("%-13s %9llu %7llu  ", stats_op_name[i], (unsigned long long)hist->count,
+                        (unsigned long long)stats->op[i].errors);
+            else
+                printf("%-13s %9s %7s  ", "", "", "");
+            printf("%-9s %9.3f %9.3f %9.3f %9.3f %9.3f\n", stats_phase_name[j],
+                    (hist->count == 0) ? 0.0 : ((double)hist->sum / hist->count) / 1000.0,
+                    stats_percentile(hist, 50) / 1000.0,
+                    stats_percentile(hist, 90) / 1000.0,
+                    stats_percentile(hist, 99) / 1000.0,
+                    hist->max / 1000.0);
+        }
+    }
+}
+
+/**********************************************************************
+* stats_print_sec_gov()
+* Estimated security event counter and decisions of the SEC governor
+**********************************************************************/
+static void stats_print_sec_gov(void)
+{
+    static const char *state_name[] = {"submit", "queue", "shed"};
+    trustm_sec_gov_stats_t gov;
+
+    if ((trustm_sec_gov_get(&gov) != 0) || (gov.samples == 0))
+        return;
+    printf("\nSEC %u (read %u, %u ms ago, %llu reads, %llu events)  last decision %s\n",
+            gov.sec, gov.sampled, gov.age, (unsigned long long)gov.samples,
+            (unsigned long long)gov.events, state_name[gov.state % 3]);
+    printf("Queued %llu (%llu ms)  shed %llu\n", (unsigned long long)gov.queued,
+            (unsigned long long)gov.queued_ms, (unsigned long long)gov.shed);
+}
+
+/**********************************************************************
+* stats_print_shield()
+* Handshakes of the shielded connection and the time saved by keeping it
+**********************************************************************/
+static void stats_print_shield(void)
+{
+    trustm_shield_stats_t shield;
+
+    if ((trustm_shield_get(&shield) != 0) || (shield.commands == 0))
+        return;
+    printf("\nShielded %llu  handshakes %llu (open %llu, rekey %llu, recover %llu)  comms errors %llu\n",
+            (unsigned long long)shield.commands,
+            (unsigned long long)(shield.opened + shield.renewed + shield.recovered),
+            (unsigned long long)shield.opened, (unsigned long long)shield.renewed,
+            (unsigned long long)shield.recovered, (unsigned long long)shield.errors);
+    printf("With handshake %llu us  kept channel %llu us  saved %llu ms\n",
+            (unsigned long long)(shield.hs_n ? (shield.hs_us / shield.hs_n) : 0),
+            (unsigned long long)(shield.reuse_n ? (shield.reuse_us / shield.reuse_n) : 0),
+            (unsigned long long)(trustm_shield_saved_us(&shield) / 1000));
+}
+
+/**********************************************************************
+* stats_print_processes()
+**********************************************************************/
+static void stats_print_processes(void)
+{
+    trustm_stats_proc_t proc;
+    int i;
+
+    for (i = 0; i < TRUSTM_STATS_PROCS; i++)
+    {
+        memcpy(&proc, &stats_shm->proc[i], sizeof(proc));
+        if (proc.pid == 0)
+            continue;
+        proc.comm[sizeof(proc.comm) - 1] = '\0';
+        printf("\nProcess %d (%s)%s\n", proc.pid, proc.comm,
+                ((kill(proc.pid, 0) == -1) && (errno == ESRCH)) ? " exited" : "");
+        stats_print(&proc);
+    }
+}
+
+int main (int argc, char **argv)
+{
+    static trustm_stats_proc_t total, last, delta;
+    uint32_t interval = 0;
+    uint32_t count = 0;
+    uint32_t n;
+    time_t now;
+
+    int option = 0; // Command line option.
+
+    uOptFlag.all = 0;
+
+    do // Begin of DO WHILE(FALSE) for error handling.
+    {
+        // ---------- Command line parsing with getopt ----------
+        opterr = 0; // Disable getopt error messages in case of unknown parameters
+
+        // Loop through parameters with getopt.
+        while (-1 != (option = getopt(argc, argv, "pi:n:rh")))
+        {
+            switch (option)
+            {
+                case 'p': // Every process
+                    uOptFlag.flags.process = 1;
+                    break;
+                case 'i': // Interval
+                    uOptFlag.flags.interval = 1;
+                    interval = trustmHexorDec(optarg);
+                    if (interval == 0)
+                    {
+                        printf("Invalid interval!!!\n");
+                        exit(1);
+                    }
+                    break;
+                case 'n': // Number of intervals
+                    count = trustmHexorDec(optarg);
+                    break;
+                case 'r': // Reset
+                    uOptFlag.flags.reset = 1;
+                    break;
+                case 'h': // Print Help Menu
+                default:  // Any other command Print Help Menu
+                    helpmenu();
+                    exit(0);
+                    break;
+            }
+        }
+    } while (0); // End of DO WHILE FALSE loop.
+
+    if (stats_map(uOptFlag.flags.reset) != 0)
+    {
+        stats_print_sec_gov();
+        stats_print_shield();
+        exit(1);
+    }
+
+    if (uOptFlag.flags.reset == 1)
+    {
+        stats_reset();
+        printf("Statistics reset\n");
+        return 0;
+    }
+
+    if (uOptFlag.flags.interval != 1)
+    {
+        stats_snapshot(&total);
+        printf("========================================================\n");
+        stats_print(&total);
+        if (uOptFlag.flags.process == 1)
+            stats_print_processes();
+        if (stats_shm->dropped != 0)
+            printf("\n%u processes not recorded, no free slot\n", stats_shm->dropped);
+        stats_print_sec_gov();
+        stats_print_shield();
+        printf("========================================================\n");
+        return 0;
+    }
+
+    stats_snapshot(&last);
+    for (n = 0; (count == 0) || (n < count); n++)
+    {
+        sleep(interval);
+        stats_snapshot(&total);
+        memcpy(&delta, &total, sizeof(delta));
+        stats_add(&delta, &last, -1);
+        memcpy(&last, &total, sizeof(last));
+
+        now = time(NULL);
+        printf("======== %.24s, last %u s ========\n", ctime(&now), interval);
+        stats_print(&delta);
+        stats_print_sec_gov();
+        stats_print_shield();
+        fflush(stdout);
+    }
+    return 0;
+}
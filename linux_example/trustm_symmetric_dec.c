@@ -29,6 +29,8 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_stream.h"
+#include "trustm_tools.h"
 
 typedef struct _OPTFLAG {
     uint16_t    mode        : 1;
@@ -49,12 +51,12 @@ typedef struct _OPTFLAG {
     uint16_t    dummy15     : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
     OPTFLAG flags;
     uint16_t    all;
 } uOptFlag;
 
-void _helpmenu(void)
+static void _helpmenu(void)
 {
     printf("\nHelp menu: trustm_symmetric_dec <option> ...<option>\n");
     printf("option:- \n");
@@ -67,17 +69,15 @@ void _helpmenu(void)
     printf("-h            : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_symmetric_dec_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
 
-    uint8_t message[64];     
-    uint32_t messagelen = sizeof(message);
-    uint8_t encyptdata[64];
-    uint32_t encyptdatalen = sizeof(encyptdata);
     uint8_t iv[64];     
     uint16_t ivlen = sizeof(iv);
 
+    trustm_stream_stats_t stats;
+
     char *outFile = NULL;
     char *inFile = NULL;
     char *ivFile = NULL;
@@ -103,7 +103,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             _helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -137,7 +137,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                     _helpmenu();
-                    exit(0);
+                    return 0;
                     break;
             }
         }
@@ -158,7 +158,7 @@ int main (int argc, char **argv)
 
     return_status = trustm_Open();
     if (return_status != OPTIGA_LIB_SUCCESS)
-        exit(1);
+        return 1;
 
     printf("========================================================\n");
 
@@ -182,17 +182,6 @@ int main (int argc, char **argv)
             printf("Output File Name : %s \n", outFile);
             printf("Input File Name  : %s \n", inFile);
 
-            encyptdatalen = trustmreadFrom(encyptdata, (uint8_t *) inFile);
-            if (encyptdatalen == 0)
-            {
-                printf("Error reading file!!!\n");
-                break;
-            }
-
-            printf("Input data : \n");
-            trustmHexDump(encyptdata,encyptdatalen);
-            
-
             if (encryption_mode == OPTIGA_SYMMETRIC_CBC){
                  printf("IV File Name  : %s \n", ivFile);
                  ivlen = trustmreadFrom(iv, (uint8_t *) ivFile);
@@ -205,51 +194,21 @@ int main (int argc, char **argv)
             printf("Initialized value : \n");
             trustmHexDump(iv,ivlen);}
 
-            if(uOptFlag.flags.bypass != 1)
-            {
-                // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
-            }
-
-            optiga_lib_status = OPTIGA_LIB_BUSY;
+            // Inputs of any size are streamed through the chip, the key never leaves it
             symmetric_key = OPTIGA_KEY_ID_SECRET_BASED;
-            if(encryption_mode == OPTIGA_SYMMETRIC_CBC){
-                return_status = optiga_crypt_symmetric_decrypt(me_crypt,
-                                                             encryption_mode,
-                                                             symmetric_key,
-                                                             encyptdata,
-                                                             encyptdatalen,
-                                                             iv,
-                                                             ivlen,
-                                                             NULL,
-                                                             0,
-                                                             message,
-                                                             &messagelen);}
-            else{
-                 return_status = optiga_crypt_symmetric_decrypt(me_crypt,
-                                                             encryption_mode,
-                                                             symmetric_key,
-                                                             encyptdata,
-                                                             encyptdatalen,
-                                                             NULL,
-                                                             0,
-                                                             NULL,
-                                                             0,
-                                                             message,
-                                                             &messagelen); }                                                                                                    
-            if (OPTIGA_LIB_SUCCESS != return_status)
-                break;
-            //Wait until the optiga_util_read_metadata operation is completed
-            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-            return_status = optiga_lib_status;
+            return_status = trustmSymmetricStream(FALSE,
+                                                    encryption_mode,
+                                                    symmetric_key,
+                                                    (encryption_mode == OPTIGA_SYMMETRIC_CBC) ? iv : NULL,
+                                                    (encryption_mode == OPTIGA_SYMMETRIC_CBC) ? ivlen : 0,
+                                                    (uOptFlag.flags.bypass != 1),
+                                                    inFile,
+                                                    outFile,
+                                                    &stats);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
-            else
-            {
-                trustmwriteTo(message, messagelen, outFile);
-                printf("Success\n");
-            }
+            trustmPrintStreamStats(&stats);
+            printf("Success\n");
         }
 
     }while(FALSE);
@@ -264,3 +223,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_symmetric_dec_run(argc, argv);
+}
+#endif
@@ -31,6 +31,9 @@
 #include "optiga/optiga_util.h"
 
 #include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_shield.h"
+#include "trustm_tools.h"
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -58,13 +61,13 @@ typedef struct _OPTFLAG {
         uint16_t        dummy15         : 1;
 }OPTFLAG;
 
-union _uOptFlag {
+static union _uOptFlag {
         OPTFLAG flags;
         uint16_t        all;
 } uOptFlag;
 
 
-void helpmenu(void)
+static void helpmenu(void)
 {
     printf("\nHelp menu: trustm_symmetric_keygen <option> ...<option>\n");
     printf("option:- \n");
@@ -77,7 +80,7 @@ void helpmenu(void)
     printf("-h              : Print this help \n");
 }
 
-int main (int argc, char **argv)
+int trustm_symmetric_keygen_run (int argc, char **argv)
 {
     optiga_lib_status_t return_status;
     optiga_key_id_t symmetric_key;                            
@@ -95,7 +98,7 @@ int main (int argc, char **argv)
         if (argc < 2)
         {
             helpmenu();
-            exit(0);
+            return 0;
         }
 
         // ---------- Command line parsing with getopt ----------
@@ -113,7 +116,7 @@ int main (int argc, char **argv)
                         if ((keyType == 0x00) || (keyType & 0xc0))
                         {
                                 printf("Key Type Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'k': // Key Size
@@ -122,7 +125,7 @@ int main (int argc, char **argv)
                         if ((keySize != 0x81) && (keySize != 0x82)&& (keySize != 0x83))
                         {
                                 printf("Key Size Error!!!\n");
-                                exit(0);
+                                return 0;
                         }
                         break;
                 case 'X': // Bypass Shielded Communication
@@ -132,7 +135,7 @@ int main (int argc, char **argv)
                 case 'h': // Print Help Menu
                 default:  // Any other command Print Help Menu
                         helpmenu();
-                        exit(0);
+                        return 0;
                         break;
             }
         }
@@ -148,7 +151,7 @@ int main (int argc, char **argv)
         trustm_hibernate_flag = 0; // disable hibernate Context Save
 
     return_status = trustm_Open();
-    if (return_status != OPTIGA_LIB_SUCCESS) {exit(1);}
+    if (return_status != OPTIGA_LIB_SUCCESS) {return 1;}
 
     printf("========================================================\n");
 
@@ -157,8 +160,7 @@ int main (int argc, char **argv)
             if(uOptFlag.flags.bypass != 1)
             {
                 // OPTIGA Comms Shielded connection settings to enable the protection
-                OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me_crypt, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET);
-                OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+                TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
             }
             
             optiga_lib_status = OPTIGA_LIB_BUSY;
@@ -173,6 +175,7 @@ int main (int argc, char **argv)
             //Wait until the optiga_util_read_metadata operation is completed
             trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(symmetric_key);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             else
@@ -190,3 +193,10 @@ int main (int argc, char **argv)
     trustm_hibernate_flag = 0; // Disable hibernate Context Save
     return 0;
 }
+
+#ifndef TRUSTM_RUNNER
+int main (int argc, char **argv)
+{
+    return trustm_symmetric_keygen_run(argc, argv);
+}
+#endif
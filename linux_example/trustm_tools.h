@@ -0,0 +1,61 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_TOOLS_H_
+#define _TRUSTM_TOOLS_H_
+
+// Entry points of the command line tools. Each tool's main only calls
+// its run function, which returns the exit status instead of calling
+// exit() and releases what it allocated, so that the runner (trustm)
+// can call the tools one after the other in one process. The runner
+// objects are built with TRUSTM_RUNNER defined, which drops the main.
+
+// Function Prototype
+
+int trustm_cert_run(int argc, char **argv);
+int trustm_chipinfo_run(int argc, char **argv);
+int trustm_data_run(int argc, char **argv);
+int trustm_ecc_keygen_run(int argc, char **argv);
+int trustm_ecc_sign_run(int argc, char **argv);
+int trustm_ecc_verify_run(int argc, char **argv);
+int trustm_envelope_run(int argc, char **argv);
+int trustm_hkdf_run(int argc, char **argv);
+int trustm_hmac_run(int argc, char **argv);
+int trustm_metadata_run(int argc, char **argv);
+int trustm_monotonic_counter_run(int argc, char **argv);
+int trustm_read_data_run(int argc, char **argv);
+int trustm_read_status_run(int argc, char **argv);
+int trustm_readmetadata_data_run(int argc, char **argv);
+int trustm_readmetadata_private_run(int argc, char **argv);
+int trustm_readmetadata_status_run(int argc, char **argv);
+int trustm_rsa_dec_run(int argc, char **argv);
+int trustm_rsa_enc_run(int argc, char **argv);
+int trustm_rsa_keygen_run(int argc, char **argv);
+int trustm_rsa_sign_run(int argc, char **argv);
+int trustm_rsa_verify_run(int argc, char **argv);
+int trustm_symmetric_dec_run(int argc, char **argv);
+int trustm_symmetric_enc_run(int argc, char **argv);
+int trustm_symmetric_keygen_run(int argc, char **argv);
+
+#endif  // _TRUSTM_TOOLS_H_
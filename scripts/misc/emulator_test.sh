@@ -0,0 +1,64 @@
+#!/bin/bash
+# Builds the emulator target and runs the tools and the engine against a
+# private emulated chip, no OPTIGA Trust M or trustm_lib is needed.
+# Usage: emulator_test.sh [-n] ; -n skips the build
+
+TOPDIR="$(cd "$(dirname "$0")/../.." && pwd)"
+EXEPATH="$TOPDIR/bin/emulator"
+WORKDIR="$(mktemp -d /tmp/trustm_emu_test.XXXXXX)"
+
+# The tools are linked with a relative run path to libtrustm.so
+export LD_LIBRARY_PATH="$EXEPATH${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+export TRUSTM_EMU_STORE="$WORKDIR/trustm_emu.store"
+export TRUSTM_EMU_LATENCY="scale=0"
+# Cached metadata of the chip used before would not match the new store
+export TRUSTM_CACHE=0
+
+trap 'rm -rf "$WORKDIR"' EXIT
+
+set -e
+
+if [ "$1" != "-n" ]; then
+echo "Build emulator"
+make -C "$TOPDIR" emulator >/dev/null
+fi
+
+cd "$WORKDIR"
+echo "input" >mydata.txt
+head -c 100000 /dev/urandom >payload.bin
+
+echo "Chip info"
+$EXEPATH/trustm_chipinfo
+
+echo "Data object write and read back"
+echo -n "0123456789abcdef" >data.txt
+$EXEPATH/trustm_data -e -w 0xf1d0 -i data.txt
+$EXEPATH/trustm_data -r 0xf1d0 -o data_read.txt
+cmp data.txt data_read.txt
+
+echo "ECC256 key generation, sign and verify"
+$EXEPATH/trustm_ecc_keygen -g 0xe0f1 -t 0x13 -k 0x03 -o test_e0f1_pub.pem -s
+$EXEPATH/trustm_ecc_sign -k 0xe0f1 -o test_e0f1.sig -i mydata.txt -H
+$EXEPATH/trustm_ecc_verify -i mydata.txt -s test_e0f1.sig -p test_e0f1_pub.pem -H
+openssl dgst -verify test_e0f1_pub.pem -keyform pem -sha256 -signature test_e0f1.sig mydata.txt
+
+echo "RSA1024 key generation, encrypt and decrypt"
+$EXEPATH/trustm_rsa_keygen -g 0xe0fc -t 0x13 -k 0x41 -o test_e0fc_pub.pem -s
+$EXEPATH/trustm_rsa_enc -p test_e0fc_pub.pem -o test_e0fc.enc -i mydata.txt
+$EXEPATH/trustm_rsa_dec -k 0xe0fc -o test_e0fc.dec -i test_e0fc.enc
+cmp mydata.txt test_e0fc.dec
+
+echo "Envelope encrypt and decrypt, in place"
+cp payload.bin envelope.bin
+$EXEPATH/trustm_envelope -e -k 0xe0fc -p test_e0fc_pub.pem -i envelope.bin -o envelope.bin
+! cmp -s payload.bin envelope.bin
+$EXEPATH/trustm_envelope -d -i envelope.bin -o envelope.bin
+cmp payload.bin envelope.bin
+
+echo "Engine random and signature"
+openssl rand -engine $EXEPATH/trustm_engine.so -hex 32
+openssl dgst -sha256 -engine $EXEPATH/trustm_engine.so -keyform engine -sign 0xe0f1 \
+    -out test_engine.sig mydata.txt
+openssl dgst -sha256 -verify test_e0f1_pub.pem -signature test_engine.sig mydata.txt
+
+echo "Emulator test passed"
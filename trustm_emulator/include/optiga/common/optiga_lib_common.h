@@ -0,0 +1,89 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _OPTIGA_LIB_COMMON_H_
+#define _OPTIGA_LIB_COMMON_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Emulator build only: the part of the OPTIGA Trust M host library API
+// used by the helper, the engine and the tools, so the emulator builds
+// without trustm_lib. Names and values follow the host library.
+
+typedef uint8_t bool_t;
+
+#ifndef TRUE
+#define TRUE                                    (1U)
+#endif
+#ifndef FALSE
+#define FALSE                                   (0U)
+#endif
+
+typedef uint16_t optiga_lib_status_t;
+
+typedef void (*callback_handler_t)(void * callback_ctx, optiga_lib_status_t event);
+
+#define OPTIGA_INSTANCE_ID_0                    (0x00)
+
+// Return codes
+#define OPTIGA_LIB_SUCCESS                      (0x0000)
+#define OPTIGA_LIB_BUSY                         (0x0001)
+#define OPTIGA_DEVICE_ERROR                     (0x8000)
+
+#define OPTIGA_COMMS_ERROR                      (0x0102)
+#define OPTIGA_COMMS_ERROR_INVALID_INPUT        (0x0103)
+#define OPTIGA_COMMS_ERROR_MEMORY_INSUFFICIENT  (0x0104)
+#define OPTIGA_COMMS_ERROR_STACK_MEMORY         (0x0105)
+#define OPTIGA_COMMS_ERROR_FATAL                (0x0106)
+#define OPTIGA_COMMS_ERROR_HANDSHAKE            (0x0107)
+#define OPTIGA_COMMS_ERROR_SESSION              (0x0108)
+
+#define OPTIGA_CMD_ERROR                        (0x0202)
+#define OPTIGA_CMD_ERROR_INVALID_INPUT          (0x0203)
+#define OPTIGA_CMD_ERROR_MEMORY_INSUFFICIENT    (0x0204)
+
+#define OPTIGA_UTIL_ERROR                       (0x0302)
+#define OPTIGA_UTIL_ERROR_INVALID_INPUT         (0x0303)
+#define OPTIGA_UTIL_ERROR_MEMORY_INSUFFICIENT   (0x0304)
+#define OPTIGA_UTIL_ERROR_INSTANCE_IN_USE       (0x0305)
+
+#define OPTIGA_CRYPT_ERROR                      (0x0402)
+#define OPTIGA_CRYPT_ERROR_INVALID_INPUT        (0x0403)
+#define OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT  (0x0404)
+#define OPTIGA_CRYPT_ERROR_INSTANCE_IN_USE      (0x0405)
+
+// Shielded connection, parameter types of optiga_xxx_set_comms_params()
+#define OPTIGA_COMMS_PROTECTION_LEVEL           (0x01)
+#define OPTIGA_COMMS_PROTOCOL_VERSION           (0x02)
+
+#define OPTIGA_COMMS_NO_PROTECTION              (0x00)
+#define OPTIGA_COMMS_COMMAND_PROTECTION         (0x01)
+#define OPTIGA_COMMS_RESPONSE_PROTECTION        (0x02)
+#define OPTIGA_COMMS_FULL_PROTECTION            (0x03)
+#define OPTIGA_COMMS_RE_ESTABLISH               (0x80)
+
+#define OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET (0x01)
+
+#endif  // _OPTIGA_LIB_COMMON_H_
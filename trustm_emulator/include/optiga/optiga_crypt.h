@@ -0,0 +1,286 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _OPTIGA_CRYPT_H_
+#define _OPTIGA_CRYPT_H_
+
+#include "optiga/common/optiga_lib_common.h"
+
+// Emulator build only, see optiga_lib_common.h
+
+typedef enum optiga_rng_type
+{
+    OPTIGA_RNG_TYPE_TRNG = 0x00,
+    OPTIGA_RNG_TYPE_DRNG = 0x01,
+} optiga_rng_type_t;
+
+typedef enum optiga_key_usage
+{
+    OPTIGA_KEY_USAGE_AUTHENTICATION = 0x01,
+    OPTIGA_KEY_USAGE_ENCRYPTION = 0x02,
+    OPTIGA_KEY_USAGE_SIGN = 0x10,
+    OPTIGA_KEY_USAGE_KEY_AGREEMENT = 0x20,
+} optiga_key_usage_t;
+
+typedef enum optiga_key_id
+{
+    OPTIGA_KEY_ID_E0F0 = 0xE0F0,
+    OPTIGA_KEY_ID_E0F1 = 0xE0F1,
+    OPTIGA_KEY_ID_E0F2 = 0xE0F2,
+    OPTIGA_KEY_ID_E0F3 = 0xE0F3,
+    OPTIGA_KEY_ID_E0FC = 0xE0FC,
+    OPTIGA_KEY_ID_E0FD = 0xE0FD,
+    OPTIGA_KEY_ID_SESSION_BASED = 0xE100,
+    OPTIGA_KEY_ID_SECRET_BASED = 0xE200,
+} optiga_key_id_t;
+
+typedef enum optiga_ecc_curve
+{
+    OPTIGA_ECC_CURVE_NIST_P_256 = 0x03,
+    OPTIGA_ECC_CURVE_NIST_P_384 = 0x04,
+    OPTIGA_ECC_CURVE_NIST_P_521 = 0x05,
+    OPTIGA_ECC_CURVE_BRAIN_POOL_P_256R1 = 0x13,
+    OPTIGA_ECC_CURVE_BRAIN_POOL_P_384R1 = 0x15,
+    OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1 = 0x16,
+} optiga_ecc_curve_t;
+
+typedef enum optiga_rsa_key_type
+{
+    OPTIGA_RSA_KEY_1024_BIT_EXPONENTIAL = 0x41,
+    OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL = 0x42,
+} optiga_rsa_key_type_t;
+
+typedef enum optiga_rsa_encryption_scheme
+{
+    OPTIGA_RSAES_PKCS1_V15 = 0x11,
+} optiga_rsa_encryption_scheme_t;
+
+typedef enum optiga_rsa_signature_scheme
+{
+    OPTIGA_RSASSA_PKCS1_V15_SHA256 = 0x01,
+    OPTIGA_RSASSA_PKCS1_V15_SHA384 = 0x02,
+    OPTIGA_RSASSA_PKCS1_V15_SHA512 = 0x03,
+} optiga_rsa_signature_scheme_t;
+
+typedef enum optiga_hash_type
+{
+    OPTIGA_HASH_TYPE_SHA_256 = 0xE2,
+} optiga_hash_type_t;
+
+typedef enum optiga_symmetric_key_type
+{
+    OPTIGA_SYMMETRIC_AES_128 = 0x81,
+    OPTIGA_SYMMETRIC_AES_192 = 0x82,
+    OPTIGA_SYMMETRIC_AES_256 = 0x83,
+} optiga_symmetric_key_type_t;
+
+typedef enum optiga_symmetric_encryption_mode
+{
+    OPTIGA_SYMMETRIC_ECB = 0x08,
+    OPTIGA_SYMMETRIC_CBC = 0x09,
+    OPTIGA_SYMMETRIC_CBC_MAC = 0x0A,
+    OPTIGA_SYMMETRIC_CMAC = 0x0B,
+} optiga_symmetric_encryption_mode_t;
+
+typedef enum optiga_hmac_type
+{
+    OPTIGA_HMAC_SHA_256 = 0x20,
+    OPTIGA_HMAC_SHA_384 = 0x21,
+    OPTIGA_HMAC_SHA_512 = 0x22,
+} optiga_hmac_type_t;
+
+typedef enum optiga_hkdf_type
+{
+    OPTIGA_HKDF_SHA_256 = 0x08,
+    OPTIGA_HKDF_SHA_384 = 0x09,
+    OPTIGA_HKDF_SHA_512 = 0x0A,
+} optiga_hkdf_type_t;
+
+// Source of the data to hash and of public keys
+#define OPTIGA_CRYPT_OID_DATA                   (0x00)
+#define OPTIGA_CRYPT_HOST_DATA                  (0x01)
+
+#define OPTIGA_HASH_CONTEXT_LENGTH_SHA_256      (209)
+
+typedef struct hash_data_from_host
+{
+    const uint8_t * buffer;
+    uint32_t length;
+} hash_data_from_host_t;
+
+typedef struct hash_data_in_optiga
+{
+    uint16_t oid;
+    uint16_t offset;
+    uint16_t length;
+} hash_data_in_optiga_t;
+
+typedef struct optiga_hash_context
+{
+    uint8_t * context_buffer;
+    uint16_t context_buffer_length;
+    uint8_t hash_algo;
+} optiga_hash_context_t;
+
+typedef struct public_key_from_host
+{
+    uint8_t * public_key;
+    uint16_t length;
+    uint8_t key_type;
+} public_key_from_host_t;
+
+// The emulator keeps its state beside the instance, see trustm_emulator.h
+typedef struct optiga_crypt
+{
+    uint8_t instance_id;
+} optiga_crypt_t;
+
+#define OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(p_instance, protection_level) \
+    optiga_crypt_set_comms_params(p_instance, OPTIGA_COMMS_PROTECTION_LEVEL, protection_level)
+#define OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(p_instance, version) \
+    optiga_crypt_set_comms_params(p_instance, OPTIGA_COMMS_PROTOCOL_VERSION, version)
+
+optiga_crypt_t * optiga_crypt_create(uint8_t optiga_instance_id, callback_handler_t handler, void * caller_context);
+optiga_lib_status_t optiga_crypt_destroy(optiga_crypt_t * me);
+void optiga_crypt_set_comms_params(optiga_crypt_t * me, uint8_t parameter_type, uint8_t value);
+
+optiga_lib_status_t optiga_crypt_random(optiga_crypt_t * me, optiga_rng_type_t rng_type,
+                                        uint8_t * random_data, uint16_t random_data_length);
+
+optiga_lib_status_t optiga_crypt_hash(optiga_crypt_t * me, optiga_hash_type_t hash_algorithm,
+                                        uint8_t source_of_data_to_hash, const void * data_to_hash,
+                                        uint8_t * hash_output);
+optiga_lib_status_t optiga_crypt_hash_start(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx);
+optiga_lib_status_t optiga_crypt_hash_update(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx,
+                                                uint8_t source_of_data_to_hash, const void * data_to_hash);
+optiga_lib_status_t optiga_crypt_hash_finalize(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx,
+                                                uint8_t * hash_output);
+
+optiga_lib_status_t optiga_crypt_ecc_generate_keypair(optiga_crypt_t * me, optiga_ecc_curve_t curve_id,
+                                                        uint8_t key_usage, bool_t export_private_key,
+                                                        void * private_key, uint8_t * public_key,
+                                                        uint16_t * public_key_length);
+optiga_lib_status_t optiga_crypt_ecdsa_sign(optiga_crypt_t * me, const uint8_t * digest, uint8_t digest_length,
+                                            optiga_key_id_t private_key, uint8_t * signature,
+                                            uint16_t * signature_length);
+optiga_lib_status_t optiga_crypt_ecdsa_verify(optiga_crypt_t * me, const uint8_t * digest, uint8_t digest_length,
+                                                const uint8_t * signature, uint16_t signature_length,
+                                                uint8_t public_key_source_type, const void * public_key);
+
+optiga_lib_status_t optiga_crypt_rsa_generate_keypair(optiga_crypt_t * me, optiga_rsa_key_type_t key_type,
+                                                        uint8_t key_usage, bool_t export_private_key,
+                                                        void * private_key, uint8_t * public_key,
+                                                        uint16_t * public_key_length);
+optiga_lib_status_t optiga_crypt_rsa_sign(optiga_crypt_t * me, optiga_rsa_signature_scheme_t signature_scheme,
+                                            const uint8_t * digest, uint8_t digest_length,
+                                            optiga_key_id_t private_key, uint8_t * signature,
+                                            uint16_t * signature_length, uint16_t salt_length);
+optiga_lib_status_t optiga_crypt_rsa_verify(optiga_crypt_t * me, optiga_rsa_signature_scheme_t signature_scheme,
+                                            const uint8_t * digest, uint8_t digest_length,
+                                            const uint8_t * signature, uint16_t signature_length,
+                                            uint8_t public_key_source_type, const void * public_key,
+                                            uint16_t salt_length);
+optiga_lib_status_t optiga_crypt_rsa_encrypt_message(optiga_crypt_t * me,
+                                                        optiga_rsa_encryption_scheme_t encryption_scheme,
+                                                        const uint8_t * message, uint16_t message_length,
+                                                        const uint8_t * label, uint16_t label_length,
+                                                        uint8_t public_key_source_type, const void * public_key,
+                                                        uint8_t * encrypted_message,
+                                                        uint16_t * encrypted_message_length);
+optiga_lib_status_t optiga_crypt_rsa_decrypt_and_export(optiga_crypt_t * me,
+                                                        optiga_rsa_encryption_scheme_t encryption_scheme,
+                                                        const uint8_t * encrypted_message,
+                                                        uint16_t encrypted_message_length,
+                                                        const uint8_t * label, uint16_t label_length,
+                                                        optiga_key_id_t private_key, uint8_t * message,
+                                                        uint16_t * message_length);
+
+optiga_lib_status_t optiga_crypt_symmetric_encrypt(optiga_crypt_t * me,
+                                                    optiga_symmetric_encryption_mode_t encryption_mode,
+                                                    optiga_key_id_t symmetric_key_oid,
+                                                    const uint8_t * plain_data, uint32_t plain_data_length,
+                                                    const uint8_t * iv, uint16_t iv_length,
+                                                    const uint8_t * associated_data, uint16_t associated_data_length,
+                                                    uint8_t * encrypted_data, uint32_t * encrypted_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_decrypt(optiga_crypt_t * me,
+                                                    optiga_symmetric_encryption_mode_t encryption_mode,
+                                                    optiga_key_id_t symmetric_key_oid,
+                                                    const uint8_t * encrypted_data, uint32_t encrypted_data_length,
+                                                    const uint8_t * iv, uint16_t iv_length,
+                                                    const uint8_t * associated_data, uint16_t associated_data_length,
+                                                    uint8_t * plain_data, uint32_t * plain_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_start(optiga_crypt_t * me,
+                                                            optiga_symmetric_encryption_mode_t encryption_mode,
+                                                            optiga_key_id_t symmetric_key_oid,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            const uint8_t * iv, uint16_t iv_length,
+                                                            const uint8_t * associated_data,
+                                                            uint16_t associated_data_length,
+                                                            uint16_t total_plain_data_length,
+                                                            uint8_t * encrypted_data, uint32_t * encrypted_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_continue(optiga_crypt_t * me,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            uint8_t * encrypted_data, uint32_t * encrypted_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_final(optiga_crypt_t * me,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            uint8_t * encrypted_data, uint32_t * encrypted_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_start(optiga_crypt_t * me,
+                                                            optiga_symmetric_encryption_mode_t encryption_mode,
+                                                            optiga_key_id_t symmetric_key_oid,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            const uint8_t * iv, uint16_t iv_length,
+                                                            const uint8_t * associated_data,
+                                                            uint16_t associated_data_length,
+                                                            uint16_t total_encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_continue(optiga_crypt_t * me,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_final(optiga_crypt_t * me,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length);
+optiga_lib_status_t optiga_crypt_symmetric_generate_key(optiga_crypt_t * me,
+                                                        optiga_symmetric_key_type_t key_type,
+                                                        uint8_t key_usage, bool_t export_symmetric_key,
+                                                        void * symmetric_key);
+
+optiga_lib_status_t optiga_crypt_hmac(optiga_crypt_t * me, optiga_hmac_type_t type, uint16_t secret,
+                                        const uint8_t * input_data, uint32_t input_data_length,
+                                        uint8_t * mac, uint32_t * mac_length);
+optiga_lib_status_t optiga_crypt_hmac_start(optiga_crypt_t * me, optiga_hmac_type_t type, uint16_t secret,
+                                            const uint8_t * input_data, uint32_t input_data_length);
+optiga_lib_status_t optiga_crypt_hmac_update(optiga_crypt_t * me, const uint8_t * input_data,
+                                                uint32_t input_data_length);
+optiga_lib_status_t optiga_crypt_hmac_finalize(optiga_crypt_t * me, const uint8_t * input_data,
+                                                uint32_t input_data_length, uint8_t * mac, uint32_t * mac_length);
+optiga_lib_status_t optiga_crypt_hkdf(optiga_crypt_t * me, optiga_hkdf_type_t type, uint16_t secret,
+                                        const uint8_t * salt, uint16_t salt_length,
+                                        const uint8_t * info, uint16_t info_length,
+                                        uint16_t derived_key_length, bool_t export_to_host,
+                                        uint8_t * derived_key);
+
+#endif  // _OPTIGA_CRYPT_H_
@@ -0,0 +1,61 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _OPTIGA_UTIL_H_
+#define _OPTIGA_UTIL_H_
+
+#include "optiga/common/optiga_lib_common.h"
+
+// Emulator build only, see optiga_lib_common.h
+
+#define OPTIGA_UTIL_WRITE_ONLY                  (0x00)
+#define OPTIGA_UTIL_ERASE_AND_WRITE             (0x40)
+
+// The emulator keeps its state beside the instance, see trustm_emulator.h
+typedef struct optiga_util
+{
+    uint8_t instance_id;
+} optiga_util_t;
+
+#define OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(p_instance, protection_level) \
+    optiga_util_set_comms_params(p_instance, OPTIGA_COMMS_PROTECTION_LEVEL, protection_level)
+#define OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(p_instance, version) \
+    optiga_util_set_comms_params(p_instance, OPTIGA_COMMS_PROTOCOL_VERSION, version)
+
+optiga_util_t * optiga_util_create(uint8_t optiga_instance_id, callback_handler_t handler, void * caller_context);
+optiga_lib_status_t optiga_util_destroy(optiga_util_t * me);
+void optiga_util_set_comms_params(optiga_util_t * me, uint8_t parameter_type, uint8_t value);
+optiga_lib_status_t optiga_util_open_application(optiga_util_t * me, bool_t perform_restore);
+optiga_lib_status_t optiga_util_close_application(optiga_util_t * me, bool_t perform_hibernate);
+optiga_lib_status_t optiga_util_read_data(optiga_util_t * me, uint16_t optiga_oid, uint16_t offset,
+                                            uint8_t * buffer, uint16_t * length);
+optiga_lib_status_t optiga_util_read_metadata(optiga_util_t * me, uint16_t optiga_oid,
+                                                uint8_t * buffer, uint16_t * length);
+optiga_lib_status_t optiga_util_write_data(optiga_util_t * me, uint16_t optiga_oid, uint8_t write_type,
+                                            uint16_t offset, const uint8_t * buffer, uint16_t length);
+optiga_lib_status_t optiga_util_write_metadata(optiga_util_t * me, uint16_t optiga_oid,
+                                                const uint8_t * buffer, uint8_t length);
+optiga_lib_status_t optiga_util_update_count(optiga_util_t * me, uint16_t optiga_counter_oid, uint8_t count);
+
+#endif  // _OPTIGA_UTIL_H_
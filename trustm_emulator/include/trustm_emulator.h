@@ -0,0 +1,174 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_EMULATOR_H_
+#define _TRUSTM_EMULATOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "optiga/optiga_util.h"
+#include "optiga/optiga_crypt.h"
+
+// Software OPTIGA Trust M. Replaces the host library (optiga util/crypt,
+// comms and PAL) in the emulator build: every optiga_util_xxx and
+// optiga_crypt_xxx call used by the helper, the engine and the tools is
+// executed with OpenSSL against an object store file, and the completion
+// callback is delivered from a worker thread after a modelled command
+// latency. The store is mapped shared, so all processes on the host see
+// the same chip, and only one command is "on the bus" at a time. The
+// API is declared by the headers in include/optiga, trustm_lib is not used.
+//
+// Environment:
+//   TRUSTM_EMU_STORE    object store file [default TRUSTM_EMU_STORE_FILE]
+//   TRUSTM_EMU_LATENCY  comma separated <cmd>=<ms> overrides, see
+//                       trustm_emu_latency_name[]; also byte=<us> per byte
+//                       transferred, sec=<ms> per security event count and
+//                       scale=<factor> applied to the total (0 : no delay)
+
+//#define TRUSTM_EMU_DEBUG
+
+#ifdef TRUSTM_EMU_DEBUG
+#define TRUSTM_EMU_DBGFN(x, ...)    fprintf(stderr, "%d:%s:%d %s: " x "\n", getpid(),__FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+#else
+#define TRUSTM_EMU_DBGFN(x, ...)
+#endif
+#define TRUSTM_EMU_ERRFN(x, ...)    fprintf(stderr, "%d:Error in %s:%d %s: " x "\n",getpid(), __FILE__, __LINE__, __FUNCTION__, ##__VA_ARGS__)
+
+#define TRUSTM_EMU_STORE_FILE       "/tmp/trustm_emu.store"
+#define TRUSTM_EMU_STORE_MAGIC      0x544D4531  // "TME1", bump on layout change
+
+// Hibernate context files, same names the Linux PAL datastore uses
+#define TRUSTM_EMU_CTX_FILENAME             ".trustm_ctx"
+#define TRUSTM_EMU_HIBERNATE_CTX_FILENAME   ".trustm_hibernate_ctx"
+
+#define TRUSTM_EMU_MAX_OBJECTS      64
+#define TRUSTM_EMU_DATA_SIZE        1728
+#define TRUSTM_EMU_METADATA_SIZE    44
+#define TRUSTM_EMU_MAX_INSTANCES    16
+
+// Device error codes returned through the callback, see trustmPrintErrorCode()
+#define TRUSTM_EMU_ERR_INVALID_OID      (OPTIGA_DEVICE_ERROR | 0x01)
+#define TRUSTM_EMU_ERR_INVALID_PARAM    (OPTIGA_DEVICE_ERROR | 0x03)
+#define TRUSTM_EMU_ERR_INVALID_LENGTH   (OPTIGA_DEVICE_ERROR | 0x04)
+#define TRUSTM_EMU_ERR_INVALID_DATA     (OPTIGA_DEVICE_ERROR | 0x05)
+#define TRUSTM_EMU_ERR_INTERNAL         (OPTIGA_DEVICE_ERROR | 0x06)
+#define TRUSTM_EMU_ERR_ACCESS           (OPTIGA_DEVICE_ERROR | 0x07)
+#define TRUSTM_EMU_ERR_BOUNDARY         (OPTIGA_DEVICE_ERROR | 0x08)
+#define TRUSTM_EMU_ERR_SEQUENCE         (OPTIGA_DEVICE_ERROR | 0x0B)
+#define TRUSTM_EMU_ERR_NOT_AVAILABLE    (OPTIGA_DEVICE_ERROR | 0x0C)
+#define TRUSTM_EMU_ERR_COUNTER          (OPTIGA_DEVICE_ERROR | 0x0E)
+#define TRUSTM_EMU_ERR_VERIFY           (OPTIGA_DEVICE_ERROR | 0x2C)
+#define TRUSTM_EMU_ERR_DECRYPT          (OPTIGA_DEVICE_ERROR | 0x2E)
+
+// Commands of the latency model
+typedef enum trustm_emu_cmd
+{
+    TRUSTM_EMU_CMD_OPEN = 0,
+    TRUSTM_EMU_CMD_CLOSE,
+    TRUSTM_EMU_CMD_READ,
+    TRUSTM_EMU_CMD_WRITE,
+    TRUSTM_EMU_CMD_READ_META,
+    TRUSTM_EMU_CMD_WRITE_META,
+    TRUSTM_EMU_CMD_COUNT,
+    TRUSTM_EMU_CMD_RANDOM,
+    TRUSTM_EMU_CMD_HASH,
+    TRUSTM_EMU_CMD_ECC_KEYGEN,
+    TRUSTM_EMU_CMD_ECDSA_SIGN,
+    TRUSTM_EMU_CMD_ECDSA_VERIFY,
+    TRUSTM_EMU_CMD_RSA_KEYGEN,
+    TRUSTM_EMU_CMD_RSA_SIGN,
+    TRUSTM_EMU_CMD_RSA_VERIFY,
+    TRUSTM_EMU_CMD_RSA_ENC,
+    TRUSTM_EMU_CMD_RSA_DEC,
+    TRUSTM_EMU_CMD_SYM_KEYGEN,
+    TRUSTM_EMU_CMD_SYMMETRIC,
+    TRUSTM_EMU_CMD_HMAC,
+    TRUSTM_EMU_CMD_HKDF,
+    TRUSTM_EMU_CMD_MAX
+} trustm_emu_cmd_t;
+
+typedef struct trustm_emu_object_str
+{
+    uint16_t oid;           // 0 : free entry
+    uint16_t len;
+    uint16_t metaLen;       // 0 : default metadata
+    uint8_t  meta[TRUSTM_EMU_METADATA_SIZE];
+    uint8_t  data[TRUSTM_EMU_DATA_SIZE];
+} trustm_emu_object_t;
+
+typedef struct trustm_emu_store_str
+{
+    uint32_t            magic;
+    pthread_mutex_t     lock;   // protects all fields below
+    pthread_mutex_t     bus;    // held while a command is executing
+    uint8_t             sec;    // security event counter
+    uint64_t            secStamp;   // last decrement, ms since epoch
+    uint64_t            commands;
+    trustm_emu_object_t obj[TRUSTM_EMU_MAX_OBJECTS];
+} trustm_emu_store_t;
+
+// State of an optiga_util / optiga_crypt instance, kept beside the library
+// structure so the emulator does not depend on its layout
+typedef struct trustm_emu_instance_str
+{
+    void                *me;    // NULL : free entry
+    callback_handler_t  handler;
+    void                *context;
+    uint8_t             crypt;  // optiga_crypt instance
+    uint8_t             busy;
+    // Sequence state of start/continue/final commands
+    uint8_t             symMode;
+    uint8_t             symEncrypt;
+    void                *symCtx;
+    uint8_t             symBlock[16];   // last CBC-MAC block
+    void                *hmacCtx;
+} trustm_emu_instance_t;
+
+// Function Prototype
+
+trustm_emu_store_t *trustm_emu_lock(void);
+void trustm_emu_unlock(void);
+trustm_emu_object_t *trustm_emu_object(trustm_emu_store_t *store, uint16_t oid, uint8_t create);
+uint16_t trustm_emu_object_size(uint16_t oid);
+uint8_t trustm_emu_is_key(uint16_t oid);
+uint16_t trustm_emu_metadata(trustm_emu_object_t *obj, uint16_t oid, uint8_t *buf);
+uint16_t trustm_emu_write_metadata(trustm_emu_object_t *obj, uint16_t oid, const uint8_t *buf, uint8_t len);
+int trustm_emu_metadata_tag(const uint8_t *meta, uint16_t len, uint8_t tag, uint8_t *value);
+uint16_t trustm_emu_metadata_set(uint8_t *meta, uint16_t len, uint16_t max,
+                                uint8_t tag, const uint8_t *value, uint8_t valueLen);
+void trustm_emu_security_event(trustm_emu_store_t *store);
+int trustm_emu_random(uint8_t *buf, size_t len);
+
+void *trustm_emu_instance_new(size_t size, uint8_t crypt, callback_handler_t handler, void *context);
+trustm_emu_instance_t *trustm_emu_instance(void *me);
+optiga_lib_status_t trustm_emu_instance_free(void *me);
+optiga_lib_status_t trustm_emu_begin(void *me, uint8_t crypt, trustm_emu_instance_t **inst);
+void trustm_emu_complete(trustm_emu_instance_t *inst, trustm_emu_cmd_t cmd,
+                            uint32_t bytes, optiga_lib_status_t status);
+void trustm_emu_set_open(uint8_t open);
+uint8_t trustm_emu_opened(void);
+void trustm_emu_provision(trustm_emu_store_t *store);
+
+#endif  // _TRUSTM_EMULATOR_H_
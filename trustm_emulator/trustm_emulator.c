@@ -0,0 +1,812 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "optiga/pal/pal_gpio.h"
+#include "optiga/pal/pal_ifx_i2c_config.h"
+#include "optiga/pal/pal_os_timer.h"
+
+#include "trustm_emulator.h"
+#include "trustm_helper_trace.h"
+#include "trustm_helper_shm.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+// Default command latency in us, roughly the OPTIGA Trust M datasheet
+// figures at 400 kHz I2C
+static const char *trustm_emu_latency_name[TRUSTM_EMU_CMD_MAX] = {
+    "open", "close", "read", "write", "readmeta", "writemeta", "count",
+    "random", "hash", "ecckeygen", "ecdsasign", "ecdsaverify",
+    "rsakeygen", "rsasign", "rsaverify", "rsaenc", "rsadec",
+    "symkeygen", "symmetric", "hmac", "hkdf"
+};
+
+static uint32_t trustm_emu_latency[TRUSTM_EMU_CMD_MAX] = {
+    10000, 5000, 3000, 6000, 3000, 6000, 5000,
+    4000, 3000, 25000, 18000, 30000,
+    1500000, 80000, 15000, 15000, 80000,
+    10000, 4000, 6000, 12000
+};
+
+// Transfer time per APDU byte, us
+static uint32_t trustm_emu_byte_us = 25;
+// Extra delay per security event count, us
+static uint32_t trustm_emu_sec_us = 0;
+static double trustm_emu_scale = 1.0;
+
+// Security event counter decrement period
+#define TRUSTM_EMU_SEC_DECAY_MS     1000
+
+static trustm_emu_store_t *emu_store = NULL;
+static pthread_mutex_t emu_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static trustm_emu_instance_t emu_instance[TRUSTM_EMU_MAX_INSTANCES];
+static pthread_mutex_t emu_instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t emu_open = 0;
+static pthread_mutex_t emu_open_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Completions waiting for the worker thread
+typedef struct trustm_emu_job_str
+{
+    struct trustm_emu_job_str *next;
+    trustm_emu_instance_t *inst;
+    callback_handler_t handler;
+    void *context;
+    optiga_lib_status_t status;
+    uint32_t delay;         // us
+    trustm_emu_cmd_t cmd;
+    uint32_t bytes;
+} trustm_emu_job_t;
+
+static trustm_emu_job_t *emu_job_head = NULL;
+static trustm_emu_job_t *emu_job_tail = NULL;
+static pthread_mutex_t emu_job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t emu_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t emu_worker_once = PTHREAD_ONCE_INIT;
+
+// PAL symbols the helper uses directly
+pal_gpio_t optiga_reset_0;
+pal_gpio_t optiga_vdd_0;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+static uint64_t __emu_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**********************************************************************
+* __emu_latency_init()
+* Applies the TRUSTM_EMU_LATENCY overrides.
+**********************************************************************/
+static void __emu_latency_init(void)
+{
+    char *env, *item, *save, *value;
+    double ms;
+    int i;
+
+    if (getenv("TRUSTM_EMU_LATENCY") == NULL)
+        return;
+    env = strdup(getenv("TRUSTM_EMU_LATENCY"));
+    if (env == NULL)
+        return;
+
+    for (item = strtok_r(env, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        value = strchr(item, '=');
+        if (value == NULL)
+        {
+            TRUSTM_EMU_ERRFN("Invalid latency setting : %s", item);
+            continue;
+        }
+        *value++ = '\0';
+        ms = strtod(value, NULL);
+        if (ms < 0)
+            ms = 0;
+
+        if (strcmp(item, "scale") == 0)
+        {
+            trustm_emu_scale = ms;
+            continue;
+        }
+        if (strcmp(item, "byte") == 0)
+        {
+            trustm_emu_byte_us = (uint32_t)ms;
+            continue;
+        }
+        if (strcmp(item, "sec") == 0)
+        {
+            trustm_emu_sec_us = (uint32_t)(ms * 1000);
+            continue;
+        }
+        for (i = 0; i < TRUSTM_EMU_CMD_MAX; i++)
+        {
+            if (strcmp(item, trustm_emu_latency_name[i]) == 0)
+            {
+                trustm_emu_latency[i] = (uint32_t)(ms * 1000);
+                break;
+            }
+        }
+        if (i == TRUSTM_EMU_CMD_MAX)
+            TRUSTM_EMU_ERRFN("Unknown command : %s", item);
+    }
+    free(env);
+}
+
+/**********************************************************************
+* __emu_store_setup()
+* Provisions a new store
+**********************************************************************/
+static void __emu_store_setup(void *shm)
+{
+    trustm_emu_store_t *store = shm;
+
+    trustm_shm_mutex_init(&store->lock);
+    trustm_shm_mutex_init(&store->bus);
+    store->secStamp = __emu_now_ms();
+    trustm_emu_provision(store);
+}
+
+/**********************************************************************
+* __emu_store_init()
+* Maps the object store, creating and provisioning it if this is the
+* first user.
+**********************************************************************/
+static trustm_emu_store_t *__emu_store_init(void)
+{
+    trustm_emu_store_t *store;
+    const char *path;
+
+    if (__atomic_load_n(&emu_store, __ATOMIC_ACQUIRE) != NULL)
+        return emu_store;
+
+    pthread_mutex_lock(&emu_init_mutex);
+    if (emu_store == NULL)
+    {
+        __emu_latency_init();
+
+        path = getenv("TRUSTM_EMU_STORE");
+        if (path == NULL)
+            path = TRUSTM_EMU_STORE_FILE;
+
+        store = trustm_shm_map_file(path, sizeof(trustm_emu_store_t), 0666,
+                                    TRUSTM_EMU_STORE_MAGIC, __emu_store_setup);
+        if (store != NULL)
+            __atomic_store_n(&emu_store, store, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&emu_init_mutex);
+
+    return emu_store;
+}
+
+static void __emu_mutex_lock(pthread_mutex_t *mutex)
+{
+    if (pthread_mutex_lock(mutex) == EOWNERDEAD)
+    {
+        // A process died inside a command, the objects it wrote are
+        // complete as they are only updated once the command succeeded
+        TRUSTM_EMU_DBGFN("Lock owner died");
+        pthread_mutex_consistent(mutex);
+    }
+}
+
+/**********************************************************************
+* __emu_sec_decay()
+* Store lock must be held
+**********************************************************************/
+static void __emu_sec_decay(trustm_emu_store_t *store)
+{
+    uint64_t now = __emu_now_ms();
+    uint64_t steps;
+
+    if (now < store->secStamp)
+        store->secStamp = now;
+    steps = (now - store->secStamp) / TRUSTM_EMU_SEC_DECAY_MS;
+    if (steps == 0)
+        return;
+    store->sec = (steps >= store->sec) ? 0 : (uint8_t)(store->sec - steps);
+    store->secStamp += steps * TRUSTM_EMU_SEC_DECAY_MS;
+}
+
+/**********************************************************************
+* trustm_emu_lock() / trustm_emu_unlock()
+* Returns the locked store, NULL if it cannot be mapped.
+**********************************************************************/
+trustm_emu_store_t *trustm_emu_lock(void)
+{
+    trustm_emu_store_t *store = __emu_store_init();
+
+    if (store == NULL)
+        return NULL;
+    __emu_mutex_lock(&store->lock);
+    __emu_sec_decay(store);
+    return store;
+}
+
+void trustm_emu_unlock(void)
+{
+    pthread_mutex_unlock(&emu_store->lock);
+}
+
+/**********************************************************************
+* trustm_emu_security_event()
+* Store lock must be held
+**********************************************************************/
+void trustm_emu_security_event(trustm_emu_store_t *store)
+{
+    if (store->sec == 0)
+        store->secStamp = __emu_now_ms();
+    if (store->sec < 0xFF)
+        store->sec++;
+}
+
+/**********************************************************************
+* trustm_emu_object_size()
+* Returns the maximum data size of oid, 0 for an unknown OID.
+**********************************************************************/
+uint16_t trustm_emu_object_size(uint16_t oid)
+{
+    if (trustm_emu_is_key(oid))
+        return TRUSTM_EMU_DATA_SIZE;
+    if (oid == 0xE0C2)                          // Coprocessor UID
+        return 27;
+    if (oid == 0xE0C6)                          // Max comms buffer size
+        return 2;
+    if ((oid >= 0xE0C0) && (oid <= 0xE0C5))     // Lifecycle, status, SEC
+        return 1;
+    if ((oid >= 0xE0E0) && (oid <= 0xE0E3))     // Certificates
+        return 1728;
+    if ((oid == 0xE0E8) || (oid == 0xE0E9) || (oid == 0xE0EF))
+        return 1024;
+    if ((oid >= 0xE120) && (oid <= 0xE123))     // Monotonic counters
+        return 8;
+    if (oid == 0xE140)                          // Platform binding secret
+        return 64;
+    if ((oid >= 0xF1C0) && (oid <= 0xF1C2))
+        return 1;
+    if ((oid >= 0xF1D0) && (oid <= 0xF1DB))
+        return 140;
+    if ((oid == 0xF1E0) || (oid == 0xF1E1))
+        return 1500;
+    return 0;
+}
+
+uint8_t trustm_emu_is_key(uint16_t oid)
+{
+    return (((oid >= 0xE0F0) && (oid <= 0xE0F3)) ||
+            ((oid >= 0xE0FC) && (oid <= 0xE0FD)) ||
+            ((oid >= 0xE100) && (oid <= 0xE103)) ||
+            (oid == 0xE200));
+}
+
+/**********************************************************************
+* trustm_emu_object()
+* Returns the entry of oid, allocating a free entry when create is set.
+* Store lock must be held.
+**********************************************************************/
+trustm_emu_object_t *trustm_emu_object(trustm_emu_store_t *store, uint16_t oid, uint8_t create)
+{
+    trustm_emu_object_t *free_obj = NULL;
+    int i;
+
+    for (i = 0; i < TRUSTM_EMU_MAX_OBJECTS; i++)
+    {
+        if (store->obj[i].oid == oid)
+            return &store->obj[i];
+        if ((free_obj == NULL) && (store->obj[i].oid == 0))
+            free_obj = &store->obj[i];
+    }
+    if ((create == 0) || (free_obj == NULL))
+        return NULL;
+
+    memset(free_obj, 0, sizeof(trustm_emu_object_t));
+    free_obj->oid = oid;
+    return free_obj;
+}
+
+/**********************************************************************
+* trustm_emu_metadata_tag()
+* Finds tag in a metadata TLV list, without the 0x20 header. Copies the
+* value to value (may be NULL) and returns its length, -1 if not found.
+**********************************************************************/
+int trustm_emu_metadata_tag(const uint8_t *meta, uint16_t len, uint8_t tag, uint8_t *value)
+{
+    uint16_t i = 0;
+
+    while ((i + 2) <= len)
+    {
+        if ((i + 2 + meta[i+1]) > len)
+            break;
+        if (meta[i] == tag)
+        {
+            if (value != NULL)
+                memcpy(value, meta+i+2, meta[i+1]);
+            return meta[i+1];
+        }
+        i += 2 + meta[i+1];
+    }
+    return -1;
+}
+
+/**********************************************************************
+* trustm_emu_metadata_set()
+* Adds or replaces tag in a TLV list. Returns the new length, 0 if it
+* does not fit in max.
+**********************************************************************/
+uint16_t trustm_emu_metadata_set(uint8_t *meta, uint16_t len, uint16_t max,
+                                uint8_t tag, const uint8_t *value, uint8_t valueLen)
+{
+    uint16_t i = 0;
+    uint16_t entry;
+
+    while (((i + 2) <= len) && ((i + 2 + meta[i+1]) <= len))
+    {
+        entry = 2 + meta[i+1];
+        if (meta[i] == tag)
+        {
+            // Remove the old entry, the new one is appended
+            memmove(meta+i, meta+i+entry, len-(i+entry));
+            len -= entry;
+            break;
+        }
+        i += entry;
+    }
+    if ((len + 2 + valueLen) > max)
+        return 0;
+    meta[len] = tag;
+    meta[len+1] = valueLen;
+    memcpy(meta+len+2, value, valueLen);
+    return len + 2 + valueLen;
+}
+
+/**********************************************************************
+* trustm_emu_metadata()
+* Builds the metadata of oid, 0x20 header included, into buf. buf must
+* hold 2*TRUSTM_EMU_METADATA_SIZE bytes. obj may be NULL for an object
+* never written. Returns the length.
+**********************************************************************/
+uint16_t trustm_emu_metadata(trustm_emu_object_t *obj, uint16_t oid, uint8_t *buf)
+{
+    const uint16_t max = (2 * TRUSTM_EMU_METADATA_SIZE) - 2;
+    uint8_t *meta = buf + 2;
+    uint16_t len = 0;
+    uint16_t size;
+    uint16_t i;
+    uint8_t value[2];
+
+    value[0] = ((oid >= 0xE0C0) && (oid <= 0xE0C6)) ? 0x07 : 0x01;
+    len = trustm_emu_metadata_set(meta, len, max, 0xC0, value, 1);   // LcsO
+    if (!trustm_emu_is_key(oid))
+    {
+        size = trustm_emu_object_size(oid);
+        value[0] = size >> 8;
+        value[1] = size & 0xFF;
+        len = trustm_emu_metadata_set(meta, len, max, 0xC4, value, 2);   // Max size
+        size = (obj != NULL) ? obj->len : 0;
+        if ((oid == 0xE0C5) || (oid == 0xE0C2) || (oid == 0xE0C0))
+            size = trustm_emu_object_size(oid);
+        value[0] = size >> 8;
+        value[1] = size & 0xFF;
+        len = trustm_emu_metadata_set(meta, len, max, 0xC5, value, 2);   // Used size
+    }
+    // Change: NEV for the device owned objects, ALW otherwise
+    value[0] = ((oid == 0xE0C2) || (oid == 0xE0C5) || (oid == 0xE0C6) ||
+                (oid == 0xE0C0)) ? 0xFF : 0x00;
+    len = trustm_emu_metadata_set(meta, len, max, 0xD0, value, 1);
+    // Read: NEV for keys
+    value[0] = trustm_emu_is_key(oid) ? 0xFF : 0x00;
+    len = trustm_emu_metadata_set(meta, len, max, 0xD1, value, 1);
+    value[0] = 0x00;
+    len = trustm_emu_metadata_set(meta, len, max, 0xD3, value, 1);   // Execute
+
+    // Written metadata overrides the defaults
+    i = 0;
+    while ((obj != NULL) && ((i + 2) <= obj->metaLen))
+    {
+        len = trustm_emu_metadata_set(meta, len, max, obj->meta[i], obj->meta+i+2, obj->meta[i+1]);
+        i += 2 + obj->meta[i+1];
+    }
+
+    buf[0] = 0x20;
+    buf[1] = (uint8_t)len;
+    return len + 2;
+}
+
+/**********************************************************************
+* trustm_emu_write_metadata()
+* Merges buf (0x20 header included) into the written metadata of obj.
+* Store lock must be held.
+**********************************************************************/
+uint16_t trustm_emu_write_metadata(trustm_emu_object_t *obj, uint16_t oid, const uint8_t *buf, uint8_t len)
+{
+    uint8_t current[2 * TRUSTM_EMU_METADATA_SIZE];
+    uint8_t meta[TRUSTM_EMU_METADATA_SIZE];
+    uint16_t metaLen;
+    uint16_t currentLen;
+    uint8_t lcs = 0;
+    uint16_t i;
+
+    if ((len < 2) || (buf[0] != 0x20) || (buf[1] != (len - 2)))
+        return TRUSTM_EMU_ERR_INVALID_DATA;
+
+    // Metadata is frozen once the object is operational
+    currentLen = trustm_emu_metadata(obj, oid, current);
+    trustm_emu_metadata_tag(current+2, currentLen-2, 0xC0, &lcs);
+    if (lcs >= 0x07)
+        return TRUSTM_EMU_ERR_ACCESS;
+
+    memcpy(meta, obj->meta, obj->metaLen);
+    metaLen = obj->metaLen;
+    for (i = 2; i < len; i += 2 + buf[i+1])
+    {
+        if (((i + 2) > len) || ((i + 2 + buf[i+1]) > len))
+            return TRUSTM_EMU_ERR_INVALID_DATA;
+        // Sizes are not writable and the lifecycle only goes forward
+        if ((buf[i] == 0xC4) || (buf[i] == 0xC5))
+            return TRUSTM_EMU_ERR_INVALID_DATA;
+        if ((buf[i] == 0xC0) && ((buf[i+1] != 1) || (buf[i+2] < lcs)))
+            return TRUSTM_EMU_ERR_INVALID_DATA;
+        metaLen = trustm_emu_metadata_set(meta, metaLen, sizeof(meta), buf[i], buf+i+2, buf[i+1]);
+        if (metaLen == 0)
+            return TRUSTM_EMU_ERR_INVALID_LENGTH;
+    }
+
+    memcpy(obj->meta, meta, metaLen);
+    obj->metaLen = metaLen;
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* trustm_emu_set_open() / trustm_emu_opened()
+* Application state of this process, commands other than open
+* application fail while it is closed.
+**********************************************************************/
+void trustm_emu_set_open(uint8_t open)
+{
+    pthread_mutex_lock(&emu_open_mutex);
+    emu_open = open;
+    pthread_mutex_unlock(&emu_open_mutex);
+}
+
+uint8_t trustm_emu_opened(void)
+{
+    uint8_t open;
+
+    pthread_mutex_lock(&emu_open_mutex);
+    open = emu_open;
+    pthread_mutex_unlock(&emu_open_mutex);
+    return open;
+}
+
+/**********************************************************************
+* __emu_worker()
+* Delivers the completions in order once the modelled command time has
+* passed on the bus shared by all processes.
+**********************************************************************/
+static void *__emu_worker(void *arg)
+{
+    trustm_emu_job_t *job;
+    struct timespec ts;
+    uint64_t start;
+
+    (void)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&emu_job_mutex);
+        while (emu_job_head == NULL)
+            pthread_cond_wait(&emu_job_cond, &emu_job_mutex);
+        job = emu_job_head;
+        emu_job_head = job->next;
+        if (emu_job_head == NULL)
+            emu_job_tail = NULL;
+        pthread_mutex_unlock(&emu_job_mutex);
+
+        if (job->delay != 0)
+        {
+            __emu_mutex_lock(&emu_store->bus);
+            start = trustm_trace_clock();
+            ts.tv_sec = job->delay / 1000000;
+            ts.tv_nsec = (long)(job->delay % 1000000) * 1000;
+            while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR))
+                ;
+            pthread_mutex_unlock(&emu_store->bus);
+            // The command on the bus, in place of the APDU of the host library
+            trustm_trace_span(TRUSTM_TRACE_APDU, trustm_emu_latency_name[job->cmd], start, 0,
+                                0, (job->bytes > 0xFFFF) ? 0xFFFF : job->bytes, job->status);
+        }
+
+        pthread_mutex_lock(&emu_instance_mutex);
+        job->inst->busy = 0;
+        pthread_mutex_unlock(&emu_instance_mutex);
+        if (job->handler != NULL)
+            job->handler(job->context, job->status);
+        free(job);
+    }
+    return NULL;
+}
+
+static void __emu_atfork_child(void);
+
+static void __emu_atfork_register(void)
+{
+    pthread_atfork(NULL, NULL, __emu_atfork_child);
+}
+
+static void __emu_worker_start(void)
+{
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, __emu_worker, NULL) == 0)
+        pthread_detach(thread);
+    else
+        TRUSTM_EMU_ERRFN("Cannot start worker : %s", strerror(errno));
+}
+
+/**********************************************************************
+* __emu_atfork_child()
+* The worker does not survive fork, the child starts its own with its
+* first command.
+**********************************************************************/
+static void __emu_atfork_child(void)
+{
+    pthread_once_t once = PTHREAD_ONCE_INIT;
+    int i;
+
+    emu_worker_once = once;
+    emu_job_head = NULL;
+    emu_job_tail = NULL;
+    pthread_mutex_init(&emu_job_mutex, NULL);
+    pthread_cond_init(&emu_job_cond, NULL);
+    pthread_mutex_init(&emu_instance_mutex, NULL);
+    // Completions pending in the parent are never delivered here
+    for (i = 0; i < TRUSTM_EMU_MAX_INSTANCES; i++)
+        emu_instance[i].busy = 0;
+}
+
+/**********************************************************************
+* trustm_emu_instance_new()
+* Allocates a util (crypt = 0) or crypt instance of size bytes.
+**********************************************************************/
+void *trustm_emu_instance_new(size_t size, uint8_t crypt, callback_handler_t handler, void *context)
+{
+    static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+    void *me;
+    int i;
+
+    if (__emu_store_init() == NULL)
+        return NULL;
+    pthread_once(&atfork_once, __emu_atfork_register);
+
+    me = calloc(1, size);
+    if (me == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&emu_instance_mutex);
+    for (i = 0; i < TRUSTM_EMU_MAX_INSTANCES; i++)
+    {
+        if (emu_instance[i].me == NULL)
+        {
+            memset(&emu_instance[i], 0, sizeof(trustm_emu_instance_t));
+            emu_instance[i].me = me;
+            emu_instance[i].crypt = crypt;
+            emu_instance[i].handler = handler;
+            emu_instance[i].context = context;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_instance_mutex);
+
+    if (i == TRUSTM_EMU_MAX_INSTANCES)
+    {
+        TRUSTM_EMU_ERRFN("Too many instances");
+        free(me);
+        return NULL;
+    }
+    return me;
+}
+
+/**********************************************************************
+* trustm_emu_instance()
+* Returns the emulator state of a library instance, NULL if unknown.
+**********************************************************************/
+trustm_emu_instance_t *trustm_emu_instance(void *me)
+{
+    trustm_emu_instance_t *inst = NULL;
+    int i;
+
+    if (me == NULL)
+        return NULL;
+    pthread_mutex_lock(&emu_instance_mutex);
+    for (i = 0; i < TRUSTM_EMU_MAX_INSTANCES; i++)
+    {
+        if (emu_instance[i].me == me)
+        {
+            inst = &emu_instance[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu_instance_mutex);
+    return inst;
+}
+
+/**********************************************************************
+* trustm_emu_instance_free()
+* Sequence contexts must have been released by the caller.
+**********************************************************************/
+optiga_lib_status_t trustm_emu_instance_free(void *me)
+{
+    trustm_emu_instance_t *inst = trustm_emu_instance(me);
+
+    if (inst == NULL)
+        return OPTIGA_LIB_SUCCESS;
+
+    pthread_mutex_lock(&emu_instance_mutex);
+    if (inst->busy)
+    {
+        pthread_mutex_unlock(&emu_instance_mutex);
+        return inst->crypt ? OPTIGA_CRYPT_ERROR_INSTANCE_IN_USE : OPTIGA_UTIL_ERROR_INSTANCE_IN_USE;
+    }
+    memset(inst, 0, sizeof(trustm_emu_instance_t));
+    pthread_mutex_unlock(&emu_instance_mutex);
+    free(me);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* trustm_emu_begin()
+* Marks the instance busy until the completion is delivered.
+**********************************************************************/
+optiga_lib_status_t trustm_emu_begin(void *me, uint8_t crypt, trustm_emu_instance_t **inst)
+{
+    *inst = trustm_emu_instance(me);
+    if (*inst == NULL)
+        return crypt ? OPTIGA_CRYPT_ERROR_INVALID_INPUT : OPTIGA_UTIL_ERROR_INVALID_INPUT;
+
+    pthread_mutex_lock(&emu_instance_mutex);
+    if ((*inst)->busy)
+    {
+        pthread_mutex_unlock(&emu_instance_mutex);
+        return crypt ? OPTIGA_CRYPT_ERROR_INSTANCE_IN_USE : OPTIGA_UTIL_ERROR_INSTANCE_IN_USE;
+    }
+    (*inst)->busy = 1;
+    pthread_mutex_unlock(&emu_instance_mutex);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* trustm_emu_complete()
+* Queues the completion of a command. bytes is the APDU payload sent
+* and received, for the transfer part of the latency.
+**********************************************************************/
+void trustm_emu_complete(trustm_emu_instance_t *inst, trustm_emu_cmd_t cmd,
+                            uint32_t bytes, optiga_lib_status_t status)
+{
+    trustm_emu_job_t *job;
+    double delay;
+
+    __atomic_add_fetch(&emu_store->commands, 1, __ATOMIC_RELAXED);
+
+    delay = (double)trustm_emu_latency[cmd] + ((double)bytes * trustm_emu_byte_us) +
+            ((double)__atomic_load_n(&emu_store->sec, __ATOMIC_RELAXED) * trustm_emu_sec_us);
+    delay *= trustm_emu_scale;
+
+    job = malloc(sizeof(trustm_emu_job_t));
+    if (job == NULL)
+    {
+        // Deliver in the caller context rather than lose the completion
+        pthread_mutex_lock(&emu_instance_mutex);
+        inst->busy = 0;
+        pthread_mutex_unlock(&emu_instance_mutex);
+        if (inst->handler != NULL)
+            inst->handler(inst->context, status);
+        return;
+    }
+    job->next = NULL;
+    job->inst = inst;
+    job->handler = inst->handler;
+    job->context = inst->context;
+    job->status = status;
+    job->cmd = cmd;
+    job->bytes = bytes;
+    job->delay = (delay > 4000000000.0) ? 4000000000U : (uint32_t)delay;
+
+    pthread_once(&emu_worker_once, __emu_worker_start);
+    pthread_mutex_lock(&emu_job_mutex);
+    if (emu_job_tail != NULL)
+        emu_job_tail->next = job;
+    else
+        emu_job_head = job;
+    emu_job_tail = job;
+    pthread_cond_signal(&emu_job_cond);
+    pthread_mutex_unlock(&emu_job_mutex);
+}
+
+/*************************************************************************
+*  PAL
+*************************************************************************/
+pal_status_t pal_gpio_init(const pal_gpio_t * p_gpio_context)
+{
+    (void)p_gpio_context;
+    return PAL_STATUS_SUCCESS;
+}
+
+pal_status_t pal_gpio_deinit(const pal_gpio_t * p_gpio_context)
+{
+    (void)p_gpio_context;
+    return PAL_STATUS_SUCCESS;
+}
+
+uint32_t pal_os_timer_get_time_in_milliseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+void pal_os_timer_delay_in_milliseconds(uint16_t milliseconds)
+{
+    usleep((useconds_t)milliseconds * 1000);
+}
+
+/**********************************************************************
+* trustm_emu_random()
+* Random bytes from the kernel. Not RAND_bytes(): with the engine as the
+* default OpenSSL RAND that would call back into the emulated chip from
+* inside a command.
+**********************************************************************/
+int trustm_emu_random(uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = getrandom(buf, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            TRUSTM_EMU_ERRFN("getrandom : %s", strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
@@ -0,0 +1,1927 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/kdf.h>
+#include <openssl/x509.h>
+#include <openssl/objects.h>
+
+#include "trustm_emulator.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+// Position of a command in a start/continue/final sequence
+#define EMU_SEQ_ONESHOT     0
+#define EMU_SEQ_START       1
+#define EMU_SEQ_CONTINUE    2
+#define EMU_SEQ_FINAL       3
+
+#define EMU_AES_BLOCK       16
+#define EMU_HASH_MAGIC      0x544D4843  // "TMHC"
+
+// Hash context kept in the caller's context buffer
+typedef struct emu_hash_ctx_str
+{
+    uint32_t    magic;
+    EVP_MD_CTX  *md;
+} emu_hash_ctx_t;
+
+// AlgorithmIdentifier parts of the public keys exchanged with the host,
+// which only carries the subjectPublicKey BIT STRING
+static const uint8_t emu_oid_ecpubkey[] = {0x06,0x07,0x2A,0x86,0x48,0xCE,0x3D,0x02,0x01};
+static const uint8_t emu_oid_rsa[] = {0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,0x01,0x05,0x00};
+static const uint8_t emu_oid_p256[] = {0x06,0x08,0x2A,0x86,0x48,0xCE,0x3D,0x03,0x01,0x07};
+static const uint8_t emu_oid_p384[] = {0x06,0x05,0x2B,0x81,0x04,0x00,0x22};
+static const uint8_t emu_oid_p521[] = {0x06,0x05,0x2B,0x81,0x04,0x00,0x23};
+static const uint8_t emu_oid_bp256[] = {0x06,0x09,0x2B,0x24,0x03,0x03,0x02,0x08,0x01,0x01,0x07};
+static const uint8_t emu_oid_bp384[] = {0x06,0x09,0x2B,0x24,0x03,0x03,0x02,0x08,0x01,0x01,0x0B};
+static const uint8_t emu_oid_bp512[] = {0x06,0x09,0x2B,0x24,0x03,0x03,0x02,0x08,0x01,0x01,0x0D};
+
+typedef struct emu_curve_str
+{
+    uint8_t         curve;
+    int             nid;
+    const uint8_t   *oid;
+    uint8_t         oidLen;
+} emu_curve_t;
+
+static const emu_curve_t emu_curve[] = {
+    {OPTIGA_ECC_CURVE_NIST_P_256, NID_X9_62_prime256v1, emu_oid_p256, sizeof(emu_oid_p256)},
+    {OPTIGA_ECC_CURVE_NIST_P_384, NID_secp384r1, emu_oid_p384, sizeof(emu_oid_p384)},
+    {OPTIGA_ECC_CURVE_NIST_P_521, NID_secp521r1, emu_oid_p521, sizeof(emu_oid_p521)},
+    {OPTIGA_ECC_CURVE_BRAIN_POOL_P_256R1, NID_brainpoolP256r1, emu_oid_bp256, sizeof(emu_oid_bp256)},
+    {OPTIGA_ECC_CURVE_BRAIN_POOL_P_384R1, NID_brainpoolP384r1, emu_oid_bp384, sizeof(emu_oid_bp384)},
+    {OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1, NID_brainpoolP512r1, emu_oid_bp512, sizeof(emu_oid_bp512)},
+};
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+static const emu_curve_t *__emu_curve(uint8_t curve)
+{
+    uint16_t i;
+
+    for (i = 0; i < (sizeof(emu_curve) / sizeof(emu_curve[0])); i++)
+    {
+        if (emu_curve[i].curve == curve)
+            return &emu_curve[i];
+    }
+    return NULL;
+}
+
+/**********************************************************************
+* __emu_der_header()
+* Writes a DER tag and length to buf, returns the header size.
+**********************************************************************/
+static uint16_t __emu_der_header(uint8_t *buf, uint8_t tag, uint16_t len)
+{
+    buf[0] = tag;
+    if (len < 0x80)
+    {
+        buf[1] = (uint8_t)len;
+        return 2;
+    }
+    if (len < 0x100)
+    {
+        buf[1] = 0x81;
+        buf[2] = (uint8_t)len;
+        return 3;
+    }
+    buf[1] = 0x82;
+    buf[2] = (uint8_t)(len >> 8);
+    buf[3] = (uint8_t)len;
+    return 4;
+}
+
+/**********************************************************************
+* __emu_der_parse()
+* Returns the header size of the DER element at buf and its content
+* length in *len, 0 if it is malformed or exceeds bufLen.
+**********************************************************************/
+static uint16_t __emu_der_parse(const uint8_t *buf, uint32_t bufLen, uint32_t *len)
+{
+    uint16_t hdr;
+
+    if (bufLen < 2)
+        return 0;
+    if (buf[1] < 0x80)
+    {
+        *len = buf[1];
+        hdr = 2;
+    }
+    else if ((buf[1] == 0x81) && (bufLen >= 3))
+    {
+        *len = buf[2];
+        hdr = 3;
+    }
+    else if ((buf[1] == 0x82) && (bufLen >= 4))
+    {
+        *len = ((uint32_t)buf[2] << 8) | buf[3];
+        hdr = 4;
+    }
+    else
+    {
+        return 0;
+    }
+    return ((hdr + *len) <= bufLen) ? hdr : 0;
+}
+
+/**********************************************************************
+* __emu_builtin()
+* Keys get the default EC/RSA method on creation, which is the trustm
+* engine once an application made it the default. The private key and
+* RSA encrypt operations run on the low level key with the built-in
+* method instead, as EVP would route them back into the engine.
+**********************************************************************/
+static EVP_PKEY *__emu_builtin(EVP_PKEY *pkey)
+{
+    if (pkey == NULL)
+        return NULL;
+    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_EC)
+        EC_KEY_set_method((EC_KEY *)EVP_PKEY_get0_EC_KEY(pkey), EC_KEY_OpenSSL());
+    else if (EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA)
+        RSA_set_method((RSA *)EVP_PKEY_get0_RSA(pkey), RSA_PKCS1_OpenSSL());
+    return pkey;
+}
+
+/**********************************************************************
+* __emu_pubkey()
+* Builds a public key from the BIT STRING form used by the host
+* library. curve is the OPTIGA curve of an EC key, 0 for RSA.
+**********************************************************************/
+static EVP_PKEY *__emu_pubkey(const uint8_t *key, uint16_t keyLen, uint8_t curve)
+{
+    const emu_curve_t *c = NULL;
+    const unsigned char *p;
+    uint8_t der[1024];
+    uint16_t algLen;
+    uint16_t len;
+
+    if ((key == NULL) || (keyLen < 2) || (key[0] != 0x03))
+        return NULL;
+    if ((curve != 0) && ((c = __emu_curve(curve)) == NULL))
+        return NULL;
+
+    algLen = (c != NULL) ? (sizeof(emu_oid_ecpubkey) + c->oidLen) : sizeof(emu_oid_rsa);
+    if ((8 + algLen + keyLen) > sizeof(der))
+        return NULL;
+
+    len = __emu_der_header(der, 0x30, 2 + algLen + keyLen);
+    len += __emu_der_header(der+len, 0x30, algLen);
+    if (c != NULL)
+    {
+        memcpy(der+len, emu_oid_ecpubkey, sizeof(emu_oid_ecpubkey));
+        memcpy(der+len+sizeof(emu_oid_ecpubkey), c->oid, c->oidLen);
+    }
+    else
+    {
+        memcpy(der+len, emu_oid_rsa, sizeof(emu_oid_rsa));
+    }
+    len += algLen;
+    memcpy(der+len, key, keyLen);
+    len += keyLen;
+
+    p = der;
+    return __emu_builtin(d2i_PUBKEY(NULL, &p, len));
+}
+
+/**********************************************************************
+* __emu_pubkey_export()
+* Writes the subjectPublicKey BIT STRING of pkey, the form the chip
+* returns on key generation.
+**********************************************************************/
+static optiga_lib_status_t __emu_pubkey_export(EVP_PKEY *pkey, uint8_t *out, uint16_t *outLen)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    unsigned char *der = NULL;
+    const uint8_t *p;
+    uint32_t len, algLen;
+    uint16_t hdr;
+    int derLen;
+
+    do
+    {
+        derLen = i2d_PUBKEY(pkey, &der);
+        if ((derLen <= 0) || ((hdr = __emu_der_parse(der, derLen, &len)) == 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        // Skip the AlgorithmIdentifier
+        p = der + hdr;
+        if ((hdr = __emu_der_parse(p, len, &algLen)) == 0)
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        len -= hdr + algLen;
+        p += hdr + algLen;
+        if (len > *outLen)
+        {
+            status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+            break;
+        }
+        memcpy(out, p, len);
+        *outLen = (uint16_t)len;
+    }while(0);
+    OPENSSL_free(der);
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_store_key()
+* Stores a key with its algorithm (0xE0) and usage (0xE1) metadata.
+* Store lock must be held.
+**********************************************************************/
+static optiga_lib_status_t __emu_store_key(trustm_emu_store_t *store, uint16_t oid, uint8_t algo,
+                                            uint8_t usage, const uint8_t *key, uint16_t keyLen)
+{
+    uint8_t meta[2 * TRUSTM_EMU_METADATA_SIZE];
+    uint8_t change;
+    trustm_emu_object_t *obj;
+    uint16_t len;
+
+    obj = trustm_emu_object(store, oid, 0);
+    len = trustm_emu_metadata(obj, oid, meta);
+    if ((trustm_emu_metadata_tag(meta+2, len-2, 0xD0, &change) == 1) && (change == 0xFF))
+    {
+        trustm_emu_security_event(store);
+        return TRUSTM_EMU_ERR_ACCESS;
+    }
+    if ((keyLen > TRUSTM_EMU_DATA_SIZE) ||
+        ((obj == NULL) && ((obj = trustm_emu_object(store, oid, 1)) == NULL)))
+    {
+        TRUSTM_EMU_ERRFN("Cannot store key 0x%.4X", oid);
+        return TRUSTM_EMU_ERR_INTERNAL;
+    }
+
+    memset(obj->data, 0, sizeof(obj->data));
+    memcpy(obj->data, key, keyLen);
+    obj->len = keyLen;
+    len = trustm_emu_metadata_set(obj->meta, obj->metaLen, sizeof(obj->meta), 0xE0, &algo, 1);
+    if (len != 0)
+        len = trustm_emu_metadata_set(obj->meta, len, sizeof(obj->meta), 0xE1, &usage, 1);
+    if (len == 0)
+        return TRUSTM_EMU_ERR_INVALID_LENGTH;
+    obj->metaLen = len;
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_store_pkey()
+* Locks the store and stores the private key of pkey.
+**********************************************************************/
+static optiga_lib_status_t __emu_store_pkey(uint16_t oid, uint8_t algo, uint8_t usage, EVP_PKEY *pkey)
+{
+    optiga_lib_status_t status;
+    trustm_emu_store_t *store;
+    unsigned char *der = NULL;
+    int derLen;
+
+    derLen = i2d_PrivateKey(pkey, &der);
+    if (derLen <= 0)
+        return TRUSTM_EMU_ERR_INTERNAL;
+
+    if ((store = trustm_emu_lock()) != NULL)
+    {
+        status = __emu_store_key(store, oid, algo, usage, der, (uint16_t)derLen);
+        trustm_emu_unlock();
+    }
+    else
+    {
+        status = TRUSTM_EMU_ERR_INTERNAL;
+    }
+    OPENSSL_cleanse(der, derLen);
+    OPENSSL_free(der);
+    return status;
+}
+
+/**********************************************************************
+* __emu_key()
+* Loads the private key in oid. The key must be of type and its usage
+* must have one of the usage bits.
+**********************************************************************/
+static optiga_lib_status_t __emu_key(uint16_t oid, int type, uint8_t usage, EVP_PKEY **pkey)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+    const unsigned char *p;
+    uint8_t keyUsage = 0;
+
+    *pkey = NULL;
+    if (!trustm_emu_is_key(oid) || (oid == 0xE200))
+        return TRUSTM_EMU_ERR_INVALID_OID;
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        obj = trustm_emu_object(store, oid, 0);
+        if ((obj == NULL) || (obj->len == 0))
+        {
+            // No key generated yet
+            status = TRUSTM_EMU_ERR_INVALID_DATA;
+            break;
+        }
+        trustm_emu_metadata_tag(obj->meta, obj->metaLen, 0xE1, &keyUsage);
+        if ((keyUsage & usage) == 0)
+        {
+            trustm_emu_security_event(store);
+            status = TRUSTM_EMU_ERR_ACCESS;
+            break;
+        }
+        p = obj->data;
+        *pkey = __emu_builtin(d2i_AutoPrivateKey(NULL, &p, obj->len));
+    }while(0);
+    trustm_emu_unlock();
+
+    if ((status == OPTIGA_LIB_SUCCESS) && ((*pkey == NULL) || (EVP_PKEY_base_id(*pkey) != type)))
+    {
+        EVP_PKEY_free(*pkey);
+        *pkey = NULL;
+        status = TRUSTM_EMU_ERR_INVALID_PARAM;
+    }
+    return status;
+}
+
+/**********************************************************************
+* __emu_object_copy()
+* Copies the data of oid, used for certificates and secrets.
+**********************************************************************/
+static optiga_lib_status_t __emu_object_copy(uint16_t oid, uint8_t *buf, uint16_t *len)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+
+    if ((trustm_emu_object_size(oid) == 0) || trustm_emu_is_key(oid))
+        return TRUSTM_EMU_ERR_INVALID_OID;
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+
+    obj = trustm_emu_object(store, oid, 0);
+    if ((obj == NULL) || (obj->len == 0))
+    {
+        status = TRUSTM_EMU_ERR_INVALID_DATA;
+    }
+    else
+    {
+        memcpy(buf, obj->data, obj->len);
+        *len = obj->len;
+    }
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_public_key()
+* Public key of a verify or encrypt command, given by the host or as a
+* certificate in an OID.
+**********************************************************************/
+static optiga_lib_status_t __emu_public_key(uint8_t source, const void *public_key, uint8_t ecc, EVP_PKEY **pkey)
+{
+    const public_key_from_host_t *host;
+    const unsigned char *p;
+    optiga_lib_status_t status;
+    uint8_t cert[TRUSTM_EMU_DATA_SIZE];
+    uint16_t certLen = 0;
+    X509 *x509;
+
+    *pkey = NULL;
+    if (source == OPTIGA_CRYPT_HOST_DATA)
+    {
+        host = (const public_key_from_host_t *)public_key;
+        *pkey = __emu_pubkey(host->public_key, host->length, ecc ? host->key_type : 0);
+        return (*pkey != NULL) ? OPTIGA_LIB_SUCCESS : TRUSTM_EMU_ERR_INVALID_DATA;
+    }
+
+    status = __emu_object_copy(*(const uint16_t *)public_key, cert, &certLen);
+    if (status != OPTIGA_LIB_SUCCESS)
+        return status;
+    p = cert;
+    // Skip the TLS identity header of the device certificates
+    if ((certLen > 9) && (cert[0] == 0xC0))
+        p += 9;
+    x509 = d2i_X509(NULL, &p, certLen - (p - cert));
+    if (x509 == NULL)
+        return TRUSTM_EMU_ERR_INVALID_DATA;
+    *pkey = X509_get_pubkey(x509);
+    X509_free(x509);
+    return (*pkey != NULL) ? OPTIGA_LIB_SUCCESS : TRUSTM_EMU_ERR_INVALID_DATA;
+}
+
+static const EVP_MD *__emu_rsa_md(optiga_rsa_signature_scheme_t scheme)
+{
+    switch (scheme)
+    {
+        case OPTIGA_RSASSA_PKCS1_V15_SHA256:
+            return EVP_sha256();
+        case OPTIGA_RSASSA_PKCS1_V15_SHA384:
+            return EVP_sha384();
+        case OPTIGA_RSASSA_PKCS1_V15_SHA512:
+            return EVP_sha512();
+        default:
+            return NULL;
+    }
+}
+
+/**********************************************************************
+* __emu_random()
+**********************************************************************/
+static optiga_lib_status_t __emu_random(uint8_t *random_data, uint16_t random_data_length)
+{
+    if ((random_data_length < 8) || (random_data_length > 256))
+        return TRUSTM_EMU_ERR_INVALID_PARAM;
+    if (trustm_emu_random(random_data, random_data_length) != 0)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_ecc_keygen()
+**********************************************************************/
+static optiga_lib_status_t __emu_ecc_keygen(uint8_t curve, uint8_t usage, uint8_t exportKey,
+                                            void *private_key, uint8_t *public_key, uint16_t *public_key_length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    const emu_curve_t *c;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    unsigned char *der = NULL;
+    uint32_t len, intLen;
+    uint16_t hdr, intHdr, oid = 0;
+    int derLen;
+
+    do
+    {
+        if ((c = __emu_curve(curve)) == NULL)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+        if (!exportKey)
+        {
+            oid = *(optiga_key_id_t *)private_key;
+            if (!(((oid >= 0xE0F0) && (oid <= 0xE0F3)) || ((oid >= 0xE100) && (oid <= 0xE103))))
+            {
+                status = TRUSTM_EMU_ERR_INVALID_OID;
+                break;
+            }
+        }
+
+        ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+            (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, c->nid) <= 0) ||
+            (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if ((status = __emu_pubkey_export(pkey, public_key, public_key_length)) != OPTIGA_LIB_SUCCESS)
+            break;
+
+        if (!exportKey)
+        {
+            status = __emu_store_pkey(oid, curve, usage, pkey);
+            break;
+        }
+
+        // Exported as the private key OCTET STRING of the ECPrivateKey
+        derLen = i2d_PrivateKey(pkey, &der);
+        if ((derLen <= 0) || ((hdr = __emu_der_parse(der, derLen, &len)) == 0) ||
+            ((intHdr = __emu_der_parse(der+hdr, len, &intLen)) == 0) ||
+            (__emu_der_parse(der+hdr+intHdr+intLen, len-intHdr-intLen, &len) == 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        memcpy(private_key, der+hdr+intHdr+intLen, 2 + len);
+    }while(0);
+
+    if (der != NULL)
+    {
+        OPENSSL_cleanse(der, derLen);
+        OPENSSL_free(der);
+    }
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_CTX_free(ctx);
+    return status;
+}
+
+/**********************************************************************
+* __emu_ecdsa_sign()
+* The signature is returned as the two DER INTEGERs r and s without
+* the SEQUENCE header, like the chip does.
+**********************************************************************/
+static optiga_lib_status_t __emu_ecdsa_sign(const uint8_t *digest, uint8_t digest_length, optiga_key_id_t key,
+                                            uint8_t *signature, uint16_t *signature_length)
+{
+    optiga_lib_status_t status;
+    ECDSA_SIG *sig = NULL;
+    EVP_PKEY *pkey = NULL;
+    uint8_t der[160];
+    uint8_t *p = der;
+    int derLen;
+    uint32_t len;
+    uint16_t hdr;
+
+    do
+    {
+        status = __emu_key(key, EVP_PKEY_EC, OPTIGA_KEY_USAGE_AUTHENTICATION|OPTIGA_KEY_USAGE_SIGN, &pkey);
+        if (status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        sig = ECDSA_do_sign(digest, digest_length, (EC_KEY *)EVP_PKEY_get0_EC_KEY(pkey));
+        if ((sig == NULL) || (i2d_ECDSA_SIG(sig, NULL) > (int)sizeof(der)) ||
+            ((derLen = i2d_ECDSA_SIG(sig, &p)) <= 0) ||
+            ((hdr = __emu_der_parse(der, derLen, &len)) == 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if (len > *signature_length)
+        {
+            status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+            break;
+        }
+        memcpy(signature, der+hdr, len);
+        *signature_length = (uint16_t)len;
+    }while(0);
+
+    ECDSA_SIG_free(sig);
+    EVP_PKEY_free(pkey);
+    return status;
+}
+
+/**********************************************************************
+* __emu_verify()
+* Verifies an ECDSA (r and s INTEGERs without SEQUENCE) or RSA PKCS#1
+* v1.5 signature.
+**********************************************************************/
+static optiga_lib_status_t __emu_verify(const EVP_MD *md, const uint8_t *digest, uint8_t digest_length,
+                                        const uint8_t *signature, uint16_t signature_length,
+                                        uint8_t source, const void *public_key)
+{
+    optiga_lib_status_t status;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    uint8_t der[600];
+    uint16_t derLen;
+    int ret;
+
+    do
+    {
+        if ((status = __emu_public_key(source, public_key, (md == NULL), &pkey)) != OPTIGA_LIB_SUCCESS)
+            break;
+        if (EVP_PKEY_base_id(pkey) != ((md == NULL) ? EVP_PKEY_EC : EVP_PKEY_RSA))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+
+        if (md == NULL)
+        {
+            if ((signature_length + 4) > sizeof(der))
+            {
+                status = TRUSTM_EMU_ERR_INVALID_LENGTH;
+                break;
+            }
+            derLen = __emu_der_header(der, 0x30, signature_length);
+            memcpy(der+derLen, signature, signature_length);
+            derLen += signature_length;
+        }
+
+        ctx = EVP_PKEY_CTX_new(pkey, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_verify_init(ctx) <= 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if (md == NULL)
+        {
+            ret = EVP_PKEY_verify(ctx, der, derLen, digest, digest_length);
+        }
+        else
+        {
+            if ((EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+                (EVP_PKEY_CTX_set_signature_md(ctx, md) <= 0))
+            {
+                status = TRUSTM_EMU_ERR_INTERNAL;
+                break;
+            }
+            ret = EVP_PKEY_verify(ctx, signature, signature_length, digest, digest_length);
+        }
+        if (ret != 1)
+            status = TRUSTM_EMU_ERR_VERIFY;
+    }while(0);
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return status;
+}
+
+/**********************************************************************
+* __emu_rsa_keygen()
+**********************************************************************/
+static optiga_lib_status_t __emu_rsa_keygen(optiga_rsa_key_type_t key_type, uint8_t usage, uint8_t exportKey,
+                                            void *private_key, uint8_t *public_key, uint16_t *public_key_length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    uint16_t oid;
+    int bits;
+
+    do
+    {
+        if (key_type == OPTIGA_RSA_KEY_1024_BIT_EXPONENTIAL)
+            bits = 1024;
+        else if (key_type == OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL)
+            bits = 2048;
+        else
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+        // Export of the private key is not modelled
+        if (exportKey)
+        {
+            status = TRUSTM_EMU_ERR_NOT_AVAILABLE;
+            break;
+        }
+        oid = *(optiga_key_id_t *)private_key;
+        if ((oid != 0xE0FC) && (oid != 0xE0FD))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+
+        ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+            (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits) <= 0) ||
+            (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if ((status = __emu_pubkey_export(pkey, public_key, public_key_length)) != OPTIGA_LIB_SUCCESS)
+            break;
+        status = __emu_store_pkey(oid, (uint8_t)key_type, usage, pkey);
+    }while(0);
+
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_CTX_free(ctx);
+    return status;
+}
+
+/**********************************************************************
+* __emu_rsa_sign()
+**********************************************************************/
+static optiga_lib_status_t __emu_rsa_sign(optiga_rsa_signature_scheme_t scheme, const uint8_t *digest,
+                                            uint8_t digest_length, optiga_key_id_t key,
+                                            uint8_t *signature, uint16_t *signature_length)
+{
+    optiga_lib_status_t status;
+    const EVP_MD *md = __emu_rsa_md(scheme);
+    EVP_PKEY *pkey = NULL;
+    unsigned int len;
+
+    do
+    {
+        if ((md == NULL) || (digest_length != EVP_MD_size(md)))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+        status = __emu_key(key, EVP_PKEY_RSA, OPTIGA_KEY_USAGE_AUTHENTICATION|OPTIGA_KEY_USAGE_SIGN, &pkey);
+        if (status != OPTIGA_LIB_SUCCESS)
+            break;
+        len = EVP_PKEY_size(pkey);
+        if (len > *signature_length)
+        {
+            status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+            break;
+        }
+
+        if (RSA_sign(EVP_MD_type(md), digest, digest_length, signature, &len,
+                     (RSA *)EVP_PKEY_get0_RSA(pkey)) != 1)
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        *signature_length = (uint16_t)len;
+    }while(0);
+
+    EVP_PKEY_free(pkey);
+    return status;
+}
+
+/**********************************************************************
+* __emu_rsa_crypt()
+* PKCS#1 v1.5 encryption with a host or certificate key (encrypt = 1),
+* decryption with a key object (encrypt = 0).
+**********************************************************************/
+static optiga_lib_status_t __emu_rsa_crypt(uint8_t encrypt, optiga_rsa_encryption_scheme_t scheme,
+                                            const uint8_t *in, uint16_t inLen,
+                                            uint8_t source, const void *key,
+                                            uint8_t *out, uint16_t *outLen)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    EVP_PKEY *pkey = NULL;
+    RSA *rsa;
+    uint8_t buf[512];
+    int len;
+
+    do
+    {
+        if (scheme != OPTIGA_RSAES_PKCS1_V15)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+        if (encrypt)
+        {
+            if ((status = __emu_public_key(source, key, 0, &pkey)) != OPTIGA_LIB_SUCCESS)
+                break;
+            if (EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA)
+            {
+                status = TRUSTM_EMU_ERR_INVALID_PARAM;
+                break;
+            }
+        }
+        else
+        {
+            status = __emu_key(*(const optiga_key_id_t *)key, EVP_PKEY_RSA, OPTIGA_KEY_USAGE_ENCRYPTION, &pkey);
+            if (status != OPTIGA_LIB_SUCCESS)
+                break;
+        }
+
+        rsa = (RSA *)EVP_PKEY_get0_RSA(pkey);
+        if (RSA_size(rsa) > (int)sizeof(buf))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if (encrypt)
+            len = RSA_public_encrypt(inLen, in, buf, rsa, RSA_PKCS1_PADDING);
+        else
+            len = RSA_private_decrypt(inLen, in, buf, rsa, RSA_PKCS1_PADDING);
+        if (len < 0)
+        {
+            if (encrypt)
+            {
+                status = TRUSTM_EMU_ERR_INVALID_LENGTH;
+                break;
+            }
+            status = TRUSTM_EMU_ERR_DECRYPT;
+            if ((store = trustm_emu_lock()) != NULL)
+            {
+                trustm_emu_security_event(store);
+                trustm_emu_unlock();
+            }
+            break;
+        }
+        if (len > *outLen)
+        {
+            status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+            break;
+        }
+        memcpy(out, buf, len);
+        *outLen = (uint16_t)len;
+    }while(0);
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+    EVP_PKEY_free(pkey);
+    return status;
+}
+
+/**********************************************************************
+* __emu_hash()
+* step is EMU_SEQ_START, EMU_SEQ_CONTINUE or EMU_SEQ_FINAL.
+**********************************************************************/
+static optiga_lib_status_t __emu_hash(uint8_t step, optiga_hash_context_t *hash_ctx, uint8_t source,
+                                        const void *data, uint8_t *hash_output)
+{
+    const hash_data_from_host_t *host;
+    const hash_data_in_optiga_t *in;
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    uint8_t buf[TRUSTM_EMU_DATA_SIZE];
+    uint16_t len = 0;
+    emu_hash_ctx_t ctx;
+
+    if (step == EMU_SEQ_START)
+    {
+        if (hash_ctx->hash_algo != (uint8_t)OPTIGA_HASH_TYPE_SHA_256)
+            return TRUSTM_EMU_ERR_INVALID_PARAM;
+        ctx.magic = EMU_HASH_MAGIC;
+        ctx.md = EVP_MD_CTX_new();
+        if ((ctx.md == NULL) || (EVP_DigestInit_ex(ctx.md, EVP_sha256(), NULL) != 1))
+        {
+            EVP_MD_CTX_free(ctx.md);
+            return TRUSTM_EMU_ERR_INTERNAL;
+        }
+        memcpy(hash_ctx->context_buffer, &ctx, sizeof(ctx));
+        return OPTIGA_LIB_SUCCESS;
+    }
+
+    memcpy(&ctx, hash_ctx->context_buffer, sizeof(ctx));
+    if (ctx.magic != EMU_HASH_MAGIC)
+        return TRUSTM_EMU_ERR_SEQUENCE;
+
+    if (step == EMU_SEQ_CONTINUE)
+    {
+        if (source == OPTIGA_CRYPT_HOST_DATA)
+        {
+            host = (const hash_data_from_host_t *)data;
+            if (EVP_DigestUpdate(ctx.md, host->buffer, host->length) != 1)
+                status = TRUSTM_EMU_ERR_INTERNAL;
+            return status;
+        }
+
+        in = (const hash_data_in_optiga_t *)data;
+        if ((status = __emu_object_copy(in->oid, buf, &len)) != OPTIGA_LIB_SUCCESS)
+            return status;
+        if (((uint32_t)in->offset + in->length) > len)
+            return TRUSTM_EMU_ERR_BOUNDARY;
+        if (EVP_DigestUpdate(ctx.md, buf+in->offset, in->length) != 1)
+            status = TRUSTM_EMU_ERR_INTERNAL;
+        return status;
+    }
+
+    if (EVP_DigestFinal_ex(ctx.md, hash_output, NULL) != 1)
+        status = TRUSTM_EMU_ERR_INTERNAL;
+    EVP_MD_CTX_free(ctx.md);
+    memset(hash_ctx->context_buffer, 0, sizeof(ctx));
+    return status;
+}
+
+static const EVP_MD *__emu_hmac_md(uint8_t type)
+{
+    switch (type)
+    {
+        case OPTIGA_HMAC_SHA_256:
+            return EVP_sha256();
+        case OPTIGA_HMAC_SHA_384:
+            return EVP_sha384();
+        case OPTIGA_HMAC_SHA_512:
+            return EVP_sha512();
+        default:
+            return NULL;
+    }
+}
+
+/**********************************************************************
+* __emu_hmac()
+* HMAC with the secret in a data object, one shot or as a sequence
+* kept in the instance.
+**********************************************************************/
+static optiga_lib_status_t __emu_hmac(trustm_emu_instance_t *inst, uint8_t step, optiga_hmac_type_t type,
+                                        uint16_t secret, const uint8_t *in, uint32_t inLen,
+                                        uint8_t *mac, uint32_t *mac_length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    const EVP_MD *md;
+    EVP_PKEY *pkey = NULL;
+    uint8_t key[TRUSTM_EMU_DATA_SIZE];
+    uint16_t keyLen = 0;
+    size_t len;
+
+    do
+    {
+        if ((step == EMU_SEQ_START) || (step == EMU_SEQ_ONESHOT))
+        {
+            EVP_MD_CTX_free(inst->hmacCtx);
+            inst->hmacCtx = NULL;
+            if ((md = __emu_hmac_md(type)) == NULL)
+            {
+                status = TRUSTM_EMU_ERR_INVALID_PARAM;
+                break;
+            }
+            if ((status = __emu_object_copy(secret, key, &keyLen)) != OPTIGA_LIB_SUCCESS)
+                break;
+            pkey = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, key, keyLen);
+            inst->hmacCtx = EVP_MD_CTX_new();
+            if ((pkey == NULL) || (inst->hmacCtx == NULL) ||
+                (EVP_DigestSignInit(inst->hmacCtx, NULL, md, NULL, pkey) != 1))
+            {
+                status = TRUSTM_EMU_ERR_INTERNAL;
+                break;
+            }
+        }
+        else if (inst->hmacCtx == NULL)
+        {
+            status = TRUSTM_EMU_ERR_SEQUENCE;
+            break;
+        }
+
+        if ((inLen != 0) && (EVP_DigestSignUpdate(inst->hmacCtx, in, inLen) != 1))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+
+        if ((step == EMU_SEQ_FINAL) || (step == EMU_SEQ_ONESHOT))
+        {
+            if ((EVP_DigestSignFinal(inst->hmacCtx, NULL, &len) != 1) || (len > *mac_length))
+            {
+                status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+                break;
+            }
+            if (EVP_DigestSignFinal(inst->hmacCtx, mac, &len) != 1)
+            {
+                status = TRUSTM_EMU_ERR_INTERNAL;
+                break;
+            }
+            *mac_length = (uint32_t)len;
+        }
+    }while(0);
+
+    if ((status != OPTIGA_LIB_SUCCESS) || (step == EMU_SEQ_FINAL) || (step == EMU_SEQ_ONESHOT))
+    {
+        EVP_MD_CTX_free(inst->hmacCtx);
+        inst->hmacCtx = NULL;
+    }
+    EVP_PKEY_free(pkey);
+    OPENSSL_cleanse(key, sizeof(key));
+    return status;
+}
+
+/**********************************************************************
+* __emu_hkdf()
+* Only export of the derived key to the host is modelled.
+**********************************************************************/
+static optiga_lib_status_t __emu_hkdf(uint8_t type, uint16_t secret, const uint8_t *salt, uint16_t salt_length,
+                                        const uint8_t *info, uint16_t info_length,
+                                        uint16_t derived_key_length, uint8_t export_to_host,
+                                        uint8_t *derived_key)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    const EVP_MD *md;
+    EVP_PKEY_CTX *ctx = NULL;
+    uint8_t key[TRUSTM_EMU_DATA_SIZE];
+    uint16_t keyLen = 0;
+    size_t len = derived_key_length;
+
+    do
+    {
+        switch (type)
+        {
+            case OPTIGA_HKDF_SHA_256:
+                md = EVP_sha256();
+                break;
+            case OPTIGA_HKDF_SHA_384:
+                md = EVP_sha384();
+                break;
+            case OPTIGA_HKDF_SHA_512:
+                md = EVP_sha512();
+                break;
+            default:
+                md = NULL;
+                break;
+        }
+        if (md == NULL)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_PARAM;
+            break;
+        }
+        if (!export_to_host)
+        {
+            status = TRUSTM_EMU_ERR_NOT_AVAILABLE;
+            break;
+        }
+        if ((status = __emu_object_copy(secret, key, &keyLen)) != OPTIGA_LIB_SUCCESS)
+            break;
+
+        ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_derive_init(ctx) <= 0) ||
+            (EVP_PKEY_CTX_set_hkdf_md(ctx, md) <= 0) ||
+            ((salt_length != 0) && (EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, salt_length) <= 0)) ||
+            (EVP_PKEY_CTX_set1_hkdf_key(ctx, key, keyLen) <= 0) ||
+            ((info_length != 0) && (EVP_PKEY_CTX_add1_hkdf_info(ctx, info, info_length) <= 0)) ||
+            (EVP_PKEY_derive(ctx, derived_key, &len) <= 0))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+    }while(0);
+
+    EVP_PKEY_CTX_free(ctx);
+    OPENSSL_cleanse(key, sizeof(key));
+    return status;
+}
+
+/**********************************************************************
+* __emu_symmetric_key()
+* Loads the AES key in oid and returns the cipher for mode.
+**********************************************************************/
+static optiga_lib_status_t __emu_symmetric_key(uint16_t oid, uint8_t mode, uint8_t *key, uint16_t *keyLen,
+                                                const EVP_CIPHER **cipher)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+    uint8_t keyType = 0;
+    uint8_t ecb = (mode == OPTIGA_SYMMETRIC_ECB);
+
+    if (oid != 0xE200)
+        return TRUSTM_EMU_ERR_INVALID_OID;
+    if ((mode != OPTIGA_SYMMETRIC_ECB) && (mode != OPTIGA_SYMMETRIC_CBC) &&
+        (mode != OPTIGA_SYMMETRIC_CBC_MAC) && (mode != OPTIGA_SYMMETRIC_CMAC))
+        return TRUSTM_EMU_ERR_NOT_AVAILABLE;
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        obj = trustm_emu_object(store, oid, 0);
+        if ((obj == NULL) || (obj->len == 0))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_DATA;
+            break;
+        }
+        trustm_emu_metadata_tag(obj->meta, obj->metaLen, 0xE0, &keyType);
+        switch (keyType)
+        {
+            case OPTIGA_SYMMETRIC_AES_128:
+                *cipher = ecb ? EVP_aes_128_ecb() : EVP_aes_128_cbc();
+                break;
+            case OPTIGA_SYMMETRIC_AES_192:
+                *cipher = ecb ? EVP_aes_192_ecb() : EVP_aes_192_cbc();
+                break;
+            case OPTIGA_SYMMETRIC_AES_256:
+                *cipher = ecb ? EVP_aes_256_ecb() : EVP_aes_256_cbc();
+                break;
+            default:
+                status = TRUSTM_EMU_ERR_INVALID_DATA;
+                break;
+        }
+        if (status != OPTIGA_LIB_SUCCESS)
+            break;
+        memcpy(key, obj->data, obj->len);
+        *keyLen = obj->len;
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+static void __emu_symmetric_free(trustm_emu_instance_t *inst)
+{
+    if (inst->symCtx == NULL)
+        return;
+    if (inst->symMode == OPTIGA_SYMMETRIC_CMAC)
+        EVP_MD_CTX_free(inst->symCtx);
+    else
+        EVP_CIPHER_CTX_free(inst->symCtx);
+    inst->symCtx = NULL;
+}
+
+/**********************************************************************
+* __emu_symmetric()
+* AES ECB/CBC encryption and decryption without padding, CBC-MAC and
+* CMAC generation. *outLen is the size of out on input.
+**********************************************************************/
+static optiga_lib_status_t __emu_symmetric(trustm_emu_instance_t *inst, uint8_t step, uint8_t encrypt,
+                                            uint8_t mode, uint16_t oid, const uint8_t *iv, uint16_t ivLen,
+                                            const uint8_t *in, uint32_t inLen, uint8_t *out, uint32_t *outLen)
+{
+    static const uint8_t zero[EMU_AES_BLOCK] = {0};
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    const EVP_CIPHER *cipher = NULL;
+    EVP_PKEY *pkey = NULL;
+    uint8_t key[32];
+    uint16_t keyLen = 0;
+    uint8_t scratch[1024];
+    uint32_t produced = 0;
+    uint32_t piece, i;
+    size_t macLen;
+    int n;
+
+    do
+    {
+        if ((step == EMU_SEQ_START) || (step == EMU_SEQ_ONESHOT))
+        {
+            __emu_symmetric_free(inst);
+            // MAC modes only generate
+            if (!encrypt && ((mode == OPTIGA_SYMMETRIC_CBC_MAC) || (mode == OPTIGA_SYMMETRIC_CMAC)))
+            {
+                status = TRUSTM_EMU_ERR_INVALID_PARAM;
+                break;
+            }
+            if ((mode == OPTIGA_SYMMETRIC_CBC) && ((iv == NULL) || (ivLen != EMU_AES_BLOCK)))
+            {
+                status = TRUSTM_EMU_ERR_INVALID_PARAM;
+                break;
+            }
+            if ((status = __emu_symmetric_key(oid, mode, key, &keyLen, &cipher)) != OPTIGA_LIB_SUCCESS)
+                break;
+
+            inst->symMode = mode;
+            inst->symEncrypt = encrypt;
+            memset(inst->symBlock, 0, sizeof(inst->symBlock));
+            if (mode == OPTIGA_SYMMETRIC_CMAC)
+            {
+                pkey = EVP_PKEY_new_CMAC_key(NULL, key, keyLen, cipher);
+                inst->symCtx = EVP_MD_CTX_new();
+                if ((pkey == NULL) || (inst->symCtx == NULL) ||
+                    (EVP_DigestSignInit(inst->symCtx, NULL, NULL, NULL, pkey) != 1))
+                {
+                    status = TRUSTM_EMU_ERR_INTERNAL;
+                    break;
+                }
+            }
+            else
+            {
+                inst->symCtx = EVP_CIPHER_CTX_new();
+                if ((inst->symCtx == NULL) ||
+                    (EVP_CipherInit_ex(inst->symCtx, cipher, NULL, key,
+                                        (mode == OPTIGA_SYMMETRIC_CBC) ? iv : zero, encrypt) != 1))
+                {
+                    status = TRUSTM_EMU_ERR_INTERNAL;
+                    break;
+                }
+                EVP_CIPHER_CTX_set_padding(inst->symCtx, 0);
+            }
+        }
+        else if ((inst->symCtx == NULL) || (inst->symEncrypt != encrypt))
+        {
+            status = TRUSTM_EMU_ERR_SEQUENCE;
+            break;
+        }
+
+        if (inst->symMode == OPTIGA_SYMMETRIC_CMAC)
+        {
+            if ((inLen != 0) && (EVP_DigestSignUpdate(inst->symCtx, in, inLen) != 1))
+                status = TRUSTM_EMU_ERR_INTERNAL;
+        }
+        else if ((inLen % EMU_AES_BLOCK) != 0)
+        {
+            // No padding, whole blocks only
+            status = TRUSTM_EMU_ERR_INVALID_LENGTH;
+        }
+        else if (inst->symMode == OPTIGA_SYMMETRIC_CBC_MAC)
+        {
+            for (i = 0; (i < inLen) && (status == OPTIGA_LIB_SUCCESS); i += piece)
+            {
+                piece = ((inLen - i) > sizeof(scratch)) ? sizeof(scratch) : (inLen - i);
+                if (EVP_CipherUpdate(inst->symCtx, scratch, &n, in+i, piece) != 1)
+                    status = TRUSTM_EMU_ERR_INTERNAL;
+                else if (n >= EMU_AES_BLOCK)
+                    memcpy(inst->symBlock, scratch+n-EMU_AES_BLOCK, EMU_AES_BLOCK);
+            }
+        }
+        else if (inLen > *outLen)
+        {
+            status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+        }
+        else if ((inLen != 0) && (EVP_CipherUpdate(inst->symCtx, out, &n, in, inLen) != 1))
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+        }
+        else
+        {
+            produced = inLen;
+        }
+        if (status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        if (((step == EMU_SEQ_FINAL) || (step == EMU_SEQ_ONESHOT)) &&
+            ((inst->symMode == OPTIGA_SYMMETRIC_CMAC) || (inst->symMode == OPTIGA_SYMMETRIC_CBC_MAC)))
+        {
+            if (*outLen < EMU_AES_BLOCK)
+            {
+                status = OPTIGA_CRYPT_ERROR_MEMORY_INSUFFICIENT;
+                break;
+            }
+            macLen = EMU_AES_BLOCK;
+            if (inst->symMode == OPTIGA_SYMMETRIC_CBC_MAC)
+                memcpy(out, inst->symBlock, EMU_AES_BLOCK);
+            else if (EVP_DigestSignFinal(inst->symCtx, out, &macLen) != 1)
+            {
+                status = TRUSTM_EMU_ERR_INTERNAL;
+                break;
+            }
+            produced = (uint32_t)macLen;
+        }
+        *outLen = produced;
+    }while(0);
+
+    if ((status != OPTIGA_LIB_SUCCESS) || (step == EMU_SEQ_FINAL) || (step == EMU_SEQ_ONESHOT))
+        __emu_symmetric_free(inst);
+    EVP_PKEY_free(pkey);
+    OPENSSL_cleanse(key, sizeof(key));
+    return status;
+}
+
+/**********************************************************************
+* __emu_symmetric_keygen()
+**********************************************************************/
+static optiga_lib_status_t __emu_symmetric_keygen(optiga_symmetric_key_type_t key_type, uint8_t usage,
+                                                    uint8_t exportKey, void *symmetric_key)
+{
+    optiga_lib_status_t status;
+    trustm_emu_store_t *store;
+    uint8_t key[32];
+    uint16_t keyLen;
+
+    switch (key_type)
+    {
+        case OPTIGA_SYMMETRIC_AES_128:
+            keyLen = 16;
+            break;
+        case OPTIGA_SYMMETRIC_AES_192:
+            keyLen = 24;
+            break;
+        case OPTIGA_SYMMETRIC_AES_256:
+            keyLen = 32;
+            break;
+        default:
+            return TRUSTM_EMU_ERR_INVALID_PARAM;
+    }
+    if (!exportKey && (*(optiga_key_id_t *)symmetric_key != 0xE200))
+        return TRUSTM_EMU_ERR_INVALID_OID;
+    if (trustm_emu_random(key, keyLen) != 0)
+        return TRUSTM_EMU_ERR_INTERNAL;
+
+    if (exportKey)
+    {
+        memcpy(symmetric_key, key, keyLen);
+        status = OPTIGA_LIB_SUCCESS;
+    }
+    else if ((store = trustm_emu_lock()) != NULL)
+    {
+        status = __emu_store_key(store, 0xE200, (uint8_t)key_type, usage, key, keyLen);
+        trustm_emu_unlock();
+    }
+    else
+    {
+        status = TRUSTM_EMU_ERR_INTERNAL;
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    return status;
+}
+
+/**********************************************************************
+* trustm_emu_provision()
+* Content of a new store: lifecycle and identification data objects,
+* the platform binding secret and the device key E0F0 with its
+* self-signed certificate in E0E0.
+* Called with the store file locked, not the store lock.
+**********************************************************************/
+void trustm_emu_provision(trustm_emu_store_t *store)
+{
+    static const uint8_t locked[] = {0xC0, 0x01, 0x07, 0xD0, 0x01, 0xFF};
+    trustm_emu_object_t *obj;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    X509 *x509 = NULL;
+    unsigned char *der = NULL;
+    unsigned char *p;
+    int derLen = 0;
+    int certLen;
+
+    // Global lifecycle state, operational
+    obj = trustm_emu_object(store, 0xE0C0, 1);
+    obj->data[0] = 0x07;
+    obj->len = 1;
+    // Coprocessor UID
+    obj = trustm_emu_object(store, 0xE0C2, 1);
+    trustm_emu_random(obj->data, 27);
+    obj->data[0] = 0xCD;
+    obj->len = 27;
+    // Current limitation, 6 mA
+    obj = trustm_emu_object(store, 0xE0C4, 1);
+    obj->data[0] = 0x06;
+    obj->len = 1;
+    // Maximum comms buffer size, 1557
+    obj = trustm_emu_object(store, 0xE0C6, 1);
+    obj->data[0] = 0x06;
+    obj->data[1] = 0x15;
+    obj->len = 2;
+    // Platform binding secret
+    obj = trustm_emu_object(store, 0xE140, 1);
+    trustm_emu_random(obj->data, 64);
+    obj->len = 64;
+
+    do
+    {
+        ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+        if ((ctx == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+            (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) <= 0) ||
+            (EVP_PKEY_keygen(ctx, &pkey) <= 0) ||
+            ((derLen = i2d_PrivateKey(__emu_builtin(pkey), &der)) <= 0))
+            break;
+        if (__emu_store_key(store, 0xE0F0, OPTIGA_ECC_CURVE_NIST_P_256,
+                            OPTIGA_KEY_USAGE_AUTHENTICATION|OPTIGA_KEY_USAGE_SIGN,
+                            der, (uint16_t)derLen) != OPTIGA_LIB_SUCCESS)
+            break;
+        obj = trustm_emu_object(store, 0xE0F0, 0);
+        memcpy(obj->meta+obj->metaLen, locked, sizeof(locked));
+        obj->metaLen += sizeof(locked);
+
+        x509 = X509_new();
+        if ((x509 == NULL) ||
+            (X509_set_version(x509, 2) != 1) ||
+            (ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) != 1) ||
+            (X509_gmtime_adj(X509_getm_notBefore(x509), 0) == NULL) ||
+            (X509_gmtime_adj(X509_getm_notAfter(x509), 20L * 365 * 24 * 3600) == NULL) ||
+            (X509_NAME_add_entry_by_txt(X509_get_subject_name(x509), "CN", MBSTRING_ASC,
+                                        (const unsigned char *)"OPTIGA(TM) Trust M Emulator", -1, -1, 0) != 1) ||
+            (X509_set_issuer_name(x509, X509_get_subject_name(x509)) != 1) ||
+            (X509_set_pubkey(x509, pkey) != 1) ||
+            (X509_sign(x509, pkey, EVP_sha256()) <= 0))
+            break;
+
+        // Stored with the TLS identity header like the factory certificate
+        certLen = i2d_X509(x509, NULL);
+        if ((certLen <= 0) || ((certLen + 9) > TRUSTM_EMU_DATA_SIZE))
+            break;
+        obj = trustm_emu_object(store, 0xE0E0, 1);
+        obj->data[0] = 0xC0;
+        obj->data[1] = (uint8_t)((certLen + 6) >> 8);
+        obj->data[2] = (uint8_t)(certLen + 6);
+        obj->data[3] = 0x00;
+        obj->data[4] = (uint8_t)((certLen + 3) >> 8);
+        obj->data[5] = (uint8_t)(certLen + 3);
+        obj->data[6] = 0x00;
+        obj->data[7] = (uint8_t)(certLen >> 8);
+        obj->data[8] = (uint8_t)certLen;
+        p = obj->data + 9;
+        i2d_X509(x509, &p);
+        obj->len = (uint16_t)(certLen + 9);
+    }while(0);
+
+    if (der != NULL)
+    {
+        OPENSSL_cleanse(der, derLen);
+        OPENSSL_free(der);
+    }
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    EVP_PKEY_CTX_free(ctx);
+}
+
+/*************************************************************************
+*  optiga_crypt API
+*************************************************************************/
+optiga_crypt_t * optiga_crypt_create(uint8_t optiga_instance_id, callback_handler_t handler, void * caller_context)
+{
+    (void)optiga_instance_id;
+    return trustm_emu_instance_new(sizeof(optiga_crypt_t), 1, handler, caller_context);
+}
+
+optiga_lib_status_t optiga_crypt_destroy(optiga_crypt_t * me)
+{
+    trustm_emu_instance_t *inst = trustm_emu_instance(me);
+    optiga_lib_status_t return_status;
+
+    if ((inst != NULL) && !inst->busy)
+    {
+        __emu_symmetric_free(inst);
+        EVP_MD_CTX_free(inst->hmacCtx);
+        inst->hmacCtx = NULL;
+    }
+    return_status = trustm_emu_instance_free(me);
+    return return_status;
+}
+
+void optiga_crypt_set_comms_params(optiga_crypt_t * me, uint8_t parameter_type, uint8_t value)
+{
+    (void)me;
+    (void)parameter_type;
+    (void)value;
+}
+
+optiga_lib_status_t optiga_crypt_random(optiga_crypt_t * me, optiga_rng_type_t rng_type,
+                                        uint8_t * random_data, uint16_t random_data_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    (void)rng_type;
+    if (random_data == NULL)
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_random(random_data, random_data_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RANDOM, random_data_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_hash(optiga_crypt_t * me, optiga_hash_type_t hash_algorithm,
+                                        uint8_t source_of_data_to_hash, const void * data_to_hash,
+                                        uint8_t * hash_output)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+    optiga_hash_context_t hash_ctx;
+    uint8_t context[sizeof(emu_hash_ctx_t)] = {0};
+
+    if ((data_to_hash == NULL) || (hash_output == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    hash_ctx.context_buffer = context;
+    hash_ctx.context_buffer_length = sizeof(context);
+    hash_ctx.hash_algo = (uint8_t)hash_algorithm;
+    do
+    {
+        if (!trustm_emu_opened())
+        {
+            return_status = TRUSTM_EMU_ERR_SEQUENCE;
+            break;
+        }
+        if ((return_status = __emu_hash(EMU_SEQ_START, &hash_ctx, 0, NULL, NULL)) != OPTIGA_LIB_SUCCESS)
+            break;
+        return_status = __emu_hash(EMU_SEQ_CONTINUE, &hash_ctx, source_of_data_to_hash, data_to_hash, NULL);
+        // Finalize also releases the digest context on error
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            __emu_hash(EMU_SEQ_FINAL, &hash_ctx, 0, NULL, hash_output);
+        else
+            return_status = __emu_hash(EMU_SEQ_FINAL, &hash_ctx, 0, NULL, hash_output);
+    }while(0);
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HASH,
+                        (source_of_data_to_hash == OPTIGA_CRYPT_HOST_DATA) ?
+                        ((const hash_data_from_host_t *)data_to_hash)->length : 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_hash_start(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((hash_ctx == NULL) || (hash_ctx->context_buffer == NULL) ||
+        (hash_ctx->context_buffer_length < sizeof(emu_hash_ctx_t)))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_hash(EMU_SEQ_START, hash_ctx, 0, NULL, NULL)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HASH, 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_hash_update(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx,
+                                                uint8_t source_of_data_to_hash, const void * data_to_hash)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((hash_ctx == NULL) || (hash_ctx->context_buffer == NULL) || (data_to_hash == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_hash(EMU_SEQ_CONTINUE, hash_ctx, source_of_data_to_hash,
+                                                        data_to_hash, NULL)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HASH,
+                        (source_of_data_to_hash == OPTIGA_CRYPT_HOST_DATA) ?
+                        ((const hash_data_from_host_t *)data_to_hash)->length : 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_hash_finalize(optiga_crypt_t * me, optiga_hash_context_t * hash_ctx,
+                                                uint8_t * hash_output)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((hash_ctx == NULL) || (hash_ctx->context_buffer == NULL) || (hash_output == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_hash(EMU_SEQ_FINAL, hash_ctx, 0, NULL, hash_output)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HASH, 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_ecc_generate_keypair(optiga_crypt_t * me, optiga_ecc_curve_t curve_id,
+                                                        uint8_t key_usage, bool_t export_private_key,
+                                                        void * private_key, uint8_t * public_key,
+                                                        uint16_t * public_key_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((private_key == NULL) || (public_key == NULL) || (public_key_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_ecc_keygen((uint8_t)curve_id, key_usage, export_private_key,
+                                                            private_key, public_key, public_key_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_ECC_KEYGEN, 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_ecdsa_sign(optiga_crypt_t * me, const uint8_t * digest, uint8_t digest_length,
+                                            optiga_key_id_t private_key, uint8_t * signature,
+                                            uint16_t * signature_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((digest == NULL) || (signature == NULL) || (signature_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_ecdsa_sign(digest, digest_length, private_key,
+                                                            signature, signature_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_ECDSA_SIGN, digest_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_ecdsa_verify(optiga_crypt_t * me, const uint8_t * digest, uint8_t digest_length,
+                                                const uint8_t * signature, uint16_t signature_length,
+                                                uint8_t public_key_source_type, const void * public_key)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((digest == NULL) || (signature == NULL) || (public_key == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_verify(NULL, digest, digest_length, signature, signature_length,
+                                                        public_key_source_type, public_key)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_ECDSA_VERIFY, digest_length + signature_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_rsa_generate_keypair(optiga_crypt_t * me, optiga_rsa_key_type_t key_type,
+                                                        uint8_t key_usage, bool_t export_private_key,
+                                                        void * private_key, uint8_t * public_key,
+                                                        uint16_t * public_key_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((private_key == NULL) || (public_key == NULL) || (public_key_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_rsa_keygen(key_type, key_usage, export_private_key,
+                                                            private_key, public_key, public_key_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RSA_KEYGEN, 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_rsa_sign(optiga_crypt_t * me, optiga_rsa_signature_scheme_t signature_scheme,
+                                            const uint8_t * digest, uint8_t digest_length,
+                                            optiga_key_id_t private_key, uint8_t * signature,
+                                            uint16_t * signature_length, uint16_t salt_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    (void)salt_length;
+    if ((digest == NULL) || (signature == NULL) || (signature_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_rsa_sign(signature_scheme, digest, digest_length, private_key,
+                                                            signature, signature_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RSA_SIGN, digest_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_rsa_verify(optiga_crypt_t * me, optiga_rsa_signature_scheme_t signature_scheme,
+                                            const uint8_t * digest, uint8_t digest_length,
+                                            const uint8_t * signature, uint16_t signature_length,
+                                            uint8_t public_key_source_type, const void * public_key,
+                                            uint16_t salt_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+    const EVP_MD *md = __emu_rsa_md(signature_scheme);
+
+    (void)salt_length;
+    if ((digest == NULL) || (signature == NULL) || (public_key == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    if (!trustm_emu_opened())
+        return_status = TRUSTM_EMU_ERR_SEQUENCE;
+    else if (md == NULL)
+        return_status = TRUSTM_EMU_ERR_INVALID_PARAM;
+    else
+        return_status = __emu_verify(md, digest, digest_length, signature, signature_length,
+                                        public_key_source_type, public_key);
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RSA_VERIFY, digest_length + signature_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_rsa_encrypt_message(optiga_crypt_t * me,
+                                                        optiga_rsa_encryption_scheme_t encryption_scheme,
+                                                        const uint8_t * message, uint16_t message_length,
+                                                        const uint8_t * label, uint16_t label_length,
+                                                        uint8_t public_key_source_type, const void * public_key,
+                                                        uint8_t * encrypted_message,
+                                                        uint16_t * encrypted_message_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    (void)label;
+    (void)label_length;
+    if ((message == NULL) || (public_key == NULL) || (encrypted_message == NULL) ||
+        (encrypted_message_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_rsa_crypt(1, encryption_scheme, message, message_length,
+                                                            public_key_source_type, public_key,
+                                                            encrypted_message, encrypted_message_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RSA_ENC, message_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_rsa_decrypt_and_export(optiga_crypt_t * me,
+                                                        optiga_rsa_encryption_scheme_t encryption_scheme,
+                                                        const uint8_t * encrypted_message,
+                                                        uint16_t encrypted_message_length,
+                                                        const uint8_t * label, uint16_t label_length,
+                                                        optiga_key_id_t private_key, uint8_t * message,
+                                                        uint16_t * message_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    (void)label;
+    (void)label_length;
+    if ((encrypted_message == NULL) || (message == NULL) || (message_length == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_rsa_crypt(0, encryption_scheme, encrypted_message,
+                                                            encrypted_message_length, 0, &private_key,
+                                                            message, message_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_RSA_DEC, encrypted_message_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_symmetric_cmd()
+* Common part of the symmetric encrypt and decrypt commands.
+**********************************************************************/
+static optiga_lib_status_t __emu_symmetric_cmd(optiga_crypt_t * me, uint8_t step, uint8_t encrypt,
+                                                uint8_t mode, optiga_key_id_t key,
+                                                const uint8_t * in, uint32_t in_length,
+                                                const uint8_t * iv, uint16_t iv_length,
+                                                uint8_t * out, uint32_t * out_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+    uint32_t none = 0;
+
+    if ((in == NULL) && (in_length != 0))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    // MAC sequences produce no output before the final command
+    if (out_length == NULL)
+        out_length = &none;
+    if ((out == NULL) && (*out_length != 0))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_symmetric(inst, step, encrypt, mode, key, iv, iv_length,
+                                                            in, in_length, out, out_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_SYMMETRIC, in_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_encrypt(optiga_crypt_t * me,
+                                                    optiga_symmetric_encryption_mode_t encryption_mode,
+                                                    optiga_key_id_t symmetric_key_oid,
+                                                    const uint8_t * plain_data, uint32_t plain_data_length,
+                                                    const uint8_t * iv, uint16_t iv_length,
+                                                    const uint8_t * associated_data,
+                                                    uint16_t associated_data_length,
+                                                    uint8_t * encrypted_data, uint32_t * encrypted_data_length)
+{
+    (void)associated_data;
+    (void)associated_data_length;
+    return __emu_symmetric_cmd(me, EMU_SEQ_ONESHOT, 1, (uint8_t)encryption_mode, symmetric_key_oid,
+                                plain_data, plain_data_length, iv, iv_length,
+                                encrypted_data, encrypted_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_decrypt(optiga_crypt_t * me,
+                                                    optiga_symmetric_encryption_mode_t encryption_mode,
+                                                    optiga_key_id_t symmetric_key_oid,
+                                                    const uint8_t * encrypted_data, uint32_t encrypted_data_length,
+                                                    const uint8_t * iv, uint16_t iv_length,
+                                                    const uint8_t * associated_data,
+                                                    uint16_t associated_data_length,
+                                                    uint8_t * plain_data, uint32_t * plain_data_length)
+{
+    (void)associated_data;
+    (void)associated_data_length;
+    return __emu_symmetric_cmd(me, EMU_SEQ_ONESHOT, 0, (uint8_t)encryption_mode, symmetric_key_oid,
+                                encrypted_data, encrypted_data_length, iv, iv_length,
+                                plain_data, plain_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_start(optiga_crypt_t * me,
+                                                            optiga_symmetric_encryption_mode_t encryption_mode,
+                                                            optiga_key_id_t symmetric_key_oid,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            const uint8_t * iv, uint16_t iv_length,
+                                                            const uint8_t * associated_data,
+                                                            uint16_t associated_data_length,
+                                                            uint16_t total_plain_data_length,
+                                                            uint8_t * encrypted_data,
+                                                            uint32_t * encrypted_data_length)
+{
+    (void)associated_data;
+    (void)associated_data_length;
+    (void)total_plain_data_length;
+    return __emu_symmetric_cmd(me, EMU_SEQ_START, 1, (uint8_t)encryption_mode, symmetric_key_oid,
+                                plain_data, plain_data_length, iv, iv_length,
+                                encrypted_data, encrypted_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_continue(optiga_crypt_t * me,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            uint8_t * encrypted_data,
+                                                            uint32_t * encrypted_data_length)
+{
+    return __emu_symmetric_cmd(me, EMU_SEQ_CONTINUE, 1, 0, 0, plain_data, plain_data_length, NULL, 0,
+                                encrypted_data, encrypted_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_encrypt_final(optiga_crypt_t * me,
+                                                            const uint8_t * plain_data, uint32_t plain_data_length,
+                                                            uint8_t * encrypted_data,
+                                                            uint32_t * encrypted_data_length)
+{
+    return __emu_symmetric_cmd(me, EMU_SEQ_FINAL, 1, 0, 0, plain_data, plain_data_length, NULL, 0,
+                                encrypted_data, encrypted_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_start(optiga_crypt_t * me,
+                                                            optiga_symmetric_encryption_mode_t encryption_mode,
+                                                            optiga_key_id_t symmetric_key_oid,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            const uint8_t * iv, uint16_t iv_length,
+                                                            const uint8_t * associated_data,
+                                                            uint16_t associated_data_length,
+                                                            uint16_t total_encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length)
+{
+    (void)associated_data;
+    (void)associated_data_length;
+    (void)total_encrypted_data_length;
+    return __emu_symmetric_cmd(me, EMU_SEQ_START, 0, (uint8_t)encryption_mode, symmetric_key_oid,
+                                encrypted_data, encrypted_data_length, iv, iv_length,
+                                plain_data, plain_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_continue(optiga_crypt_t * me,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length)
+{
+    return __emu_symmetric_cmd(me, EMU_SEQ_CONTINUE, 0, 0, 0, encrypted_data, encrypted_data_length, NULL, 0,
+                                plain_data, plain_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_decrypt_final(optiga_crypt_t * me,
+                                                            const uint8_t * encrypted_data,
+                                                            uint32_t encrypted_data_length,
+                                                            uint8_t * plain_data, uint32_t * plain_data_length)
+{
+    return __emu_symmetric_cmd(me, EMU_SEQ_FINAL, 0, 0, 0, encrypted_data, encrypted_data_length, NULL, 0,
+                                plain_data, plain_data_length);
+}
+
+optiga_lib_status_t optiga_crypt_symmetric_generate_key(optiga_crypt_t * me,
+                                                        optiga_symmetric_key_type_t key_type,
+                                                        uint8_t key_usage, bool_t export_symmetric_key,
+                                                        void * symmetric_key)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if (symmetric_key == NULL)
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_symmetric_keygen(key_type, key_usage, export_symmetric_key,
+                                                                    symmetric_key)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_SYM_KEYGEN, 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_hmac_cmd()
+* Common part of the HMAC commands.
+**********************************************************************/
+static optiga_lib_status_t __emu_hmac_cmd(optiga_crypt_t * me, uint8_t step, optiga_hmac_type_t type,
+                                            uint16_t secret, const uint8_t * input_data,
+                                            uint32_t input_data_length, uint8_t * mac, uint32_t * mac_length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((input_data == NULL) && (input_data_length != 0))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if (((step == EMU_SEQ_FINAL) || (step == EMU_SEQ_ONESHOT)) && ((mac == NULL) || (mac_length == NULL)))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_hmac(inst, step, type, secret, input_data, input_data_length,
+                                                        mac, mac_length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HMAC, input_data_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_crypt_hmac(optiga_crypt_t * me, optiga_hmac_type_t type, uint16_t secret,
+                                        const uint8_t * input_data, uint32_t input_data_length,
+                                        uint8_t * mac, uint32_t * mac_length)
+{
+    return __emu_hmac_cmd(me, EMU_SEQ_ONESHOT, type, secret, input_data, input_data_length, mac, mac_length);
+}
+
+optiga_lib_status_t optiga_crypt_hmac_start(optiga_crypt_t * me, optiga_hmac_type_t type, uint16_t secret,
+                                            const uint8_t * input_data, uint32_t input_data_length)
+{
+    return __emu_hmac_cmd(me, EMU_SEQ_START, type, secret, input_data, input_data_length, NULL, NULL);
+}
+
+optiga_lib_status_t optiga_crypt_hmac_update(optiga_crypt_t * me, const uint8_t * input_data,
+                                                uint32_t input_data_length)
+{
+    return __emu_hmac_cmd(me, EMU_SEQ_CONTINUE, 0, 0, input_data, input_data_length, NULL, NULL);
+}
+
+optiga_lib_status_t optiga_crypt_hmac_finalize(optiga_crypt_t * me, const uint8_t * input_data,
+                                                uint32_t input_data_length, uint8_t * mac, uint32_t * mac_length)
+{
+    return __emu_hmac_cmd(me, EMU_SEQ_FINAL, 0, 0, input_data, input_data_length, mac, mac_length);
+}
+
+optiga_lib_status_t optiga_crypt_hkdf(optiga_crypt_t * me, optiga_hkdf_type_t type, uint16_t secret,
+                                        const uint8_t * salt, uint16_t salt_length,
+                                        const uint8_t * info, uint16_t info_length,
+                                        uint16_t derived_key_length, bool_t export_to_host,
+                                        uint8_t * derived_key)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if (((salt == NULL) && (salt_length != 0)) || ((info == NULL) && (info_length != 0)) ||
+        (derived_key == NULL))
+        return OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 1, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_hkdf((uint8_t)type, secret, salt, salt_length, info, info_length,
+                                                        derived_key_length, export_to_host, derived_key)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_HKDF, salt_length + info_length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
@@ -0,0 +1,457 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trustm_emulator.h"
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __emu_write_file()
+**********************************************************************/
+static int __emu_write_file(const char *filename, const uint8_t *buf, uint16_t len)
+{
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+        return -1;
+    if (fwrite(buf, 1, len, fp) != len)
+        ret = -1;
+    fclose(fp);
+    return ret;
+}
+
+/**********************************************************************
+* __emu_access()
+* Checks the access condition tag (0xD0 change, 0xD1 read) of oid.
+* Only NEV (0xFF) is enforced. Store lock must be held.
+**********************************************************************/
+static optiga_lib_status_t __emu_access(trustm_emu_store_t *store, trustm_emu_object_t *obj,
+                                        uint16_t oid, uint8_t tag)
+{
+    uint8_t meta[2 * TRUSTM_EMU_METADATA_SIZE];
+    uint8_t value[TRUSTM_EMU_METADATA_SIZE];
+    uint16_t len;
+
+    len = trustm_emu_metadata(obj, oid, meta);
+    if ((trustm_emu_metadata_tag(meta+2, len-2, tag, value) == 1) && (value[0] == 0xFF))
+    {
+        trustm_emu_security_event(store);
+        return TRUSTM_EMU_ERR_ACCESS;
+    }
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_open() / __emu_close()
+* Hibernate saves an application context the next open can restore,
+* only possible while the security event counter is 0.
+**********************************************************************/
+static optiga_lib_status_t __emu_open(uint8_t restore)
+{
+    if (restore)
+    {
+        if ((access(TRUSTM_EMU_HIBERNATE_CTX_FILENAME, F_OK) == -1) ||
+            (access(TRUSTM_EMU_CTX_FILENAME, F_OK) == -1))
+            return TRUSTM_EMU_ERR_SEQUENCE;
+        remove(TRUSTM_EMU_HIBERNATE_CTX_FILENAME);
+    }
+    trustm_emu_set_open(1);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+static optiga_lib_status_t __emu_close(uint8_t hibernate)
+{
+    trustm_emu_store_t *store;
+    uint8_t ctx[8];
+    uint8_t sec;
+
+    if (!trustm_emu_opened())
+        return TRUSTM_EMU_ERR_SEQUENCE;
+
+    if (hibernate)
+    {
+        if ((store = trustm_emu_lock()) == NULL)
+            return TRUSTM_EMU_ERR_INTERNAL;
+        sec = store->sec;
+        trustm_emu_unlock();
+        if (sec != 0)
+            return TRUSTM_EMU_ERR_SEQUENCE;
+
+        trustm_emu_random(ctx, sizeof(ctx));
+        if ((__emu_write_file(TRUSTM_EMU_CTX_FILENAME, ctx, sizeof(ctx)) != 0) ||
+            (__emu_write_file(TRUSTM_EMU_HIBERNATE_CTX_FILENAME, ctx, sizeof(ctx)) != 0))
+            return TRUSTM_EMU_ERR_INTERNAL;
+    }
+    trustm_emu_set_open(0);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+/**********************************************************************
+* __emu_read_data()
+**********************************************************************/
+static optiga_lib_status_t __emu_read_data(uint16_t oid, uint16_t offset, uint8_t *buffer, uint16_t *length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+    const uint8_t *data;
+    uint16_t len;
+
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        if (trustm_emu_object_size(oid) == 0)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+        obj = trustm_emu_object(store, oid, 0);
+        if ((status = __emu_access(store, obj, oid, 0xD1)) != OPTIGA_LIB_SUCCESS)
+            break;
+
+        if (oid == 0xE0C5)
+        {
+            data = &store->sec;
+            len = 1;
+        }
+        else
+        {
+            data = (obj != NULL) ? obj->data : NULL;
+            len = (obj != NULL) ? obj->len : 0;
+        }
+        if (offset > len)
+        {
+            status = TRUSTM_EMU_ERR_BOUNDARY;
+            break;
+        }
+        if (*length > (len - offset))
+            *length = len - offset;
+        if (*length != 0)
+            memcpy(buffer, data+offset, *length);
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_write_data()
+**********************************************************************/
+static optiga_lib_status_t __emu_write_data(uint16_t oid, uint8_t write_type, uint16_t offset,
+                                            const uint8_t *buffer, uint16_t length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        if ((trustm_emu_object_size(oid) == 0) || trustm_emu_is_key(oid))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+        obj = trustm_emu_object(store, oid, 0);
+        if ((status = __emu_access(store, obj, oid, 0xD0)) != OPTIGA_LIB_SUCCESS)
+            break;
+        if (((uint32_t)offset + length) > trustm_emu_object_size(oid))
+        {
+            status = TRUSTM_EMU_ERR_BOUNDARY;
+            break;
+        }
+        if ((obj == NULL) && ((obj = trustm_emu_object(store, oid, 1)) == NULL))
+        {
+            TRUSTM_EMU_ERRFN("Object store full");
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+
+        if (write_type == OPTIGA_UTIL_ERASE_AND_WRITE)
+        {
+            memset(obj->data, 0, sizeof(obj->data));
+            obj->len = 0;
+        }
+        memcpy(obj->data+offset, buffer, length);
+        if ((offset + length) > obj->len)
+            obj->len = offset + length;
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_read_metadata()
+**********************************************************************/
+static optiga_lib_status_t __emu_read_metadata(uint16_t oid, uint8_t *buffer, uint16_t *length)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    uint8_t meta[2 * TRUSTM_EMU_METADATA_SIZE];
+    trustm_emu_store_t *store;
+    uint16_t len;
+
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        if (trustm_emu_object_size(oid) == 0)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+        len = trustm_emu_metadata(trustm_emu_object(store, oid, 0), oid, meta);
+        if (len > *length)
+        {
+            status = OPTIGA_UTIL_ERROR_MEMORY_INSUFFICIENT;
+            break;
+        }
+        memcpy(buffer, meta, len);
+        *length = len;
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_write_metadata()
+**********************************************************************/
+static optiga_lib_status_t __emu_write_metadata(uint16_t oid, const uint8_t *buffer, uint8_t length)
+{
+    optiga_lib_status_t status;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        if (trustm_emu_object_size(oid) == 0)
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+        if ((obj = trustm_emu_object(store, oid, 1)) == NULL)
+        {
+            TRUSTM_EMU_ERRFN("Object store full");
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        status = trustm_emu_write_metadata(obj, oid, buffer, length);
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/**********************************************************************
+* __emu_update_count()
+* Counter objects hold a 4 byte count followed by a 4 byte threshold,
+* both big endian. A counter never written has no threshold.
+**********************************************************************/
+static optiga_lib_status_t __emu_update_count(uint16_t oid, uint8_t count)
+{
+    optiga_lib_status_t status = OPTIGA_LIB_SUCCESS;
+    trustm_emu_store_t *store;
+    trustm_emu_object_t *obj;
+    uint32_t value = 0;
+    uint32_t threshold = 0xFFFFFFFF;
+    int i;
+
+    if ((store = trustm_emu_lock()) == NULL)
+        return TRUSTM_EMU_ERR_INTERNAL;
+    do
+    {
+        if ((oid < 0xE120) || (oid > 0xE123))
+        {
+            status = TRUSTM_EMU_ERR_INVALID_OID;
+            break;
+        }
+        if ((obj = trustm_emu_object(store, oid, 1)) == NULL)
+        {
+            status = TRUSTM_EMU_ERR_INTERNAL;
+            break;
+        }
+        if (obj->len == 8)
+        {
+            value = ((uint32_t)obj->data[0] << 24) | ((uint32_t)obj->data[1] << 16) |
+                    ((uint32_t)obj->data[2] << 8) | obj->data[3];
+            threshold = ((uint32_t)obj->data[4] << 24) | ((uint32_t)obj->data[5] << 16) |
+                        ((uint32_t)obj->data[6] << 8) | obj->data[7];
+        }
+        if (((uint64_t)value + count) > threshold)
+        {
+            value = threshold;
+            status = TRUSTM_EMU_ERR_COUNTER;
+        }
+        else
+        {
+            value += count;
+        }
+        for (i = 0; i < 4; i++)
+        {
+            obj->data[i] = (uint8_t)(value >> (24 - (8 * i)));
+            obj->data[4+i] = (uint8_t)(threshold >> (24 - (8 * i)));
+        }
+        obj->len = 8;
+    }while(0);
+    trustm_emu_unlock();
+
+    return status;
+}
+
+/*************************************************************************
+*  optiga_util API
+*************************************************************************/
+optiga_util_t * optiga_util_create(uint8_t optiga_instance_id, callback_handler_t handler, void * caller_context)
+{
+    (void)optiga_instance_id;
+    return trustm_emu_instance_new(sizeof(optiga_util_t), 0, handler, caller_context);
+}
+
+optiga_lib_status_t optiga_util_destroy(optiga_util_t * me)
+{
+    return trustm_emu_instance_free(me);
+}
+
+// The shielded connection is not modelled, the data never leaves the host
+void optiga_util_set_comms_params(optiga_util_t * me, uint8_t parameter_type, uint8_t value)
+{
+    (void)me;
+    (void)parameter_type;
+    (void)value;
+}
+
+optiga_lib_status_t optiga_util_open_application(optiga_util_t * me, bool_t perform_restore)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_OPEN, 0, __emu_open(perform_restore));
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_close_application(optiga_util_t * me, bool_t perform_hibernate)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_CLOSE, 0, __emu_close(perform_hibernate));
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_read_data(optiga_util_t * me, uint16_t optiga_oid, uint16_t offset,
+                                            uint8_t * buffer, uint16_t * length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((buffer == NULL) || (length == NULL))
+        return OPTIGA_UTIL_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_read_data(optiga_oid, offset, buffer, length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_READ,
+                        (return_status == OPTIGA_LIB_SUCCESS) ? *length : 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_read_metadata(optiga_util_t * me, uint16_t optiga_oid,
+                                                uint8_t * buffer, uint16_t * length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((buffer == NULL) || (length == NULL))
+        return OPTIGA_UTIL_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_read_metadata(optiga_oid, buffer, length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_READ_META,
+                        (return_status == OPTIGA_LIB_SUCCESS) ? *length : 0, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_write_data(optiga_util_t * me, uint16_t optiga_oid, uint8_t write_type,
+                                            uint16_t offset, const uint8_t * buffer, uint16_t length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((buffer == NULL) && (length != 0))
+        return OPTIGA_UTIL_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_write_data(optiga_oid, write_type, offset, buffer, length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_WRITE, length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_write_metadata(optiga_util_t * me, uint16_t optiga_oid,
+                                                const uint8_t * buffer, uint8_t length)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if (buffer == NULL)
+        return OPTIGA_UTIL_ERROR_INVALID_INPUT;
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_write_metadata(optiga_oid, buffer, length)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_WRITE_META, length, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
+
+optiga_lib_status_t optiga_util_update_count(optiga_util_t * me, uint16_t optiga_counter_oid, uint8_t count)
+{
+    trustm_emu_instance_t *inst;
+    optiga_lib_status_t return_status;
+
+    if ((return_status = trustm_emu_begin(me, 0, &inst)) != OPTIGA_LIB_SUCCESS)
+        return return_status;
+    return_status = trustm_emu_opened() ? __emu_update_count(optiga_counter_oid, count)
+                                        : TRUSTM_EMU_ERR_SEQUENCE;
+    trustm_emu_complete(inst, TRUSTM_EMU_CMD_COUNT, 1, return_status);
+    return OPTIGA_LIB_SUCCESS;
+}
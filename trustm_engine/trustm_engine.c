@@ -29,24 +29,112 @@
 
 #include "optiga/pal/pal_ifx_i2c_config.h"
 #include "trustm_helper.h"
+#include "trustm_broker.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_trace.h"
+#include "trustm_helper_sec.h"
+#include "trustm_helper_shield.h"
 
 #include "trustm_engine_common.h"
 #include "trustm_engine_ipc_lock.h"
 
 
-#ifdef WORKAROUND
-	extern void pal_os_event_disarm(void);
-	extern void pal_os_event_arm(void);
-	extern void pal_os_event_destroy1(void);
-#endif
-
 trustm_ctx_t trustm_ctx;
 
-extern void pal_os_event_disarm(void);
-
 static const char *engine_id   = "trustm_engine";
 static const char *engine_name = "Infineon OPTIGA TrustM Engine";
 
+// Engine control commands
+#define TRUSTM_ENGINE_CMD_SESSION       (ENGINE_CMD_BASE)
+#define TRUSTM_ENGINE_CMD_BROKER        (ENGINE_CMD_BASE+1)
+#define TRUSTM_ENGINE_CMD_ASYNC         (ENGINE_CMD_BASE+2)
+#define TRUSTM_ENGINE_CMD_THREADS       (ENGINE_CMD_BASE+3)
+#define TRUSTM_ENGINE_CMD_RAND_POOL     (ENGINE_CMD_BASE+4)
+#define TRUSTM_ENGINE_CMD_RAND_MODE     (ENGINE_CMD_BASE+5)
+#define TRUSTM_ENGINE_CMD_RAND_RESEED   (ENGINE_CMD_BASE+6)
+#define TRUSTM_ENGINE_CMD_RAND_PR       (ENGINE_CMD_BASE+7)
+#define TRUSTM_ENGINE_CMD_STATS         (ENGINE_CMD_BASE+8)
+#define TRUSTM_ENGINE_CMD_STATS_RESET   (ENGINE_CMD_BASE+9)
+#define TRUSTM_ENGINE_CMD_STATS_GET     (ENGINE_CMD_BASE+10)
+#define TRUSTM_ENGINE_CMD_TRACE         (ENGINE_CMD_BASE+11)
+#define TRUSTM_ENGINE_CMD_TRACE_DUMP    (ENGINE_CMD_BASE+12)
+#define TRUSTM_ENGINE_CMD_SEC_GOV       (ENGINE_CMD_BASE+13)
+#define TRUSTM_ENGINE_CMD_SEC_GOV_LIMITS (ENGINE_CMD_BASE+14)
+#define TRUSTM_ENGINE_CMD_SHIELD        (ENGINE_CMD_BASE+15)
+#define TRUSTM_ENGINE_CMD_SHIELD_REKEY  (ENGINE_CMD_BASE+16)
+
+static const ENGINE_CMD_DEFN engine_cmd_defns[] = {
+    {TRUSTM_ENGINE_CMD_SESSION,
+     "SESSION",
+     "Keep the OPTIGA application open across operations (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_BROKER,
+     "BROKER",
+     "Forward operations to trustm_broker listening on the given socket",
+     ENGINE_CMD_FLAG_STRING},
+    {TRUSTM_ENGINE_CMD_ASYNC,
+     "ASYNC",
+     "Pause ASYNC jobs while waiting for the chip (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_THREADS,
+     "THREADS",
+     "Schedule operations of all threads over a pool of crypt instances (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_RAND_POOL,
+     "RAND_POOL",
+     "Serve random bytes from a shared pool of TRNG output (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_RAND_MODE,
+     "RAND_MODE",
+     "Random source (0:TRNG 1:CTR_DRBG seeded from the TRNG)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_RAND_RESEED,
+     "RAND_RESEED",
+     "Number of CTR_DRBG requests between reseeds from the TRNG",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_RAND_PR,
+     "RAND_PR",
+     "CTR_DRBG prediction resistance, reseed before every request (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_STATS,
+     "STATS",
+     "Record operation latencies for trustm_stats (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_STATS_RESET,
+     "STATS_RESET",
+     "Clear the latency statistics of this process",
+     ENGINE_CMD_FLAG_NO_INPUT},
+    {TRUSTM_ENGINE_CMD_STATS_GET,
+     "STATS_GET",
+     "Copy the latency statistics of this process to a trustm_stats_proc_t",
+     ENGINE_CMD_FLAG_INTERNAL},
+    {TRUSTM_ENGINE_CMD_TRACE,
+     "TRACE",
+     "Record I2C, frame, APDU and operation events of this process (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_TRACE_DUMP,
+     "TRACE_DUMP",
+     "Write the recorded events to the given file in Chrome trace format",
+     ENGINE_CMD_FLAG_STRING},
+    {TRUSTM_ENGINE_CMD_SEC_GOV,
+     "SEC_GOV",
+     "Delay and shed work before the security event counter makes the chip throttle (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_SEC_GOV_LIMITS,
+     "SEC_GOV_LIMITS",
+     "Counter values from which random refills are dropped and all work is delayed, <shed>:<queue>",
+     ENGINE_CMD_FLAG_STRING},
+    {TRUSTM_ENGINE_CMD_SHIELD,
+     "SHIELD",
+     "Run the commands over a shielded connection kept for the session (0:off 1:on)",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {TRUSTM_ENGINE_CMD_SHIELD_REKEY,
+     "SHIELD_REKEY",
+     "Number of shielded commands between handshakes, 0 only after errors",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {0, NULL, NULL, 0}
+};
+
 /**********************************************************************
 * mssleep()
 **********************************************************************/
@@ -75,8 +163,9 @@ int mssleep(long msec)
 **********************************************************************/
 void engine_optiga_util_callback(void * context, optiga_lib_status_t return_status)
 {
-    optiga_lib_status = return_status;
-    TRUSTM_HELPER_DBGFN("optiga_lib_status: %x\n",optiga_lib_status);
+    trustm_SetStatus(return_status);
+    trustmEngine_async_wake();
+    TRUSTM_HELPER_DBGFN("optiga_lib_status: %x\n",return_status);
 }
 
 /**********************************************************************
@@ -84,7 +173,8 @@ void engine_optiga_util_callback(void * context, optiga_lib_status_t return_stat
 **********************************************************************/
 void engine_optiga_crypt_callback(void * context, optiga_lib_status_t return_status)
 {
-    optiga_lib_status = return_status;
+    trustm_SetStatus(return_status);
+    trustmEngine_async_wake();
     if (NULL != context)
     {
         // callback to upper layer here
@@ -92,38 +182,72 @@ void engine_optiga_crypt_callback(void * context, optiga_lib_status_t return_sta
 }
 
 /**********************************************************************
-* __trustmEngine_delay()
+* trustmEngine_WaitForCompletion()
 **********************************************************************/
-static void __trustmEngine_delay (int cnt)
+optiga_lib_status_t trustmEngine_WaitForCompletion(uint16_t wait_time)
 {
-    uint32_t wait;
-
-    for(wait=0;wait<(0x1fffffff*cnt);wait++)
-    {}
+    return trustmEngine_async_WaitForCompletion(wait_time);
 }
 
 /**********************************************************************
-* trustmEngine_WaitForCompletion()
+* trustmEngine_read_data()
+* optiga_util_read_data() or the broker, waits for completion
 **********************************************************************/
-optiga_lib_status_t trustmEngine_WaitForCompletion(uint16_t wait_time)
+optiga_lib_status_t trustmEngine_read_data(uint16_t oid, uint16_t offset, uint8_t *buf, uint16_t *len)
 {
-    uint16_t tickcount;
-     
-    tickcount=0;
+    optiga_lib_status_t return_status;
+    trustm_stats_frame_t stats;
+    uint64_t t0;
+
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_READ_DATA);
+    t0 = trustmEngine_stats_clock();
     do
     {
-        mssleep(1);
-        tickcount++;
-        if (tickcount >= wait_time)
+        if (trustm_ctx.broker)
         {
-            TRUSTM_ENGINE_ERRFN("Fail : Optiga Busy Time Out:%d\n",tickcount);
-            return OPTIGA_LIB_BUSY;
+            return_status = trustm_broker_read_data(oid, offset, buf, len);
+            break;
         }
-         
-    }while (optiga_lib_status == OPTIGA_LIB_BUSY);
-    TRUSTM_ENGINE_DBGFN(" max wait_time:%d, Tick Counter: %d", wait_time,tickcount);
-    return optiga_lib_status;
-    
+
+        if (trustm_ctx.shield)
+            TRUSTM_SHIELD_UTIL(me_util, OPTIGA_COMMS_FULL_PROTECTION);
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        return_status = optiga_util_read_data(me_util,
+                                            oid,
+                                            offset,
+                                            buf,
+                                            len);
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            break;
+        //Wait until the optiga_util_read_data operation is completed
+        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        return_status = optiga_lib_status;
+        trustm_shield_result(return_status);
+        trustmEngine_sec_gov_result(return_status);
+    }while(FALSE);
+    trustmEngine_stats_phase(TRUSTM_STATS_CHIP, t0);
+    trustmEngine_stats_end(&stats, return_status == OPTIGA_LIB_SUCCESS);
+    return return_status;
+}
+
+/**********************************************************************
+* trustmEngine_read_metadata()
+* trustmReadMetadataRaw() or the broker, the metadata cache is used in
+* both cases
+**********************************************************************/
+optiga_lib_status_t trustmEngine_read_metadata(uint16_t oid, uint8_t *buf, uint16_t *len)
+{
+    optiga_lib_status_t return_status;
+
+    if (trustm_ctx.broker == 0)
+        return trustmReadMetadataRaw(oid, buf, len);
+
+    if (trustm_cache_metadata_get(oid, buf, len) == 0)
+        return OPTIGA_LIB_SUCCESS;
+    return_status = trustm_broker_read_metadata(oid, buf, len);
+    if (return_status == OPTIGA_LIB_SUCCESS)
+        trustm_cache_metadata_put(oid, buf, *len);
+    return return_status;
 }
 
 /**********************************************************************
@@ -173,6 +297,55 @@ static uint8_t __trustmEngine_secCnt(void)
     return read_data_buffer[0];
 }
 
+/**********************************************************************
+* __trustmEngine_sec_gov_sample()
+* Reads the security event counter for the governor when a reading is
+* due, the application is open and the IPC lock held.
+**********************************************************************/
+static void __trustmEngine_sec_gov_sample(void)
+{
+    uint8_t secCnt;
+
+    if ((trustm_ctx.secGov == 0) || (trustm_sec_gov_due() == 0))
+        return;
+    secCnt = __trustmEngine_secCnt();
+    if (optiga_lib_status == OPTIGA_LIB_SUCCESS)
+        trustm_sec_gov_sample(secCnt);
+}
+
+/**********************************************************************
+* trustmEngine_sec_gov_admit()
+* Called before work is submitted to the chip. Waits while the governor
+* queues the work, an ASYNC job is paused meanwhile. Returns 0 if the
+* work is shed and must not be submitted.
+**********************************************************************/
+int trustmEngine_sec_gov_admit(uint8_t prio)
+{
+    uint32_t wait;
+    int decision;
+
+    if (trustm_ctx.secGov == 0)
+        return 1;
+    while ((decision = trustm_sec_gov_admit(prio, &wait)) == TRUSTM_SEC_GOV_QUEUE_WORK)
+    {
+        TRUSTM_ENGINE_DBGFN("SEC high, delay %u ms", wait);
+        trustmEngine_async_sleep(wait);
+    }
+    if (decision == TRUSTM_SEC_GOV_SHED_WORK)
+        TRUSTM_ENGINE_DBGFN("SEC high, shed");
+    return (decision != TRUSTM_SEC_GOV_SHED_WORK);
+}
+
+/**********************************************************************
+* trustmEngine_sec_gov_result()
+* Status of a finished command for the governor
+**********************************************************************/
+void trustmEngine_sec_gov_result(optiga_lib_status_t ret)
+{
+    if (trustm_ctx.secGov != 0)
+        trustm_sec_gov_result(ret);
+}
+
 /**********************************************************************
 * trustmEngine_Open()
 **********************************************************************/
@@ -188,7 +361,11 @@ optiga_lib_status_t trustmEngine_Open(void)
         //pal_gpio_init(&optiga_vdd_0);
         
         //Create an instance of optiga_util to open the application on OPTIGA.
-        trustmEngine_ipc_acquire();
+        if (trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS)
+        {
+            return_status = OPTIGA_LIB_BUSY;
+            break;
+        }
         if (me_util == NULL)
         {
              me_util = optiga_util_create(0, engine_optiga_util_callback, NULL);
@@ -266,6 +443,7 @@ optiga_lib_status_t trustmEngine_App_Open_Recovery(void)
 optiga_lib_status_t trustmEngine_App_Open(void)
 {
     optiga_lib_status_t return_status;
+    uint64_t t0 = 0;
 
     TRUSTM_ENGINE_DBGFN(">");
     do
@@ -277,6 +455,7 @@ optiga_lib_status_t trustmEngine_App_Open(void)
             TRUSTM_ENGINE_ERRFN("Fail to create instances");
             break;
         }
+        t0 = trustmEngine_stats_clock();
         /**
          * Open the application on OPTIGA which is a precondition to perform any other operations
          * using optiga_util_open_application
@@ -343,8 +522,11 @@ optiga_lib_status_t trustmEngine_App_Open(void)
         }
         
         trustm_ctx.appOpen = 1;
+        trustm_ctx.sessionGen = trustmEngine_ipc_session_new();
+        trustm_shield_opened(trustm_ctx.sessionGen);
         TRUSTM_ENGINE_DBGFN("Success : optiga_util_open_application \n");
     }while(FALSE);      
+    trustmEngine_stats_phase(TRUSTM_STATS_OPEN, t0);
 
     TRUSTM_ENGINE_DBGFN("<");
     return return_status;
@@ -374,7 +556,6 @@ optiga_lib_status_t trustmEngine_Close(void)
     {   TRUSTM_ENGINE_DBGFN("optiga_util_destroy\n");
         return_status=optiga_util_destroy(me_util);   
     }
-    TRUSTM_WORKAROUND_TIMER_DISARM;
 
     // No point deinit the GPIO as it is a fix pin
     //pal_gpio_deinit(&optiga_reset_0);
@@ -392,7 +573,10 @@ optiga_lib_status_t trustmEngine_Close(void)
 optiga_lib_status_t trustmEngine_App_Close(void)
 {
     optiga_lib_status_t return_status;
-    uint8_t secCnt;
+    uint8_t secCnt, lastCnt = 0;
+    uint32_t wait = 0;
+    uint8_t lost = 0;
+    uint64_t t0 = trustmEngine_stats_clock();
 
     TRUSTM_HELPER_DBGFN(">");
 
@@ -411,12 +595,30 @@ optiga_lib_status_t trustmEngine_App_Close(void)
             secCnt = __trustmEngine_secCnt();
             while (secCnt)
             {
-                TRUSTM_ENGINE_DBGFN("Security Event Counter : %d [waiting. Ctrl+c to abort.]\n",secCnt);
-                __trustmEngine_delay(2);
+                wait = trustm_secCnt_backoff(secCnt, lastCnt, wait);
+                TRUSTM_ENGINE_DBGFN("Security Event Counter : %d [waiting %d ms]\n",secCnt,wait);
+                // Other processes may use the chip while the counter decays,
+                // an ASYNC job is paused instead of blocking the thread
+                trustmEngine_ipc_release();
+                trustmEngine_async_sleep(wait);
+                if ((trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS) ||
+                    (trustm_ctx.sessionGen != trustmEngine_ipc_session_get()))
+                {
+                    lost = 1;
+                    break;
+                }
+                lastCnt = secCnt;
                 secCnt = __trustmEngine_secCnt();
                 if (secCnt == 0)
                     TRUSTM_ENGINE_DBGFN("context saved.\n");
             }
+            if (lost)
+            {
+                // Application re-opened by another process, no context to save
+                TRUSTM_ENGINE_DBGFN("Session %u lost, skip hibernate", trustm_ctx.sessionGen);
+                return_status = OPTIGA_LIB_SUCCESS;
+                break;
+            }
             optiga_lib_status = OPTIGA_LIB_BUSY;
             return_status = optiga_util_close_application(me_util, 1);
         }
@@ -455,13 +657,153 @@ optiga_lib_status_t trustmEngine_App_Close(void)
         trustmPrintErrorCode(return_status);
     trustmEngine_Close();
     trustm_ctx.appOpen = 0;   
-    /// IPC Release 
-    mssleep(30);
+    /// IPC Release, the next ticket is handed over at once
+    trustmEngine_stats_phase(TRUSTM_STATS_CLOSE, t0);
     trustmEngine_ipc_release();
     TRUSTM_ENGINE_DBGFN("<");
     return return_status;
 }
 
+/**********************************************************************
+* trustmEngine_Session_Open()
+* Called before every engine operation. Without session mode this is
+* the full open with recovery. In session mode the application stays
+* open and only the IPC lock is taken, unless no session exists yet or
+* another process has re-opened the application since our last use.
+* On failure nothing is left open or locked, trustmEngine_Session_Close()
+* must not be called then.
+**********************************************************************/
+optiga_lib_status_t trustmEngine_Session_Open(void)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+    uint64_t t0 = trustmEngine_stats_clock();
+
+    TRUSTM_ENGINE_DBGFN(">");
+    trustmEngine_sec_gov_admit(TRUSTM_SEC_GOV_NORMAL);
+    if (trustmEngine_async_begin() != TRUSTM_ENGINE_SUCCESS)
+        return OPTIGA_LIB_BUSY;
+    // Waiting for the governor and other ASYNC jobs of the thread
+    trustmEngine_stats_phase(TRUSTM_STATS_LOCK, t0);
+    do
+    {
+        if (trustm_ctx.sessionMode == 0)
+        {
+            return_status = trustmEngine_App_Open_Recovery();
+            break;
+        }
+
+        if (trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS)
+        {
+            return_status = OPTIGA_LIB_BUSY;
+            break;
+        }
+        if (trustm_ctx.appOpen == 1)
+        {
+            if (trustm_ctx.sessionGen == trustmEngine_ipc_session_get())
+            {
+                TRUSTM_ENGINE_DBGFN("Reuse session %u", trustm_ctx.sessionGen);
+                break;
+            }
+            // Application was re-opened by another process, our instances
+            // refer to a context which no longer exists. Drop them without
+            // closing the application.
+            TRUSTM_ENGINE_DBGFN("Session %u lost, re-open", trustm_ctx.sessionGen);
+            trustmEngine_Close();
+            trustm_ctx.appOpen = 0;
+        }
+
+        trustm_hibernate_flag = 0;
+        return_status = trustmEngine_App_Open();
+        if (return_status != OPTIGA_LIB_SUCCESS)
+        {
+            TRUSTM_ENGINE_DBGFN("Error opening Trust M, Retry 1");
+            trustmEngine_Close();
+            return_status = trustmEngine_App_Open();
+            if (return_status != OPTIGA_LIB_SUCCESS)
+            {
+                TRUSTM_ENGINE_ERRFN("Error opening Trust M session");
+            }
+        }
+    }while(FALSE);
+
+    if (return_status == OPTIGA_LIB_SUCCESS)
+    {
+        __trustmEngine_sec_gov_sample();
+    }
+    else
+    {
+        // The caller returns without trustmEngine_Session_Close(), drop
+        // the instances and give the chip to the others
+        trustmEngine_Close();
+        trustm_ctx.appOpen = 0;
+        trustmEngine_ipc_release();
+        trustmEngine_async_end();
+    }
+    TRUSTM_ENGINE_DBGFN("<");
+    return return_status;
+}
+
+/**********************************************************************
+* trustmEngine_Session_Close()
+* Called after every engine operation. In session mode the application
+* is kept open and only the IPC lock is released. If the last command
+* did not complete successfully the session is closed, so the next
+* operation starts from a freshly opened application.
+**********************************************************************/
+void trustmEngine_Session_Close(void)
+{
+    TRUSTM_ENGINE_DBGFN(">");
+    if (trustm_ctx.sessionMode == 0)
+    {
+        if (trustm_ctx.appOpen == 1)
+            trustmEngine_App_Close();
+        else
+            trustm_ctx.appOpen = 1;
+    }
+    else if (trustm_ctx.appOpen != 1)
+    {
+        trustmEngine_ipc_release();
+    }
+    else if (optiga_lib_status != OPTIGA_LIB_SUCCESS)
+    {
+        TRUSTM_ENGINE_DBGFN("Last status 0x%.4X, close session", optiga_lib_status);
+        trustmEngine_App_Close();
+    }
+    else
+    {
+        trustmEngine_ipc_release();
+    }
+    trustmEngine_async_end();
+    TRUSTM_ENGINE_DBGFN("<");
+}
+
+/**********************************************************************
+* __trustmEngine_Session_End()
+* Leave session mode, closing the application only if no other process
+* has re-opened it since.
+**********************************************************************/
+static void __trustmEngine_Session_End(void)
+{
+    if (trustm_ctx.appOpen != 1)
+        return;
+
+    if (trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS)
+    {
+        // The application cannot be closed without the lock
+        trustmEngine_Close();
+    }
+    else if (trustm_ctx.sessionGen == trustmEngine_ipc_session_get())
+    {
+        trustmEngine_App_Close();
+    }
+    else
+    {
+        trustmEngine_Close();
+        trustmEngine_ipc_release();
+    }
+    trustm_ctx.appOpen = 0;
+}
+
 static uint32_t parseKeyParams(const char *aArg)
 {   
     uint32_t ret;
@@ -481,13 +823,13 @@ static uint32_t parseKeyParams(const char *aArg)
     
     optiga_lib_status_t return_status;
     uint16_t offset =0;
-    uint32_t bytes_to_read;
+    uint16_t bytes_to_read;
     uint8_t read_data_buffer[2048];
+    uint8_t metadata_buffer[TRUSTM_CACHE_METADATA_SIZE];
+    uint8_t appOpen = 0;
     const char needle[3] = "0x";    
     char *ptr;
     TRUSTM_ENGINE_DBGFN(">");
-    TRUSTM_WORKAROUND_TIMER_ARM;
-    TRUSTM_ENGINE_APP_OPEN_RET(NULL,NULL);
     do
     {
         strcpy(in, aArg);
@@ -546,7 +888,18 @@ static uint32_t parseKeyParams(const char *aArg)
         {          
             trustm_ctx.key_oid = value;
             
-            trustmReadMetadata(value, &oidMetadata);          
+            // The application is only opened when the metadata or the
+            // public key is not cached
+            bytes_to_read = sizeof(metadata_buffer);
+            if (trustm_cache_metadata_get(value, metadata_buffer, &bytes_to_read) != 0)
+            {
+                TRUSTM_ENGINE_BROKER_APP_OPEN_RET(ret,0);
+                appOpen = 1;
+                bytes_to_read = sizeof(metadata_buffer);
+                if (trustmEngine_read_metadata(value, metadata_buffer, &bytes_to_read) != OPTIGA_LIB_SUCCESS)
+                    bytes_to_read = 0;
+            }
+            trustmParseMetadata(metadata_buffer, bytes_to_read, &oidMetadata);
             
             if ((oidMetadata.E0_algo == OPTIGA_ECC_CURVE_NIST_P_256) ||
                 (oidMetadata.E0_algo == OPTIGA_ECC_CURVE_NIST_P_384) ||
@@ -625,40 +978,41 @@ static uint32_t parseKeyParams(const char *aArg)
 
             if(i == 2)
             {
-                bytes_to_read = sizeof(read_data_buffer);
-                optiga_lib_status = OPTIGA_LIB_BUSY;
-                return_status = optiga_util_read_data(me_util,
-                                                    trustm_ctx.pubkeyStore,
-                                                    offset,
-                                                    read_data_buffer,
-                                                    (uint16_t *)&bytes_to_read);
-                if (OPTIGA_LIB_SUCCESS != return_status)
-                    break;			
-                //Wait until the optiga_util_read_metadata operation is completed
-                trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-                return_status = optiga_lib_status;
-                if (return_status != OPTIGA_LIB_SUCCESS)
-                    break;
-                else
+                bytes_to_read = PUBKEY_SIZE;
+                if (trustm_cache_pubkey_get(trustm_ctx.pubkeyStore, read_data_buffer, &bytes_to_read) != 0)
                 {
-                    TRUSTM_ENGINE_DBGFN("Load Pubkey from : 0x%.4X",trustm_ctx.pubkeyStore);
-
-                    for(i=0;i<bytes_to_read;i++)
+                    if (appOpen == 0)
                     {
-                        trustm_ctx.pubkey[i] = *(read_data_buffer+i);
-                    }                        
-
-                    trustm_ctx.pubkeylen = (uint16_t) bytes_to_read;                    
-                    j=0;
-                    if((trustm_ctx.pubkey[1] & 0x80) == 0x00)
-                        j = trustm_ctx.pubkey[3] + 4;
-                    else
-                    {
-                        j = (trustm_ctx.pubkey[1] & 0x7f);
-                        j = trustm_ctx.pubkey[j+3] + j + 4; 
+                        TRUSTM_ENGINE_BROKER_APP_OPEN_RET(ret,0);
+                        appOpen = 1;
                     }
-                    trustm_ctx.pubkeyHeaderLen = j;
-                } 
+                    bytes_to_read = PUBKEY_SIZE;
+                    return_status = trustmEngine_read_data(trustm_ctx.pubkeyStore,
+                                                           offset,
+                                                           read_data_buffer,
+                                                           &bytes_to_read);
+                    if (return_status != OPTIGA_LIB_SUCCESS)
+                        break;
+                    trustm_cache_pubkey_put(trustm_ctx.pubkeyStore, read_data_buffer, bytes_to_read);
+                }
+
+                TRUSTM_ENGINE_DBGFN("Load Pubkey from : 0x%.4X",trustm_ctx.pubkeyStore);
+
+                for(i=0;i<bytes_to_read;i++)
+                {
+                    trustm_ctx.pubkey[i] = *(read_data_buffer+i);
+                }                        
+
+                trustm_ctx.pubkeylen = (uint16_t) bytes_to_read;                    
+                j=0;
+                if((trustm_ctx.pubkey[1] & 0x80) == 0x00)
+                    j = trustm_ctx.pubkey[3] + 4;
+                else
+                {
+                    j = (trustm_ctx.pubkey[1] & 0x7f);
+                    j = trustm_ctx.pubkey[j+3] + j + 4; 
+                }
+                trustm_ctx.pubkeyHeaderLen = j;
             }
         }
 
@@ -699,13 +1053,77 @@ static uint32_t parseKeyParams(const char *aArg)
         }        
         ret = value;
     }while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    if (appOpen == 1)
+    {
+        TRUSTM_ENGINE_BROKER_APP_CLOSE;
+    }
     TRUSTM_ENGINE_DBGFN("<");
 
     return ret;
 }
 
+/**********************************************************************
+* trustmEngine_key_ctx_default()
+* Fills kctx from the key last loaded into trustm_ctx
+**********************************************************************/
+void trustmEngine_key_ctx_default(trustm_key_ctx_t *kctx)
+{
+    kctx->key_oid = trustm_ctx.key_oid;
+    kctx->rsa_key_type = trustm_ctx.rsa_key_type;
+    kctx->rsa_key_enc_scheme = trustm_ctx.rsa_key_enc_scheme;
+    kctx->rsa_key_sig_scheme = trustm_ctx.rsa_key_sig_scheme;
+    kctx->ec_key_curve = trustm_ctx.ec_key_curve;
+    kctx->pubkeylen = trustm_ctx.pubkeylen;
+    kctx->pubkeyHeaderLen = trustm_ctx.pubkeyHeaderLen;
+    memcpy(kctx->pubkey, trustm_ctx.pubkey, trustm_ctx.pubkeylen);
+}
+
+/**********************************************************************
+* trustmEngine_key_ctx_new()
+**********************************************************************/
+trustm_key_ctx_t *trustmEngine_key_ctx_new(void)
+{
+    trustm_key_ctx_t *kctx;
+
+    kctx = OPENSSL_zalloc(sizeof(trustm_key_ctx_t));
+    if (kctx != NULL)
+        trustmEngine_key_ctx_default(kctx);
+    return kctx;
+}
+
+/**********************************************************************
+* trustmEngine_key_ctx_free()
+* ex_data free function, called when the RSA / EC_KEY is freed
+**********************************************************************/
+void trustmEngine_key_ctx_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                               int idx, long argl, void *argp)
+{
+    OPENSSL_free(ptr);
+}
+
+/**********************************************************************
+* trustmEngine_key_ctx_dup()
+* ex_data dup function, a duplicated key gets its own copy
+**********************************************************************/
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int trustmEngine_key_ctx_dup(CRYPTO_EX_DATA *to, const CRYPTO_EX_DATA *from,
+                             void **from_d, int idx, long argl, void *argp)
+#else
+int trustmEngine_key_ctx_dup(CRYPTO_EX_DATA *to, const CRYPTO_EX_DATA *from,
+                             void *from_d, int idx, long argl, void *argp)
+#endif
+{
+    void **pctx = (void **)from_d;
+
+    if (*pctx != NULL)
+    {
+        *pctx = OPENSSL_memdup(*pctx, sizeof(trustm_key_ctx_t));
+        if (*pctx == NULL)
+            return TRUSTM_ENGINE_FAIL;
+    }
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
 static int engine_destroy(ENGINE *e)
 {
     uint16_t i;
@@ -736,6 +1154,18 @@ static int engine_destroy(ENGINE *e)
     {
         trustm_ctx.pubkey[i] = 0x00;
     }
+
+    trustmEngine_drbg_clear();
+    trustmEngine_rand_pool_stop();
+    if (trustm_ctx.threadMode == 1)
+    {
+        trustm_ctx.threadMode = 0;
+        trustmEngine_sched_stop();
+    }
+    if (trustm_ctx.sessionMode == 1)
+        __trustmEngine_Session_End();
+    if (trustm_ctx.broker == 1)
+        trustm_broker_disconnect();
     trustmEngine_Close();
     trustmEngine_ipc_release();
     
@@ -761,7 +1191,14 @@ static int engine_finish(ENGINE *e)
 static EVP_PKEY * engine_load_privkey(ENGINE *e, const char *key_id, UI_METHOD *ui, void *cb_data)
 {
     EVP_PKEY    *key         = NULL;    
-    trustmEngine_ipc_acquire();
+    trustm_stats_frame_t stats;
+
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_KEY_LOAD);
+    if (trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return NULL;
+    }
     
     TRUSTM_ENGINE_DBGFN("> key_id : %s", key_id);
 
@@ -812,9 +1249,27 @@ static EVP_PKEY * engine_load_privkey(ENGINE *e, const char *key_id, UI_METHOD *
             default:
                 TRUSTM_ENGINE_ERRFN("Invalid OID!!!");
         }
-        
+        if (key == NULL)
+            break;
+
+        // Attach the key parameters, later loads overwrite trustm_ctx
+        if (EVP_PKEY_base_id(key) == EVP_PKEY_RSA)
+        {
+            if (trustm_rsa_set_key_ctx(key) == TRUSTM_ENGINE_SUCCESS)
+                break;
+        }
+        else if (EVP_PKEY_base_id(key) == EVP_PKEY_EC)
+        {
+            if (trustm_ec_set_key_ctx(key) == TRUSTM_ENGINE_SUCCESS)
+                break;
+        }
+        TRUSTM_ENGINE_ERRFN("Fail to attach key context");
+        EVP_PKEY_free(key);
+        key = NULL;
     }while(FALSE);
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    // The lock is owned per thread, keys may be used from other threads
+    trustmEngine_ipc_release();
+    trustmEngine_stats_end(&stats, key != NULL);
 
     TRUSTM_ENGINE_DBGFN("<");
     return key;
@@ -888,13 +1343,126 @@ static int engine_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f) ())
 {
     int ret = TRUSTM_ENGINE_SUCCESS;
 
-    TRUSTM_ENGINE_DBGFN(">");
     TRUSTM_ENGINE_DBGFN(">");
     TRUSTM_ENGINE_DBGFN("cmd: %d", cmd);
 
     do {
-        //TRUSTM_ENGINE_MSGFN("Function Not implemented.");
-        //Implement code here;
+        switch (cmd)
+        {
+            case TRUSTM_ENGINE_CMD_SESSION:
+                if ((trustm_ctx.sessionMode == 1) && (i == 0))
+                    __trustmEngine_Session_End();
+                trustm_ctx.sessionMode = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("Session mode : %d", trustm_ctx.sessionMode);
+                break;
+            case TRUSTM_ENGINE_CMD_BROKER:
+                if (trustm_broker_connect((const char *)p) != 0)
+                {
+                    TRUSTM_ENGINE_ERRFN("Fail to connect to trustm_broker");
+                    ret = TRUSTM_ENGINE_FAIL;
+                    break;
+                }
+                trustm_ctx.broker = 1;
+                TRUSTM_ENGINE_DBGFN("Using trustm_broker");
+                break;
+            case TRUSTM_ENGINE_CMD_ASYNC:
+                trustm_ctx.asyncMode = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("Async mode : %d", trustm_ctx.asyncMode);
+                break;
+            case TRUSTM_ENGINE_CMD_THREADS:
+                if (i == 0)
+                {
+                    trustmEngine_rand_pool_stop();
+                    trustm_ctx.threadMode = 0;
+                    trustmEngine_sched_stop();
+                }
+                else if (trustmEngine_sched_start() == TRUSTM_ENGINE_SUCCESS)
+                    trustm_ctx.threadMode = 1;
+                else
+                    ret = TRUSTM_ENGINE_FAIL;
+                TRUSTM_ENGINE_DBGFN("Thread mode : %d", trustm_ctx.threadMode);
+                break;
+            case TRUSTM_ENGINE_CMD_RAND_POOL:
+                if (i == 0)
+                    trustmEngine_rand_pool_stop();
+                trustm_ctx.randPool = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("Random pool : %d", trustm_ctx.randPool);
+                break;
+            case TRUSTM_ENGINE_CMD_RAND_MODE:
+                trustm_ctx.randMode = (i != 0) ? 1 : 0;
+                if (trustm_ctx.randMode == 0)
+                    trustmEngine_drbg_clear();
+                TRUSTM_ENGINE_DBGFN("Random mode : %d", trustm_ctx.randMode);
+                break;
+            case TRUSTM_ENGINE_CMD_RAND_RESEED:
+                if (i < 1)
+                {
+                    TRUSTM_ENGINE_ERRFN("Invalid reseed interval %ld", i);
+                    ret = TRUSTM_ENGINE_FAIL;
+                    break;
+                }
+                trustm_ctx.drbgReseed = (uint32_t)i;
+                TRUSTM_ENGINE_DBGFN("DRBG reseed interval : %u", trustm_ctx.drbgReseed);
+                break;
+            case TRUSTM_ENGINE_CMD_RAND_PR:
+                trustm_ctx.drbgPR = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("DRBG prediction resistance : %d", trustm_ctx.drbgPR);
+                break;
+            case TRUSTM_ENGINE_CMD_STATS:
+                ret = trustmEngine_stats_enable(i != 0);
+                TRUSTM_ENGINE_DBGFN("Statistics : %d", trustm_ctx.stats);
+                break;
+            case TRUSTM_ENGINE_CMD_STATS_RESET:
+                trustmEngine_stats_reset();
+                break;
+            case TRUSTM_ENGINE_CMD_STATS_GET:
+                ret = trustmEngine_stats_get((trustm_stats_proc_t *)p);
+                break;
+            case TRUSTM_ENGINE_CMD_TRACE:
+                if (trustm_trace_enable((i != 0) ? 1 : 0) == 0)
+                    ret = TRUSTM_ENGINE_FAIL;
+                TRUSTM_ENGINE_DBGFN("Trace : %d", trustm_trace_on);
+                break;
+            case TRUSTM_ENGINE_CMD_TRACE_DUMP:
+                if (trustm_trace_dump((const char *)p) < 0)
+                    ret = TRUSTM_ENGINE_FAIL;
+                break;
+            case TRUSTM_ENGINE_CMD_SEC_GOV:
+                trustm_ctx.secGov = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("SEC governor : %d", trustm_ctx.secGov);
+                break;
+            case TRUSTM_ENGINE_CMD_SEC_GOV_LIMITS:
+                {
+                    unsigned int shed, queue;
+
+                    if ((p == NULL) || (sscanf((const char *)p, "%u:%u", &shed, &queue) != 2) ||
+                        (shed > queue) || (queue > 0xFF) || (queue == 0))
+                    {
+                        TRUSTM_ENGINE_ERRFN("Invalid SEC governor limits, expected <shed>:<queue>");
+                        ret = TRUSTM_ENGINE_FAIL;
+                        break;
+                    }
+                    trustm_sec_gov_limits((uint8_t)shed, (uint8_t)queue);
+                    TRUSTM_ENGINE_DBGFN("SEC governor limits : shed %u queue %u", shed, queue);
+                }
+                break;
+            case TRUSTM_ENGINE_CMD_SHIELD:
+                trustm_ctx.shield = (i != 0) ? 1 : 0;
+                TRUSTM_ENGINE_DBGFN("Shielded connection : %d", trustm_ctx.shield);
+                break;
+            case TRUSTM_ENGINE_CMD_SHIELD_REKEY:
+                if (i < 0)
+                {
+                    TRUSTM_ENGINE_ERRFN("Invalid rekey interval %ld", i);
+                    ret = TRUSTM_ENGINE_FAIL;
+                    break;
+                }
+                trustm_shield_rekey((uint32_t)i);
+                TRUSTM_ENGINE_DBGFN("Shielded connection rekey interval : %ld", i);
+                break;
+            default:
+                TRUSTM_ENGINE_DBGFN("Control command not handled");
+        }
     }while(FALSE);
    
     TRUSTM_ENGINE_DBGFN("<");
@@ -922,14 +1490,20 @@ static int engine_init(ENGINE *e)
         pal_gpio_init(&optiga_reset_0);
         pal_gpio_init(&optiga_vdd_0);
         
-        return_status = trustmEngine_Open();
-        if (return_status != OPTIGA_LIB_SUCCESS)
+        // The broker is only used if selected with the BROKER command,
+        // the chip is then accessed directly for operations it does not serve
+        if (trustm_ctx.broker == 0)
         {
-            TRUSTM_ENGINE_ERRFN("Fail to open trustM!!");
-            ret = TRUSTM_ENGINE_FAIL; 
-            exit(1);
-            //break;
+            return_status = trustmEngine_Open();
+            if (return_status != OPTIGA_LIB_SUCCESS)
+            {
+                TRUSTM_ENGINE_ERRFN("Fail to open trustM!!");
+                ret = TRUSTM_ENGINE_FAIL; 
+                exit(1);
+                //break;
+            }
         }
+        TRUSTM_ENGINE_DBGFN("trustm_broker : %d", trustm_ctx.broker);
 
         //Init TrustM context
         trustm_ctx.key_oid = 0x0000;
@@ -950,6 +1524,15 @@ static int engine_init(ENGINE *e)
         
         trustm_ctx.appOpen = 0;
         trustm_ctx.ipcInit = 0;
+        trustm_ctx.sessionMode = TRUSTM_ENGINE_SESSION_DEFAULT;
+        trustm_ctx.sessionGen = 0;
+        trustm_ctx.asyncMode = TRUSTM_ENGINE_ASYNC_DEFAULT;
+        trustm_ctx.randPool = TRUSTM_ENGINE_RAND_POOL_DEFAULT;
+        trustm_ctx.randMode = TRUSTM_ENGINE_RAND_MODE_DEFAULT;
+        trustm_ctx.drbgPR = 0;
+        trustm_ctx.drbgReseed = TRUSTM_ENGINE_DRBG_RESEED_DEFAULT;
+        trustm_ctx.stats = 0;
+        trustmEngine_stats_enable(TRUSTM_ENGINE_STATS_DEFAULT);
 
         // Init Random Method
         #ifdef TRUSTM_RAND_ENABLED 
@@ -986,7 +1569,8 @@ static int bind(ENGINE *e, const char *id)
     int ret = TRUSTM_ENGINE_FAIL;
     
     TRUSTM_ENGINE_DBGFN(">");
-    trustmEngine_ipc_acquire();
+    if (trustmEngine_ipc_acquire() != TRUSTM_ENGINE_SUCCESS)
+        return ret;
 
     do {         
         if (!ENGINE_set_id(e, engine_id)) {
@@ -1031,12 +1615,11 @@ static int bind(ENGINE *e, const char *id)
             break;
         }
 
-/*
         if (!ENGINE_set_cmd_defns(e, engine_cmd_defns)) {
             TRUSTM_ENGINE_DBGFN("ENGINE_set_cmd_defns failed\n");
             break;
         }
-*/
+
         ret = TRUSTM_ENGINE_SUCCESS;
     }while(FALSE);
     trustmEngine_ipc_release();
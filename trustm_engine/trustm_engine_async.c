@@ -0,0 +1,345 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <openssl/async.h>
+#include <openssl/engine.h>
+
+#include "trustm_helper.h"
+
+#include "trustm_engine_common.h"
+
+#define TRUSTM_ENGINE_ASYNC_WAITERS     64
+
+// Operation currently using the chip, the job running it (NULL when
+// called outside of a job) and its thread. Others wait for it.
+static int async_depth = 0;
+static ASYNC_JOB *async_owner = NULL;
+static pthread_t async_thread;
+static OSSL_ASYNC_FD async_waiter[TRUSTM_ENGINE_ASYNC_WAITERS];
+static int async_nwaiter = 0;
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+
+// Wait fd of the job waiting for the current command, -1 if none
+static OSSL_ASYNC_FD async_fd = -1;
+
+// Key of the wait fd in the ASYNC_WAIT_CTX
+static const char async_key[] = "trustm_engine_async";
+// Key of the timer of trustmEngine_async_sleep()
+static const char async_sleep_key[] = "trustm_engine_sleep";
+
+/**********************************************************************
+* __trustmEngine_async_cleanup()
+* Called by OpenSSL when the wait context of the job is freed
+**********************************************************************/
+static void __trustmEngine_async_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+                                         OSSL_ASYNC_FD fd, void *custom)
+{
+    close(fd);
+}
+
+/**********************************************************************
+* __trustmEngine_async_fd()
+* Returns the wait fd of the job, created on first use
+**********************************************************************/
+static OSSL_ASYNC_FD __trustmEngine_async_fd(ASYNC_JOB *job)
+{
+    ASYNC_WAIT_CTX *waitctx;
+    OSSL_ASYNC_FD fd;
+    void *custom;
+
+    waitctx = ASYNC_get_wait_ctx(job);
+    if (waitctx == NULL)
+        return -1;
+
+    if (ASYNC_WAIT_CTX_get_fd(waitctx, async_key, &fd, &custom))
+        return fd;
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+    {
+        TRUSTM_ENGINE_ERRFN("eventfd : %s", strerror(errno));
+        return -1;
+    }
+    if (!ASYNC_WAIT_CTX_set_wait_fd(waitctx, async_key, fd, NULL,
+                                    __trustmEngine_async_cleanup))
+    {
+        TRUSTM_ENGINE_ERRFN("ASYNC_WAIT_CTX_set_wait_fd failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**********************************************************************
+* __trustmEngine_async_signal()
+**********************************************************************/
+static void __trustmEngine_async_signal(OSSL_ASYNC_FD fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0)
+        TRUSTM_ENGINE_DBGFN("eventfd write : %s", strerror(errno));
+}
+
+/**********************************************************************
+* __trustmEngine_async_drain()
+**********************************************************************/
+static void __trustmEngine_async_drain(OSSL_ASYNC_FD fd)
+{
+    uint64_t cnt;
+
+    while (read(fd, &cnt, sizeof(cnt)) > 0)
+    {}
+}
+
+/**********************************************************************
+* __trustmEngine_async_owned()
+* True if the operation in progress is ours. async_mutex held.
+**********************************************************************/
+static int __trustmEngine_async_owned(ASYNC_JOB *job)
+{
+    return (async_depth > 0) && (async_owner == job) &&
+           ((job != NULL) || pthread_equal(async_thread, pthread_self()));
+}
+
+/**********************************************************************
+* trustmEngine_async_begin()
+* Called before an engine operation. The chip context (instances,
+* optiga_lib_status, IPC lock) is shared by all jobs running in the
+* process, so a job finding another operation in progress pauses until
+* it is finished. Callers outside of a job wait for it on other
+* threads. On the thread of a paused job they cannot wait, the job only
+* resumes once they returned, so they fail.
+**********************************************************************/
+int trustmEngine_async_begin(void)
+{
+    ASYNC_JOB *job;
+    OSSL_ASYNC_FD fd;
+    trustm_stats_frame_t *stats;
+
+    if (trustm_ctx.asyncMode == 0)
+        return TRUSTM_ENGINE_SUCCESS;
+    job = ASYNC_get_current_job();
+
+    pthread_mutex_lock(&async_mutex);
+    while ((async_depth > 0) && !__trustmEngine_async_owned(job))
+    {
+        if (job == NULL)
+        {
+            if (pthread_equal(async_thread, pthread_self()))
+            {
+                pthread_mutex_unlock(&async_mutex);
+                TRUSTM_ENGINE_ERRFN("Chip in use by paused job %p", async_owner);
+                return TRUSTM_ENGINE_FAIL;
+            }
+            pthread_cond_wait(&async_cond, &async_mutex);
+            continue;
+        }
+
+        fd = __trustmEngine_async_fd(job);
+        if ((fd < 0) || (async_nwaiter == TRUSTM_ENGINE_ASYNC_WAITERS))
+        {
+            pthread_mutex_unlock(&async_mutex);
+            TRUSTM_ENGINE_ERRFN("Cannot wait for chip, job not paused");
+            return TRUSTM_ENGINE_FAIL;
+        }
+        async_waiter[async_nwaiter++] = fd;
+        pthread_mutex_unlock(&async_mutex);
+
+        TRUSTM_ENGINE_DBGFN("Chip in use by %p, pause", async_owner);
+        stats = trustmEngine_stats_suspend();
+        ASYNC_pause_job();
+        trustmEngine_stats_resume(stats);
+        __trustmEngine_async_drain(fd);
+
+        pthread_mutex_lock(&async_mutex);
+    }
+    async_owner = job;
+    async_thread = pthread_self();
+    async_depth++;
+    pthread_mutex_unlock(&async_mutex);
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* trustmEngine_async_end()
+* Called after an engine operation, resumes the jobs waiting for it
+**********************************************************************/
+void trustmEngine_async_end(void)
+{
+    int i;
+
+    pthread_mutex_lock(&async_mutex);
+    if (__trustmEngine_async_owned(ASYNC_get_current_job()) && (--async_depth == 0))
+    {
+        async_owner = NULL;
+        for (i = 0; i < async_nwaiter; i++)
+            __trustmEngine_async_signal(async_waiter[i]);
+        async_nwaiter = 0;
+        pthread_cond_broadcast(&async_cond);
+    }
+    pthread_mutex_unlock(&async_mutex);
+}
+
+/**********************************************************************
+* trustmEngine_async_wake()
+* Called from the OPTIGA callbacks once optiga_lib_status is set
+**********************************************************************/
+void trustmEngine_async_wake(void)
+{
+    OSSL_ASYNC_FD fd;
+
+    // Pairs with the store in trustmEngine_async_WaitForCompletion(),
+    // either the job sees the new status or we see its wait fd
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    fd = __atomic_load_n(&async_fd, __ATOMIC_SEQ_CST);
+    if (fd >= 0)
+        __trustmEngine_async_signal(fd);
+}
+
+/**********************************************************************
+* trustmEngine_async_WaitForCompletion()
+* Waits for the OPTIGA command by pausing the job instead of blocking
+* the thread. The application resumes the job once the wait fd becomes
+* readable. Returns OPTIGA_LIB_BUSY on time out, like
+* trustm_WaitForStatus(). Outside of a job the caller waits as usual.
+**********************************************************************/
+optiga_lib_status_t trustmEngine_async_WaitForCompletion(uint16_t wait_time)
+{
+    ASYNC_JOB *job;
+    OSSL_ASYNC_FD fd;
+    struct timespec start, now;
+    uint32_t elapsed = 0;
+    optiga_lib_status_t status;
+    trustm_stats_frame_t *stats;
+    int paused;
+
+    job = (trustm_ctx.asyncMode == 0) ? NULL : ASYNC_get_current_job();
+    fd = (job == NULL) ? -1 : __trustmEngine_async_fd(job);
+    if (fd < 0)
+    {
+        status = trustm_WaitForStatus(wait_time, &elapsed);
+        if (status == OPTIGA_LIB_BUSY)
+            TRUSTM_ENGINE_ERRFN("Fail : Optiga Busy Time Out:%d\n",elapsed/1000);
+        return status;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    __atomic_store_n(&async_fd, fd, __ATOMIC_SEQ_CST);
+    while ((status = __atomic_load_n(&optiga_lib_status, __ATOMIC_SEQ_CST)) == OPTIGA_LIB_BUSY)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000000 +
+                  (now.tv_nsec - start.tv_nsec) / 1000;
+        if (elapsed >= (uint32_t)wait_time * 1000)
+        {
+            TRUSTM_ENGINE_ERRFN("Fail : Optiga Busy Time Out:%d\n",elapsed/1000);
+            break;
+        }
+        stats = trustmEngine_stats_suspend();
+        paused = ASYNC_pause_job();
+        trustmEngine_stats_resume(stats);
+        if (!paused)
+        {
+            // Cannot pause, block the thread for the remaining time
+            status = trustm_WaitForStatus(wait_time - elapsed/1000, NULL);
+            break;
+        }
+        __trustmEngine_async_drain(fd);
+    }
+    __atomic_store_n(&async_fd, -1, __ATOMIC_SEQ_CST);
+    __trustmEngine_async_drain(fd);
+
+    TRUSTM_ENGINE_DBGFN(" max wait_time:%d, Wait time (us): %d", wait_time,elapsed);
+    return status;
+}
+
+/**********************************************************************
+* trustmEngine_async_sleep()
+* Sleeps by pausing the job on a timerfd added to its wait context, the
+* application resumes the job once the timer expired. Outside of a job
+* the thread sleeps.
+**********************************************************************/
+void trustmEngine_async_sleep(uint32_t msec)
+{
+    ASYNC_JOB *job;
+    ASYNC_WAIT_CTX *waitctx = NULL;
+    struct itimerspec its;
+    struct pollfd pfd;
+    uint64_t expirations;
+    trustm_stats_frame_t *stats;
+    int tfd = -1;
+    int paused;
+
+    job = (trustm_ctx.asyncMode == 0) ? NULL : ASYNC_get_current_job();
+    if (job != NULL)
+        waitctx = ASYNC_get_wait_ctx(job);
+    if (waitctx != NULL)
+        tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0)
+    {
+        mssleep(msec);
+        return;
+    }
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = msec / 1000;
+    its.it_value.tv_nsec = (long)(msec % 1000) * 1000000;
+    if (msec == 0)
+        its.it_value.tv_nsec = 1;
+    if ((timerfd_settime(tfd, 0, &its, NULL) == -1) ||
+        !ASYNC_WAIT_CTX_set_wait_fd(waitctx, async_sleep_key, tfd, NULL, NULL))
+    {
+        close(tfd);
+        mssleep(msec);
+        return;
+    }
+
+    TRUSTM_ENGINE_DBGFN("Pause job for %u ms", msec);
+    while (read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        stats = trustmEngine_stats_suspend();
+        paused = ASYNC_pause_job();
+        trustmEngine_stats_resume(stats);
+        if (!paused)
+        {
+            // Cannot pause, block the thread on the timer
+            pfd.fd = tfd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, -1);
+        }
+    }
+    ASYNC_WAIT_CTX_clear_fd(waitctx, async_sleep_key);
+    close(tfd);
+}
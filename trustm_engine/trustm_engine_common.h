@@ -30,30 +30,60 @@
 #include <openssl/engine.h>
 
 #include "optiga_lib_common.h"
+#include "optiga_crypt.h"
 #include "sys/types.h"
 #include "unistd.h"
 #include <signal.h>
 #include <time.h>
 #include <errno.h>   
 
+#include "trustm_engine_stats.h"
+
 // SETTINGS
 #define OBJ_MAX_LEN          (128) /* Maximum length for key object paths or passwords */
 #define KEY_CONTEXT_MAX_LEN  (100)
 #define PARAM_MAX_LEN        (128)
 
-#define WORKAROUND 1
-//#define TRUSTM_RAND_ENABLED 1
+#define TRUSTM_RAND_ENABLED 1
 //#define TRUSTM_ENGINE_DEBUG = 1
 
-#ifdef WORKAROUND
-#define TRUSTM_WORKAROUND_TIMER_ARM        pal_os_event_arm()
-#define TRUSTM_WORKAROUND_TIMER_DISARM     pal_os_event_disarm()
-#define TRUSTM_WORKAROUND_TIMER_DESTROY    pal_os_event_destroy1()
-#else
-#define TRUSTM_WORKAROUND_TIMER_ARM
-#define TRUSTM_WORKAROUND_TIMER_DISARM
-#define TRUSTM_WORKAROUND_TIMER_DESTROY    
-#endif
+// Session mode keeps the OPTIGA application open across engine operations.
+// 0 : open/close the application for every operation (default)
+// 1 : open once per process, only take the IPC lock per operation
+// Can be changed at runtime with the engine control command SESSION.
+#define TRUSTM_ENGINE_SESSION_DEFAULT 0
+
+// Inside an OpenSSL ASYNC_JOB, pause the job while the chip is busy
+// instead of blocking the thread. Can be changed with the engine
+// control command ASYNC.
+#define TRUSTM_ENGINE_ASYNC_DEFAULT 1
+
+// Thread mode (engine control command THREADS) : number of optiga_crypt
+// instances requests are spread over, and the number of requests served
+// before the scheduler gives the IPC lock to other processes.
+#define TRUSTM_ENGINE_SCHED_POOL    4
+#define TRUSTM_ENGINE_SCHED_BURST   32
+
+// Random pool (engine control command RAND_POOL) : random bytes are served
+// from a per user pool in shared memory holding TRNG output. The pool is
+// refilled up to the high watermark when it falls below the low one, in
+// the background in thread mode or with the broker.
+#define TRUSTM_ENGINE_RAND_POOL_DEFAULT 1
+#define TRUSTM_ENGINE_RAND_POOL_SIZE    8192
+#define TRUSTM_ENGINE_RAND_POOL_LOW     2048
+#define TRUSTM_ENGINE_RAND_POOL_HIGH    8192
+
+// Random mode (engine control command RAND_MODE)
+// 0 : TRNG output, from the random pool if enabled (default)
+// 1 : AES-256 CTR_DRBG seeded from the TRNG, reseeded every
+//     RAND_RESEED requests (RAND_PR = 1 : before every request)
+#define TRUSTM_ENGINE_RAND_MODE_DEFAULT     0
+#define TRUSTM_ENGINE_DRBG_RESEED_DEFAULT   1024
+
+// Latency statistics (engine control command STATS) : lock wait, open
+// application, chip, close application and total time of every operation
+// are recorded in the shared segment read by trustm_stats.
+#define TRUSTM_ENGINE_STATS_DEFAULT 0
 
 #ifdef TRUSTM_ENGINE_DEBUG
 
@@ -84,11 +114,38 @@
                                                x = y;return x;} \
                                            }else{trustm_ctx.appOpen = 2;}
 */                                           
-#define TRUSTM_ENGINE_APP_OPEN_RET(x,y)   trustmEngine_App_Open_Recovery();
+// The xxx_APP_OPEN macros evaluate to the status of the open, the
+// xxx_APP_OPEN_RET(x,y) macros return x = y from the caller if it failed.
+// trustmEngine_Session_Open() cleans up after a failure itself, so no
+// xxx_APP_CLOSE must follow then.
+#define TRUSTM_ENGINE_APP_OPEN            trustmEngine_Session_Open()
+
+#define TRUSTM_ENGINE_APP_OPEN_RET(x,y)   if (TRUSTM_ENGINE_APP_OPEN != OPTIGA_LIB_SUCCESS) \
+                                          {TRUSTM_ENGINE_ERRFN("Fail to open trustM!!"); \
+                                           x = y;return x;}
 
-#define TRUSTM_ENGINE_APP_CLOSE        if (trustm_ctx.appOpen == 1) \
-                                          {trustmEngine_App_Close(); \
-                                          }else{trustm_ctx.appOpen = 1;}
+#define TRUSTM_ENGINE_APP_CLOSE           trustmEngine_Session_Close();
+
+// Operations which trustm_broker can serve do not open the application
+// locally when the engine is connected to the broker
+#define TRUSTM_ENGINE_BROKER_APP_OPEN           ((trustm_ctx.broker == 0) ? trustmEngine_Session_Open() : OPTIGA_LIB_SUCCESS)
+
+#define TRUSTM_ENGINE_BROKER_APP_OPEN_RET(x,y)  if (TRUSTM_ENGINE_BROKER_APP_OPEN != OPTIGA_LIB_SUCCESS) \
+                                                {TRUSTM_ENGINE_ERRFN("Fail to open trustM!!"); \
+                                                 x = y;return x;}
+
+#define TRUSTM_ENGINE_BROKER_APP_CLOSE          if (trustm_ctx.broker == 0) trustmEngine_Session_Close();
+
+// Crypt operations dispatched through the __trustmEngine_xxx() helpers,
+// which forward to the broker or to the thread mode scheduler themselves
+#define TRUSTM_ENGINE_CRYPT_APP_OPEN            (((trustm_ctx.broker == 0) && (trustm_ctx.threadMode == 0)) ? \
+                                                 trustmEngine_Session_Open() : OPTIGA_LIB_SUCCESS)
+
+#define TRUSTM_ENGINE_CRYPT_APP_OPEN_RET(x,y)   if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS) \
+                                                {TRUSTM_ENGINE_ERRFN("Fail to open trustM!!"); \
+                                                 x = y;return x;}
+
+#define TRUSTM_ENGINE_CRYPT_APP_CLOSE           if ((trustm_ctx.broker == 0) && (trustm_ctx.threadMode == 0)) trustmEngine_Session_Close();
 
 //Macro define
 /// Definition for false
@@ -148,9 +205,55 @@ typedef struct trustm_ctx_str
   uint16_t  pubkeyStore;
   uint8_t   appOpen;
   uint8_t   ipcInit;
+  uint8_t   sessionMode;
+  uint32_t  sessionGen;
+  uint8_t   broker;
+  uint8_t   asyncMode;
+  uint8_t   threadMode;
+  uint8_t   randPool;
+  uint8_t   randMode;
+  uint8_t   drbgPR;
+  uint32_t  drbgReseed;
+  uint8_t   stats;
+  uint8_t   secGov;
+  uint8_t   shield;
   
 } trustm_ctx_t;
 
+// Per key context, attached to the RSA / EC_KEY of every loaded key with
+// RSA_set_ex_data() / EC_KEY_set_ex_data(). trustm_ctx only holds the
+// parameters of the key being loaded.
+typedef struct trustm_key_ctx_str
+{
+  uint16_t  key_oid;
+  optiga_rsa_key_type_t  rsa_key_type;
+  optiga_rsa_encryption_scheme_t rsa_key_enc_scheme;
+  optiga_rsa_signature_scheme_t rsa_key_sig_scheme;
+  optiga_ecc_curve_t  ec_key_curve;
+  uint8_t   pubkey[PUBKEY_SIZE];
+  uint16_t  pubkeylen;
+  uint8_t   pubkeyHeaderLen;
+} trustm_key_ctx_t;
+
+// Thread mode request, one per pool instance
+typedef struct trustm_sched_req_str
+{
+  optiga_crypt_t *crypt;
+  optiga_lib_status_t status;
+  uint8_t   busy;
+} trustm_sched_req_t;
+
+// Latency of one operation in progress, phases of nested operations
+// (e.g. data object reads while loading a key) count for all of them
+typedef struct trustm_stats_frame_str
+{
+  struct trustm_stats_frame_str *parent;
+  uint64_t  start;
+  uint64_t  phase[TRUSTM_STATS_TOTAL];
+  uint8_t   op;
+  uint8_t   active;
+} trustm_stats_frame_t;
+
 //extern
 extern trustm_ctx_t trustm_ctx;
 
@@ -166,14 +269,60 @@ optiga_lib_status_t trustmEngine_App_Open_Recovery(void);
 optiga_lib_status_t trustmEngine_Close(void);
 optiga_lib_status_t trustmEngine_App_Close(void);
 
+optiga_lib_status_t trustmEngine_Session_Open(void);
+void trustmEngine_Session_Close(void);
+
+int  trustmEngine_sec_gov_admit(uint8_t prio);
+void trustmEngine_sec_gov_result(optiga_lib_status_t ret);
+
+int  trustmEngine_async_begin(void);
+void trustmEngine_async_end(void);
+void trustmEngine_async_wake(void);
+optiga_lib_status_t trustmEngine_async_WaitForCompletion(uint16_t wait_time);
+void trustmEngine_async_sleep(uint32_t msec);
+
+int  trustmEngine_sched_start(void);
+void trustmEngine_sched_stop(void);
+trustm_sched_req_t *trustmEngine_sched_begin(void);
+optiga_lib_status_t trustmEngine_sched_end(trustm_sched_req_t *req, optiga_lib_status_t ret);
+optiga_crypt_t *trustmEngine_crypt_begin(trustm_sched_req_t **req);
+optiga_lib_status_t trustmEngine_crypt_end(trustm_sched_req_t *req, optiga_lib_status_t ret);
+
 uint16_t trustmEngine_init_rand(ENGINE *e);
+void trustmEngine_rand_pool_stop(void);
+void trustmEngine_drbg_clear(void);
+int  trustmEngine_stats_enable(int on);
+void trustmEngine_stats_reset(void);
+int  trustmEngine_stats_get(trustm_stats_proc_t *proc);
+void trustmEngine_stats_begin(trustm_stats_frame_t *frame, uint8_t op);
+void trustmEngine_stats_end(trustm_stats_frame_t *frame, int ok);
+uint64_t trustmEngine_stats_clock(void);
+void trustmEngine_stats_phase(uint8_t phase, uint64_t start);
+optiga_lib_status_t trustmEngine_stats_chip(uint64_t start, optiga_lib_status_t ret);
+trustm_stats_frame_t *trustmEngine_stats_suspend(void);
+void trustmEngine_stats_resume(trustm_stats_frame_t *frame);
 uint16_t trustmEngine_init_rsa(ENGINE *e);
 uint16_t trustmEngine_init_ec(ENGINE *e);
 
 EVP_PKEY *trustm_rsa_loadkey(void);
 EVP_PKEY *trustm_ec_loadkey(void);
 EVP_PKEY *trustm_ec_loadkeyE0E0(void);
+int trustm_rsa_set_key_ctx(EVP_PKEY *key);
+int trustm_ec_set_key_ctx(EVP_PKEY *key);
+
+void trustmEngine_key_ctx_default(trustm_key_ctx_t *kctx);
+trustm_key_ctx_t *trustmEngine_key_ctx_new(void);
+void trustmEngine_key_ctx_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                               int idx, long argl, void *argp);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int trustmEngine_key_ctx_dup(CRYPTO_EX_DATA *to, const CRYPTO_EX_DATA *from,
+                             void **from_d, int idx, long argl, void *argp);
+#else
+int trustmEngine_key_ctx_dup(CRYPTO_EX_DATA *to, const CRYPTO_EX_DATA *from,
+                             void *from_d, int idx, long argl, void *argp);
+#endif
 optiga_lib_status_t trustmEngine_WaitForCompletion(uint16_t wait_time);
-pthread_mutex_t lock;
+optiga_lib_status_t trustmEngine_read_data(uint16_t oid, uint16_t offset, uint8_t *buf, uint16_t *len);
+optiga_lib_status_t trustmEngine_read_metadata(uint16_t oid, uint8_t *buf, uint16_t *len);
 
 #endif // _TRUSTM_ENGINE_COMMON_H_
@@ -27,11 +27,8 @@
 
 #include "trustm_engine_common.h"
 #include "trustm_helper.h"
-
-#ifdef WORKAROUND
-    extern void pal_os_event_disarm(void);
-    extern void pal_os_event_arm(void);
-#endif
+#include "trustm_broker.h"
+#include "trustm_helper_cache.h"
 
 unsigned char dummy_ec_public_key_256[] = 
 {
@@ -143,6 +140,7 @@ EVP_PKEY *trustm_ec_generatekey(void)
 
     uint8_t public_key [500];
     uint16_t public_key_length = sizeof(public_key);
+    uint16_t pubkey_oid;
     uint16_t i,j;
     uint8_t *data;
 
@@ -187,7 +185,6 @@ EVP_PKEY *trustm_ec_generatekey(void)
                                 0x2B,0x24,0x03,0x03,0x02,0x08,0x01,0x01,0x0d};                                                                                    
 
     TRUSTM_ENGINE_DBGFN(">");
-    TRUSTM_WORKAROUND_TIMER_ARM;
     TRUSTM_ENGINE_APP_OPEN_RET(key,NULL);
     do
     {
@@ -254,6 +251,7 @@ EVP_PKEY *trustm_ec_generatekey(void)
         //Wait until the optiga_util_read_metadata operation is completed
         trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
         return_status = optiga_lib_status;
+        trustm_cache_invalidate(trustm_ctx.key_oid);
         if (return_status != OPTIGA_LIB_SUCCESS)
         {
             break;
@@ -270,6 +268,11 @@ EVP_PKEY *trustm_ec_generatekey(void)
                 TRUSTM_ENGINE_DBGFN("Save Pubkey to : 0x%.4X",(trustm_ctx.key_oid) + 0x10ED);}
             else{TRUSTM_ENGINE_DBGFN("Save Pubkey to : 0x%.4X",(trustm_ctx.key_oid) + 0x10E0);}
 
+            if((trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_NIST_P_521) || (trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1))
+                pubkey_oid = (trustm_ctx.key_oid)+0x10ED;
+            else
+                pubkey_oid = (trustm_ctx.key_oid)+0x10E0;
+
             // Save pubkey without header
             optiga_lib_status = OPTIGA_LIB_BUSY;
             if((trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_NIST_P_521) || (trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1)){
@@ -292,10 +295,11 @@ EVP_PKEY *trustm_ec_generatekey(void)
             //Wait until the optiga_util_read_metadata operation is completed
             trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate(pubkey_oid);
             if (return_status != OPTIGA_LIB_SUCCESS)
             break;
-            else
-            TRUSTM_ENGINE_DBGFN("Write Success \n");              
+            TRUSTM_ENGINE_DBGFN("Write Success \n");
+            trustm_cache_pubkey_put(pubkey_oid, public_key, public_key_length+i);
         }
         
         trustm_ctx.pubkeylen = public_key_length+i;
@@ -307,7 +311,6 @@ EVP_PKEY *trustm_ec_generatekey(void)
             key = d2i_PUBKEY(NULL,(const unsigned char **)&data,public_key_length+i);
     } while (FALSE);
     TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
     
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -334,24 +337,40 @@ EVP_PKEY *trustm_ec_loadkeyE0E0(void)
     
     optiga_lib_status_t return_status;
 
-    TRUSTM_WORKAROUND_TIMER_ARM; 
-    TRUSTM_ENGINE_APP_OPEN_RET(key,NULL);
+    // The public key extracted from the certificate is cached, the
+    // certificate is only read and parsed on the first load
+    bytes_to_read = PUBKEY_SIZE;
+    if (trustm_cache_pubkey_get(0xE0E0, trustm_ctx.pubkey, &bytes_to_read) == 0)
+    {
+        data = trustm_ctx.pubkey;
+        key = d2i_PUBKEY(NULL, (const unsigned char **)&data, bytes_to_read);
+        if (key != NULL)
+        {
+            trustm_ctx.pubkeylen = bytes_to_read;
+            if((trustm_ctx.pubkey[1] & 0x80) == 0x00)
+                j = trustm_ctx.pubkey[3] + 4;
+            else
+            {
+                j = (trustm_ctx.pubkey[1] & 0x7f);
+                j = trustm_ctx.pubkey[j+3] + j + 4;
+            }
+            trustm_ctx.pubkeyHeaderLen = j;
+            TRUSTM_ENGINE_DBGFN("Public key from cache");
+            return key;
+        }
+        trustm_cache_invalidate(0xE0E0);
+    }
+
+    TRUSTM_ENGINE_BROKER_APP_OPEN_RET(key,NULL);
     do
     {
         offset = 9;
         bytes_to_read = sizeof(read_data_buffer);
 
-        optiga_lib_status = OPTIGA_LIB_BUSY;
-        return_status = optiga_util_read_data(me_util,
-                                            0xE0E0,
-                                            offset,
-                                            read_data_buffer,
-                                            (uint16_t *)&bytes_to_read);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
+        return_status = trustmEngine_read_data(0xE0E0,
+                                               offset,
+                                               read_data_buffer,
+                                               &bytes_to_read);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
         else
@@ -386,11 +405,11 @@ EVP_PKEY *trustm_ec_loadkeyE0E0(void)
         break;
         }
         TRUSTM_ENGINE_DBGFN("Extracted public key from cert");
+        trustm_cache_pubkey_put(0xE0E0, trustm_ctx.pubkey, trustm_ctx.pubkeylen);
       }
 
     } while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_BROKER_APP_CLOSE;
     
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -466,6 +485,82 @@ EVP_PKEY *trustm_ec_loadkey(void)
     return key;      
 }
 
+// ex_data index of the trustm_key_ctx_t attached to loaded EC keys
+static int ec_ex_index = -1;
+
+/**********************************************************************
+* trustm_ec_set_key_ctx()
+* Attaches the parameters of the key just loaded to its EC_KEY object
+**********************************************************************/
+int trustm_ec_set_key_ctx(EVP_PKEY *key)
+{
+    EC_KEY *eckey;
+    trustm_key_ctx_t *kctx;
+    int ret = TRUSTM_ENGINE_FAIL;
+
+    eckey = EVP_PKEY_get1_EC_KEY(key);
+    if (eckey == NULL)
+        return TRUSTM_ENGINE_FAIL;
+
+    kctx = trustmEngine_key_ctx_new();
+    if (kctx != NULL)
+    {
+        ret = EC_KEY_set_ex_data(eckey, ec_ex_index, kctx);
+        if (ret != TRUSTM_ENGINE_SUCCESS)
+            OPENSSL_free(kctx);
+        else
+            TRUSTM_ENGINE_DBGFN("EC key 0x%.4X attached", kctx->key_oid);
+    }
+    EC_KEY_free(eckey);
+    return ret;
+}
+
+/**********************************************************************
+* __trustm_ec_key_ctx()
+* Key context attached to eckey. Keys not loaded through the engine
+* fall back to the last loaded key, copied to def.
+**********************************************************************/
+static const trustm_key_ctx_t *__trustm_ec_key_ctx(const EC_KEY *eckey, trustm_key_ctx_t *def)
+{
+    const trustm_key_ctx_t *kctx;
+
+    kctx = EC_KEY_get_ex_data(eckey, ec_ex_index);
+    if (kctx != NULL)
+        return kctx;
+    trustmEngine_key_ctx_default(def);
+    return def;
+}
+
+/**********************************************************************
+* __trustmEngine_ecdsa_sign()
+* optiga_crypt_ecdsa_sign() or the broker, waits for completion
+**********************************************************************/
+static optiga_lib_status_t __trustmEngine_ecdsa_sign(const uint8_t *digest, uint8_t digest_length,
+                                                     uint16_t key_oid,
+                                                     uint8_t *signature, uint16_t *signature_length)
+{
+    optiga_lib_status_t return_status;
+    optiga_crypt_t *crypt;
+    trustm_sched_req_t *req;
+    uint64_t t0 = trustmEngine_stats_clock();
+
+    if (trustm_ctx.broker)
+        return trustmEngine_stats_chip(t0, trustm_broker_ecdsa_sign(key_oid, digest, digest_length, signature, signature_length));
+
+    crypt = trustmEngine_crypt_begin(&req);
+    if (crypt == NULL)
+        return OPTIGA_CRYPT_ERROR;
+    t0 = trustmEngine_stats_clock();
+    return_status = optiga_crypt_ecdsa_sign(crypt,
+                        digest,
+                        digest_length,
+                        key_oid,
+                        signature,
+                        signature_length);
+    //Wait until the optiga_crypt_ecdsa_sign operation is completed
+    return trustmEngine_stats_chip(t0, trustmEngine_crypt_end(req, return_status));
+}
+
 static ECDSA_SIG* trustm_ecdsa_sign(
   const unsigned char  *dgst,
   int                   dgstlen,
@@ -480,9 +575,13 @@ static ECDSA_SIG* trustm_ecdsa_sign(
     uint16_t    sig_len = 500;
 
     optiga_lib_status_t return_status;
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_ec_key_ctx(eckey, &defctx);
+    trustm_stats_frame_t stats;
 
     TRUSTM_ENGINE_DBGFN(">");
-    TRUSTM_ENGINE_DBGFN("oid : 0x%.4x",trustm_ctx.key_oid);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_ECDSA_SIGN);
+    TRUSTM_ENGINE_DBGFN("oid : 0x%.4x",kctx->key_oid);
     TRUSTM_ENGINE_DBGFN("dgst len : %d",dgstlen);
 
     // TODO/HACK:
@@ -492,23 +591,19 @@ static ECDSA_SIG* trustm_ecdsa_sign(
     TRUSTM_ENGINE_DBGFN("APPLIED digest length hack");
     }
 
-    TRUSTM_WORKAROUND_TIMER_ARM;    
-    TRUSTM_ENGINE_APP_OPEN_RET(ecdsa_sig,NULL);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ecdsa_sig;
+    }
     do 
     {  
-        optiga_lib_status = OPTIGA_LIB_BUSY;
-        if((trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_NIST_P_521) || (trustm_ctx.ec_key_curve == OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1)){
-        return_status = optiga_crypt_ecdsa_sign(me_crypt,
-                            dgst,
+        if((kctx->ec_key_curve == OPTIGA_ECC_CURVE_NIST_P_521) || (kctx->ec_key_curve == OPTIGA_ECC_CURVE_BRAIN_POOL_P_512R1)){
+        return_status = __trustmEngine_ecdsa_sign(dgst,
                             dgstlen,
-                            trustm_ctx.key_oid,
+                            kctx->key_oid,
                             (sig+3),
                             &sig_len);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;          
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
         else
@@ -520,24 +615,18 @@ static ECDSA_SIG* trustm_ecdsa_sign(
             sig[0] = 0x30;
             sig[1] = 0x81;
             sig[2] = sig_len;
-            TRUSTM_ENGINE_DBGFN("ecc curve: 0x%.4x",trustm_ctx.ec_key_curve);
+            TRUSTM_ENGINE_DBGFN("ecc curve: 0x%.4x",kctx->ec_key_curve);
             trustmHexDump(sig,sig_len+3);            
             const unsigned char *p = sig;
             ecdsa_sig = d2i_ECDSA_SIG(NULL, &p, sig_len+3);
         }
         }
         else{
-            return_status = optiga_crypt_ecdsa_sign(me_crypt,
-                            dgst,
+            return_status = __trustmEngine_ecdsa_sign(dgst,
                             dgstlen,
-                            trustm_ctx.key_oid,
+                            kctx->key_oid,
                             (sig+2),
                             &sig_len);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;          
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
         else
@@ -553,8 +642,8 @@ static ECDSA_SIG* trustm_ecdsa_sign(
         }
         }
     }while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, ecdsa_sig != NULL);
 
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -589,6 +678,13 @@ uint16_t trustmEngine_init_ec(ENGINE *e)
     if (trustm_ctx.default_ec == NULL)
       break;
 
+    if (ec_ex_index < 0)
+      ec_ex_index = EC_KEY_get_ex_new_index(0, "trustm key", NULL,
+                                            trustmEngine_key_ctx_dup,
+                                            trustmEngine_key_ctx_free);
+    if (ec_ex_index < 0)
+      break;
+
     trustm_ctx.ec_key_method = EC_KEY_METHOD_new(trustm_ctx.default_ec);
     if (    trustm_ctx.ec_key_method == NULL)
       break;
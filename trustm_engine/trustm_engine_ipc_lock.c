@@ -24,176 +24,75 @@
 */
 
 #include <stdio.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
 #include <openssl/engine.h>
 
 #include "optiga_lib_common.h"
 
+#include "trustm_helper.h"
+#include "trustm_helper_ipc_lock.h"
+
 #include "trustm_engine_common.h"
 #include "trustm_engine_ipc_lock.h"
 
 
-/*************************************************************************
-*  Global
-*************************************************************************/
-//Globe Variable
-// for IPC
-// ---- InterCom
-#define IPC_FLAGSIZE    sizeof(pid_t)
-#define IPC_SLEEP_STEPS 1
-#define MAX_IPC_TIME 50
-
-key_t ipc_FlagInterKey;
-int   ipc_FlagInterShmid;
-pid_t ipc_queue;
-unsigned char ipc_value;
-unsigned char ipc_temp;
-long ipc_task;
 /*************************************************************************
 *  functions
 *************************************************************************/
+// The engine shares the lock with the CLI tools, the implementation
+// is in trustm_helper/trustm_helper_ipc_lock.c
+
 /**********************************************************************
-* __trustmEngine_writeshm()
+* __trustmEngine_ipcInit()
 **********************************************************************/
-static void __trustmEngine_writeshm(int shmid,pid_t data)
+void __trustmEngine_ipcInit(void)
 {
-    pid_t  *Flag_segptr;
-
-    /* Attach (map) the shared memory segment into the current process */
-     if((Flag_segptr = (pid_t *)shmat(shmid, 0, 0)) == (pid_t *)-1)
-     {
-             perror("write flag shmat");
-             return;
-             //exit(1);
-     }
-
-     *Flag_segptr=data;
-     shmdt(Flag_segptr);
+    __trustm_ipcInit();
 }
 
 /**********************************************************************
-* __trustmEngine_readshm()
+* trustmEngine_ipc_acquire()
+* Returns TRUSTM_ENGINE_SUCCESS with the lock held, TRUSTM_ENGINE_FAIL
+* if the lock cannot be taken.
 **********************************************************************/
-static pid_t __trustmEngine_readshm(int shmid)
-{   pid_t  *Flag_segptr;
-    pid_t Flag;
-    /* Attach (map) the shared memory segment into the current process */
-     if((Flag_segptr = (pid_t *)shmat(shmid, 0, 0)) == (pid_t *)-1)
-     {
-             perror("read flag shmat");
-             return 0;
-             //exit(1);
-     }
-     Flag = *Flag_segptr;
-     shmdt(Flag_segptr);
+int trustmEngine_ipc_acquire(void)
+{
+    uint64_t t0 = trustmEngine_stats_clock();
+    int ret = TRUSTM_ENGINE_SUCCESS;
 
-    return Flag;
+    TRUSTM_ENGINE_DBGFN(">");
+    if (trustm_ipc_acquire() != 0)
+    {
+        TRUSTM_ENGINE_ERRFN("Fail : trustm_ipc_acquire");
+        ret = TRUSTM_ENGINE_FAIL;
+    }
+    trustmEngine_stats_phase(TRUSTM_STATS_LOCK, t0);
+    TRUSTM_ENGINE_DBGFN("<");
+    return ret;
 }
 
 /**********************************************************************
-* __trustmEngine_ipcInit()
+* trustmEngine_ipc_release(void)
 **********************************************************************/
-void __trustmEngine_ipcInit(void)
+void trustmEngine_ipc_release(void)
 {
-	/* Unique Key for InterCom */
-    ipc_FlagInterKey = 0x11111123;
-    pid_t pid;
-
-  	/* Open the shared memory segment - create if necessary */
-    if((ipc_FlagInterShmid = shmget(ipc_FlagInterKey, IPC_FLAGSIZE, IPC_CREAT|IPC_EXCL|0666)) == -1)
-    {
-        TRUSTM_ENGINE_DBGFN("Shared memory segment exists - opening as client");
-        /* Segment probably already exists - try as a client */
-        if((ipc_FlagInterShmid = shmget(ipc_FlagInterKey, IPC_FLAGSIZE, 0)) == -1)
-        {
-            TRUSTM_ENGINE_DBGFN("share mem error %d",ipc_FlagInterShmid);
-            perror("Init shmget");
-            //shmctl(shmid, IPC_RMID, 0);
-            
-            exit(1);
-        }
-    }
-    else
-    {
-        // First created so init queue
-        pid=getpid();
-        TRUSTM_ENGINE_DBGFN("Init Queue %d", pid);
-        
-        //~ __trustmEngine_writeshm(ipc_FlagInterShmid,0x1);
-        __trustmEngine_writeshm(ipc_FlagInterShmid,pid); // stores the current PID
-
-        
-    }
+    TRUSTM_ENGINE_DBGFN(">");
+    trustm_ipc_release();
+    TRUSTM_ENGINE_DBGFN("<");
 }
 
 /**********************************************************************
-* trustmEngine_ipc_acquire()
+* trustmEngine_ipc_session_get(void)
 **********************************************************************/
-void trustmEngine_ipc_acquire(void)
+uint32_t trustmEngine_ipc_session_get(void)
 {
-    pid_t current_pid;
-    pid_t queue_pid;
-    int queue_delay;
-
-    __trustmEngine_ipcInit();
-    /// IPC Check
-    current_pid=getpid();
-    queue_delay= ((current_pid %MAX_IPC_TIME)+1)*IPC_SLEEP_STEPS;; // wait for 0 to 20ms at IPC_SLEEP_STEPS steps depends on process number
-    mssleep(queue_delay);
-    
-    queue_pid = __trustmEngine_readshm(ipc_FlagInterShmid);
-    TRUSTM_ENGINE_DBGFN("Check if TrustM Open:queue %d:current:%d:Delay %d", queue_pid,current_pid,queue_delay);
-    if (queue_pid ==0xAA55)
-    {    __trustmEngine_writeshm(ipc_FlagInterShmid,current_pid); /*write pid into shared memory*/
-        queue_pid = __trustmEngine_readshm(ipc_FlagInterShmid);
-        TRUSTM_ENGINE_DBGFN("Resource seized by %d",current_pid);
-    }    
-   
-    while ( queue_pid !=current_pid)  /*Check if taken by other process and wait*/
-    {
-        queue_pid = __trustmEngine_readshm(ipc_FlagInterShmid);
-        if (queue_pid ==0xAA55)
-        {    __trustmEngine_writeshm(ipc_FlagInterShmid,current_pid); /*write pid into shared memory*/
-            //queue_pid=__trustmEngine_readshm(ipc_FlagInterShmid);
-            TRUSTM_ENGINE_DBGFN("Resource seized by %d",current_pid);
-        }
-        else if (kill(queue_pid,0) == -1) 
-        {
-          mssleep(50);
-          queue_pid = __trustmEngine_readshm(ipc_FlagInterShmid); 
-          if (kill(queue_pid,0) == -1)
-          {          
-            TRUSTM_ENGINE_DBGFN("Process does not exist1:%d", queue_pid);
-            __trustmEngine_writeshm(ipc_FlagInterShmid,current_pid);
-            //queue_pid=__trustmEngine_readshm(ipc_FlagInterShmid);
-            }
-        }
-        queue_delay= ((current_pid %MAX_IPC_TIME)+1)*IPC_SLEEP_STEPS; // wait for 1 to MAX_IPC_TIME at IPC_SLEEP_STEPS steps depends on process number
-        mssleep(queue_delay);
-        queue_pid=__trustmEngine_readshm(ipc_FlagInterShmid);
-    }
- 
-    TRUSTM_ENGINE_DBGFN("Lock queue %d", queue_pid);
-
+    return trustm_ipc_session_get();
 }
 
 /**********************************************************************
-* trustmEngine_ipc_release(void)
+* trustmEngine_ipc_session_new(void)
+* Must be called with the IPC lock held.
 **********************************************************************/
-void trustmEngine_ipc_release(void)
+uint32_t trustmEngine_ipc_session_new(void)
 {
-    pid_t current_pid;
-    pid_t queue_pid;  
-    current_pid=getpid();
-    queue_pid = __trustmEngine_readshm(ipc_FlagInterShmid);
-    if (current_pid==queue_pid)
-    {
-        TRUSTM_ENGINE_DBGFN("release shared memory\n");
-        __trustmEngine_writeshm(ipc_FlagInterShmid,0xAA55);
-    }
-    else if (queue_pid!=0xAA55)
-    {   TRUSTM_ENGINE_DBGFN("shared memory used by others\n");
-    }
-     mssleep(30);
+    return trustm_ipc_session_new();
 }
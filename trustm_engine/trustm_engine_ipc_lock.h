@@ -56,8 +56,10 @@
 // Function Prototype
 
 void __trustmEngine_ipcInit(void);
-void trustmEngine_ipc_acquire(void);
+int  trustmEngine_ipc_acquire(void);
 void trustmEngine_ipc_release(void);
+uint32_t trustmEngine_ipc_session_get(void);
+uint32_t trustmEngine_ipc_session_new(void);
 
 
 #endif  // _TRUSTM_ENGINE_IPC_LOCK_H_
@@ -23,16 +23,20 @@
 
 */
 #include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
 #include <openssl/engine.h>
+#include <openssl/evp.h>
 
 #include "trustm_helper.h"
+#include "trustm_helper_shm.h"
+#include "trustm_broker.h"
+#include "trustm_helper_sec.h"
 
 #include "trustm_engine_common.h"
 
-#ifdef WORKAROUND
-	extern void pal_os_event_disarm(void);
-	extern void pal_os_event_arm(void);
-#endif
+#define MAX_RAND_INPUT 256
 
 static int trustmEngine_getrandom(unsigned char *buf, int num);
 static int trustmEngine_rand_status(void);
@@ -48,13 +52,68 @@ static RAND_METHOD rand_methods = {
     trustmEngine_rand_status        // status()
 };
 
+// Random pool: TRNG output is buffered in shared memory, one pool per
+// user so random bytes are never readable by other users. Bytes are
+// removed from the pool when they are served, so no two callers ever
+// get the same bytes, also across fork(). The pool is refilled up to
+// the high watermark once it falls below the low watermark.
+#define RAND_POOL_SHM_NAME  "/trustm_rand_pool"
+#define RAND_POOL_MAGIC     0x544D5250  // "TMRP", bump on layout change
+
+typedef struct trustm_rand_pool_str
+{
+    uint32_t        magic;
+    pthread_mutex_t lock;       // protects all fields below
+    uint32_t        head;       // oldest byte in data
+    uint32_t        count;
+    pid_t           refiller;   // 0 : no process refilling
+    uint8_t         data[TRUSTM_ENGINE_RAND_POOL_SIZE];
+} trustm_rand_pool_t;
+
+static trustm_rand_pool_t *rand_pool = NULL;
+// -1 : not initialized, 0 : not available, 1 : mapped
+static int rand_pool_state = -1;
+static pthread_mutex_t rand_pool_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Background refill, only used when the engine is thread-safe (thread
+// mode or broker), otherwise the caller refills the pool itself
+static pthread_mutex_t rand_refill_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rand_refill_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t rand_refill_thread;
+static pid_t rand_refill_pid = 0;   // process the thread was started in
+static uint8_t rand_refill_stop = 0;
+static uint8_t rand_refill_kick = 0;
+
+// CTR_DRBG mode (SP 800-90A CTR_DRBG, AES-256, no derivation function)
+// seeded with 48 bytes of TRNG output. Reseeded after the configured
+// number of requests, before every request with prediction resistance,
+// and in a child process after fork().
+#define DRBG_KEY_LEN        32
+#define DRBG_SEED_LEN       48  // key + V
+#define DRBG_MAX_REQUEST    65536
+
+typedef struct trustm_drbg_str
+{
+    pthread_mutex_t lock;
+    EVP_CIPHER_CTX  *cipher;
+    uint8_t         key[DRBG_KEY_LEN];
+    uint8_t         v[16];
+    uint32_t        counter;    // requests since last (re)seed
+    pid_t           pid;        // process the state was seeded in
+    uint8_t         seeded;
+} trustm_drbg_t;
+
+static trustm_drbg_t drbg = {PTHREAD_MUTEX_INITIALIZER, NULL, {0}, {0}, 0, 0, 0};
+
 /** Return the entropy status of the prng
- * Since we provide real randomness 
- * function, our status is allways good.
- * @retval 1 allways good status
+ * The TRNG is allways good, the DRBG once seeded.
+ * @retval 1 good status
+ * @retval 0 DRBG not seeded
  */
 static int trustmEngine_rand_status(void)
 {
+    if ((trustm_ctx.randMode == 1) && (drbg.seeded == 0))
+        return TRUSTM_ENGINE_FAIL;
     return TRUSTM_ENGINE_SUCCESS;
 }
 
@@ -74,43 +133,335 @@ uint16_t trustmEngine_init_rand(ENGINE *e)
     
 }
 
-/** Genereate random values
- * @param buf The buffer to write the random values to
- * @param num The amound of random bytes to generate
- * @retval 1 on success
- * @retval 0 on failure
- */
-static int trustmEngine_getrandom(unsigned char *buf, int num)
+/**********************************************************************
+* __trustmEngine_random()
+* optiga_crypt_random() or the broker, waits for completion
+**********************************************************************/
+static optiga_lib_status_t __trustmEngine_random(uint8_t *buf, uint16_t len)
 {
-    #define MAX_RAND_INPUT 256
-    
     optiga_lib_status_t return_status;
+    optiga_crypt_t *crypt;
+    trustm_sched_req_t *req;
+    uint64_t t0 = trustmEngine_stats_clock();
+
+    if (trustm_ctx.broker)
+        return trustmEngine_stats_chip(t0, trustm_broker_random(buf, len));
+
+    crypt = trustmEngine_crypt_begin(&req);
+    if (crypt == NULL)
+        return OPTIGA_CRYPT_ERROR;
+    t0 = trustmEngine_stats_clock();
+    return_status = optiga_crypt_random(crypt, 
+                        OPTIGA_RNG_TYPE_TRNG, 
+                        buf,
+                        len);
+    //Wait until the optiga_crypt_random operation is completed
+    return trustmEngine_stats_chip(t0, trustmEngine_crypt_end(req, return_status));
+}
+
+/**********************************************************************
+* __trustmEngine_pool_setup()
+**********************************************************************/
+static void __trustmEngine_pool_setup(void *shm)
+{
+    trustm_shm_mutex_init(&((trustm_rand_pool_t *)shm)->lock);
+}
+
+/**********************************************************************
+* __trustmEngine_pool_init()
+* Maps the random pool of the current user, creating it if needed.
+* The pool is optional, any failure falls back to reading the chip.
+**********************************************************************/
+static int __trustmEngine_pool_init(void)
+{
+    char name[64];
+
+    if (__atomic_load_n(&rand_pool_state, __ATOMIC_ACQUIRE) >= 0)
+        return rand_pool_state;
+
+    pthread_mutex_lock(&rand_pool_init_mutex);
+    do
+    {
+        if (rand_pool_state >= 0)
+            break;
+        rand_pool_state = 0;
+
+        snprintf(name, sizeof(name), RAND_POOL_SHM_NAME ".%u", (unsigned int)getuid());
+        // Never serve bytes from a pool somebody else can read
+        rand_pool = trustm_shm_map(name, sizeof(trustm_rand_pool_t), 0600, 1,
+                                RAND_POOL_MAGIC, __trustmEngine_pool_setup);
+        if (rand_pool == NULL)
+            break;
+        __atomic_store_n(&rand_pool_state, 1, __ATOMIC_RELEASE);
+    }while(FALSE);
+    pthread_mutex_unlock(&rand_pool_init_mutex);
+
+    return rand_pool_state;
+}
+
+/**********************************************************************
+* __trustmEngine_pool_lock() / __trustmEngine_pool_unlock()
+**********************************************************************/
+static void __trustmEngine_pool_lock(void)
+{
+    if (pthread_mutex_lock(&rand_pool->lock) == EOWNERDEAD)
+    {
+        // The owner may have died between handing out bytes and updating
+        // head and count, drop the whole pool rather than serve them twice
+        TRUSTM_ENGINE_DBGFN("Random pool lock owner died");
+        OPENSSL_cleanse(rand_pool->data, sizeof(rand_pool->data));
+        rand_pool->head = 0;
+        rand_pool->count = 0;
+        rand_pool->refiller = 0;
+        pthread_mutex_consistent(&rand_pool->lock);
+    }
+}
+
+static void __trustmEngine_pool_unlock(void)
+{
+    pthread_mutex_unlock(&rand_pool->lock);
+}
+
+/**********************************************************************
+* __trustmEngine_pool_take()
+* Moves up to num bytes from the pool to buf and wipes them from the
+* pool. *low is set if the pool is below the low watermark.
+* Returns the number of bytes served.
+**********************************************************************/
+static int __trustmEngine_pool_take(uint8_t *buf, int num, int *low)
+{
+    uint32_t n, part;
+
+    *low = 0;
+    if (__trustmEngine_pool_init() != 1)
+        return 0;
+
+    __trustmEngine_pool_lock();
+    n = (rand_pool->count < (uint32_t)num) ? rand_pool->count : (uint32_t)num;
+    part = TRUSTM_ENGINE_RAND_POOL_SIZE - rand_pool->head;
+    if (part > n)
+        part = n;
+    memcpy(buf, &rand_pool->data[rand_pool->head], part);
+    OPENSSL_cleanse(&rand_pool->data[rand_pool->head], part);
+    if (n > part)
+    {
+        memcpy(buf + part, &rand_pool->data[0], n - part);
+        OPENSSL_cleanse(&rand_pool->data[0], n - part);
+    }
+    rand_pool->head = (rand_pool->head + n) % TRUSTM_ENGINE_RAND_POOL_SIZE;
+    rand_pool->count -= n;
+    *low = (rand_pool->count < TRUSTM_ENGINE_RAND_POOL_LOW) ? 1 : 0;
+    __trustmEngine_pool_unlock();
+
+    TRUSTM_ENGINE_DBGFN("Served %u of %d", n, num);
+    return (int)n;
+}
+
+/**********************************************************************
+* __trustmEngine_pool_claim()
+* Returns 1 if the pool needs a refill and no other process is on it,
+* the caller then refills and calls __trustmEngine_pool_release().
+**********************************************************************/
+static int __trustmEngine_pool_claim(void)
+{
+    int ret = 0;
+
+    if (__trustmEngine_pool_init() != 1)
+        return 0;
+
+    __trustmEngine_pool_lock();
+    if ((rand_pool->refiller != 0) &&
+        (kill(rand_pool->refiller, 0) == -1) && (errno == ESRCH))
+    {
+        TRUSTM_ENGINE_DBGFN("Refiller %d died", rand_pool->refiller);
+        rand_pool->refiller = 0;
+    }
+    if ((rand_pool->refiller == 0) && (rand_pool->count < TRUSTM_ENGINE_RAND_POOL_LOW))
+    {
+        rand_pool->refiller = getpid();
+        ret = 1;
+    }
+    __trustmEngine_pool_unlock();
+    return ret;
+}
+
+static void __trustmEngine_pool_release(void)
+{
+    __trustmEngine_pool_lock();
+    rand_pool->refiller = 0;
+    __trustmEngine_pool_unlock();
+}
+
+/**********************************************************************
+* __trustmEngine_pool_refill()
+* Fills the claimed pool up to the high watermark, one chip session for
+* the whole refill.
+**********************************************************************/
+static void __trustmEngine_pool_refill(void)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
+    uint8_t tempbuf[MAX_RAND_INPUT];
+    uint32_t tail, part;
+    trustm_stats_frame_t stats;
+
+    TRUSTM_ENGINE_DBGFN(">");
+    // Refills are only ahead of demand, the first to go when the SEC is high
+    if (!trustmEngine_sec_gov_admit(TRUSTM_SEC_GOV_LOW))
+    {
+        __trustmEngine_pool_release();
+        return;
+    }
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RANDOM);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        __trustmEngine_pool_release();
+        return;
+    }
+    for (;;)
+    {
+        // Only the claimant adds bytes, the free space can only grow
+        __trustmEngine_pool_lock();
+        part = TRUSTM_ENGINE_RAND_POOL_HIGH - rand_pool->count;
+        __trustmEngine_pool_unlock();
+        if (part < MAX_RAND_INPUT)
+            break;
+
+        // A failed batch is dropped, the pool only gets complete reads
+        return_status = __trustmEngine_random(tempbuf, MAX_RAND_INPUT);
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        __trustmEngine_pool_lock();
+        tail = (rand_pool->head + rand_pool->count) % TRUSTM_ENGINE_RAND_POOL_SIZE;
+        part = TRUSTM_ENGINE_RAND_POOL_SIZE - tail;
+        if (part > MAX_RAND_INPUT)
+            part = MAX_RAND_INPUT;
+        memcpy(&rand_pool->data[tail], tempbuf, part);
+        memcpy(&rand_pool->data[0], tempbuf + part, MAX_RAND_INPUT - part);
+        rand_pool->count += MAX_RAND_INPUT;
+        __trustmEngine_pool_unlock();
+    }
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, return_status == OPTIGA_LIB_SUCCESS);
+    OPENSSL_cleanse(tempbuf, sizeof(tempbuf));
+
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        trustmPrintErrorCode(return_status);
+    __trustmEngine_pool_release();
+    TRUSTM_ENGINE_DBGFN("<");
+}
+
+/**********************************************************************
+* __trustmEngine_refill_main()
+* Background refill thread, woken by consumers when the pool is low
+**********************************************************************/
+static void *__trustmEngine_refill_main(void *arg)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&rand_refill_mutex);
+    while (rand_refill_stop == 0)
+    {
+        if (rand_refill_kick == 0)
+        {
+            // Also look at the pool now and then, another process may
+            // have died while refilling it
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&rand_refill_cond, &rand_refill_mutex, &deadline);
+            continue;
+        }
+        rand_refill_kick = 0;
+        pthread_mutex_unlock(&rand_refill_mutex);
+
+        if (__trustmEngine_pool_claim())
+            __trustmEngine_pool_refill();
+
+        pthread_mutex_lock(&rand_refill_mutex);
+    }
+    pthread_mutex_unlock(&rand_refill_mutex);
+    return NULL;
+}
+
+/**********************************************************************
+* __trustmEngine_pool_kick()
+* Called when the pool is below the low watermark
+**********************************************************************/
+static void __trustmEngine_pool_kick(void)
+{
+    // Without thread mode or the broker the OPTIGA host library must not
+    // be used from another thread, refill in the caller
+    if ((trustm_ctx.threadMode == 0) && (trustm_ctx.broker == 0))
+    {
+        if (__trustmEngine_pool_claim())
+            __trustmEngine_pool_refill();
+        return;
+    }
+
+    pthread_mutex_lock(&rand_refill_mutex);
+    // A thread started before fork() does not exist in the child
+    if (rand_refill_pid != getpid())
+    {
+        rand_refill_stop = 0;
+        if (pthread_create(&rand_refill_thread, NULL, __trustmEngine_refill_main, NULL) == 0)
+            rand_refill_pid = getpid();
+        else
+            TRUSTM_ENGINE_ERRFN("Fail to start random pool refill : %s", strerror(errno));
+    }
+    rand_refill_kick = 1;
+    pthread_cond_signal(&rand_refill_cond);
+    pthread_mutex_unlock(&rand_refill_mutex);
+}
+
+/**********************************************************************
+* trustmEngine_rand_pool_stop()
+* Stops the background refill, must be called before leaving thread
+* mode and on engine destroy.
+**********************************************************************/
+void trustmEngine_rand_pool_stop(void)
+{
+    pthread_mutex_lock(&rand_refill_mutex);
+    if (rand_refill_pid != getpid())
+    {
+        pthread_mutex_unlock(&rand_refill_mutex);
+        return;
+    }
+    rand_refill_stop = 1;
+    pthread_cond_signal(&rand_refill_cond);
+    pthread_mutex_unlock(&rand_refill_mutex);
+
+    pthread_join(rand_refill_thread, NULL);
+    rand_refill_pid = 0;
+}
+
+/**********************************************************************
+* __trustmEngine_getrandom_chip()
+* Reads num bytes directly from the chip TRNG
+**********************************************************************/
+static int __trustmEngine_getrandom_chip(unsigned char *buf, int num)
+{
+    optiga_lib_status_t return_status = OPTIGA_LIB_SUCCESS;
     int i,j,k;
     uint8_t tempbuf[MAX_RAND_INPUT];    
     int ret = TRUSTM_ENGINE_FAIL;
-    
-    TRUSTM_ENGINE_DBGFN("> num : %d", num);
+    trustm_stats_frame_t stats;
     
     i = num % MAX_RAND_INPUT; // max random number output, find the reminder
     j = (num - i)/MAX_RAND_INPUT; // Get the count 
 
-    TRUSTM_WORKAROUND_TIMER_ARM; 
-    TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RANDOM);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ret;
+    }
     do 
     {   
         k = 0;
         if(i > 0)  
         {
-            optiga_lib_status = OPTIGA_LIB_BUSY;
-            return_status = optiga_crypt_random(me_crypt, 
-                                OPTIGA_RNG_TYPE_TRNG, 
-                                tempbuf,
-                                MAX_RAND_INPUT);
-            if (OPTIGA_LIB_SUCCESS != return_status)
-                break;			
-            //Wait until the optiga_util_read_metadata operation is completed
-            trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-            return_status = optiga_lib_status;
+            return_status = __trustmEngine_random(tempbuf, MAX_RAND_INPUT);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
 
@@ -122,29 +473,227 @@ static int trustmEngine_getrandom(unsigned char *buf, int num)
 
         for(;j>0;j--)  
         {
-            optiga_lib_status = OPTIGA_LIB_BUSY;
-            return_status = optiga_crypt_random(me_crypt, 
-                                OPTIGA_RNG_TYPE_TRNG, 
-                                (buf+k),
-                                MAX_RAND_INPUT);
-            if (OPTIGA_LIB_SUCCESS != return_status)
-                break;			
-            //Wait until the optiga_util_read_metadata operation is completed
-            trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-            return_status = optiga_lib_status;
+            return_status = __trustmEngine_random((buf+k), MAX_RAND_INPUT);
             if (return_status != OPTIGA_LIB_SUCCESS)
                 break;
             k += (MAX_RAND_INPUT);
         }
-
-        ret = TRUSTM_ENGINE_SUCCESS;
     }while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, return_status == OPTIGA_LIB_SUCCESS);
+    OPENSSL_cleanse(tempbuf, sizeof(tempbuf));
+
   
-	// Capture OPTIGA Error
+	// Capture OPTIGA Error, only a complete read is random output
 	if (return_status != OPTIGA_LIB_SUCCESS)
+	{
+		OPENSSL_cleanse(buf, num);
 		trustmPrintErrorCode(return_status);
+	}
+	else
+		ret = TRUSTM_ENGINE_SUCCESS;
+
+    return ret;
+}
+
+/**********************************************************************
+* __trustmEngine_trng()
+* num bytes of TRNG output, from the pool if enabled
+**********************************************************************/
+static int __trustmEngine_trng(unsigned char *buf, int num)
+{
+    int k;
+    int low;
+    int ret = TRUSTM_ENGINE_SUCCESS;
+
+    k = 0;
+    if (trustm_ctx.randPool == 1)
+    {
+        k = __trustmEngine_pool_take(buf, num, &low);
+        if (low)
+        {
+            __trustmEngine_pool_kick();
+            if (k < num)
+                k += __trustmEngine_pool_take(buf + k, num - k, &low);
+        }
+    }
+
+    // Pool disabled or empty, read the remainder from the chip
+    if (k < num)
+        ret = __trustmEngine_getrandom_chip(buf + k, num - k);
+    return ret;
+}
+
+/**********************************************************************
+* __trustmEngine_drbg_add()
+* Adds n to the 128 bit big endian counter v
+**********************************************************************/
+static void __trustmEngine_drbg_add(uint8_t *v, uint32_t n)
+{
+    int i;
+    uint32_t carry = n;
+
+    for (i = 15; (i >= 0) && (carry != 0); i--)
+    {
+        carry += v[i];
+        v[i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+}
+
+/**********************************************************************
+* __trustmEngine_drbg_block()
+* len bytes of AES-256(key, V+1), AES-256(key, V+2), ... V is advanced
+* past the blocks used. This is AES-CTR over zeros with IV V+1.
+**********************************************************************/
+static int __trustmEngine_drbg_block(uint8_t *out, int len)
+{
+    uint8_t iv[16];
+    int outl;
+    int ret = TRUSTM_ENGINE_FAIL;
+
+    memcpy(iv, drbg.v, sizeof(iv));
+    __trustmEngine_drbg_add(iv, 1);
+    memset(out, 0, len);
+    if ((EVP_EncryptInit_ex(drbg.cipher, EVP_aes_256_ctr(), NULL, drbg.key, iv) == 1) &&
+        (EVP_EncryptUpdate(drbg.cipher, out, &outl, out, len) == 1))
+    {
+        __trustmEngine_drbg_add(drbg.v, (len + 15) / 16);
+        ret = TRUSTM_ENGINE_SUCCESS;
+    }
+    return ret;
+}
+
+/**********************************************************************
+* __trustmEngine_drbg_update()
+* CTR_DRBG_Update(), provided is DRBG_SEED_LEN bytes
+**********************************************************************/
+static int __trustmEngine_drbg_update(const uint8_t *provided)
+{
+    uint8_t temp[DRBG_SEED_LEN];
+    int i;
+
+    if (__trustmEngine_drbg_block(temp, DRBG_SEED_LEN) != TRUSTM_ENGINE_SUCCESS)
+        return TRUSTM_ENGINE_FAIL;
+    for (i = 0; i < DRBG_SEED_LEN; i++)
+        temp[i] ^= provided[i];
+    memcpy(drbg.key, temp, DRBG_KEY_LEN);
+    memcpy(drbg.v, temp + DRBG_KEY_LEN, sizeof(drbg.v));
+    OPENSSL_cleanse(temp, sizeof(temp));
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* __trustmEngine_drbg_reseed()
+* Instantiates or reseeds the DRBG from the TRNG, drbg.lock held
+**********************************************************************/
+static int __trustmEngine_drbg_reseed(void)
+{
+    uint8_t entropy[DRBG_SEED_LEN];
+    int ret = TRUSTM_ENGINE_FAIL;
+
+    TRUSTM_ENGINE_DBGFN("> seeded : %d", drbg.seeded);
+    do
+    {
+        if ((drbg.cipher == NULL) && ((drbg.cipher = EVP_CIPHER_CTX_new()) == NULL))
+            break;
+        if (__trustmEngine_trng(entropy, sizeof(entropy)) != TRUSTM_ENGINE_SUCCESS)
+            break;
+
+        // Instantiate starts from key and V all zero, reseed from the
+        // current state
+        if ((drbg.seeded == 0) || (drbg.pid != getpid()))
+        {
+            OPENSSL_cleanse(drbg.key, sizeof(drbg.key));
+            OPENSSL_cleanse(drbg.v, sizeof(drbg.v));
+        }
+        if (__trustmEngine_drbg_update(entropy) != TRUSTM_ENGINE_SUCCESS)
+            break;
+        drbg.counter = 1;
+        drbg.pid = getpid();
+        drbg.seeded = 1;
+        ret = TRUSTM_ENGINE_SUCCESS;
+    }while(FALSE);
+    OPENSSL_cleanse(entropy, sizeof(entropy));
+
+    if (ret != TRUSTM_ENGINE_SUCCESS)
+    {
+        TRUSTM_ENGINE_ERRFN("Fail to seed DRBG");
+        drbg.seeded = 0;
+    }
+    TRUSTM_ENGINE_DBGFN("<");
+    return ret;
+}
+
+/**********************************************************************
+* __trustmEngine_drbg_generate()
+**********************************************************************/
+static int __trustmEngine_drbg_generate(unsigned char *buf, int num)
+{
+    static const uint8_t zero[DRBG_SEED_LEN] = {0};
+    int n, k;
+    int ret = TRUSTM_ENGINE_SUCCESS;
+
+    pthread_mutex_lock(&drbg.lock);
+    for (k = 0; (k < num) && (ret == TRUSTM_ENGINE_SUCCESS); k += n)
+    {
+        n = ((num - k) > DRBG_MAX_REQUEST) ? DRBG_MAX_REQUEST : (num - k);
+
+        // A scheduled reseed is postponed while the SEC governor sheds
+        // low priority work
+        if ((drbg.seeded == 0) || (drbg.pid != getpid()) || (trustm_ctx.drbgPR == 1) ||
+            ((drbg.counter > trustm_ctx.drbgReseed) && trustmEngine_sec_gov_admit(TRUSTM_SEC_GOV_LOW)))
+        {
+            ret = __trustmEngine_drbg_reseed();
+            if (ret != TRUSTM_ENGINE_SUCCESS)
+                break;
+        }
+
+        ret = __trustmEngine_drbg_block(buf + k, n);
+        if (ret == TRUSTM_ENGINE_SUCCESS)
+            ret = __trustmEngine_drbg_update(zero);
+        drbg.counter++;
+    }
+    if (ret != TRUSTM_ENGINE_SUCCESS)
+        drbg.seeded = 0;
+    pthread_mutex_unlock(&drbg.lock);
+
+    return ret;
+}
+
+/**********************************************************************
+* trustmEngine_drbg_clear()
+* Wipes the DRBG state, the next request instantiates it again
+**********************************************************************/
+void trustmEngine_drbg_clear(void)
+{
+    pthread_mutex_lock(&drbg.lock);
+    OPENSSL_cleanse(drbg.key, sizeof(drbg.key));
+    OPENSSL_cleanse(drbg.v, sizeof(drbg.v));
+    drbg.seeded = 0;
+    if (drbg.cipher != NULL)
+        EVP_CIPHER_CTX_free(drbg.cipher);
+    drbg.cipher = NULL;
+    pthread_mutex_unlock(&drbg.lock);
+}
+
+/** Genereate random values
+ * @param buf The buffer to write the random values to
+ * @param num The amound of random bytes to generate
+ * @retval 1 on success
+ * @retval 0 on failure
+ */
+static int trustmEngine_getrandom(unsigned char *buf, int num)
+{
+    int i;
+    int ret;
+    
+    TRUSTM_ENGINE_DBGFN("> num : %d", num);
+
+    if (trustm_ctx.randMode == 1)
+        ret = __trustmEngine_drbg_generate(buf, num);
+    else
+        ret = __trustmEngine_trng(buf, num);
   
     // if fail returns all zero
     if (ret != TRUSTM_ENGINE_SUCCESS)
@@ -158,5 +707,4 @@ static int trustmEngine_getrandom(unsigned char *buf, int num)
     
     TRUSTM_ENGINE_DBGFN("<");    
     return ret;
-    #undef MAX_RAND_INPUT
 }
@@ -27,11 +27,8 @@
 
 #include "trustm_engine_common.h"
 #include "trustm_helper.h"
-
-#ifdef WORKAROUND
-    extern void pal_os_event_disarm(void);
-    extern void pal_os_event_arm(void);
-#endif
+#include "trustm_broker.h"
+#include "trustm_helper_cache.h"
 
 static uint8_t dummy_public_key_2048[] = {
     0x30,0x82,0x01,0x22,0x30,0x0D,0x06,0x09,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,
@@ -74,6 +71,52 @@ static uint8_t dummy_public_key_1024[] = {
 const RSA_METHOD *default_rsa = NULL;
 RSA_METHOD *rsa_methods = NULL;
 
+// ex_data index of the trustm_key_ctx_t attached to loaded RSA keys
+static int rsa_ex_index = -1;
+
+/**********************************************************************
+* trustm_rsa_set_key_ctx()
+* Attaches the parameters of the key just loaded to its RSA object
+**********************************************************************/
+int trustm_rsa_set_key_ctx(EVP_PKEY *key)
+{
+    RSA *rsa;
+    trustm_key_ctx_t *kctx;
+    int ret = TRUSTM_ENGINE_FAIL;
+
+    rsa = EVP_PKEY_get1_RSA(key);
+    if (rsa == NULL)
+        return TRUSTM_ENGINE_FAIL;
+
+    kctx = trustmEngine_key_ctx_new();
+    if (kctx != NULL)
+    {
+        ret = RSA_set_ex_data(rsa, rsa_ex_index, kctx);
+        if (ret != TRUSTM_ENGINE_SUCCESS)
+            OPENSSL_free(kctx);
+        else
+            TRUSTM_ENGINE_DBGFN("RSA key 0x%.4X attached", kctx->key_oid);
+    }
+    RSA_free(rsa);
+    return ret;
+}
+
+/**********************************************************************
+* __trustm_rsa_key_ctx()
+* Key context attached to rsa. Keys not loaded through the engine fall
+* back to the last loaded key, copied to def.
+**********************************************************************/
+static const trustm_key_ctx_t *__trustm_rsa_key_ctx(const RSA *rsa, trustm_key_ctx_t *def)
+{
+    const trustm_key_ctx_t *kctx;
+
+    kctx = RSA_get_ex_data(rsa, rsa_ex_index);
+    if (kctx != NULL)
+        return kctx;
+    trustmEngine_key_ctx_default(def);
+    return def;
+}
+
 
 static EVP_PKEY *trustm_rsa_generatekey(void)
 {
@@ -98,7 +141,6 @@ static EVP_PKEY *trustm_rsa_generatekey(void)
                 0x2A,0x86,0x48,0x86,0xF7,0x0D,0x01,0x01,0x01,0x05,0x00};
 
     TRUSTM_ENGINE_DBGFN(">");
-    TRUSTM_WORKAROUND_TIMER_ARM;
     TRUSTM_ENGINE_APP_OPEN_RET(key,NULL);
     do
     {
@@ -134,6 +176,7 @@ static EVP_PKEY *trustm_rsa_generatekey(void)
         printf("Please wait generating RSA key .......\n");
         trustmEngine_WaitForCompletion(MAX_RSA_KEY_GEN_TIME);
         return_status = optiga_lib_status;
+        trustm_cache_invalidate(trustm_ctx.key_oid);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
 
@@ -155,10 +198,11 @@ static EVP_PKEY *trustm_rsa_generatekey(void)
             //Wait until the optiga_util_read_metadata operation is completed
             trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
             return_status = optiga_lib_status;
+            trustm_cache_invalidate((trustm_ctx.key_oid)+0x10E4);
             if (return_status != OPTIGA_LIB_SUCCESS)
             break;
-            else
             TRUSTM_ENGINE_DBGFN("Write Success \n");
+            trustm_cache_pubkey_put((trustm_ctx.key_oid)+0x10E4, public_key, public_key_length+i);
         }
 
         trustm_ctx.pubkeylen = public_key_length+i;
@@ -170,7 +214,6 @@ static EVP_PKEY *trustm_rsa_generatekey(void)
         key = d2i_PUBKEY(NULL,(const unsigned char **)&data,public_key_length+i);
     } while (FALSE);
     TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
     
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -228,6 +271,73 @@ EVP_PKEY *trustm_rsa_loadkey(void)
     return key;
 }
 
+/**********************************************************************
+* __trustmEngine_rsa_sign()
+* optiga_crypt_rsa_sign() or the broker, waits for completion
+**********************************************************************/
+static optiga_lib_status_t __trustmEngine_rsa_sign(optiga_rsa_signature_scheme_t scheme,
+                                                   const uint8_t *digest, uint8_t digest_length,
+                                                   uint16_t key_oid,
+                                                   uint8_t *signature, uint16_t *signature_length)
+{
+    optiga_lib_status_t return_status;
+    optiga_crypt_t *crypt;
+    trustm_sched_req_t *req;
+    uint64_t t0 = trustmEngine_stats_clock();
+
+    if (trustm_ctx.broker)
+        return trustmEngine_stats_chip(t0, trustm_broker_rsa_sign(key_oid, scheme, digest, digest_length, signature, signature_length));
+
+    crypt = trustmEngine_crypt_begin(&req);
+    if (crypt == NULL)
+        return OPTIGA_CRYPT_ERROR;
+    t0 = trustmEngine_stats_clock();
+    return_status = optiga_crypt_rsa_sign(crypt,
+                          scheme,
+                          digest,
+                          digest_length,
+                          key_oid,
+                          signature,
+                          signature_length,
+                          0x0000);
+    //Wait until the optiga_crypt_rsa_sign operation is completed
+    return trustmEngine_stats_chip(t0, trustmEngine_crypt_end(req, return_status));
+}
+
+/**********************************************************************
+* __trustmEngine_rsa_decrypt()
+* optiga_crypt_rsa_decrypt_and_export() or the broker, waits for completion
+**********************************************************************/
+static optiga_lib_status_t __trustmEngine_rsa_decrypt(optiga_rsa_encryption_scheme_t scheme,
+                                                      const uint8_t *message, uint16_t message_length,
+                                                      uint16_t key_oid,
+                                                      uint8_t *plain, uint16_t *plain_length)
+{
+    optiga_lib_status_t return_status;
+    optiga_crypt_t *crypt;
+    trustm_sched_req_t *req;
+    uint64_t t0 = trustmEngine_stats_clock();
+
+    if (trustm_ctx.broker)
+        return trustmEngine_stats_chip(t0, trustm_broker_rsa_decrypt(key_oid, scheme, message, message_length, plain, plain_length));
+
+    crypt = trustmEngine_crypt_begin(&req);
+    if (crypt == NULL)
+        return OPTIGA_CRYPT_ERROR;
+    t0 = trustmEngine_stats_clock();
+    return_status = optiga_crypt_rsa_decrypt_and_export(crypt,
+                                                        scheme,
+                                                        message,
+                                                        message_length,
+                                                        NULL,
+                                                        0,
+                                                        key_oid,
+                                                        plain,
+                                                        plain_length);
+    //Wait until the optiga_crypt_rsa_decrypt_and_export operation is completed
+    return trustmEngine_stats_chip(t0, trustmEngine_crypt_end(req, return_status));
+}
+
 /** Encrypt data using priv trustM key
  *
  * @param flen Length of the from buffer.
@@ -247,39 +357,38 @@ static int trustmEngine_rsa_priv_enc(int flen,
     int ret = TRUSTM_ENGINE_FAIL;
     optiga_lib_status_t return_status;
     uint16_t templen = 500;
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_rsa_key_ctx(rsa, &defctx);
+    trustm_stats_frame_t stats;
 
     TRUSTM_ENGINE_DBGFN(">");
 
     TRUSTM_ENGINE_DBGFN("flen : %d",flen);
     TRUSTM_ENGINE_DBGFN("padding : %d", padding);
-    TRUSTM_ENGINE_DBGFN("oid : 0x%X\n",trustm_ctx.key_oid);
+    TRUSTM_ENGINE_DBGFN("oid : 0x%X\n",kctx->key_oid);
     trustmHexDump((uint8_t *)from,flen);
-    TRUSTM_WORKAROUND_TIMER_ARM;
-    TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RSA_SIGN);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ret;
+    }
     do
     {
-        optiga_lib_status = OPTIGA_LIB_BUSY;
-        return_status = optiga_crypt_rsa_sign(me_crypt,
-                              trustm_ctx.rsa_key_sig_scheme,
-                              (uint8_t *)from,
-                              flen,
-                              trustm_ctx.key_oid,
-                              to,
-                              &templen,
-                              0x0000);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
+        return_status = __trustmEngine_rsa_sign(kctx->rsa_key_sig_scheme,
+                                                from,
+                                                flen,
+                                                kctx->key_oid,
+                                                to,
+                                                &templen);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
 
         TRUSTM_ENGINE_DBGFN("to len : %d",templen);
         ret = templen;
     }while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, ret != TRUSTM_ENGINE_FAIL);
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
     trustmPrintErrorCode(return_status);
@@ -309,31 +418,29 @@ static int trustmEngine_rsa_priv_dec(int flen,
     optiga_rsa_encryption_scheme_t encryption_scheme;
     uint8_t decrypted_message[2048];
     uint16_t decrypted_message_length = sizeof(decrypted_message);
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_rsa_key_ctx(rsa, &defctx);
+    trustm_stats_frame_t stats;
 
     TRUSTM_ENGINE_DBGFN(">");
     //TRUSTM_ENGINE_DBGFN("From len : %d",flen);
     //trustmHexDump((uint8_t *)from,flen);
-    TRUSTM_WORKAROUND_TIMER_ARM; 
-    TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RSA_PRIV_DEC);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ret;
+    }
     do
     {
-        optiga_lib_status = OPTIGA_LIB_BUSY;
         encryption_scheme = OPTIGA_RSAES_PKCS1_V15;
 
-        return_status = optiga_crypt_rsa_decrypt_and_export(me_crypt,
-                                                            encryption_scheme,
-                                                            from,
-                                                            flen,
-                                                            NULL,
-                                                            0,
-                                                            trustm_ctx.key_oid,
-                                                            decrypted_message,
-                                                            &decrypted_message_length);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
+        return_status = __trustmEngine_rsa_decrypt(encryption_scheme,
+                                                   from,
+                                                   flen,
+                                                   kctx->key_oid,
+                                                   decrypted_message,
+                                                   &decrypted_message_length);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
 
@@ -343,8 +450,8 @@ static int trustmEngine_rsa_priv_dec(int flen,
         ret = decrypted_message_length;
 
     } while (FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, ret != TRUSTM_ENGINE_FAIL);
 
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -377,22 +484,30 @@ static int trustmEngine_rsa_pub_enc(int flen,
     uint8_t encrypted_message[2048];
     uint16_t encrypted_message_length = sizeof(encrypted_message);
     public_key_from_host_t public_key_from_host;
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_rsa_key_ctx(rsa, &defctx);
+    trustm_stats_frame_t stats;
+    uint64_t t0;
 
     TRUSTM_ENGINE_DBGFN(">");
     //TRUSTM_ENGINE_DBGFN("From len : %d",flen);
     //trustmHexDump((uint8_t *)from,flen);
-    TRUSTM_WORKAROUND_TIMER_ARM; 
-    TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RSA_PUB_ENC);
+    if (TRUSTM_ENGINE_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ret;
+    }
     do
     {
         optiga_lib_status = OPTIGA_LIB_BUSY;
 
         encryption_scheme = OPTIGA_RSAES_PKCS1_V15;
 
-        public_key_from_host.public_key = (uint8_t *)(trustm_ctx.pubkey+trustm_ctx.pubkeyHeaderLen);
-        public_key_from_host.length = (trustm_ctx.pubkeylen)-(trustm_ctx.pubkeyHeaderLen);
+        public_key_from_host.public_key = (uint8_t *)(kctx->pubkey+kctx->pubkeyHeaderLen);
+        public_key_from_host.length = (kctx->pubkeylen)-(kctx->pubkeyHeaderLen);
 
-        if (trustm_ctx.rsa_key_type == OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL)
+        if (kctx->rsa_key_type == OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL)
             public_key_from_host.key_type = (uint8_t)OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL;
         else
             public_key_from_host.key_type = (uint8_t)OPTIGA_RSA_KEY_1024_BIT_EXPONENTIAL;
@@ -400,6 +515,7 @@ static int trustmEngine_rsa_pub_enc(int flen,
         //printf("Pubkey:\n");
         //trustmHexDump(public_key_from_host.public_key, public_key_from_host.length);
 
+        t0 = trustmEngine_stats_clock();
         return_status = optiga_crypt_rsa_encrypt_message(me_crypt,
                                                             encryption_scheme,
                                                             from,
@@ -414,7 +530,7 @@ static int trustmEngine_rsa_pub_enc(int flen,
             break;
         //Wait until the optiga_util_read_metadata operation is completed
         trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
+        return_status = trustmEngine_stats_chip(t0, optiga_lib_status);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
 
@@ -425,7 +541,7 @@ static int trustmEngine_rsa_pub_enc(int flen,
 
     } while (FALSE);
     TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    trustmEngine_stats_end(&stats, ret != TRUSTM_ENGINE_FAIL);
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
     trustmPrintErrorCode(return_status);
@@ -475,6 +591,9 @@ static int trustmEngine_rsa_sign(int type,
     optiga_lib_status_t return_status;
     uint16_t key_oid;
     uint16_t templen = 500;
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_rsa_key_ctx(rsa, &defctx);
+    trustm_stats_frame_t stats;
 
     TRUSTM_ENGINE_DBGFN(">");
 
@@ -482,33 +601,29 @@ static int trustmEngine_rsa_sign(int type,
     TRUSTM_ENGINE_DBGFN("m_length : %d", m_length);
     //trustmHexDump((uint8_t *)m,m_length);
 
-    TRUSTM_WORKAROUND_TIMER_ARM;
-    TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
+    trustmEngine_stats_begin(&stats, TRUSTM_STATS_OP_RSA_SIGN);
+    if (TRUSTM_ENGINE_CRYPT_APP_OPEN != OPTIGA_LIB_SUCCESS)
+    {
+        trustmEngine_stats_end(&stats, 0);
+        return ret;
+    }
     do
     {
-        key_oid = trustm_ctx.key_oid;
-        optiga_lib_status = OPTIGA_LIB_BUSY;
-        return_status = optiga_crypt_rsa_sign(me_crypt,
-                              trustm_ctx.rsa_key_sig_scheme,
-                              (uint8_t *)m,
-                              m_length,
-                              key_oid,
-                              sigret,
-                              &templen,
-                              0x0000);
-        if (OPTIGA_LIB_SUCCESS != return_status)
-            break;
-        //Wait until the optiga_util_read_metadata operation is completed
-        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
-        return_status = optiga_lib_status;
+        key_oid = kctx->key_oid;
+        return_status = __trustmEngine_rsa_sign(kctx->rsa_key_sig_scheme,
+                                                m,
+                                                m_length,
+                                                key_oid,
+                                                sigret,
+                                                &templen);
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
 
         *siglen = templen;
         ret = TRUSTM_ENGINE_SUCCESS;
     }while(FALSE);
-    TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
+    TRUSTM_ENGINE_CRYPT_APP_CLOSE;
+    trustmEngine_stats_end(&stats, ret == TRUSTM_ENGINE_SUCCESS);
 
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -528,6 +643,8 @@ int trustmEngine_rsa_verify(int dtype,
     int ret = TRUSTM_ENGINE_FAIL;
     optiga_lib_status_t return_status;
     public_key_from_host_t public_key_details;
+    trustm_key_ctx_t defctx;
+    const trustm_key_ctx_t *kctx = __trustm_rsa_key_ctx(rsa, &defctx);
 
     //uint8_t public_key[512];
     //uint16_t i;
@@ -543,27 +660,26 @@ int trustmEngine_rsa_verify(int dtype,
     //trustmHexDump((uint8_t *)sigbuf,siglen);
 
     //trustmHexDump(trustm_ctx.pubkey,trustm_ctx.pubkeylen);
-    TRUSTM_WORKAROUND_TIMER_ARM;
     TRUSTM_ENGINE_APP_OPEN_RET(ret,TRUSTM_ENGINE_FAIL);
     do
     {
-        if (trustm_ctx.pubkeylen == 0)
+        if (kctx->pubkeylen == 0)
         {
              TRUSTM_ENGINE_ERRFN("Error No Public loaded!!!");
              break;
         }
 
-        public_key_details.public_key = (uint8_t *)(trustm_ctx.pubkey+trustm_ctx.pubkeyHeaderLen);
-        public_key_details.length = (trustm_ctx.pubkeylen)-(trustm_ctx.pubkeyHeaderLen);
+        public_key_details.public_key = (uint8_t *)(kctx->pubkey+kctx->pubkeyHeaderLen);
+        public_key_details.length = (kctx->pubkeylen)-(kctx->pubkeyHeaderLen);
 
-        if (trustm_ctx.rsa_key_type == OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL)
+        if (kctx->rsa_key_type == OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL)
             public_key_details.key_type = (uint8_t)OPTIGA_RSA_KEY_2048_BIT_EXPONENTIAL;
         else
             public_key_details.key_type = (uint8_t)OPTIGA_RSA_KEY_1024_BIT_EXPONENTIAL;
 
         optiga_lib_status = OPTIGA_LIB_BUSY;
         return_status = optiga_crypt_rsa_verify (me_crypt,
-                             trustm_ctx.rsa_key_sig_scheme,
+                             kctx->rsa_key_sig_scheme,
                              (uint8_t *)m,
                              m_length,
                              sigbuf,
@@ -582,7 +698,6 @@ int trustmEngine_rsa_verify(int dtype,
         ret = TRUSTM_ENGINE_SUCCESS;
     }while(FALSE);
     TRUSTM_ENGINE_APP_CLOSE;
-    TRUSTM_WORKAROUND_TIMER_DISARM;
 
     // Capture OPTIGA Error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -657,6 +772,13 @@ uint16_t trustmEngine_init_rsa(ENGINE *e)
         if (default_rsa == NULL)
             break;
 
+        if (rsa_ex_index < 0)
+            rsa_ex_index = RSA_get_ex_new_index(0, "trustm key", NULL,
+                                                trustmEngine_key_ctx_dup,
+                                                trustmEngine_key_ctx_free);
+        if (rsa_ex_index < 0)
+            break;
+
         rsa_methods = RSA_meth_dup(default_rsa);
         RSA_meth_set1_name(rsa_methods, "TrustM RSA methods");
 
@@ -0,0 +1,400 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/engine.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_shield.h"
+
+#include "trustm_engine_common.h"
+#include "trustm_engine_ipc_lock.h"
+
+// Thread mode: engine operations from any thread are given their own
+// optiga_crypt_t instance from a pool. A scheduler thread holds the IPC
+// lock and the application session for a burst of requests, so several
+// requests can be queued in the OPTIGA host library at once.
+
+static trustm_sched_req_t sched_pool[TRUSTM_ENGINE_SCHED_POOL];
+static uint32_t sched_pool_gen = 0;
+
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_cond;
+static uint8_t sched_cond_ready = 0;
+// Serializes calls into the OPTIGA host library
+static pthread_mutex_t sched_submit = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t sched_thread;
+static uint8_t sched_running = 0;
+static uint8_t sched_stop = 0;
+static uint8_t sched_granted = 0;
+static uint16_t sched_waiting = 0;
+static uint16_t sched_inflight = 0;
+static uint16_t sched_served = 0;
+
+/**********************************************************************
+* __trustmEngine_sched_callback()
+* Completion of a pool instance, context is its trustm_sched_req_t
+**********************************************************************/
+static void __trustmEngine_sched_callback(void *context, optiga_lib_status_t return_status)
+{
+    trustm_sched_req_t *req = (trustm_sched_req_t *)context;
+
+    pthread_mutex_lock(&sched_mutex);
+    req->status = return_status;
+    pthread_cond_broadcast(&sched_cond);
+    pthread_mutex_unlock(&sched_mutex);
+}
+
+/**********************************************************************
+* __trustmEngine_sched_pending()
+* An instance left busy by a timed out command is still queued in the
+* host library until its callback comes, it must not be destroyed or
+* reused before. sched_mutex must be held.
+**********************************************************************/
+static int __trustmEngine_sched_pending(const trustm_sched_req_t *req)
+{
+    return (req->busy != 0) && (req->status == OPTIGA_LIB_BUSY);
+}
+
+/**********************************************************************
+* __trustmEngine_sched_pool()
+* (Re-)creates the idle pool instances for a new session, and the timed
+* out ones once their command has completed. Pending instances are left
+* alone. Called by the scheduler thread while no request is in flight.
+**********************************************************************/
+static int __trustmEngine_sched_pool(void)
+{
+    uint8_t renew[TRUSTM_ENGINE_SCHED_POOL];
+    int i;
+    int usable = 0;
+
+    pthread_mutex_lock(&sched_mutex);
+    for (i = 0; i < TRUSTM_ENGINE_SCHED_POOL; i++)
+    {
+        renew[i] = 0;
+        if (__trustmEngine_sched_pending(&sched_pool[i]))
+            continue;
+        renew[i] = (sched_pool[i].crypt == NULL) || (sched_pool[i].busy != 0) ||
+                   (sched_pool_gen != trustm_ctx.sessionGen);
+        usable++;
+    }
+    pthread_mutex_unlock(&sched_mutex);
+    if (usable == 0)
+    {
+        TRUSTM_ENGINE_ERRFN("All pool instances pending");
+        return TRUSTM_ENGINE_FAIL;
+    }
+
+    for (i = 0; i < TRUSTM_ENGINE_SCHED_POOL; i++)
+    {
+        if (renew[i] == 0)
+            continue;
+        TRUSTM_ENGINE_DBGFN("Create pool instance %d for session %u", i, trustm_ctx.sessionGen);
+        if (sched_pool[i].crypt != NULL)
+            optiga_crypt_destroy(sched_pool[i].crypt);
+        sched_pool[i].busy = 0;
+        sched_pool[i].crypt = optiga_crypt_create(0, __trustmEngine_sched_callback, &sched_pool[i]);
+        if (sched_pool[i].crypt == NULL)
+        {
+            TRUSTM_ENGINE_ERRFN("Fail : optiga_crypt_create");
+            return TRUSTM_ENGINE_FAIL;
+        }
+    }
+    sched_pool_gen = trustm_ctx.sessionGen;
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* __trustmEngine_sched_main()
+* Takes the chip for the process while requests are waiting. A burst
+* ends after TRUSTM_ENGINE_SCHED_BURST requests so other processes
+* queued on the IPC lock get their turn.
+**********************************************************************/
+static void *__trustmEngine_sched_main(void *arg)
+{
+    optiga_lib_status_t return_status;
+
+    pthread_mutex_lock(&sched_mutex);
+    for (;;)
+    {
+        while ((sched_stop == 0) && (sched_waiting == 0))
+            pthread_cond_wait(&sched_cond, &sched_mutex);
+        if (sched_stop)
+            break;
+        pthread_mutex_unlock(&sched_mutex);
+
+        return_status = trustmEngine_Session_Open();
+        if ((return_status == OPTIGA_LIB_SUCCESS) &&
+            (__trustmEngine_sched_pool() != TRUSTM_ENGINE_SUCCESS))
+        {
+            // Only close what was opened, a failed open cleans up itself
+            trustmEngine_Session_Close();
+            return_status = OPTIGA_CRYPT_ERROR;
+        }
+        if (return_status != OPTIGA_LIB_SUCCESS)
+        {
+            // Fail the waiting requests rather than retrying forever
+            TRUSTM_ENGINE_ERRFN("Fail to open Trust M for scheduled requests");
+            pthread_mutex_lock(&sched_mutex);
+            sched_granted = 2;
+            pthread_cond_broadcast(&sched_cond);
+            while (sched_waiting > 0)
+                pthread_cond_wait(&sched_cond, &sched_mutex);
+            sched_granted = 0;
+            continue;
+        }
+
+        pthread_mutex_lock(&sched_mutex);
+        sched_granted = 1;
+        sched_served = 0;
+        pthread_cond_broadcast(&sched_cond);
+        while ((sched_granted == 1) && ((sched_waiting > 0) || (sched_inflight > 0)))
+            pthread_cond_wait(&sched_cond, &sched_mutex);
+        sched_granted = 0;
+        while (sched_inflight > 0)
+            pthread_cond_wait(&sched_cond, &sched_mutex);
+        pthread_mutex_unlock(&sched_mutex);
+
+        trustmEngine_Session_Close();
+        pthread_mutex_lock(&sched_mutex);
+    }
+    pthread_mutex_unlock(&sched_mutex);
+    return NULL;
+}
+
+/**********************************************************************
+* trustmEngine_sched_start()
+**********************************************************************/
+int trustmEngine_sched_start(void)
+{
+    pthread_condattr_t attr;
+
+    if (sched_running)
+        return TRUSTM_ENGINE_SUCCESS;
+
+    // Kept after a stop while a pending instance may still call back
+    if (sched_cond_ready == 0)
+    {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&sched_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        sched_cond_ready = 1;
+    }
+
+    sched_stop = 0;
+    if (pthread_create(&sched_thread, NULL, __trustmEngine_sched_main, NULL) != 0)
+    {
+        TRUSTM_ENGINE_ERRFN("Fail to start scheduler : %s", strerror(errno));
+        return TRUSTM_ENGINE_FAIL;
+    }
+    sched_running = 1;
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* trustmEngine_sched_stop()
+* Must not be called while requests are in progress
+**********************************************************************/
+void trustmEngine_sched_stop(void)
+{
+    int i;
+    int pending = 0;
+
+    if (sched_running == 0)
+        return;
+
+    pthread_mutex_lock(&sched_mutex);
+    sched_stop = 1;
+    pthread_cond_broadcast(&sched_cond);
+    pthread_mutex_unlock(&sched_mutex);
+    pthread_join(sched_thread, NULL);
+    sched_running = 0;
+
+    pthread_mutex_lock(&sched_mutex);
+    for (i = 0; i < TRUSTM_ENGINE_SCHED_POOL; i++)
+    {
+        // A pending instance is leaked, its callback may still come
+        if (__trustmEngine_sched_pending(&sched_pool[i]))
+        {
+            pending = 1;
+            continue;
+        }
+        if (sched_pool[i].crypt != NULL)
+            optiga_crypt_destroy(sched_pool[i].crypt);
+        sched_pool[i].crypt = NULL;
+        sched_pool[i].busy = 0;
+    }
+    pthread_mutex_unlock(&sched_mutex);
+    if (pending == 0)
+    {
+        pthread_cond_destroy(&sched_cond);
+        sched_cond_ready = 0;
+    }
+}
+
+/**********************************************************************
+* trustmEngine_sched_begin()
+* Waits until the scheduler holds the chip and a pool instance is free.
+* Returns with the submit lock held, the caller issues one command on
+* req->crypt and passes the result to trustmEngine_sched_end().
+* Returns NULL if the chip could not be opened.
+**********************************************************************/
+trustm_sched_req_t *trustmEngine_sched_begin(void)
+{
+    trustm_sched_req_t *req = NULL;
+    int i;
+
+    pthread_mutex_lock(&sched_mutex);
+    sched_waiting++;
+    pthread_cond_broadcast(&sched_cond);
+    for (;;)
+    {
+        if (sched_granted == 2)
+            break;
+        if (sched_granted == 1)
+        {
+            for (i = 0; i < TRUSTM_ENGINE_SCHED_POOL; i++)
+            {
+                if (sched_pool[i].busy == 0)
+                {
+                    req = &sched_pool[i];
+                    break;
+                }
+            }
+            if (req != NULL)
+                break;
+        }
+        pthread_cond_wait(&sched_cond, &sched_mutex);
+    }
+    sched_waiting--;
+    if (req != NULL)
+    {
+        req->busy = 1;
+        req->status = OPTIGA_LIB_BUSY;
+        sched_inflight++;
+        if (++sched_served >= TRUSTM_ENGINE_SCHED_BURST)
+            sched_granted = 0;
+    }
+    pthread_cond_broadcast(&sched_cond);
+    pthread_mutex_unlock(&sched_mutex);
+
+    if (req != NULL)
+        pthread_mutex_lock(&sched_submit);
+    return req;
+}
+
+/**********************************************************************
+* trustmEngine_sched_end()
+* ret is the return code of the optiga_crypt_xxx() call. Waits for the
+* completion of the command and returns its status, OPTIGA_LIB_BUSY on
+* time out.
+**********************************************************************/
+optiga_lib_status_t trustmEngine_sched_end(trustm_sched_req_t *req, optiga_lib_status_t ret)
+{
+    struct timespec deadline;
+    int res = 0;
+
+    pthread_mutex_unlock(&sched_submit);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += BUSY_WAIT_TIME_OUT / 1000;
+    deadline.tv_nsec += (long)(BUSY_WAIT_TIME_OUT % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&sched_mutex);
+    if (ret == OPTIGA_LIB_SUCCESS)
+    {
+        while ((req->status == OPTIGA_LIB_BUSY) && (res != ETIMEDOUT))
+            res = pthread_cond_timedwait(&sched_cond, &sched_mutex, &deadline);
+        ret = req->status;
+        if (ret == OPTIGA_LIB_BUSY)
+            TRUSTM_ENGINE_ERRFN("Fail : Optiga Busy Time Out");
+    }
+    // A timed out instance may still complete later, keep it out of
+    // the pool until __trustmEngine_sched_pool() finds it completed
+    if (ret != OPTIGA_LIB_BUSY)
+        req->busy = 0;
+    sched_inflight--;
+    pthread_cond_broadcast(&sched_cond);
+    pthread_mutex_unlock(&sched_mutex);
+    return ret;
+}
+
+/**********************************************************************
+* trustmEngine_crypt_begin()
+* Instance to issue the next crypt command on, a pool instance in
+* thread mode otherwise me_crypt, set up for the shielded connection
+* when SHIELD is on. Returns NULL on failure.
+**********************************************************************/
+optiga_crypt_t *trustmEngine_crypt_begin(trustm_sched_req_t **req)
+{
+    optiga_crypt_t *crypt = me_crypt;
+    uint64_t t0;
+
+    *req = NULL;
+    if (trustm_ctx.threadMode)
+    {
+        // Waiting for the scheduler to take the chip and a free instance
+        t0 = trustmEngine_stats_clock();
+        *req = trustmEngine_sched_begin();
+        trustmEngine_stats_phase(TRUSTM_STATS_LOCK, t0);
+        if (*req == NULL)
+            return NULL;
+        crypt = (*req)->crypt;
+    }
+    else
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+    // All instances share the channel of the comms instance
+    if (trustm_ctx.shield)
+        TRUSTM_SHIELD_CRYPT(crypt, OPTIGA_COMMS_FULL_PROTECTION);
+    return crypt;
+}
+
+/**********************************************************************
+* trustmEngine_crypt_end()
+* ret is the return code of the optiga_crypt_xxx() call, waits for the
+* command issued after trustmEngine_crypt_begin() and returns its status
+**********************************************************************/
+optiga_lib_status_t trustmEngine_crypt_end(trustm_sched_req_t *req, optiga_lib_status_t ret)
+{
+    if (req != NULL)
+        ret = trustmEngine_sched_end(req, ret);
+    else if (OPTIGA_LIB_SUCCESS == ret)
+    {
+        trustmEngine_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        ret = optiga_lib_status;
+    }
+    trustm_shield_result(ret);
+    trustmEngine_sec_gov_result(ret);
+    return ret;
+}
@@ -0,0 +1,371 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/engine.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_shm.h"
+#include "trustm_helper_trace.h"
+
+#include "trustm_engine_common.h"
+#include "trustm_engine_stats.h"
+
+static trustm_stats_shm_t *stats_shm = NULL;
+// -1 : not initialized, 0 : not available, 1 : mapped
+static int stats_shm_state = -1;
+static pthread_mutex_t stats_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Slot of the process, claimed again in a child after fork()
+static trustm_stats_proc_t *stats_proc = NULL;
+static pid_t stats_pid = 0;
+
+// Innermost operation measured by the thread
+static __thread trustm_stats_frame_t *stats_current = NULL;
+
+// Span names of the operations and phases in the trace
+static const char *stats_op_name[TRUSTM_STATS_OP_MAX] = TRUSTM_STATS_OP_NAMES;
+static const char *stats_phase_name[TRUSTM_STATS_PHASE_MAX] = TRUSTM_STATS_PHASE_NAMES;
+
+/**********************************************************************
+* __trustmEngine_stats_now()
+* Monotonic time in us
+**********************************************************************/
+static uint64_t __trustmEngine_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __trustmEngine_stats_setup()
+**********************************************************************/
+static void __trustmEngine_stats_setup(void *shm)
+{
+    trustm_shm_mutex_init(&((trustm_stats_shm_t *)shm)->lock);
+}
+
+/**********************************************************************
+* __trustmEngine_stats_map()
+* Maps the statistics segment, creating it if needed. Shared by all
+* users of the chip like the IPC lock.
+**********************************************************************/
+static int __trustmEngine_stats_map(void)
+{
+
+    if (__atomic_load_n(&stats_shm_state, __ATOMIC_ACQUIRE) >= 0)
+        return stats_shm_state;
+
+    pthread_mutex_lock(&stats_init_mutex);
+    do
+    {
+        if (stats_shm_state >= 0)
+            break;
+        stats_shm_state = 0;
+
+        // trustm_stats of other users must see us
+        stats_shm = trustm_shm_map(TRUSTM_STATS_SHM_NAME, sizeof(trustm_stats_shm_t), 0666, 1,
+                                TRUSTM_STATS_MAGIC, __trustmEngine_stats_setup);
+        if (stats_shm == NULL)
+            break;
+        __atomic_store_n(&stats_shm_state, 1, __ATOMIC_RELEASE);
+    }while(FALSE);
+    pthread_mutex_unlock(&stats_init_mutex);
+
+    return stats_shm_state;
+}
+
+/**********************************************************************
+* __trustmEngine_stats_lock() / __trustmEngine_stats_unlock()
+**********************************************************************/
+static void __trustmEngine_stats_lock(void)
+{
+    // Only slot ownership is protected, counters are updated lock-free
+    if (pthread_mutex_lock(&stats_shm->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&stats_shm->lock);
+}
+
+static void __trustmEngine_stats_unlock(void)
+{
+    pthread_mutex_unlock(&stats_shm->lock);
+}
+
+/**********************************************************************
+* __trustmEngine_stats_retire()
+* Adds the counters of a slot to the retired totals and frees it,
+* stats_shm->lock held.
+**********************************************************************/
+static void __trustmEngine_stats_retire(trustm_stats_proc_t *proc)
+{
+    trustm_stats_hist_t *to;
+    const trustm_stats_hist_t *from;
+    int i, j, k;
+
+    TRUSTM_ENGINE_DBGFN("Retire %d", proc->pid);
+    for (i = 0; i < TRUSTM_STATS_OP_MAX; i++)
+    {
+        stats_shm->retired.op[i].errors += proc->op[i].errors;
+        for (j = 0; j < TRUSTM_STATS_PHASE_MAX; j++)
+        {
+            to = &stats_shm->retired.op[i].phase[j];
+            from = &proc->op[i].phase[j];
+            to->count += from->count;
+            to->sum += from->sum;
+            if (from->max > to->max)
+                to->max = from->max;
+            for (k = 0; k < TRUSTM_STATS_BUCKETS; k++)
+                to->bucket[k] += from->bucket[k];
+        }
+    }
+    memset(proc, 0, sizeof(trustm_stats_proc_t));
+}
+
+/**********************************************************************
+* __trustmEngine_stats_slot()
+* Slot of the calling process, NULL if the segment is not available or
+* all slots are taken by running processes.
+**********************************************************************/
+static trustm_stats_proc_t *__trustmEngine_stats_slot(void)
+{
+    trustm_stats_proc_t *slot;
+    pid_t pid = getpid();
+    FILE *fp;
+    int i;
+
+    if (__atomic_load_n(&stats_pid, __ATOMIC_ACQUIRE) == pid)
+        return stats_proc;
+    if (__trustmEngine_stats_map() != 1)
+        return NULL;
+
+    pthread_mutex_lock(&stats_init_mutex);
+    if (stats_pid != pid)
+    {
+        slot = NULL;
+        __trustmEngine_stats_lock();
+        for (i = 0; i < TRUSTM_STATS_PROCS; i++)
+        {
+            // Slots of exited processes, also one left by an earlier
+            // process with our pid
+            if ((stats_shm->proc[i].pid != 0) &&
+                ((stats_shm->proc[i].pid == pid) ||
+                 ((kill(stats_shm->proc[i].pid, 0) == -1) && (errno == ESRCH))))
+            {
+                __trustmEngine_stats_retire(&stats_shm->proc[i]);
+            }
+            if ((slot == NULL) && (stats_shm->proc[i].pid == 0))
+                slot = &stats_shm->proc[i];
+        }
+        if (slot != NULL)
+        {
+            if ((fp = fopen("/proc/self/comm", "r")) != NULL)
+            {
+                if (fgets(slot->comm, sizeof(slot->comm), fp) != NULL)
+                    slot->comm[strcspn(slot->comm, "\n")] = '\0';
+                fclose(fp);
+            }
+            __atomic_store_n(&slot->pid, pid, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            TRUSTM_ENGINE_DBGFN("No free statistics slot");
+            stats_shm->dropped++;
+        }
+        __trustmEngine_stats_unlock();
+
+        stats_proc = slot;
+        __atomic_store_n(&stats_pid, pid, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&stats_init_mutex);
+
+    return stats_proc;
+}
+
+/**********************************************************************
+* __trustmEngine_stats_hist()
+**********************************************************************/
+static void __trustmEngine_stats_hist(trustm_stats_hist_t *hist, uint64_t us)
+{
+    uint32_t val = (us > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)us;
+    uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&hist->bucket[trustm_stats_bucket(val)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, val, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    while ((val > max) &&
+           !__atomic_compare_exchange_n(&hist->max, &max, val, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {}
+}
+
+/**********************************************************************
+* trustmEngine_stats_enable()
+* Engine control command STATS, maps the segment when enabled
+**********************************************************************/
+int trustmEngine_stats_enable(int on)
+{
+    if (on && (__trustmEngine_stats_slot() == NULL))
+    {
+        TRUSTM_ENGINE_ERRFN("Statistics not available");
+        return TRUSTM_ENGINE_FAIL;
+    }
+    trustm_ctx.stats = on ? 1 : 0;
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* trustmEngine_stats_reset()
+* Engine control command STATS_RESET, clears the counters of the process
+**********************************************************************/
+void trustmEngine_stats_reset(void)
+{
+    trustm_stats_proc_t *proc = __trustmEngine_stats_slot();
+
+    // Operations finishing meanwhile may leave partial counts
+    if (proc != NULL)
+        memset(proc->op, 0, sizeof(proc->op));
+}
+
+/**********************************************************************
+* trustmEngine_stats_get()
+* Engine control command STATS_GET, copies the counters of the process
+**********************************************************************/
+int trustmEngine_stats_get(trustm_stats_proc_t *proc)
+{
+    trustm_stats_proc_t *slot = __trustmEngine_stats_slot();
+
+    if ((proc == NULL) || (slot == NULL))
+        return TRUSTM_ENGINE_FAIL;
+    memcpy(proc, slot, sizeof(trustm_stats_proc_t));
+    return TRUSTM_ENGINE_SUCCESS;
+}
+
+/**********************************************************************
+* trustmEngine_stats_begin()
+* Starts measuring operation op for the statistics and the trace, frame
+* lives on the caller's stack until trustmEngine_stats_end()
+**********************************************************************/
+void trustmEngine_stats_begin(trustm_stats_frame_t *frame, uint8_t op)
+{
+    frame->active = 0;
+    if ((trustm_ctx.stats == 0) && (trustm_trace_clock() == 0))
+        return;
+
+    memset(frame->phase, 0, sizeof(frame->phase));
+    frame->op = op;
+    frame->parent = stats_current;
+    frame->start = __trustmEngine_stats_now();
+    frame->active = 1;
+    stats_current = frame;
+}
+
+/**********************************************************************
+* trustmEngine_stats_end()
+* Records the operation started with trustmEngine_stats_begin(), ok is
+* 0 if it failed
+**********************************************************************/
+void trustmEngine_stats_end(trustm_stats_frame_t *frame, int ok)
+{
+    trustm_stats_proc_t *proc;
+    trustm_stats_op_t *op;
+    uint64_t total;
+    int i;
+
+    if (frame->active == 0)
+        return;
+    total = __trustmEngine_stats_now() - frame->start;
+    stats_current = frame->parent;
+    frame->active = 0;
+
+    trustm_trace_span(TRUSTM_TRACE_ENGINE, stats_op_name[frame->op], frame->start * 1000,
+                        (frame->start + total) * 1000, 0, 0, ok ? 0 : 1);
+    if ((trustm_ctx.stats == 0) || ((proc = __trustmEngine_stats_slot()) == NULL))
+        return;
+    op = &proc->op[frame->op];
+    for (i = 0; i < TRUSTM_STATS_TOTAL; i++)
+        __trustmEngine_stats_hist(&op->phase[i], frame->phase[i]);
+    __trustmEngine_stats_hist(&op->phase[TRUSTM_STATS_TOTAL], total);
+    if (!ok)
+        __atomic_fetch_add(&op->errors, 1, __ATOMIC_RELAXED);
+}
+
+/**********************************************************************
+* trustmEngine_stats_clock()
+* Start of a phase for trustmEngine_stats_phase(), 0 when the thread
+* is not measuring an operation
+**********************************************************************/
+uint64_t trustmEngine_stats_clock(void)
+{
+    return (stats_current == NULL) ? 0 : __trustmEngine_stats_now();
+}
+
+/**********************************************************************
+* trustmEngine_stats_phase()
+* Adds the time since start to phase of the operations in progress
+**********************************************************************/
+void trustmEngine_stats_phase(uint8_t phase, uint64_t start)
+{
+    trustm_stats_frame_t *frame;
+    uint64_t elapsed;
+
+    if (start == 0)
+        return;
+    elapsed = __trustmEngine_stats_now() - start;
+    trustm_trace_span(TRUSTM_TRACE_ENGINE, stats_phase_name[phase], start * 1000,
+                        (start + elapsed) * 1000, 0, 0, 0);
+    for (frame = stats_current; frame != NULL; frame = frame->parent)
+        frame->phase[phase] += elapsed;
+}
+
+/**********************************************************************
+* trustmEngine_stats_chip()
+* Chip phase ending now, returns ret
+**********************************************************************/
+optiga_lib_status_t trustmEngine_stats_chip(uint64_t start, optiga_lib_status_t ret)
+{
+    trustmEngine_stats_phase(TRUSTM_STATS_CHIP, start);
+    return ret;
+}
+
+/**********************************************************************
+* trustmEngine_stats_suspend() / trustmEngine_stats_resume()
+* Around ASYNC_pause_job(), other jobs run on the thread meanwhile
+**********************************************************************/
+trustm_stats_frame_t *trustmEngine_stats_suspend(void)
+{
+    trustm_stats_frame_t *frame = stats_current;
+
+    stats_current = NULL;
+    return frame;
+}
+
+void trustmEngine_stats_resume(trustm_stats_frame_t *frame)
+{
+    stats_current = frame;
+}
@@ -0,0 +1,126 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_ENGINE_STATS_H_
+#define _TRUSTM_ENGINE_STATS_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Per operation latency statistics of the engine (engine control command
+// STATS). Every process using the engine owns one slot of the shared
+// segment and updates it with atomic adds only, trustm_stats reads the
+// segment of all processes while they run. Slots of processes which have
+// exited are folded into the retired totals when the slot is reused.
+#define TRUSTM_STATS_SHM_NAME   "/trustm_engine_stats"
+#define TRUSTM_STATS_MAGIC      0x544D5331  // "TMS1", bump on layout change
+#define TRUSTM_STATS_PROCS      32
+
+// Operations
+#define TRUSTM_STATS_OP_ECDSA_SIGN      0
+#define TRUSTM_STATS_OP_RSA_SIGN        1
+#define TRUSTM_STATS_OP_RSA_PRIV_DEC    2
+#define TRUSTM_STATS_OP_RSA_PUB_ENC     3
+#define TRUSTM_STATS_OP_RANDOM          4   // TRNG reads, not random pool hits
+#define TRUSTM_STATS_OP_KEY_LOAD        5
+#define TRUSTM_STATS_OP_READ_DATA       6   // public key and metadata objects
+#define TRUSTM_STATS_OP_MAX             7
+#define TRUSTM_STATS_OP_NAMES   {"ecdsa_sign", "rsa_sign", "rsa_priv_dec", "rsa_pub_enc", \
+                                 "random", "key_load", "read_data"}
+
+// Phases of an operation, the total includes the time outside the phases
+#define TRUSTM_STATS_LOCK       0   // IPC lock, scheduler, ASYNC job and SEC governor wait
+#define TRUSTM_STATS_OPEN       1   // optiga_util_open_application()
+#define TRUSTM_STATS_CHIP       2   // command to completion, broker round trip
+#define TRUSTM_STATS_CLOSE      3   // optiga_util_close_application()
+#define TRUSTM_STATS_TOTAL      4
+#define TRUSTM_STATS_PHASE_MAX  5
+#define TRUSTM_STATS_PHASE_NAMES    {"lock_wait", "open_app", "chip", "close_app", "total"}
+
+// Log-linear histogram of us, 8 buckets per power of two up to 2^32 us
+#define TRUSTM_STATS_SUB_BITS   3
+#define TRUSTM_STATS_SUB        (1 << TRUSTM_STATS_SUB_BITS)
+#define TRUSTM_STATS_BUCKETS    256
+
+typedef struct trustm_stats_hist_str
+{
+    uint64_t count;
+    uint64_t sum;           // us
+    uint32_t max;           // us
+    uint32_t bucket[TRUSTM_STATS_BUCKETS];
+} trustm_stats_hist_t;
+
+typedef struct trustm_stats_op_str
+{
+    uint64_t errors;        // operations which did not succeed, also in the histograms
+    trustm_stats_hist_t phase[TRUSTM_STATS_PHASE_MAX];
+} trustm_stats_op_t;
+
+typedef struct trustm_stats_proc_str
+{
+    pid_t    pid;           // 0 : slot free
+    char     comm[16];
+    trustm_stats_op_t op[TRUSTM_STATS_OP_MAX];
+} trustm_stats_proc_t;
+
+typedef struct trustm_stats_shm_str
+{
+    uint32_t magic;
+    pthread_mutex_t lock;   // slot claim, reclaim and reset
+    uint32_t dropped;       // processes which found no free slot
+    trustm_stats_proc_t retired;
+    trustm_stats_proc_t proc[TRUSTM_STATS_PROCS];
+} trustm_stats_shm_t;
+
+/**********************************************************************
+* trustm_stats_bucket()
+* Histogram bucket of a latency in us
+**********************************************************************/
+static inline uint32_t trustm_stats_bucket(uint32_t us)
+{
+    uint32_t msb;
+
+    if (us < TRUSTM_STATS_SUB)
+        return us;
+    msb = 31 - __builtin_clz(us);
+    return ((msb - TRUSTM_STATS_SUB_BITS + 1) << TRUSTM_STATS_SUB_BITS) +
+           ((us >> (msb - TRUSTM_STATS_SUB_BITS)) & (TRUSTM_STATS_SUB - 1));
+}
+
+/**********************************************************************
+* trustm_stats_bucket_top()
+* Largest latency in us counted in bucket idx
+**********************************************************************/
+static inline uint64_t trustm_stats_bucket_top(uint32_t idx)
+{
+    uint32_t shift;
+
+    if (idx < TRUSTM_STATS_SUB)
+        return idx;
+    shift = (idx >> TRUSTM_STATS_SUB_BITS) - 1;
+    return ((uint64_t)(TRUSTM_STATS_SUB + (idx & (TRUSTM_STATS_SUB - 1)) + 1) << shift) - 1;
+}
+
+#endif  // _TRUSTM_ENGINE_STATS_H_
@@ -0,0 +1,92 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_BROKER_H_
+#define _TRUSTM_BROKER_H_
+
+#include <stdint.h>
+
+#include "optiga_lib_common.h"
+
+// Socket used when no path is given, can be overridden with the
+// environment variable TRUSTM_BROKER_SOCKET. The socket directory must
+// be owned by root (or the broker user) and not writable by others.
+#define TRUSTM_BROKER_RUNDIR        "/run/trustm"
+#define TRUSTM_BROKER_SOCKET        TRUSTM_BROKER_RUNDIR "/trustm_broker.sock"
+#define TRUSTM_BROKER_SOCKET_ENV    "TRUSTM_BROKER_SOCKET"
+// Members of this group may use the broker, the socket is 0660
+#define TRUSTM_BROKER_GROUP         "trustm"
+
+#define TRUSTM_BROKER_MAGIC         0x544D4252  // "TMBR"
+#define TRUSTM_BROKER_MAX_DATA      2048
+
+// A message must be complete within TRUSTM_BROKER_MSG_TIMEOUT ms of its
+// first byte, the broker drops clients sending partial requests.
+// Clients give up on a response after TRUSTM_BROKER_RESPONSE_TIMEOUT ms,
+// the broker serves the requests queued before theirs first.
+#define TRUSTM_BROKER_MSG_TIMEOUT       1000
+#define TRUSTM_BROKER_RESPONSE_TIMEOUT  30000
+
+// Broker commands
+typedef enum trustm_broker_cmd
+{
+    TRUSTM_BROKER_CMD_RANDOM = 1,   // param : number of bytes
+    TRUSTM_BROKER_CMD_READ_DATA,    // oid, param : offset
+    TRUSTM_BROKER_CMD_ECDSA_SIGN,   // oid, data : digest
+    TRUSTM_BROKER_CMD_RSA_SIGN,     // oid, param : signature scheme, data : digest
+    TRUSTM_BROKER_CMD_RSA_DECRYPT,  // oid, param : encryption scheme, data : cipher text
+    TRUSTM_BROKER_CMD_READ_METADATA // oid
+} trustm_broker_cmd_t;
+
+// Message header, followed by len bytes of data.
+// In a response cmd is echoed and param holds the optiga_lib_status_t.
+typedef struct trustm_broker_hdr_str
+{
+    uint32_t magic;
+    uint16_t cmd;
+    uint16_t oid;
+    uint32_t param;
+    uint32_t len;
+} trustm_broker_hdr_t;
+
+// Client
+int trustm_broker_connect(const char *path);
+void trustm_broker_disconnect(void);
+optiga_lib_status_t trustm_broker_random(uint8_t *buf, uint16_t len);
+optiga_lib_status_t trustm_broker_read_data(uint16_t oid, uint16_t offset, uint8_t *buf, uint16_t *len);
+optiga_lib_status_t trustm_broker_read_metadata(uint16_t oid, uint8_t *buf, uint16_t *len);
+optiga_lib_status_t trustm_broker_ecdsa_sign(uint16_t oid, const uint8_t *digest, uint16_t digest_len,
+                                             uint8_t *sig, uint16_t *sig_len);
+optiga_lib_status_t trustm_broker_rsa_sign(uint16_t oid, uint32_t scheme, const uint8_t *digest, uint16_t digest_len,
+                                           uint8_t *sig, uint16_t *sig_len);
+optiga_lib_status_t trustm_broker_rsa_decrypt(uint16_t oid, uint32_t scheme, const uint8_t *in, uint16_t in_len,
+                                              uint8_t *out, uint16_t *out_len);
+
+// Server
+int trustm_broker_listen(const char *path);
+int trustm_broker_accept(int fd);
+int trustm_broker_recv(int fd, trustm_broker_hdr_t *hdr, uint8_t *data);
+int trustm_broker_send(int fd, uint16_t cmd, optiga_lib_status_t status, const uint8_t *data, uint32_t len);
+
+#endif  // _TRUSTM_BROKER_H_
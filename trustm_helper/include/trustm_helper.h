@@ -23,7 +23,7 @@
 
 */
 #ifndef _TRUSTM_HELPER_H_
-#define _TRUSTX_HELPER_H_
+#define _TRUSTM_HELPER_H_
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,20 +45,9 @@
 #include <errno.h>   
 
 //Debug Print
-#define CLI_WORKAROUND 1
 //#define DEBUG_TRUSTM_HELPER =1
 //#define HIBERNATE_ENABLE =1
 
-#ifdef CLI_WORKAROUND
-#define TRUSTM_CLI_WORKAROUND_TIMER_ARM        pal_os_event_arm()
-#define TRUSTM_CLI_WORKAROUND_TIMER_DISARM     pal_os_event_disarm()
-#define TRUSTM_CLI_WORKAROUND_TIMER_DESTROY    pal_os_event_destroy1()
-#else
-#define TRUSTM_CLI_WORKAROUND_TIMER_ARM
-#define TRUSTM_CLI_WORKAROUND_TIMER_DISARM     
-#define TRUSTM_CLI_WORKAROUND_TIMER_DESTROY   
-#endif
-
 #ifdef DEBUG_TRUSTM_HELPER
 
 #define TRUSTM_HELPER_DBG(x, ...)      fprintf(stderr, "%d:%s:%d " x "\n", getpid(),__FILE__, __LINE__, ##__VA_ARGS__)
@@ -76,6 +65,8 @@
 #define TRUSTM_HIBERNATE_CTX_FILENAME   ".trustm_hibernate_ctx"
 #define BUSY_WAIT_TIME_OUT 6000 // Note: This value must be at least 4000, any value smaller might encounter premature exit while waiting response from Trust M
 #define MAX_RSA_KEY_GEN_TIME 62000 // Note: RSA key gen time can very from 7s to 60s
+#define TRUSTM_SEC_DECAY_MS     1000  // Security event counter is decremented once per period
+#define TRUSTM_SEC_WAIT_MAX_MS  16000 // Longest wait before the counter is read again
 
 // ********** typedef
 typedef struct _tag_trustm_UID {
@@ -128,6 +119,8 @@ extern optiga_crypt_t * me_crypt;
 extern optiga_lib_status_t optiga_lib_status;
 extern uint16_t trustm_open_flag;
 extern uint8_t trustm_hibernate_flag;
+extern uint8_t trustm_session_hold;
+extern uint16_t trustm_last_error;
 
 // Function Prototype
 int mssleep(long msec);
@@ -135,6 +128,9 @@ optiga_lib_status_t _trustm_Open(void);
 optiga_lib_status_t trustm_Close(void);
 optiga_lib_status_t trustm_Open(void);
 optiga_lib_status_t trustm_WaitForCompletion(uint16_t wait_time);
+optiga_lib_status_t trustm_WaitForStatus(uint16_t wait_time, uint32_t *elapsed);
+uint32_t trustm_secCnt_backoff(uint8_t secCnt, uint8_t lastCnt, uint32_t lastWait);
+void trustm_SetStatus(optiga_lib_status_t status);
 void helper_optiga_util_callback(void * context, optiga_lib_status_t return_status);
 void helper_optiga_crypt_callback(void * context, optiga_lib_status_t return_status);
 
@@ -154,9 +150,14 @@ void trustmGetOIDName(uint16_t optiga_oid, char *name);
 
 optiga_lib_status_t trustm_readUID(utrustm_UID_t *UID);
 optiga_lib_status_t trustmReadMetadata(uint16_t optiga_oid, trustm_metadata_t *oidMetadata);
+optiga_lib_status_t trustmReadMetadataRaw(uint16_t optiga_oid, uint8_t *buf, uint16_t *len);
+void trustmParseMetadata(const uint8_t *read_data_buffer, uint16_t bytes_to_read, trustm_metadata_t *oidMetadata);
 
 uint32_t trustmHexorDec(const char *aArg);
 uint16_t trustmwriteTo(uint8_t *buf, uint32_t len, const char *filename);
 uint16_t trustmreadFrom(uint8_t *data, uint8_t *filename);
+int trustmCreateTempFile(const char *filename, mode_t mode, char *tmpName, size_t tmpSize);
+int trustmWriteTempFile(int fd, const uint8_t *buf, size_t len);
+int trustmCommitTempFile(int fd, const char *tmpName, const char *filename);
 
 #endif  // _TRUSTM_HELPER_H_
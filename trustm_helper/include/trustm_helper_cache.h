@@ -0,0 +1,65 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_CACHE_H_
+#define _TRUSTM_HELPER_CACHE_H_
+
+#include <stdint.h>
+
+// Cache of OPTIGA object metadata and public keys shared by all processes
+// of a user through the POSIX shared memory object /trustm_cache.<uid>
+// (mode 0600). Entries are invalidated by the tools and the engine whenever
+// they write data, metadata or generate a key into an object, the epoch in
+// the IPC lock segment carries this to the caches of the other users.
+// Set the environment variable TRUSTM_CACHE=0 to bypass the cache.
+
+// Maximum number of cached objects, least recently used are replaced
+#define TRUSTM_CACHE_ENTRIES        64
+// Metadata is at most 44 bytes on OPTIGA Trust M
+#define TRUSTM_CACHE_METADATA_SIZE  64
+// Public keys are cached as DER SubjectPublicKeyInfo, keyed by the OID
+// they are read from (public key object or certificate)
+#define TRUSTM_CACHE_PUBKEYS        16
+#define TRUSTM_CACHE_PUBKEY_SIZE    1024
+
+typedef struct trustm_cache_stats_str
+{
+    uint32_t entries;       // valid metadata entries
+    uint32_t pubkeys;       // valid public key entries
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidated;
+} trustm_cache_stats_t;
+
+// Function Prototype
+
+int  trustm_cache_metadata_get(uint16_t oid, uint8_t *buf, uint16_t *len);
+void trustm_cache_metadata_put(uint16_t oid, const uint8_t *buf, uint16_t len);
+int  trustm_cache_pubkey_get(uint16_t oid, uint8_t *buf, uint16_t *len);
+void trustm_cache_pubkey_put(uint16_t oid, const uint8_t *buf, uint16_t len);
+void trustm_cache_invalidate(uint16_t oid);
+void trustm_cache_flush(void);
+void trustm_cache_get_stats(trustm_cache_stats_t *stats);
+
+#endif  // _TRUSTM_HELPER_CACHE_H_
@@ -0,0 +1,68 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_ENVELOPE_H_
+#define _TRUSTM_HELPER_ENVELOPE_H_
+
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#include "optiga_crypt.h"
+
+// Envelope encryption: every file is encrypted on the host with its own
+// AES-256-GCM data key. The data key comes from the OPTIGA TRNG and is
+// stored in the file wrapped with the RSA public key of 0xE0FC/0xE0FD,
+// so only the chip can unwrap it (optiga_crypt_rsa_decrypt_and_export).
+//
+// File layout (integers big endian):
+//   "TMEV" | version (1) | wrap (1) | key OID (2) | wrapped key length (2)
+//   | wrapped key | IV (12) | ciphertext | GCM tag (16)
+// Everything before the ciphertext is authenticated as AAD.
+
+#define TRUSTM_ENVELOPE_MAGIC           "TMEV"
+#define TRUSTM_ENVELOPE_VERSION         1
+#define TRUSTM_ENVELOPE_WRAP_RSA        0x01    // RSAES PKCS#1 v1.5
+#define TRUSTM_ENVELOPE_KEY_SIZE        32      // AES-256
+#define TRUSTM_ENVELOPE_IV_SIZE         12
+#define TRUSTM_ENVELOPE_TAG_SIZE        16
+#define TRUSTM_ENVELOPE_MAX_WRAPPED     256     // RSA 2048
+#define TRUSTM_ENVELOPE_HEADER_SIZE     (10 + TRUSTM_ENVELOPE_MAX_WRAPPED + TRUSTM_ENVELOPE_IV_SIZE)
+// Payload is mapped and pushed through the cipher this much at a time
+#define TRUSTM_ENVELOPE_CHUNK_SIZE      (1024*1024)
+
+typedef struct trustm_envelope_stats_str
+{
+    uint64_t bytes;         // payload bytes encrypted or decrypted
+    uint64_t chip_us;       // time spent waiting for the chip
+    uint64_t bulk_us;       // time spent in the host side AES-GCM pipeline
+} trustm_envelope_stats_t;
+
+// Function Prototype
+
+optiga_lib_status_t trustmEnvelopeSeal(optiga_key_id_t key_oid, EVP_PKEY *pubkey, uint8_t shielded,
+                                        const char *inFile, const char *outFile, trustm_envelope_stats_t *stats);
+optiga_lib_status_t trustmEnvelopeOpen(uint8_t shielded, const char *inFile, const char *outFile,
+                                        trustm_envelope_stats_t *stats);
+
+#endif  // _TRUSTM_HELPER_ENVELOPE_H_
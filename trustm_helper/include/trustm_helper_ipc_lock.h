@@ -59,11 +59,35 @@
 #define TRUSTM_HELPER_IPCDBG(x, ...)
 #endif
 
+// Maximum number of processes queued on the lock
+#define TRUSTM_IPC_QUEUE_SIZE   32
+
+typedef struct trustm_ipc_waiter_str
+{
+    pid_t    pid;
+    uint32_t wait;          // time in queue so far, us
+} trustm_ipc_waiter_t;
+
+typedef struct trustm_ipc_stats_str
+{
+    uint32_t depth;         // owner + waiting processes
+    pid_t    owner;         // 0 if the lock is free
+    trustm_ipc_waiter_t waiter[TRUSTM_IPC_QUEUE_SIZE];
+    uint64_t acquired;      // total number of acquisitions
+    uint64_t total_wait;    // us, sum of wait time of all acquisitions
+    uint32_t max_wait;      // us, longest wait time seen
+} trustm_ipc_stats_t;
+
 // Function Prototype
 
 void __trustm_ipcInit(void);
-void trustm_ipc_acquire(void);
+int  trustm_ipc_acquire(void);
 void trustm_ipc_release(void);
+uint32_t trustm_ipc_session_get(void);
+uint32_t trustm_ipc_session_new(void);
+uint32_t trustm_ipc_cache_epoch(void);
+uint32_t trustm_ipc_cache_bump(void);
+void trustm_ipc_get_stats(trustm_ipc_stats_t *stats);
 
 
 #endif  // _TRUSTM_HELPER_IPC_LOCK_H_
@@ -0,0 +1,91 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_SEC_H_
+#define _TRUSTM_HELPER_SEC_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "optiga_lib_common.h"
+
+// Governor of the security event counter (SEC, 0xE0C5). The chip slows
+// down all commands while the SEC is high, the governor estimates it
+// from an occasional reading and the command errors known to raise it,
+// and shapes the submissions before the chip starts throttling: low
+// priority work is dropped above the shed limit, all work is delayed
+// above the queue limit until the counter decayed. The estimate and the
+// decisions are shared by all processes in a shared segment.
+#define TRUSTM_SEC_GOV_SHM_NAME     "/trustm_sec_gov"
+#define TRUSTM_SEC_GOV_MAGIC        0x544D4731  // "TMG1", bump on layout change
+
+// Default limits
+#define TRUSTM_SEC_GOV_SHED         32
+#define TRUSTM_SEC_GOV_QUEUE        64
+// Interval in ms between readings while the counter is not 0
+#define TRUSTM_SEC_GOV_SAMPLE_MS    1000
+// Interval in ms between readings while the counter is believed 0,
+// catches events of users not known to the governor
+#define TRUSTM_SEC_GOV_IDLE_MS      60000
+
+// Priority of the work
+#define TRUSTM_SEC_GOV_NORMAL       0
+#define TRUSTM_SEC_GOV_LOW          1   // can be dropped, e.g. random refills
+
+// Decision
+#define TRUSTM_SEC_GOV_SUBMIT       0
+#define TRUSTM_SEC_GOV_QUEUE_WORK   1
+#define TRUSTM_SEC_GOV_SHED_WORK    2
+
+typedef struct trustm_sec_gov_stats_str
+{
+    uint8_t  sec;           // estimated counter
+    uint8_t  sampled;       // last value read from the chip
+    uint8_t  state;         // last decision
+    uint32_t age;           // ms since the last reading, 0 : never read
+    uint64_t samples;       // readings of 0xE0C5
+    uint64_t events;        // command errors counted as security events
+    uint64_t queued;        // submissions delayed
+    uint64_t queued_ms;     // total delay
+    uint64_t shed;          // low priority submissions dropped
+} trustm_sec_gov_stats_t;
+
+typedef struct trustm_sec_gov_shm_str
+{
+    uint32_t magic;
+    pthread_mutex_t lock;
+    uint64_t stamp;         // us, CLOCK_MONOTONIC of the last reading
+    uint8_t  pending;       // security events since the last reading
+    trustm_sec_gov_stats_t stats;
+} trustm_sec_gov_shm_t;
+
+// Function Prototype
+void trustm_sec_gov_limits(uint8_t shed, uint8_t queue);
+int  trustm_sec_gov_due(void);
+void trustm_sec_gov_sample(uint8_t sec);
+void trustm_sec_gov_result(optiga_lib_status_t status);
+int  trustm_sec_gov_admit(uint8_t prio, uint32_t *wait);
+int  trustm_sec_gov_get(trustm_sec_gov_stats_t *stats);
+
+#endif  // _TRUSTM_HELPER_SEC_H_
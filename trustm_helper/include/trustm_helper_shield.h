@@ -0,0 +1,96 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_SHIELD_H_
+#define _TRUSTM_HELPER_SHIELD_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "optiga_lib_common.h"
+
+// Shielded connection kept across commands. The pre-shared secret
+// handshake is done by the first protected command after the
+// application is opened, the keys and sequence numbers then stay in the
+// comms instance of the process for as long as the application is kept
+// open. The channel is only re-established after a comms error, after
+// another process opened the application (and so took over the chip
+// side of the channel) or when the rekey interval is reached.
+#define TRUSTM_SHIELD_SHM_NAME      "/trustm_shield"
+#define TRUSTM_SHIELD_MAGIC         0x544D5031  // "TMP1", bump on layout change
+
+// Protected commands between two handshakes, 0 : only when needed.
+// Overridden by the environment variable of the same name.
+#define TRUSTM_SHIELD_REKEY         0
+
+// Why the command carried a handshake
+#define TRUSTM_SHIELD_REUSE         0
+#define TRUSTM_SHIELD_OPEN          1   // first command after open
+#define TRUSTM_SHIELD_RENEW         2   // rekey interval reached
+#define TRUSTM_SHIELD_RECOVER       3   // comms error or channel taken over
+
+typedef struct trustm_shield_stats_str
+{
+    uint64_t commands;      // protected commands
+    uint64_t opened;        // handshakes after open
+    uint64_t renewed;       // handshakes for the rekey interval
+    uint64_t recovered;     // handshakes after an error or take over
+    uint64_t errors;        // protected commands failed in comms
+    uint64_t hs_us;         // total time of the commands with handshake
+    uint64_t hs_n;
+    uint64_t reuse_us;      // total time of the commands on a kept channel
+    uint64_t reuse_n;
+} trustm_shield_stats_t;
+
+typedef struct trustm_shield_shm_str
+{
+    uint32_t magic;
+    pthread_mutex_t lock;
+    trustm_shield_stats_t stats;
+} trustm_shield_shm_t;
+
+// Protection of the next command of a crypt/util instance, level is
+// OPTIGA_COMMS_xxx_PROTECTION, OPTIGA_COMMS_RE_ESTABLISH is added when
+// the channel must be negotiated again.
+#define TRUSTM_SHIELD_CRYPT(me, level) \
+    do { \
+        OPTIGA_CRYPT_SET_COMMS_PROTOCOL_VERSION(me, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET); \
+        OPTIGA_CRYPT_SET_COMMS_PROTECTION_LEVEL(me, trustm_shield_level(level)); \
+    } while(0)
+
+#define TRUSTM_SHIELD_UTIL(me, level) \
+    do { \
+        OPTIGA_UTIL_SET_COMMS_PROTOCOL_VERSION(me, OPTIGA_COMMS_PROTOCOL_VERSION_PRE_SHARED_SECRET); \
+        OPTIGA_UTIL_SET_COMMS_PROTECTION_LEVEL(me, trustm_shield_level(level)); \
+    } while(0)
+
+// Function Prototype
+void     trustm_shield_rekey(uint32_t commands);
+void     trustm_shield_opened(uint32_t session);
+uint8_t  trustm_shield_level(uint8_t level);
+void     trustm_shield_result(optiga_lib_status_t status);
+int      trustm_shield_get(trustm_shield_stats_t *stats);
+uint64_t trustm_shield_saved_us(const trustm_shield_stats_t *stats);
+
+#endif  // _TRUSTM_HELPER_SHIELD_H_
@@ -0,0 +1,57 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_SHM_H_
+#define _TRUSTM_HELPER_SHM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Shared segments of the helper, the engine and the emulator (IPC lock,
+// SEC governor, shield counters, metadata cache, engine statistics,
+// random pool, emulator store). Every segment starts with a uint32_t
+// magic, bump it on layout change. The first process to map a segment
+// clears it and calls init under flock(), the magic is set last so that
+// the others only see a complete segment.
+//
+// mode without group and other permissions makes the segment private:
+// it is refused if owned by another user or accessible by others.
+// Otherwise mode is applied regardless of the umask so that other users
+// can map the segment.
+
+// Sets up the locks and anything else not 0, the segment is cleared
+typedef void (*trustm_shm_init_t)(void *shm);
+
+// Function Prototype
+
+void *trustm_shm_map(const char *name, size_t size, mode_t mode, uint8_t create,
+                        uint32_t magic, trustm_shm_init_t init);
+void *trustm_shm_map_file(const char *path, size_t size, mode_t mode,
+                            uint32_t magic, trustm_shm_init_t init);
+void trustm_shm_mutex_init(pthread_mutex_t *mutex);
+void trustm_shm_cond_init(pthread_cond_t *cond);
+
+#endif  // _TRUSTM_HELPER_SHM_H_
@@ -0,0 +1,60 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_STREAM_H_
+#define _TRUSTM_HELPER_STREAM_H_
+
+#include <stdint.h>
+
+#include "optiga_crypt.h"
+
+// Streaming of arbitrary length files through the chip with the
+// start/continue/final command sequences. Two buffers are used so that
+// the next chunk is read from the file and the previous result written
+// out while the chip is still processing the current chunk.
+
+// Data sent to the chip per command. The Trust M comms buffer is 1557
+// bytes; this is the largest multiple of the AES block size and of the
+// SHA-512 block size that still leaves room for the APDU header, the
+// command TLVs and the shielded connection overhead.
+#define TRUSTM_STREAM_CHUNK_SIZE    1024
+
+typedef struct trustm_stream_stats_str
+{
+    uint64_t bytes;         // input bytes processed
+    uint64_t us;            // elapsed time
+} trustm_stream_stats_t;
+
+// Function Prototype
+
+optiga_lib_status_t trustmSymmetricStream(uint8_t encrypt, optiga_symmetric_encryption_mode_t mode,
+                                            optiga_key_id_t key, const uint8_t *iv, uint16_t ivLen,
+                                            uint8_t shielded, const char *inFile, const char *outFile,
+                                            trustm_stream_stats_t *stats);
+optiga_lib_status_t trustmHmacStream(optiga_hmac_type_t type, uint16_t secret, uint8_t shielded,
+                                        const char *inFile, uint8_t *mac, uint32_t *macLen,
+                                        trustm_stream_stats_t *stats);
+void trustmPrintStreamStats(const trustm_stream_stats_t *stats);
+
+#endif  // _TRUSTM_HELPER_STREAM_H_
@@ -0,0 +1,97 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#ifndef _TRUSTM_HELPER_TRACE_H_
+#define _TRUSTM_HELPER_TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// Timeline of the I2C transfers, IFX I2C frames, APDUs and engine
+// operations of the process, kept in an in-memory ring buffer and
+// exported in the Chrome trace event format (chrome://tracing, Perfetto).
+// Set the environment variable TRUSTM_TRACE=<file> to record from the
+// start of the process and write the trace at exit, "%p" in the file
+// name is replaced by the process id. The engine also enables and dumps
+// it with the TRACE and TRACE_DUMP control commands.
+
+// Events kept, the oldest are overwritten. Power of 2.
+#define TRUSTM_TRACE_EVENTS         16384
+#define TRUSTM_TRACE_NAME_SIZE      22
+
+// Category, the track of the event in the viewer
+#define TRUSTM_TRACE_I2C            0
+#define TRUSTM_TRACE_FRAME          1
+#define TRUSTM_TRACE_APDU           2
+#define TRUSTM_TRACE_ENGINE         3
+#define TRUSTM_TRACE_CAT_MAX        4
+
+// Event type, as the Chrome trace "ph"
+#define TRUSTM_TRACE_SPAN           'X'
+#define TRUSTM_TRACE_INSTANT        'i'
+#define TRUSTM_TRACE_BEGIN          'b'     // async, paired by id
+#define TRUSTM_TRACE_END            'e'
+
+typedef struct trustm_trace_event_str
+{
+    uint64_t seq;           // ring index + 1 once written
+    uint64_t ts;            // ns, CLOCK_MONOTONIC
+    uint64_t dur;           // ns, TRUSTM_TRACE_SPAN
+    uint32_t tid;
+    uint32_t id;            // TRUSTM_TRACE_BEGIN/END
+    uint32_t status;
+    uint16_t arg[2];        // named by the category, e.g. register and length
+    uint8_t  cat;
+    uint8_t  ph;
+    char     name[TRUSTM_TRACE_NAME_SIZE];
+} trustm_trace_event_t;
+
+// Non zero while recording, checked before any other work
+extern uint8_t trustm_trace_on;
+
+/**********************************************************************
+* trustm_trace_clock()
+* Start of a span for trustm_trace_span(), 0 when not recording
+**********************************************************************/
+static inline uint64_t trustm_trace_clock(void)
+{
+    struct timespec ts;
+
+    if (__builtin_expect(__atomic_load_n(&trustm_trace_on, __ATOMIC_RELAXED) == 0, 1))
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// Function Prototype
+
+int  trustm_trace_enable(uint8_t on);
+void trustm_trace_clear(void);
+int  trustm_trace_dump(const char *filename);
+void trustm_trace_span(uint8_t cat, const char *name, uint64_t start, uint64_t end,
+                        uint16_t arg0, uint16_t arg1, uint32_t status);
+void trustm_trace_event(uint8_t cat, uint8_t ph, const char *name, uint32_t id,
+                        uint16_t arg0, uint16_t arg1, uint32_t status);
+
+#endif  // _TRUSTM_HELPER_TRACE_H_
@@ -0,0 +1,573 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+
+#define _GNU_SOURCE     // struct ucred
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "trustm_helper.h"
+#include "trustm_broker.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+static int broker_fd = -1;
+static char broker_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_mutex_t broker_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __trustm_broker_path()
+**********************************************************************/
+static const char *__trustm_broker_path(const char *path)
+{
+    if ((path == NULL) || (path[0] == '\0'))
+        path = getenv(TRUSTM_BROKER_SOCKET_ENV);
+    if ((path == NULL) || (path[0] == '\0'))
+        path = TRUSTM_BROKER_SOCKET;
+    return path;
+}
+
+static uint64_t __trustm_broker_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/**********************************************************************
+* __trustm_broker_timeout()
+* Sets the SO_RCVTIMEO or SO_SNDTIMEO timeout of fd
+**********************************************************************/
+static int __trustm_broker_timeout(int fd, int optname, uint32_t ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    return setsockopt(fd, SOL_SOCKET, optname, &tv, sizeof(tv));
+}
+
+/**********************************************************************
+* __trustm_broker_write() / __trustm_broker_read()
+* Transfer exactly len bytes, returns 0 on success. A blocked transfer
+* fails with the socket timeout. Reads also fail once deadline (0 :
+* set on the first byte received) has passed.
+**********************************************************************/
+static int __trustm_broker_write(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int __trustm_broker_read(int fd, void *buf, size_t len, uint64_t *deadline)
+{
+    uint8_t *p = buf;
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((*deadline != 0) && (__trustm_broker_now_ms() > *deadline))
+            return -1;
+        n = recv(fd, p, len, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return -1;
+        if (*deadline == 0)
+            *deadline = __trustm_broker_now_ms() + TRUSTM_BROKER_MSG_TIMEOUT;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* __trustm_broker_stale()
+* True if the broker closed the connection. It never sends anything
+* unasked, so a readable connection is closed or broken.
+**********************************************************************/
+static int __trustm_broker_stale(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return (poll(&pfd, 1, 0) != 0);
+}
+
+/**********************************************************************
+* __trustm_broker_gid()
+* Returns the gid of TRUSTM_BROKER_GROUP, -1 if the group does not exist
+**********************************************************************/
+static gid_t __trustm_broker_gid(void)
+{
+    struct group *gr;
+
+    gr = getgrnam(TRUSTM_BROKER_GROUP);
+    return (gr != NULL) ? gr->gr_gid : (gid_t)-1;
+}
+
+/**********************************************************************
+* __trustm_broker_open()
+* Connects to the broker and checks that it runs as root or as the
+* calling user, so a socket planted by another user is never used.
+**********************************************************************/
+static int __trustm_broker_open(const char *path)
+{
+    struct sockaddr_un addr;
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (__trustm_broker_timeout(fd, SO_RCVTIMEO, TRUSTM_BROKER_RESPONSE_TIMEOUT) == -1) ||
+        (__trustm_broker_timeout(fd, SO_SNDTIMEO, TRUSTM_BROKER_MSG_TIMEOUT) == -1))
+    {
+        close(fd);
+        return -1;
+    }
+    if ((getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1) ||
+        ((cred.uid != 0) && (cred.uid != geteuid())))
+    {
+        TRUSTM_HELPER_ERRFN("Broker %s not owned by root", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**********************************************************************
+* trustm_broker_connect()
+* Connects to the broker at path, NULL selects the default socket.
+* Returns 0 on success, -1 if no broker is running.
+**********************************************************************/
+int trustm_broker_connect(const char *path)
+{
+    int ret = -1;
+    int fd;
+
+    path = __trustm_broker_path(path);
+    pthread_mutex_lock(&broker_mutex);
+    fd = __trustm_broker_open(path);
+    if (fd != -1)
+    {
+        if (broker_fd != -1)
+            close(broker_fd);
+        broker_fd = fd;
+        strcpy(broker_path, path);
+        TRUSTM_HELPER_DBGFN("Connected to broker %s", path);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&broker_mutex);
+    return ret;
+}
+
+/**********************************************************************
+* trustm_broker_disconnect()
+**********************************************************************/
+void trustm_broker_disconnect(void)
+{
+    pthread_mutex_lock(&broker_mutex);
+    if (broker_fd != -1)
+    {
+        close(broker_fd);
+        broker_fd = -1;
+    }
+    pthread_mutex_unlock(&broker_mutex);
+}
+
+/**********************************************************************
+* __trustm_broker_transact()
+* Sends one request and waits for its response. If the connection was
+* lost (e.g. broker restarted) it is re-established once, but only
+* while the request has not been sent completely: a request the broker
+* may have executed is never sent twice.
+**********************************************************************/
+static optiga_lib_status_t __trustm_broker_transact(uint16_t cmd, uint16_t oid, uint32_t param,
+                                                    const uint8_t *in, uint32_t in_len,
+                                                    uint8_t *out, uint16_t *out_len)
+{
+    optiga_lib_status_t return_status = OPTIGA_COMMS_ERROR;
+    trustm_broker_hdr_t hdr;
+    uint8_t data[TRUSTM_BROKER_MAX_DATA];
+    int retry;
+
+    if (in_len > TRUSTM_BROKER_MAX_DATA)
+        return OPTIGA_COMMS_ERROR_INVALID_INPUT;
+
+    pthread_mutex_lock(&broker_mutex);
+    for (retry = 0; retry < 2; retry++)
+    {
+        if ((broker_fd != -1) && __trustm_broker_stale(broker_fd))
+        {
+            close(broker_fd);
+            broker_fd = -1;
+        }
+        if (broker_fd == -1)
+        {
+            if (broker_path[0] == '\0')
+                break;
+            broker_fd = __trustm_broker_open(broker_path);
+            if (broker_fd == -1)
+                break;
+        }
+
+        hdr.magic = TRUSTM_BROKER_MAGIC;
+        hdr.cmd = cmd;
+        hdr.oid = oid;
+        hdr.param = param;
+        hdr.len = in_len;
+        if ((__trustm_broker_write(broker_fd, &hdr, sizeof(hdr)) != 0) ||
+            (__trustm_broker_write(broker_fd, in, in_len) != 0))
+        {
+            // The broker drops the partial request
+            TRUSTM_HELPER_DBGFN("Broker connection lost, reconnect");
+            close(broker_fd);
+            broker_fd = -1;
+            continue;
+        }
+
+        if (trustm_broker_recv(broker_fd, &hdr, data) == 0)
+        {
+            return_status = (optiga_lib_status_t)hdr.param;
+            if ((return_status == OPTIGA_LIB_SUCCESS) && (out != NULL))
+            {
+                if (hdr.len > *out_len)
+                {
+                    TRUSTM_HELPER_ERRFN("Broker response too long : %d", hdr.len);
+                    return_status = OPTIGA_COMMS_ERROR_MEMORY_INSUFFICIENT;
+                }
+                else
+                {
+                    memcpy(out, data, hdr.len);
+                    *out_len = hdr.len;
+                }
+            }
+        }
+        else
+        {
+            // A late response must not be taken for the next request
+            TRUSTM_HELPER_ERRFN("No response from broker");
+            close(broker_fd);
+            broker_fd = -1;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&broker_mutex);
+    return return_status;
+}
+
+/**********************************************************************
+* trustm_broker_random()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_random(uint8_t *buf, uint16_t len)
+{
+    optiga_lib_status_t return_status;
+    uint16_t rlen = len;
+
+    return_status = __trustm_broker_transact(TRUSTM_BROKER_CMD_RANDOM, 0, len, NULL, 0, buf, &rlen);
+    if ((return_status == OPTIGA_LIB_SUCCESS) && (rlen != len))
+        return_status = OPTIGA_COMMS_ERROR;
+    return return_status;
+}
+
+/**********************************************************************
+* trustm_broker_read_data()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_read_data(uint16_t oid, uint16_t offset, uint8_t *buf, uint16_t *len)
+{
+    return __trustm_broker_transact(TRUSTM_BROKER_CMD_READ_DATA, oid, offset, NULL, 0, buf, len);
+}
+
+/**********************************************************************
+* trustm_broker_read_metadata()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_read_metadata(uint16_t oid, uint8_t *buf, uint16_t *len)
+{
+    return __trustm_broker_transact(TRUSTM_BROKER_CMD_READ_METADATA, oid, 0, NULL, 0, buf, len);
+}
+
+/**********************************************************************
+* trustm_broker_ecdsa_sign()
+* sig returns the r and s DER integers as optiga_crypt_ecdsa_sign()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_ecdsa_sign(uint16_t oid, const uint8_t *digest, uint16_t digest_len,
+                                             uint8_t *sig, uint16_t *sig_len)
+{
+    return __trustm_broker_transact(TRUSTM_BROKER_CMD_ECDSA_SIGN, oid, 0, digest, digest_len, sig, sig_len);
+}
+
+/**********************************************************************
+* trustm_broker_rsa_sign()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_rsa_sign(uint16_t oid, uint32_t scheme, const uint8_t *digest, uint16_t digest_len,
+                                           uint8_t *sig, uint16_t *sig_len)
+{
+    return __trustm_broker_transact(TRUSTM_BROKER_CMD_RSA_SIGN, oid, scheme, digest, digest_len, sig, sig_len);
+}
+
+/**********************************************************************
+* trustm_broker_rsa_decrypt()
+**********************************************************************/
+optiga_lib_status_t trustm_broker_rsa_decrypt(uint16_t oid, uint32_t scheme, const uint8_t *in, uint16_t in_len,
+                                              uint8_t *out, uint16_t *out_len)
+{
+    return __trustm_broker_transact(TRUSTM_BROKER_CMD_RSA_DECRYPT, oid, scheme, in, in_len, out, out_len);
+}
+
+/**********************************************************************
+* __trustm_broker_rundir()
+* Checks the directory of the socket. Only root (or the broker user)
+* may be able to create files there, otherwise another user could
+* replace the socket. TRUSTM_BROKER_RUNDIR is created if missing.
+**********************************************************************/
+static int __trustm_broker_rundir(const char *path, gid_t gid)
+{
+    char dir[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    struct stat st;
+    char *p;
+
+    strcpy(dir, path);
+    p = strrchr(dir, '/');
+    if (p == NULL)
+    {
+        TRUSTM_HELPER_ERRFN("Broker socket path must be absolute : %s", path);
+        return -1;
+    }
+    p[(p == dir) ? 1 : 0] = '\0';
+
+    if ((strcmp(dir, TRUSTM_BROKER_RUNDIR) == 0) && (mkdir(dir, 0755) == 0) &&
+        (gid != (gid_t)-1) && (chown(dir, -1, gid) == -1))
+        perror("broker chown");
+
+    if (lstat(dir, &st) == -1)
+    {
+        perror("broker directory");
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode) ||
+        ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+        ((st.st_mode & (S_IWGRP|S_IWOTH)) != 0))
+    {
+        TRUSTM_HELPER_ERRFN("Broker directory %s writable by other users", dir);
+        return -1;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* trustm_broker_listen()
+* Creates the listening socket of the broker, returns the fd or -1.
+**********************************************************************/
+int trustm_broker_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    gid_t gid = __trustm_broker_gid();
+    int fd;
+
+    path = __trustm_broker_path(path);
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    if (__trustm_broker_rundir(path, gid) != 0)
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        perror("broker socket");
+        return -1;
+    }
+
+    unlink(path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+        (listen(fd, 16) == -1))
+    {
+        perror("broker bind");
+        close(fd);
+        return -1;
+    }
+    // Only the broker user and the broker group may connect
+    if ((chmod(path, 0660) == -1) ||
+        ((gid != (gid_t)-1) && (chown(path, -1, gid) == -1)))
+    {
+        perror("broker chmod");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/**********************************************************************
+* __trustm_broker_peer_allowed()
+* root, the broker user and members of TRUSTM_BROKER_GROUP are allowed
+**********************************************************************/
+static int __trustm_broker_peer_allowed(const struct ucred *cred)
+{
+    struct passwd *pw;
+    gid_t groups[64];
+    gid_t gid;
+    int n = sizeof(groups) / sizeof(groups[0]);
+    int i;
+
+    if ((cred->uid == 0) || (cred->uid == geteuid()))
+        return 1;
+    gid = __trustm_broker_gid();
+    if (gid == (gid_t)-1)
+        return 0;
+    if (cred->gid == gid)
+        return 1;
+
+    pw = getpwuid(cred->uid);
+    if ((pw == NULL) || (getgrouplist(pw->pw_name, pw->pw_gid, groups, &n) == -1))
+        return 0;
+    for (i = 0; i < n; i++)
+    {
+        if (groups[i] == gid)
+            return 1;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* trustm_broker_accept()
+* Accepts a client on the listening socket, clients which are not
+* allowed to use the broker are dropped. Transfers with the client time
+* out so that a stalled client cannot block the others. Returns the fd
+* or -1.
+**********************************************************************/
+int trustm_broker_accept(int fd)
+{
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    int cfd;
+
+    cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (cfd == -1)
+        return -1;
+    if ((getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1) ||
+        (__trustm_broker_timeout(cfd, SO_RCVTIMEO, TRUSTM_BROKER_MSG_TIMEOUT) == -1) ||
+        (__trustm_broker_timeout(cfd, SO_SNDTIMEO, TRUSTM_BROKER_MSG_TIMEOUT) == -1))
+    {
+        perror("broker accept");
+        close(cfd);
+        return -1;
+    }
+    if (!__trustm_broker_peer_allowed(&cred))
+    {
+        TRUSTM_HELPER_ERRFN("Client pid %d uid %d not allowed", cred.pid, cred.uid);
+        close(cfd);
+        return -1;
+    }
+    return cfd;
+}
+
+/**********************************************************************
+* trustm_broker_recv()
+* Reads one message, data must hold TRUSTM_BROKER_MAX_DATA bytes. The
+* wait for the first byte is bounded by the socket timeout, the rest of
+* the message must follow within TRUSTM_BROKER_MSG_TIMEOUT.
+* Returns 0 on success, -1 on error, time out or closed connection.
+**********************************************************************/
+int trustm_broker_recv(int fd, trustm_broker_hdr_t *hdr, uint8_t *data)
+{
+    uint64_t deadline = 0;
+
+    if (__trustm_broker_read(fd, hdr, sizeof(trustm_broker_hdr_t), &deadline) != 0)
+        return -1;
+    if ((hdr->magic != TRUSTM_BROKER_MAGIC) || (hdr->len > TRUSTM_BROKER_MAX_DATA))
+    {
+        TRUSTM_HELPER_ERRFN("Invalid broker message");
+        return -1;
+    }
+    return __trustm_broker_read(fd, data, hdr->len, &deadline);
+}
+
+/**********************************************************************
+* trustm_broker_send()
+**********************************************************************/
+int trustm_broker_send(int fd, uint16_t cmd, optiga_lib_status_t status, const uint8_t *data, uint32_t len)
+{
+    trustm_broker_hdr_t hdr;
+
+    hdr.magic = TRUSTM_BROKER_MAGIC;
+    hdr.cmd = cmd;
+    hdr.oid = 0;
+    hdr.param = status;
+    hdr.len = len;
+    if (__trustm_broker_write(fd, &hdr, sizeof(hdr)) != 0)
+        return -1;
+    return __trustm_broker_write(fd, data, len);
+}
@@ -26,6 +26,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -43,12 +48,9 @@
 
 #include "trustm_helper.h"
 #include "trustm_helper_ipc_lock.h"
-
-#ifdef CLI_WORKAROUND
-	extern void pal_os_event_disarm(void);
-	extern void pal_os_event_arm(void);
-	extern void pal_os_event_destroy1(void);
-#endif
+#include "trustm_helper_cache.h"
+#include "trustm_helper_sec.h"
+#include "trustm_helper_shield.h"
 
 /*************************************************************************
 *  Global
@@ -58,18 +60,96 @@ optiga_crypt_t * me_crypt;
 optiga_lib_status_t optiga_lib_status;
 uint16_t trustm_open_flag = 0;
 uint8_t trustm_hibernate_flag = 0;
+// Set while a caller keeps one session across several tools (trustm runner),
+// trustm_Open then reuses the open application and trustm_Close is a no-op
+uint8_t trustm_session_hold = 0;
+// Last error reported through trustmPrintErrorCode
+uint16_t trustm_last_error = 0;
+
+// Completion signalling between the OPTIGA callback and the waiting caller
+static pthread_mutex_t trustm_status_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trustm_status_cond;
+static pthread_once_t trustm_status_once = PTHREAD_ONCE_INIT;
 
 /*************************************************************************
 *  functions
 *************************************************************************/
+/**********************************************************************
+* __trustm_status_init()
+* The condition variable uses the monotonic clock so the wait deadline
+* is not affected by changes of the wall clock.
+**********************************************************************/
+static void __trustm_status_init(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&trustm_status_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**********************************************************************
+* trustm_SetStatus()
+* Called from the OPTIGA callbacks. Stores the status and wakes up the
+* caller blocked in trustm_WaitForStatus().
+**********************************************************************/
+void trustm_SetStatus(optiga_lib_status_t status)
+{
+    pthread_once(&trustm_status_once, __trustm_status_init);
+    pthread_mutex_lock(&trustm_status_mutex);
+    optiga_lib_status = status;
+    pthread_cond_broadcast(&trustm_status_cond);
+    pthread_mutex_unlock(&trustm_status_mutex);
+}
+
+/**********************************************************************
+* trustm_WaitForStatus()
+* Blocks until optiga_lib_status leaves OPTIGA_LIB_BUSY or wait_time
+* (ms) has passed. Returns OPTIGA_LIB_BUSY on time out.
+* *elapsed returns the time waited in us, may be NULL.
+**********************************************************************/
+optiga_lib_status_t trustm_WaitForStatus(uint16_t wait_time, uint32_t *elapsed)
+{
+    struct timespec start, now, deadline;
+    optiga_lib_status_t status;
+    int res = 0;
+
+    pthread_once(&trustm_status_once, __trustm_status_init);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    deadline.tv_sec = start.tv_sec + (wait_time / 1000);
+    deadline.tv_nsec = start.tv_nsec + ((long)(wait_time % 1000) * 1000000);
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&trustm_status_mutex);
+    while ((optiga_lib_status == OPTIGA_LIB_BUSY) && (res != ETIMEDOUT))
+    {
+        res = pthread_cond_timedwait(&trustm_status_cond, &trustm_status_mutex, &deadline);
+    }
+    status = optiga_lib_status;
+    pthread_mutex_unlock(&trustm_status_mutex);
+
+    if (elapsed != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *elapsed = (uint32_t)((now.tv_sec - start.tv_sec) * 1000000 +
+                              (now.tv_nsec - start.tv_nsec) / 1000);
+    }
+    return status;
+}
+
 /**
  * Callback when optiga_util_xxxx operation is completed asynchronously
  */
 
 void helper_optiga_util_callback(void * context, optiga_lib_status_t return_status)
 {
-    optiga_lib_status = return_status;
-    TRUSTM_HELPER_DBGFN("optiga_lib_status: %x\n",optiga_lib_status);
+    trustm_SetStatus(return_status);
+    TRUSTM_HELPER_DBGFN("optiga_lib_status: %x\n",return_status);
 }
 
 /*************************************************************************
@@ -143,13 +223,23 @@ int mssleep(long msec)
     return res;
 }
 
-static void __delay (int cnt)
+/**********************************************************************
+* trustm_secCnt_backoff()
+* Time in ms to sleep before the security event counter is read again.
+* The counter reaches 0 after secCnt decay periods. If it did not go
+* down since the last read, other commands keep raising it and the
+* previous wait is doubled.
+**********************************************************************/
+uint32_t trustm_secCnt_backoff(uint8_t secCnt, uint8_t lastCnt, uint32_t lastWait)
 {
     uint32_t wait;
-    
-    
-    for(wait=0;wait<(0x1fffffff*cnt);wait++)
-    {}
+
+    wait = (uint32_t)secCnt * TRUSTM_SEC_DECAY_MS;
+    if ((lastWait != 0) && (secCnt >= lastCnt) && (wait < (lastWait * 2)))
+        wait = lastWait * 2;
+    if (wait > TRUSTM_SEC_WAIT_MAX_MS)
+        wait = TRUSTM_SEC_WAIT_MAX_MS;
+    return wait;
 }
 
 /**********************************************************************
@@ -486,95 +576,166 @@ void trustmdecodeMetaData(uint8_t * metaData)
     }
 }
 
-optiga_lib_status_t trustmReadMetadata(uint16_t optiga_oid, trustm_metadata_t *oidMetadata)
+/**********************************************************************
+* trustmReadMetadataRaw()
+* Reads the metadata of optiga_oid, from the metadata cache if present.
+* *len is the size of buf on input and the metadata length on output.
+* Called with the application open, the IPC lock held makes sure no
+* other process changes the object between the read and the cache
+* update.
+**********************************************************************/
+optiga_lib_status_t trustmReadMetadataRaw(uint16_t optiga_oid, uint8_t *buf, uint16_t *len)
 {
     optiga_lib_status_t return_status;
-    uint16_t bytes_to_read;
-    uint8_t read_data_buffer[2048];
-    uint16_t i,j;
 
-    oidMetadata->metadataLen = 0;
-    oidMetadata->D0_changeLen = 0;
-    oidMetadata->D1_readLen = 0;
-    oidMetadata->D3_executeLen = 0;
-    oidMetadata->C4_maxSize = 0;
-    oidMetadata->C5_used = 0;
-        
+    if (trustm_cache_metadata_get(optiga_oid, buf, len) == 0)
+        return OPTIGA_LIB_SUCCESS;
+
     do
     {
-        bytes_to_read = sizeof(read_data_buffer);
         optiga_lib_status = OPTIGA_LIB_BUSY;
         return_status = optiga_util_read_metadata(me_util,
                                                     optiga_oid,
-                                                    read_data_buffer,
-                                                    &bytes_to_read);
+                                                    buf,
+                                                    len);
         if (OPTIGA_LIB_SUCCESS != return_status)
-            break;          
+            break;
         //Wait until the optiga_util_read_metadata operation is completed
         trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
         return_status = optiga_lib_status;
         if (return_status != OPTIGA_LIB_SUCCESS)
             break;
-        else
+
+        trustm_cache_metadata_put(optiga_oid, buf, *len);
+    }while(FALSE);
+
+    return return_status;
+}
+
+/**********************************************************************
+* trustmParseMetadata()
+* Decodes the metadata read from the chip or the metadata cache.
+**********************************************************************/
+void trustmParseMetadata(const uint8_t *read_data_buffer, uint16_t bytes_to_read, trustm_metadata_t *oidMetadata)
+{
+    uint16_t i,j,end,len;
+    uint8_t valid;
+
+    oidMetadata->metadataLen = 0;
+    oidMetadata->D0_changeLen = 0;
+    oidMetadata->D1_readLen = 0;
+    oidMetadata->D3_executeLen = 0;
+    oidMetadata->C4_maxSize = 0;
+    oidMetadata->C5_used = 0;
+
+    if((bytes_to_read > 1) && (read_data_buffer[0] == 0x20))
+    {
+        // Every TLV must lie within the metadata and within bytes_to_read
+        end = read_data_buffer[1] + 2;
+        valid = (end <= bytes_to_read);
+        oidMetadata->metadataLen = read_data_buffer[1];
+        for(i = 2; valid && (i < end);i += len+2)
         {
-            if(read_data_buffer[0] == 0x20)
+            if ((i + 2) > end)
+            {
+                valid = 0;
+                break;
+            }
+            len = read_data_buffer[i+1];
+            if (((i + 2 + len) > end) || ((len == 0) && (read_data_buffer[i] != 0xD0) &&
+                (read_data_buffer[i] != 0xD1) && (read_data_buffer[i] != 0xD3)))
             {
-                oidMetadata->metadataLen = read_data_buffer[1];
-                for(i = 2; i < read_data_buffer[1];i += read_data_buffer[i+1]+2)
-                {
-                    switch(read_data_buffer[i])
+                valid = 0;
+                break;
+            }
+            switch(read_data_buffer[i])
+            {
+                case 0xC0:
+                    oidMetadata->C0_lsc0 = read_data_buffer[i+2];
+                    break;
+                case 0xC1:
+                    oidMetadata->C1_verion[0] = read_data_buffer[i+1];
+                    oidMetadata->C1_verion[1] = read_data_buffer[i+2];                    
+                    break;
+                case 0xC4:
+                    if (len == 2)
+                        oidMetadata->C4_maxSize = (uint16_t)((read_data_buffer[i+2] << 8)+read_data_buffer[i+3]);
+                    else
+                        oidMetadata->C4_maxSize = (uint16_t) read_data_buffer[i+2];                              
+                    break;
+                case 0xC5:
+                    if (len == 2)
+                        oidMetadata->C5_used = (uint16_t)((read_data_buffer[i+2] << 8)+read_data_buffer[i+3]);
+                    else
+                        oidMetadata->C5_used = (uint16_t) read_data_buffer[i+2]; 
+                    break;
+                case 0xD0:
+                    if (len > sizeof(oidMetadata->D0_change))
                     {
-                        case 0xC0:
-                            oidMetadata->C0_lsc0 = read_data_buffer[i+2];
-                            break;
-                        case 0xC1:
-                            oidMetadata->C1_verion[0] = read_data_buffer[i+1];
-                            oidMetadata->C1_verion[1] = read_data_buffer[i+2];                    
-                            break;
-                        case 0xC4:
-                            if (read_data_buffer[i+1] == 2)
-                                oidMetadata->C4_maxSize = (uint16_t)((read_data_buffer[i+2] << 8)+read_data_buffer[i+3]);
-                            else
-                                oidMetadata->C4_maxSize = (uint16_t) read_data_buffer[i+2];                              
-                            break;
-                        case 0xC5:
-                            if (read_data_buffer[i+1] == 2)
-                                oidMetadata->C5_used = (uint16_t)((read_data_buffer[i+2] << 8)+read_data_buffer[i+3]);
-                            else
-                                oidMetadata->C5_used = (uint16_t) read_data_buffer[i+2]; 
-                            break;
-                        case 0xD0:
-                            oidMetadata->D0_changeLen = read_data_buffer[i+1];
-                            for(j=0;j<read_data_buffer[i+1];j++)
-                                oidMetadata->D0_change[j] = read_data_buffer[i+2+j];                            
-                            break;
-                        case 0xD1:
-                            oidMetadata->D1_readLen = read_data_buffer[i+1];
-                            for(j=0;j<read_data_buffer[i+1];j++)
-                                oidMetadata->D1_read[j] = read_data_buffer[i+2+j];                        
-                            break;
-                        case 0xD3:
-                            oidMetadata->D3_executeLen = read_data_buffer[i+1];
-                            for(j=0;j<read_data_buffer[i+1];j++)
-                                oidMetadata->D3_execute[j] = read_data_buffer[i+2+j];
-                            break;
-                        case 0xE0:
-                            oidMetadata->E0_algo = read_data_buffer[i+2];                        
-                            break;
-                        case 0xE1:
-                            oidMetadata->E1_keyUsage = read_data_buffer[i+2];
-                            break;
-                        case 0xE8:
-                            oidMetadata->E8_dataObjType = read_data_buffer[i+2];
-                            break;
-                        default:
-                            i = bytes_to_read;
-                            oidMetadata->metadataLen = 0;
+                        valid = 0;
+                        break;
+                    }
+                    oidMetadata->D0_changeLen = len;
+                    for(j=0;j<len;j++)
+                        oidMetadata->D0_change[j] = read_data_buffer[i+2+j];                            
+                    break;
+                case 0xD1:
+                    if (len > sizeof(oidMetadata->D1_read))
+                    {
+                        valid = 0;
+                        break;
+                    }
+                    oidMetadata->D1_readLen = len;
+                    for(j=0;j<len;j++)
+                        oidMetadata->D1_read[j] = read_data_buffer[i+2+j];                        
+                    break;
+                case 0xD3:
+                    if (len > sizeof(oidMetadata->D3_execute))
+                    {
+                        valid = 0;
+                        break;
                     }
-                }
+                    oidMetadata->D3_executeLen = len;
+                    for(j=0;j<len;j++)
+                        oidMetadata->D3_execute[j] = read_data_buffer[i+2+j];
+                    break;
+                case 0xE0:
+                    oidMetadata->E0_algo = read_data_buffer[i+2];                        
+                    break;
+                case 0xE1:
+                    oidMetadata->E1_keyUsage = read_data_buffer[i+2];
+                    break;
+                case 0xE8:
+                    oidMetadata->E8_dataObjType = read_data_buffer[i+2];
+                    break;
+                default:
+                    valid = 0;
             }
-        }        
-    }while(FALSE);
+        }
+        if (!valid)
+        {
+            TRUSTM_HELPER_DBGFN("Invalid metadata");
+            oidMetadata->metadataLen = 0;
+            oidMetadata->D0_changeLen = 0;
+            oidMetadata->D1_readLen = 0;
+            oidMetadata->D3_executeLen = 0;
+        }
+    }
+}
+
+optiga_lib_status_t trustmReadMetadata(uint16_t optiga_oid, trustm_metadata_t *oidMetadata)
+{
+    optiga_lib_status_t return_status;
+    uint16_t bytes_to_read;
+    uint8_t read_data_buffer[TRUSTM_CACHE_METADATA_SIZE];
+
+    bytes_to_read = sizeof(read_data_buffer);
+    return_status = trustmReadMetadataRaw(optiga_oid,
+                                          read_data_buffer,
+                                          &bytes_to_read);
+    if (return_status != OPTIGA_LIB_SUCCESS)
+        bytes_to_read = 0;
+    trustmParseMetadata(read_data_buffer, bytes_to_read, oidMetadata);
 
     // Capture OPTIGA Trust M error
     if (return_status != OPTIGA_LIB_SUCCESS)
@@ -861,7 +1022,7 @@ optiga_lib_status_t trustm_readUID(utrustm_UID_t *UID)
 **********************************************************************/
 void helper_optiga_crypt_callback(void * context, optiga_lib_status_t return_status)
 {
-    optiga_lib_status = return_status;
+    trustm_SetStatus(return_status);
     if (NULL != context)
     {
         // callback to upper layer here
@@ -873,22 +1034,20 @@ void helper_optiga_crypt_callback(void * context, optiga_lib_status_t return_sta
 **********************************************************************/
 optiga_lib_status_t trustm_WaitForCompletion(uint16_t wait_time)
 {
-    uint16_t tickcount;
-     
-    tickcount=0;
-    do
+    optiga_lib_status_t status;
+    uint32_t elapsed;
+
+    status = trustm_WaitForStatus(wait_time, &elapsed);
+    trustm_shield_result(status);
+    if (status == OPTIGA_LIB_BUSY)
     {
-        mssleep(1);
-        tickcount++;
-        if (tickcount >= wait_time)
-        {
-            TRUSTM_HELPER_ERRFN("Fail : Optiga Busy Time Out:%d\n",tickcount);
-            return OPTIGA_LIB_BUSY;
-        }
-         
-    }while (optiga_lib_status == OPTIGA_LIB_BUSY);
-    TRUSTM_HELPER_DBGFN(" max wait_time:%d, Tick Counter: %d", wait_time,tickcount);
-    return optiga_lib_status;
+        TRUSTM_HELPER_ERRFN("Fail : Optiga Busy Time Out:%d\n",elapsed/1000);
+        return OPTIGA_LIB_BUSY;
+    }
+    TRUSTM_HELPER_DBGFN(" max wait_time:%d, Wait time (us): %d", wait_time,elapsed);
+    // Security events of the tools count for the governor of the engine
+    trustm_sec_gov_result(status);
+    return status;
  }   
 
 
@@ -899,7 +1058,8 @@ optiga_lib_status_t _trustm_Open(void)
 {
     optiga_lib_status_t return_status = OPTIGA_LIB_BUSY;
     
-    trustm_ipc_acquire();
+    if (trustm_ipc_acquire() != 0)
+        return return_status;
 
 
     TRUSTM_HELPER_DBGFN(">");
@@ -952,7 +1112,6 @@ optiga_lib_status_t _trustm_Open(void)
             break;
         }
 
-        TRUSTM_CLI_WORKAROUND_TIMER_ARM;
         TRUSTM_HELPER_DBGFN("waiting...");
         //Wait until the optiga_util_open_application is completed
         trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
@@ -968,6 +1127,8 @@ optiga_lib_status_t _trustm_Open(void)
         }
         
         trustm_open_flag = 1;
+        // Invalidate any engine session kept open by other processes
+        trustm_shield_opened(trustm_ipc_session_new());
         TRUSTM_HELPER_DBGFN("Success : optiga_util_open_application \n");
     }while(FALSE);      
 
@@ -985,6 +1146,12 @@ optiga_lib_status_t trustm_Open(void)
     optiga_lib_status_t return_status;
     
     TRUSTM_HELPER_DBGFN(">");
+    if ((trustm_session_hold != 0) && (trustm_open_flag == 1))
+    {
+        TRUSTM_HELPER_DBGFN("Session held, reuse the open application");
+        trustm_hibernate_flag = 0;
+        return OPTIGA_LIB_SUCCESS;
+    }
     TRUSTM_HELPER_DBGFN("trustm_Open with recovery\n"); 
     if  (trustm_open_flag == 1)
     {   
@@ -1016,10 +1183,17 @@ optiga_lib_status_t trustm_Open(void)
 optiga_lib_status_t trustm_Close(void)
 {
     optiga_lib_status_t return_status;
-    uint8_t secCnt;
+    uint8_t secCnt, lastCnt = 0;
+    uint32_t wait = 0;
 
     TRUSTM_HELPER_DBGFN(">");
 
+    if (trustm_session_hold != 0)
+    {
+        TRUSTM_HELPER_DBGFN("Session held, keep the application open");
+        return OPTIGA_LIB_SUCCESS;
+    }
+
     do{
         if (trustm_open_flag != 1)
         {
@@ -1035,8 +1209,10 @@ optiga_lib_status_t trustm_Close(void)
             secCnt = __trustm_secCnt();
             while (secCnt)
             {
-                TRUSTM_HELPER_INFO("Security Event Counter : %d [waiting. Ctrl+c to abort.]\n",secCnt);
-                __delay(2);
+                wait = trustm_secCnt_backoff(secCnt, lastCnt, wait);
+                TRUSTM_HELPER_INFO("Security Event Counter : %d [waiting %d ms. Ctrl+c to abort.]\n",secCnt,wait);
+                mssleep(wait);
+                lastCnt = secCnt;
                 secCnt = __trustm_secCnt();
                 if (secCnt == 0)
                     TRUSTM_HELPER_INFO("context saved.\n");
@@ -1098,12 +1274,10 @@ optiga_lib_status_t trustm_Close(void)
         return_status=optiga_util_destroy(me_util);
     }
     trustm_open_flag = 0;
-    /// IPC Release 
-    mssleep(30);
+    /// IPC Release, the next ticket is handed over at once
     trustm_ipc_release();
     TRUSTM_HELPER_DBGFN("release shared memory.\n");
 
-    TRUSTM_CLI_WORKAROUND_TIMER_DISARM;
     TRUSTM_HELPER_DBGFN("TrustM Closed.\n");
     TRUSTM_HELPER_DBGFN("<");
     return return_status;
@@ -1170,8 +1344,84 @@ uint16_t trustmreadFrom(uint8_t *data, uint8_t *filename)
 
 }
 
+/**********************************************************************
+* trustmCreateTempFile()
+* Creates a temporary file next to filename, tmpName receives its name.
+* The output only replaces filename in trustmCommitTempFile(), so it
+* can be the input and a failure leaves any existing file untouched.
+* Returns the fd or -1.
+**********************************************************************/
+int trustmCreateTempFile(const char *filename, mode_t mode, char *tmpName, size_t tmpSize)
+{
+    mode_t mask;
+    int fd;
+
+    if ((size_t)snprintf(tmpName, tmpSize, "%s.XXXXXX", filename) >= tmpSize)
+    {
+        TRUSTM_HELPER_ERRFN("file name %s too long", filename);
+        return -1;
+    }
+    fd = mkstemp(tmpName);
+    if (fd < 0)
+    {
+        TRUSTM_HELPER_ERRFN("failed to create file %s : %s", tmpName, strerror(errno));
+        return -1;
+    }
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, mode & ~mask);
+    return fd;
+}
+
+/**********************************************************************
+* trustmWriteTempFile()
+**********************************************************************/
+int trustmWriteTempFile(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            TRUSTM_HELPER_ERRFN("write failed : %s", strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**********************************************************************
+* trustmCommitTempFile()
+* Closes the temporary file and moves it over filename. On failure the
+* caller still has to unlink tmpName.
+**********************************************************************/
+int trustmCommitTempFile(int fd, const char *tmpName, const char *filename)
+{
+    int ret;
+
+    ret = fsync(fd);
+    if ((close(fd) != 0) || (ret != 0))
+    {
+        TRUSTM_HELPER_ERRFN("write failed : %s", strerror(errno));
+        return -1;
+    }
+    if (rename(tmpName, filename) != 0)
+    {
+        TRUSTM_HELPER_ERRFN("failed to create file %s : %s", filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
 void trustmPrintErrorCode(uint16_t errcode)
 {
+    trustm_last_error = errcode;
     switch (errcode)
     {
         // OPTIGA comms
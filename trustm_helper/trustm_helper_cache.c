@@ -0,0 +1,411 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_cache.h"
+#include "trustm_helper_ipc_lock.h"
+#include "trustm_helper_shm.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+#define CACHE_SHM_NAME      "/trustm_cache"   // .<uid> appended
+#define CACHE_SHM_MAGIC     0x544D4333  // "TMC3", bump on layout change
+
+typedef struct trustm_cache_meta_str
+{
+    uint16_t oid;           // 0 : free entry
+    uint16_t len;
+    uint32_t stamp;         // last use, for replacement
+    uint8_t  data[TRUSTM_CACHE_METADATA_SIZE];
+} trustm_cache_meta_t;
+
+typedef struct trustm_cache_pubkey_str
+{
+    uint16_t oid;           // 0 : free entry
+    uint16_t len;
+    uint32_t stamp;         // last use, for replacement
+    uint8_t  data[TRUSTM_CACHE_PUBKEY_SIZE];
+} trustm_cache_pubkey_t;
+
+typedef struct trustm_cache_shm_str
+{
+    uint32_t            magic;
+    pthread_mutex_t     lock;   // protects all fields below
+    uint32_t            epoch;  // trustm_ipc_cache_epoch() of the entries
+    uint32_t            stamp;
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            invalidated;
+    trustm_cache_meta_t meta[TRUSTM_CACHE_ENTRIES];
+    trustm_cache_pubkey_t pubkey[TRUSTM_CACHE_PUBKEYS];
+} trustm_cache_shm_t;
+
+static trustm_cache_shm_t *cache_shm = NULL;
+// -1 : not initialized, 0 : disabled, 1 : enabled
+static int cache_state = -1;
+static pthread_mutex_t cache_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __trustm_cache_setup()
+**********************************************************************/
+static void __trustm_cache_setup(void *shm)
+{
+    trustm_shm_mutex_init(&((trustm_cache_shm_t *)shm)->lock);
+}
+
+/**********************************************************************
+* __trustm_cacheInit()
+* Maps the cache of the current user, creating it if needed. Cached
+* metadata and public keys are trusted by the engine and the tools, so
+* the segment is private to the user. Unlike the IPC lock the cache is
+* optional, any failure disables it.
+**********************************************************************/
+static int __trustm_cacheInit(void)
+{
+    const char *env;
+    char name[64];
+
+    if (__atomic_load_n(&cache_state, __ATOMIC_ACQUIRE) >= 0)
+        return cache_state;
+
+    pthread_mutex_lock(&cache_init_mutex);
+    do
+    {
+        if (cache_state >= 0)
+            break;
+        cache_state = 0;
+
+        env = getenv("TRUSTM_CACHE");
+        if ((env != NULL) && (strcmp(env, "0") == 0))
+        {
+            TRUSTM_HELPER_DBGFN("Cache disabled");
+            break;
+        }
+
+        snprintf(name, sizeof(name), CACHE_SHM_NAME ".%u", (unsigned int)getuid());
+        cache_shm = trustm_shm_map(name, sizeof(trustm_cache_shm_t), 0600, 1,
+                                    CACHE_SHM_MAGIC, __trustm_cache_setup);
+        if (cache_shm == NULL)
+            break;
+        __atomic_store_n(&cache_state, 1, __ATOMIC_RELEASE);
+    }while(FALSE);
+    pthread_mutex_unlock(&cache_init_mutex);
+
+    return cache_state;
+}
+
+/**********************************************************************
+* __trustm_cache_lock() / __trustm_cache_unlock()
+* All entries are dropped once another process (of any user) has
+* invalidated an object since they were stored.
+**********************************************************************/
+static void __trustm_cache_lock(void)
+{
+    uint32_t epoch = trustm_ipc_cache_epoch();
+    int i;
+
+    if (pthread_mutex_lock(&cache_shm->lock) == EOWNERDEAD)
+    {
+        // Entries are only marked valid once complete, nothing to repair
+        TRUSTM_HELPER_DBGFN("Cache lock owner died");
+        pthread_mutex_consistent(&cache_shm->lock);
+    }
+    if (cache_shm->epoch != epoch)
+    {
+        TRUSTM_HELPER_DBGFN("Cache epoch %u, flush", epoch);
+        for (i = 0; i < TRUSTM_CACHE_ENTRIES; i++)
+            cache_shm->meta[i].oid = 0;
+        for (i = 0; i < TRUSTM_CACHE_PUBKEYS; i++)
+            cache_shm->pubkey[i].oid = 0;
+        cache_shm->epoch = epoch;
+    }
+}
+
+static void __trustm_cache_unlock(void)
+{
+    pthread_mutex_unlock(&cache_shm->lock);
+}
+
+/**********************************************************************
+* __trustm_cache_find()
+* Cache lock must be held
+**********************************************************************/
+static trustm_cache_meta_t *__trustm_cache_find(uint16_t oid)
+{
+    int i;
+
+    for (i = 0; i < TRUSTM_CACHE_ENTRIES; i++)
+    {
+        if (cache_shm->meta[i].oid == oid)
+            return &cache_shm->meta[i];
+    }
+    return NULL;
+}
+
+/**********************************************************************
+* trustm_cache_metadata_get()
+* Copies the cached metadata of oid to buf. *len is the size of buf on
+* input and the metadata length on output.
+* Returns 0 on a hit, -1 otherwise.
+**********************************************************************/
+int trustm_cache_metadata_get(uint16_t oid, uint8_t *buf, uint16_t *len)
+{
+    trustm_cache_meta_t *entry;
+    int ret = -1;
+
+    if (__trustm_cacheInit() != 1)
+        return -1;
+
+    __trustm_cache_lock();
+    entry = __trustm_cache_find(oid);
+    if ((entry != NULL) && (entry->len <= *len))
+    {
+        memcpy(buf, entry->data, entry->len);
+        *len = entry->len;
+        entry->stamp = ++cache_shm->stamp;
+        cache_shm->hits++;
+        ret = 0;
+    }
+    else
+    {
+        cache_shm->misses++;
+    }
+    __trustm_cache_unlock();
+
+    TRUSTM_HELPER_DBGFN("Metadata 0x%.4X : %s", oid, (ret == 0) ? "hit" : "miss");
+    return ret;
+}
+
+/**********************************************************************
+* trustm_cache_metadata_put()
+* Stores metadata read from the chip, replacing the least recently
+* used entry if the cache is full.
+**********************************************************************/
+void trustm_cache_metadata_put(uint16_t oid, const uint8_t *buf, uint16_t len)
+{
+    trustm_cache_meta_t *entry;
+    int i;
+
+    if ((oid == 0) || (len > TRUSTM_CACHE_METADATA_SIZE))
+        return;
+    if (__trustm_cacheInit() != 1)
+        return;
+
+    __trustm_cache_lock();
+    entry = __trustm_cache_find(oid);
+    if (entry == NULL)
+    {
+        entry = &cache_shm->meta[0];
+        for (i = 1; i < TRUSTM_CACHE_ENTRIES; i++)
+        {
+            if (entry->oid == 0)
+                break;
+            if ((cache_shm->meta[i].oid == 0) || (cache_shm->meta[i].stamp < entry->stamp))
+                entry = &cache_shm->meta[i];
+        }
+    }
+    entry->oid = 0;
+    memcpy(entry->data, buf, len);
+    entry->len = len;
+    entry->stamp = ++cache_shm->stamp;
+    entry->oid = oid;
+    __trustm_cache_unlock();
+}
+
+/**********************************************************************
+* __trustm_cache_find_pubkey()
+* Cache lock must be held
+**********************************************************************/
+static trustm_cache_pubkey_t *__trustm_cache_find_pubkey(uint16_t oid)
+{
+    int i;
+
+    for (i = 0; i < TRUSTM_CACHE_PUBKEYS; i++)
+    {
+        if (cache_shm->pubkey[i].oid == oid)
+            return &cache_shm->pubkey[i];
+    }
+    return NULL;
+}
+
+/**********************************************************************
+* trustm_cache_pubkey_get()
+* Copies the cached public key read from oid to buf. *len is the size
+* of buf on input and the public key length on output.
+* Returns 0 on a hit, -1 otherwise.
+**********************************************************************/
+int trustm_cache_pubkey_get(uint16_t oid, uint8_t *buf, uint16_t *len)
+{
+    trustm_cache_pubkey_t *entry;
+    int ret = -1;
+
+    if (__trustm_cacheInit() != 1)
+        return -1;
+
+    __trustm_cache_lock();
+    entry = __trustm_cache_find_pubkey(oid);
+    if ((entry != NULL) && (entry->len <= *len))
+    {
+        memcpy(buf, entry->data, entry->len);
+        *len = entry->len;
+        entry->stamp = ++cache_shm->stamp;
+        cache_shm->hits++;
+        ret = 0;
+    }
+    else
+    {
+        cache_shm->misses++;
+    }
+    __trustm_cache_unlock();
+
+    TRUSTM_HELPER_DBGFN("Pubkey 0x%.4X : %s", oid, (ret == 0) ? "hit" : "miss");
+    return ret;
+}
+
+/**********************************************************************
+* trustm_cache_pubkey_put()
+* Stores the public key read from oid, either the content of a public
+* key object or the key extracted from a certificate.
+**********************************************************************/
+void trustm_cache_pubkey_put(uint16_t oid, const uint8_t *buf, uint16_t len)
+{
+    trustm_cache_pubkey_t *entry;
+    int i;
+
+    if ((oid == 0) || (len == 0) || (len > TRUSTM_CACHE_PUBKEY_SIZE))
+        return;
+    if (__trustm_cacheInit() != 1)
+        return;
+
+    __trustm_cache_lock();
+    entry = __trustm_cache_find_pubkey(oid);
+    if (entry == NULL)
+    {
+        entry = &cache_shm->pubkey[0];
+        for (i = 1; i < TRUSTM_CACHE_PUBKEYS; i++)
+        {
+            if (entry->oid == 0)
+                break;
+            if ((cache_shm->pubkey[i].oid == 0) || (cache_shm->pubkey[i].stamp < entry->stamp))
+                entry = &cache_shm->pubkey[i];
+        }
+    }
+    entry->oid = 0;
+    memcpy(entry->data, buf, len);
+    entry->len = len;
+    entry->stamp = ++cache_shm->stamp;
+    entry->oid = oid;
+    __trustm_cache_unlock();
+}
+
+/**********************************************************************
+* trustm_cache_invalidate()
+* Must be called after anything is written to oid (data, metadata or a
+* generated key), the next read goes to the chip. Bumping the epoch
+* flushes the caches of all users, including this one.
+**********************************************************************/
+void trustm_cache_invalidate(uint16_t oid)
+{
+    trustm_cache_meta_t *entry;
+    trustm_cache_pubkey_t *pubkey;
+
+    trustm_ipc_cache_bump();
+    if (__trustm_cacheInit() != 1)
+        return;
+
+    __trustm_cache_lock();
+    entry = __trustm_cache_find(oid);
+    if (entry != NULL)
+    {
+        entry->oid = 0;
+        cache_shm->invalidated++;
+    }
+    pubkey = __trustm_cache_find_pubkey(oid);
+    if (pubkey != NULL)
+    {
+        pubkey->oid = 0;
+        cache_shm->invalidated++;
+    }
+    __trustm_cache_unlock();
+    TRUSTM_HELPER_DBGFN("Invalidate 0x%.4X", oid);
+}
+
+/**********************************************************************
+* trustm_cache_flush()
+**********************************************************************/
+void trustm_cache_flush(void)
+{
+    int i;
+
+    if (__trustm_cacheInit() != 1)
+        return;
+
+    __trustm_cache_lock();
+    for (i = 0; i < TRUSTM_CACHE_ENTRIES; i++)
+        cache_shm->meta[i].oid = 0;
+    for (i = 0; i < TRUSTM_CACHE_PUBKEYS; i++)
+        cache_shm->pubkey[i].oid = 0;
+    __trustm_cache_unlock();
+}
+
+/**********************************************************************
+* trustm_cache_get_stats()
+**********************************************************************/
+void trustm_cache_get_stats(trustm_cache_stats_t *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(trustm_cache_stats_t));
+    if (__trustm_cacheInit() != 1)
+        return;
+
+    __trustm_cache_lock();
+    for (i = 0; i < TRUSTM_CACHE_ENTRIES; i++)
+    {
+        if (cache_shm->meta[i].oid != 0)
+            stats->entries++;
+    }
+    for (i = 0; i < TRUSTM_CACHE_PUBKEYS; i++)
+    {
+        if (cache_shm->pubkey[i].oid != 0)
+            stats->pubkeys++;
+    }
+    stats->hits = cache_shm->hits;
+    stats->misses = cache_shm->misses;
+    stats->invalidated = cache_shm->invalidated;
+    __trustm_cache_unlock();
+}
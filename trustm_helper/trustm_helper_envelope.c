@@ -0,0 +1,401 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/rand.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_envelope.h"
+#include "trustm_helper_shield.h"
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+static uint64_t __envelope_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __envelope_map()
+* Maps the whole input file read only. An empty file gives a NULL map
+* with size 0.
+**********************************************************************/
+static int __envelope_map(const char *filename, uint8_t **data, size_t *size)
+{
+    struct stat st;
+    int fd;
+
+    *data = NULL;
+    *size = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        TRUSTM_HELPER_ERRFN("failed to open file %s : %s", filename, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size > 0)
+    {
+        *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*data == MAP_FAILED)
+        {
+            TRUSTM_HELPER_ERRFN("failed to map file %s : %s", filename, strerror(errno));
+            *data = NULL;
+            close(fd);
+            return -1;
+        }
+        madvise(*data, st.st_size, MADV_SEQUENTIAL);
+        *size = st.st_size;
+    }
+    close(fd);
+    return 0;
+}
+
+/**********************************************************************
+* __envelope_pipeline()
+* Runs the mapped payload through the initialized AES-GCM context in
+* TRUSTM_ENVELOPE_CHUNK_SIZE pieces and writes the result to fd.
+**********************************************************************/
+static int __envelope_pipeline(EVP_CIPHER_CTX *ctx, const uint8_t *in, size_t len, int fd)
+{
+    uint8_t *out;
+    size_t chunk;
+    int outLen;
+    int ret = -1;
+
+    out = malloc(TRUSTM_ENVELOPE_CHUNK_SIZE + TRUSTM_ENVELOPE_TAG_SIZE);
+    if (out == NULL)
+        return -1;
+
+    do
+    {
+        while (len > 0)
+        {
+            chunk = (len > TRUSTM_ENVELOPE_CHUNK_SIZE) ? TRUSTM_ENVELOPE_CHUNK_SIZE : len;
+            if (EVP_CipherUpdate(ctx, out, &outLen, in, (int)chunk) != 1)
+                break;
+            if (trustmWriteTempFile(fd, out, outLen) != 0)
+                break;
+            in += chunk;
+            len -= chunk;
+        }
+        if (len != 0)
+            break;
+        ret = 0;
+    }while(FALSE);
+
+    OPENSSL_cleanse(out, TRUSTM_ENVELOPE_CHUNK_SIZE);
+    free(out);
+    return ret;
+}
+
+/**********************************************************************
+* trustmEnvelopeSeal()
+* Encrypts inFile into outFile under a fresh data key drawn from the
+* OPTIGA TRNG and wrapped with the RSA public key of key_oid.
+**********************************************************************/
+optiga_lib_status_t trustmEnvelopeSeal(optiga_key_id_t key_oid, EVP_PKEY *pubkey, uint8_t shielded,
+                                        const char *inFile, const char *outFile, trustm_envelope_stats_t *stats)
+{
+    optiga_lib_status_t return_status = OPTIGA_CRYPT_ERROR;
+    uint8_t header[TRUSTM_ENVELOPE_HEADER_SIZE];
+    uint16_t headerLen;
+    uint8_t dataKey[TRUSTM_ENVELOPE_KEY_SIZE];
+    uint8_t wrapped[TRUSTM_ENVELOPE_MAX_WRAPPED];
+    size_t wrappedLen = sizeof(wrapped);
+    uint8_t tag[TRUSTM_ENVELOPE_TAG_SIZE];
+    EVP_PKEY_CTX *pctx = NULL;
+    EVP_CIPHER_CTX *ctx = NULL;
+    uint8_t *in = NULL;
+    size_t inLen = 0;
+    char tmpName[PATH_MAX];
+    uint64_t start;
+    int outLen;
+    int fd = -1;
+    int created = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    do
+    {
+        if ((pubkey == NULL) || (EVP_PKEY_id(pubkey) != EVP_PKEY_RSA))
+        {
+            TRUSTM_HELPER_ERRFN("envelope needs an RSA public key");
+            return_status = OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+            break;
+        }
+
+        if (__envelope_map(inFile, &in, &inLen) != 0)
+            break;
+
+        start = __envelope_now_us();
+        if (shielded)
+        {
+            // OPTIGA Comms Shielded connection settings to enable the protection
+            TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+        }
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        return_status = optiga_crypt_random(me_crypt,
+                                            OPTIGA_RNG_TYPE_TRNG,
+                                            dataKey,
+                                            sizeof(dataKey));
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            break;
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        return_status = optiga_lib_status;
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+        stats->chip_us = __envelope_now_us() - start;
+
+        return_status = OPTIGA_CRYPT_ERROR;
+        start = __envelope_now_us();
+
+        // Wrap the data key, the chip only supports PKCS#1 v1.5 padding
+        pctx = EVP_PKEY_CTX_new(pubkey, NULL);
+        if ((pctx == NULL) ||
+            (EVP_PKEY_encrypt_init(pctx) <= 0) ||
+            (EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) <= 0) ||
+            (EVP_PKEY_encrypt(pctx, wrapped, &wrappedLen, dataKey, sizeof(dataKey)) <= 0))
+        {
+            TRUSTM_HELPER_ERRFN("failed to wrap data key");
+            break;
+        }
+
+        memcpy(header, TRUSTM_ENVELOPE_MAGIC, 4);
+        header[4] = TRUSTM_ENVELOPE_VERSION;
+        header[5] = TRUSTM_ENVELOPE_WRAP_RSA;
+        header[6] = (key_oid >> 8) & 0xFF;
+        header[7] = key_oid & 0xFF;
+        header[8] = (wrappedLen >> 8) & 0xFF;
+        header[9] = wrappedLen & 0xFF;
+        memcpy(header + 10, wrapped, wrappedLen);
+        headerLen = 10 + wrappedLen;
+        if (RAND_bytes(header + headerLen, TRUSTM_ENVELOPE_IV_SIZE) != 1)
+            break;
+        headerLen += TRUSTM_ENVELOPE_IV_SIZE;
+
+        fd = trustmCreateTempFile(outFile, 0644, tmpName, sizeof(tmpName));
+        if (fd < 0)
+            break;
+        created = 1;
+        if (trustmWriteTempFile(fd, header, headerLen) != 0)
+            break;
+
+        ctx = EVP_CIPHER_CTX_new();
+        if ((ctx == NULL) ||
+            (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1) ||
+            (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, TRUSTM_ENVELOPE_IV_SIZE, NULL) != 1) ||
+            (EVP_EncryptInit_ex(ctx, NULL, NULL, dataKey, header + headerLen - TRUSTM_ENVELOPE_IV_SIZE) != 1) ||
+            (EVP_EncryptUpdate(ctx, NULL, &outLen, header, headerLen) != 1))
+            break;
+
+        if (__envelope_pipeline(ctx, in, inLen, fd) != 0)
+            break;
+        if ((EVP_EncryptFinal_ex(ctx, tag, &outLen) != 1) ||
+            (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, sizeof(tag), tag) != 1))
+            break;
+        if (trustmWriteTempFile(fd, tag, sizeof(tag)) != 0)
+            break;
+        if (trustmCommitTempFile(fd, tmpName, outFile) != 0)
+        {
+            fd = -1;
+            break;
+        }
+        fd = -1;
+        created = 0;
+
+        stats->bytes = inLen;
+        stats->bulk_us = __envelope_now_us() - start;
+        return_status = OPTIGA_LIB_SUCCESS;
+    }while(FALSE);
+
+    OPENSSL_cleanse(dataKey, sizeof(dataKey));
+    if (ctx != NULL)
+        EVP_CIPHER_CTX_free(ctx);
+    if (pctx != NULL)
+        EVP_PKEY_CTX_free(pctx);
+    if (in != NULL)
+        munmap(in, inLen);
+    if (fd >= 0)
+        close(fd);
+    if (created)
+        unlink(tmpName);
+
+    return return_status;
+}
+
+/**********************************************************************
+* trustmEnvelopeOpen()
+* Unwraps the data key of inFile inside the OPTIGA and decrypts the
+* payload into outFile. outFile is only written once the GCM tag
+* verifies, so a tampered file never leaves plaintext behind.
+**********************************************************************/
+optiga_lib_status_t trustmEnvelopeOpen(uint8_t shielded, const char *inFile, const char *outFile,
+                                        trustm_envelope_stats_t *stats)
+{
+    optiga_lib_status_t return_status = OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+    optiga_key_id_t key_oid;
+    uint8_t dataKey[TRUSTM_ENVELOPE_MAX_WRAPPED];
+    uint16_t dataKeyLen = sizeof(dataKey);
+    uint16_t wrappedLen;
+    size_t headerLen;
+    uint8_t tag[TRUSTM_ENVELOPE_TAG_SIZE];
+    EVP_CIPHER_CTX *ctx = NULL;
+    uint8_t *in = NULL;
+    size_t inLen = 0;
+    char tmpName[PATH_MAX];
+    uint64_t start;
+    int outLen;
+    int fd = -1;
+    int created = 0;
+
+    memset(stats, 0, sizeof(*stats));
+
+    do
+    {
+        if (__envelope_map(inFile, &in, &inLen) != 0)
+        {
+            return_status = OPTIGA_CRYPT_ERROR;
+            break;
+        }
+
+        if ((inLen < 10) ||
+            (memcmp(in, TRUSTM_ENVELOPE_MAGIC, 4) != 0) ||
+            (in[4] != TRUSTM_ENVELOPE_VERSION) ||
+            (in[5] != TRUSTM_ENVELOPE_WRAP_RSA))
+        {
+            TRUSTM_HELPER_ERRFN("%s is not an envelope file", inFile);
+            break;
+        }
+        key_oid = (in[6] << 8) | in[7];
+        wrappedLen = (in[8] << 8) | in[9];
+        headerLen = 10 + wrappedLen + TRUSTM_ENVELOPE_IV_SIZE;
+        if ((wrappedLen > TRUSTM_ENVELOPE_MAX_WRAPPED) ||
+            (inLen < headerLen + TRUSTM_ENVELOPE_TAG_SIZE))
+        {
+            TRUSTM_HELPER_ERRFN("%s is truncated", inFile);
+            break;
+        }
+
+        start = __envelope_now_us();
+        if (shielded)
+        {
+            // OPTIGA Comms Shielded connection settings to enable the protection
+            TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+        }
+        optiga_lib_status = OPTIGA_LIB_BUSY;
+        return_status = optiga_crypt_rsa_decrypt_and_export(me_crypt,
+                                                            OPTIGA_RSAES_PKCS1_V15,
+                                                            in + 10,
+                                                            wrappedLen,
+                                                            NULL,
+                                                            0,
+                                                            key_oid,
+                                                            dataKey,
+                                                            &dataKeyLen);
+        if (OPTIGA_LIB_SUCCESS != return_status)
+            break;
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+        return_status = optiga_lib_status;
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+        stats->chip_us = __envelope_now_us() - start;
+
+        return_status = OPTIGA_CRYPT_ERROR;
+        if (dataKeyLen != TRUSTM_ENVELOPE_KEY_SIZE)
+        {
+            TRUSTM_HELPER_ERRFN("unexpected data key length %d", dataKeyLen);
+            break;
+        }
+        start = __envelope_now_us();
+
+        fd = trustmCreateTempFile(outFile, 0600, tmpName, sizeof(tmpName));
+        if (fd < 0)
+            break;
+        created = 1;
+
+        memcpy(tag, in + inLen - TRUSTM_ENVELOPE_TAG_SIZE, sizeof(tag));
+        ctx = EVP_CIPHER_CTX_new();
+        if ((ctx == NULL) ||
+            (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) != 1) ||
+            (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, TRUSTM_ENVELOPE_IV_SIZE, NULL) != 1) ||
+            (EVP_DecryptInit_ex(ctx, NULL, NULL, dataKey, in + headerLen - TRUSTM_ENVELOPE_IV_SIZE) != 1) ||
+            (EVP_DecryptUpdate(ctx, NULL, &outLen, in, headerLen) != 1))
+            break;
+
+        if (__envelope_pipeline(ctx, in + headerLen, inLen - headerLen - TRUSTM_ENVELOPE_TAG_SIZE, fd) != 0)
+            break;
+        if ((EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, sizeof(tag), tag) != 1) ||
+            (EVP_DecryptFinal_ex(ctx, tag, &outLen) != 1))
+        {
+            TRUSTM_HELPER_ERRFN("authentication failed, %s is corrupted or tampered", inFile);
+            break;
+        }
+        if (trustmCommitTempFile(fd, tmpName, outFile) != 0)
+        {
+            fd = -1;
+            break;
+        }
+        fd = -1;
+        created = 0;
+
+        stats->bytes = inLen - headerLen - TRUSTM_ENVELOPE_TAG_SIZE;
+        stats->bulk_us = __envelope_now_us() - start;
+        return_status = OPTIGA_LIB_SUCCESS;
+    }while(FALSE);
+
+    OPENSSL_cleanse(dataKey, sizeof(dataKey));
+    if (ctx != NULL)
+        EVP_CIPHER_CTX_free(ctx);
+    if (in != NULL)
+        munmap(in, inLen);
+    if (fd >= 0)
+        close(fd);
+    if (created)
+        unlink(tmpName);
+
+    return return_status;
+}
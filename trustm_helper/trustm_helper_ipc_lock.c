@@ -25,9 +25,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <pthread.h>
 
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -46,6 +46,7 @@
 
 #include "trustm_helper.h"
 #include "trustm_helper_ipc_lock.h"
+#include "trustm_helper_shm.h"
 
 
 /*************************************************************************
@@ -53,139 +54,266 @@
 *************************************************************************/
 //Globe Variable
 // for IPC
-// ---- InterCom
-#define IPC_FLAGSIZE    sizeof(pid_t)
-#define IPC_SLEEP_STEPS 1
-#define MAX_IPC_TIME 50
-
-key_t ipc_FlagInterKey;
-int   ipc_FlagInterShmid;
-pid_t ipc_queue;
-unsigned char ipc_value;
-unsigned char ipc_temp;
-long ipc_task;
+// ---- InterCom, named shared memory holding the ticket queue
+#define IPC_SHM_NAME    "/trustm_ipc_lock"
+#define IPC_SHM_MAGIC   0x544D4C33  // "TML3", bump on layout change
+// ---- Interval in ms at which waiters check for dead queue entries
+#define IPC_POLL_TIME   100
+
+typedef struct trustm_ipc_slot_str
+{
+    pthread_mutex_t mutex;      // held by the ticket owner while queued and served
+    pthread_cond_t  cond;       // signalled when the ticket is served
+    pid_t           pid;
+    uint32_t        ticket;
+    uint64_t        enqueue;    // CLOCK_MONOTONIC, us
+} trustm_ipc_slot_t;
+
+typedef struct trustm_ipc_shm_str
+{
+    uint32_t          magic;
+    pthread_mutex_t   qlock;    // protects all fields below
+    pthread_cond_t    space;    // signalled when a queue slot frees up
+    uint32_t          next_ticket;
+    uint32_t          serving;
+    pid_t             owner;
+    uint32_t          session;  // application session generation
+    uint32_t          cache_epoch; // bumped on every cache invalidation
+    uint64_t          acquired;
+    uint64_t          total_wait;
+    uint32_t          max_wait;
+    trustm_ipc_slot_t slot[TRUSTM_IPC_QUEUE_SIZE];
+} trustm_ipc_shm_t;
+
+static trustm_ipc_shm_t *ipc_shm = NULL;
+static pthread_mutex_t ipc_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Lock ownership is per thread, acquire/release are idempotent.
+// The owner pid is kept so that a child forked while the lock is held
+// does not inherit the ownership.
+static __thread pid_t ipc_owned = 0;
+static __thread uint32_t ipc_ticket = 0;
+
 /*************************************************************************
 *  functions
 *************************************************************************/
 
 /**********************************************************************
-* __trustm_writeshm()
+* __trustm_ipc_now()
+* Monotonic time in us
+**********************************************************************/
+static uint64_t __trustm_ipc_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __trustm_ipc_timedwait()
+* Waits on cond for at most IPC_POLL_TIME ms, qlock must be held.
+* Returns 0 or ETIMEDOUT with qlock held, any other error if qlock is
+* lost (not recoverable).
+**********************************************************************/
+static int __trustm_ipc_timedwait(pthread_cond_t *cond)
+{
+    struct timespec ts;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += IPC_POLL_TIME * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    ret = pthread_cond_timedwait(cond, &ipc_shm->qlock, &ts);
+    if (ret == EOWNERDEAD)
+        ret = pthread_mutex_consistent(&ipc_shm->qlock);
+    if ((ret != 0) && (ret != ETIMEDOUT))
+        TRUSTM_HELPER_ERRFN("Queue lock : %s", strerror(ret));
+    return ret;
+}
+
+/**********************************************************************
+* __trustm_ipc_qlock() / __trustm_ipc_qunlock()
+* __trustm_ipc_qlock() returns 0 with qlock held, -1 on failure
+**********************************************************************/
+static int __trustm_ipc_qlock(void)
+{
+    int ret;
+
+    ret = pthread_mutex_lock(&ipc_shm->qlock);
+    if (ret == EOWNERDEAD)
+    {
+        TRUSTM_HELPER_DBGFN("Queue lock owner died");
+        ret = pthread_mutex_consistent(&ipc_shm->qlock);
+    }
+    if (ret != 0)
+    {
+        TRUSTM_HELPER_ERRFN("Queue lock : %s", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+static void __trustm_ipc_qunlock(void)
+{
+    pthread_mutex_unlock(&ipc_shm->qlock);
+}
+
+/**********************************************************************
+* __trustm_ipc_reap()
+* Skips queue entries whose process has died, either while being served
+* or while waiting. The slot mutex of a live entry is always held by its
+* owner, so a successful trylock means the owner is gone.
+* qlock must be held.
 **********************************************************************/
-static void __trustm_writeshm(int shmid,pid_t data)
+static void __trustm_ipc_reap(void)
 {
-    pid_t  *Flag_segptr;
+    trustm_ipc_slot_t *slot;
+    uint8_t reaped = 0;
+    int ret;
 
-    /* Attach (map) the shared memory segment into the current process */
-     if((Flag_segptr = (pid_t *)shmat(shmid, 0, 0)) == (pid_t *)-1)
-     {
-             perror("write flag shmat");
-             //exit(1);
-             return;
-     }
+    while (ipc_shm->serving != ipc_shm->next_ticket)
+    {
+        slot = &ipc_shm->slot[ipc_shm->serving % TRUSTM_IPC_QUEUE_SIZE];
+        ret = pthread_mutex_trylock(&slot->mutex);
+        if (ret == EBUSY)
+            break;
+        if (ret == EOWNERDEAD)
+            pthread_mutex_consistent(&slot->mutex);
+        pthread_mutex_unlock(&slot->mutex);
 
-     *Flag_segptr=data;
-     shmdt(Flag_segptr);
+        TRUSTM_HELPER_DBGFN("Process does not exist1:%d", slot->pid);
+        slot->pid = 0;
+        ipc_shm->owner = 0;
+        ipc_shm->serving++;
+        reaped = 1;
+    }
+
+    if (reaped)
+    {
+        pthread_cond_signal(&ipc_shm->slot[ipc_shm->serving % TRUSTM_IPC_QUEUE_SIZE].cond);
+        pthread_cond_broadcast(&ipc_shm->space);
+    }
 }
 
 /**********************************************************************
-* __trustm_readshm()
+* __trustm_ipc_setup()
 **********************************************************************/
-static pid_t __trustm_readshm(int shmid)
-{   pid_t  *Flag_segptr;
-    pid_t Flag;
-    /* Attach (map) the shared memory segment into the current process */
-     if((Flag_segptr = (pid_t *)shmat(shmid, 0, 0)) == (pid_t *)-1)
-     {
-             perror("read flag shmat");
-             //exit(1);
-             return 0;
-     }
-     Flag = *Flag_segptr;
-     shmdt(Flag_segptr);
-
-    return Flag;
+static void __trustm_ipc_setup(void *segment)
+{
+    trustm_ipc_shm_t *shm = segment;
+    int i;
+
+    trustm_shm_mutex_init(&shm->qlock);
+    trustm_shm_cond_init(&shm->space);
+    for (i = 0; i < TRUSTM_IPC_QUEUE_SIZE; i++)
+    {
+        trustm_shm_mutex_init(&shm->slot[i].mutex);
+        trustm_shm_cond_init(&shm->slot[i].cond);
+    }
 }
 
 /**********************************************************************
 * __trustm_ipcInit()
+* Maps the shared queue, creating and initializing it if this is the
+* first user.
 **********************************************************************/
 void __trustm_ipcInit(void)
 {
-	/* Unique Key for InterCom */
-    ipc_FlagInterKey = 0x11111123;
-    pid_t pid;
+    trustm_ipc_shm_t *shm;
 
-  	/* Open the shared memory segment - create if necessary */
-    if((ipc_FlagInterShmid = shmget(ipc_FlagInterKey, IPC_FLAGSIZE, IPC_CREAT|IPC_EXCL|0666)) == -1)
+    pthread_mutex_lock(&ipc_init_mutex);
+    if (ipc_shm == NULL)
     {
-        TRUSTM_HELPER_DBGFN("Shared memory segment exists - opening as client");
-        /* Segment probably already exists - try as a client */
-        if((ipc_FlagInterShmid = shmget(ipc_FlagInterKey, IPC_FLAGSIZE, 0)) == -1)
-        {
-            perror("Init shmget");
+        // Other users must be able to take the lock
+        shm = trustm_shm_map(IPC_SHM_NAME, sizeof(trustm_ipc_shm_t), 0666, 1,
+                                IPC_SHM_MAGIC, __trustm_ipc_setup);
+        if (shm == NULL)
             exit(1);
-        }
-    }
-    else
-    {
-        // First created so init queue
-        pid=getpid();
-        TRUSTM_HELPER_DBGFN("Init Queue %d", pid);
-        
-        //~ __trustm_writeshm(ipc_FlagInterShmid,0x1);
-        __trustm_writeshm(ipc_FlagInterShmid,pid); // stores the current PID
+        ipc_shm = shm;
     }
+    pthread_mutex_unlock(&ipc_init_mutex);
 }
 
 /**********************************************************************
 * trustm_ipc_acquire()
+* Takes a ticket and blocks until it is served. Tickets are served in
+* FIFO order, at most TRUSTM_IPC_QUEUE_SIZE processes can be queued,
+* further callers wait for a free slot before taking a ticket.
+* Returns 0 with the lock held, -1 if the lock cannot be taken, the
+* caller must not use the chip then.
 **********************************************************************/
-void trustm_ipc_acquire(void)
-{
-    pid_t current_pid;
-    pid_t queue_pid;
-    int queue_delay;
-
-     __trustm_ipcInit();
-
-    /// IPC Check
-    current_pid=getpid();
-    queue_delay= ((current_pid %MAX_IPC_TIME)+1)*IPC_SLEEP_STEPS;; // wait for 0 to 20ms at IPC_SLEEP_STEPS steps depends on process number
-    mssleep(queue_delay);
-    
-    queue_pid = __trustm_readshm(ipc_FlagInterShmid);
-    TRUSTM_HELPER_DBGFN("Check if TrustM Open:queue %d:current:%d:Delay %d", queue_pid,current_pid,queue_delay);
-    if (queue_pid ==0xAA55)
-    {    __trustm_writeshm(ipc_FlagInterShmid,current_pid); /*write pid into shared memory*/
-        queue_pid = __trustm_readshm(ipc_FlagInterShmid);
-        TRUSTM_HELPER_DBGFN("Resource seized by %d",current_pid);
-    }    
-   
-    while ( queue_pid !=current_pid)  /*Check if taken by other process and wait*/
+int trustm_ipc_acquire(void)
+{
+    trustm_ipc_slot_t *slot;
+    uint32_t wait;
+    int ret;
+
+    if (ipc_owned == getpid())
     {
-        queue_pid = __trustm_readshm(ipc_FlagInterShmid);
-        if (queue_pid ==0XAA55)
-        {    __trustm_writeshm(ipc_FlagInterShmid,current_pid); /*write pid into shared memory*/
-            //queue_pid=__trustm_readshm(ipc_FlagInterShmid);
-            TRUSTM_HELPER_DBGFN("Resource seized by %d",current_pid);
-        }
-        else if (kill(queue_pid,0) == -1) 
+        TRUSTM_HELPER_DBGFN("Lock already owned");
+        return 0;
+    }
+
+    __trustm_ipcInit();
+    if (__trustm_ipc_qlock() != 0)
+        return -1;
+
+    while ((ipc_shm->next_ticket - ipc_shm->serving) >= TRUSTM_IPC_QUEUE_SIZE)
+    {
+        ret = __trustm_ipc_timedwait(&ipc_shm->space);
+        if (ret == ETIMEDOUT)
+            __trustm_ipc_reap();
+        else if (ret != 0)
+            return -1;
+    }
+
+    ipc_ticket = ipc_shm->next_ticket++;
+    slot = &ipc_shm->slot[ipc_ticket % TRUSTM_IPC_QUEUE_SIZE];
+    ret = pthread_mutex_lock(&slot->mutex);
+    if (ret == EOWNERDEAD)
+        ret = pthread_mutex_consistent(&slot->mutex);
+    if (ret != 0)
+    {
+        // The ticket stays unowned, __trustm_ipc_reap() skips it
+        TRUSTM_HELPER_ERRFN("Queue slot : %s", strerror(ret));
+        __trustm_ipc_qunlock();
+        return -1;
+    }
+    slot->pid = getpid();
+    slot->ticket = ipc_ticket;
+    slot->enqueue = __trustm_ipc_now();
+    TRUSTM_HELPER_DBGFN("Check if TrustM Open:ticket %u:serving %u:current:%d",
+                        ipc_ticket, ipc_shm->serving, slot->pid);
+
+    while (ipc_shm->serving != ipc_ticket)
+    {
+        ret = __trustm_ipc_timedwait(&slot->cond);
+        if (ret == ETIMEDOUT)
+            __trustm_ipc_reap();
+        else if (ret != 0)
         {
-          mssleep(100); 
-          queue_pid = __trustm_readshm(ipc_FlagInterShmid);
-          if (kill(queue_pid,0) == -1)
-          {
-              TRUSTM_HELPER_DBGFN("Process does not exist1:%d", queue_pid);
-              __trustm_writeshm(ipc_FlagInterShmid,current_pid);
-              //queue_pid=__trustm_readshm(ipc_FlagInterShmid);
-            }
+            // Give the ticket up, it is skipped once served
+            slot->pid = 0;
+            pthread_mutex_unlock(&slot->mutex);
+            return -1;
         }
-        queue_delay= ((current_pid %MAX_IPC_TIME)+1)*IPC_SLEEP_STEPS; // wait for 1 to MAX_IPC_TIME at IPC_SLEEP_STEPS steps depends on process number
-        mssleep(queue_delay);
-        queue_pid=__trustm_readshm(ipc_FlagInterShmid);
     }
-    TRUSTM_HELPER_DBGFN("Lock queue %d", queue_pid);
-    
+
+    wait = (uint32_t)(__trustm_ipc_now() - slot->enqueue);
+    ipc_shm->owner = slot->pid;
+    ipc_shm->acquired++;
+    ipc_shm->total_wait += wait;
+    if (wait > ipc_shm->max_wait)
+        ipc_shm->max_wait = wait;
+    ipc_owned = slot->pid;
+    __trustm_ipc_qunlock();
+
+    TRUSTM_HELPER_DBGFN("Lock queue %d, waited %u us", getpid(), wait);
+    return 0;
 }
 
 /**********************************************************************
@@ -193,17 +321,106 @@ void trustm_ipc_acquire(void)
 **********************************************************************/
 void trustm_ipc_release(void)
 {
-    pid_t current_pid;
-    pid_t queue_pid;  
-    current_pid=getpid();
-    queue_pid = __trustm_readshm(ipc_FlagInterShmid);
-    if (current_pid==queue_pid)
+    trustm_ipc_slot_t *slot;
+
+    if (ipc_owned != getpid())
     {
-        TRUSTM_HELPER_DBGFN("release shared memory\n");
-        __trustm_writeshm(ipc_FlagInterShmid,0xAA55);
+        TRUSTM_HELPER_DBGFN("shared memory used by others\n");
+        return;
     }
-    else if (queue_pid!=0xAA55)
-    {   TRUSTM_HELPER_DBGFN("shared memory used by others\n");
+
+    TRUSTM_HELPER_DBGFN("release shared memory\n");
+    if (__trustm_ipc_qlock() != 0)
+    {
+        // Nobody can take the lock any more, only drop the ownership
+        ipc_owned = 0;
+        return;
+    }
+    slot = &ipc_shm->slot[ipc_ticket % TRUSTM_IPC_QUEUE_SIZE];
+    slot->pid = 0;
+    pthread_mutex_unlock(&slot->mutex);
+    ipc_shm->owner = 0;
+    ipc_shm->serving++;
+    ipc_owned = 0;
+    pthread_cond_signal(&ipc_shm->slot[ipc_shm->serving % TRUSTM_IPC_QUEUE_SIZE].cond);
+    pthread_cond_broadcast(&ipc_shm->space);
+    __trustm_ipc_qunlock();
+}
+
+/**********************************************************************
+* trustm_ipc_get_stats()
+* Snapshot of the queue. waiter[0] is the current owner if any,
+* followed by the waiting processes in service order.
+**********************************************************************/
+void trustm_ipc_get_stats(trustm_ipc_stats_t *stats)
+{
+    trustm_ipc_slot_t *slot;
+    uint64_t now;
+    uint32_t t;
+
+    memset(stats, 0, sizeof(trustm_ipc_stats_t));
+    __trustm_ipcInit();
+    if (__trustm_ipc_qlock() != 0)
+        return;
+    now = __trustm_ipc_now();
+    stats->owner = ipc_shm->owner;
+    stats->acquired = ipc_shm->acquired;
+    stats->total_wait = ipc_shm->total_wait;
+    stats->max_wait = ipc_shm->max_wait;
+    for (t = ipc_shm->serving; t != ipc_shm->next_ticket; t++)
+    {
+        slot = &ipc_shm->slot[t % TRUSTM_IPC_QUEUE_SIZE];
+        stats->waiter[stats->depth].pid = slot->pid;
+        stats->waiter[stats->depth].wait = (uint32_t)(now - slot->enqueue);
+        stats->depth++;
     }
-    mssleep(30);
+    __trustm_ipc_qunlock();
+}
+
+/**********************************************************************
+* trustm_ipc_session_get(void)
+* Application session generation, bumped every time a process opens
+* the application on OPTIGA. A process which keeps the application open
+* compares it with its own copy to find out if another process has
+* re-opened (and so reset) the application in the meantime.
+**********************************************************************/
+uint32_t trustm_ipc_session_get(void)
+{
+    uint32_t session;
+
+    __trustm_ipcInit();
+    session = __atomic_load_n(&ipc_shm->session, __ATOMIC_ACQUIRE);
+    TRUSTM_HELPER_DBGFN("Session generation %u", session);
+    return session;
+}
+
+/**********************************************************************
+* trustm_ipc_session_new(void)
+* Must be called with the IPC lock held.
+**********************************************************************/
+uint32_t trustm_ipc_session_new(void)
+{
+    uint32_t session;
+
+    __trustm_ipcInit();
+    session = __atomic_add_fetch(&ipc_shm->session, 1, __ATOMIC_ACQ_REL);
+    TRUSTM_HELPER_DBGFN("Session generation %u", session);
+    return session;
+}
+
+/**********************************************************************
+* trustm_ipc_cache_epoch() / trustm_ipc_cache_bump()
+* The metadata cache is private to each user, objects written by one
+* user bump the epoch so that the caches of all users are flushed.
+**********************************************************************/
+uint32_t trustm_ipc_cache_epoch(void)
+{
+    __trustm_ipcInit();
+    return __atomic_load_n(&ipc_shm->cache_epoch, __ATOMIC_ACQUIRE);
+}
+
+uint32_t trustm_ipc_cache_bump(void)
+{
+    __trustm_ipcInit();
+    return __atomic_add_fetch(&ipc_shm->cache_epoch, 1, __ATOMIC_ACQ_REL);
 }
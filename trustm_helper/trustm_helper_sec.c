@@ -0,0 +1,257 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_shm.h"
+#include "trustm_helper_sec.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+static trustm_sec_gov_shm_t *gov_shm = NULL;
+static pthread_mutex_t gov_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Limits of this process
+static uint8_t gov_shed = TRUSTM_SEC_GOV_SHED;
+static uint8_t gov_queue = TRUSTM_SEC_GOV_QUEUE;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __trustm_sec_gov_now()
+* Monotonic time in us
+**********************************************************************/
+static uint64_t __trustm_sec_gov_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __trustm_sec_gov_setup()
+**********************************************************************/
+static void __trustm_sec_gov_setup(void *shm)
+{
+    trustm_shm_mutex_init(&((trustm_sec_gov_shm_t *)shm)->lock);
+}
+
+/**********************************************************************
+* __trustm_sec_gov_map()
+* Maps the governor segment. Without create, NULL if no process has
+* created it yet.
+**********************************************************************/
+static trustm_sec_gov_shm_t *__trustm_sec_gov_map(int create)
+{
+    pthread_mutex_lock(&gov_init_mutex);
+    if (gov_shm == NULL)
+    {
+        // Other users share the estimate
+        gov_shm = trustm_shm_map(TRUSTM_SEC_GOV_SHM_NAME, sizeof(trustm_sec_gov_shm_t), 0666, create,
+                                TRUSTM_SEC_GOV_MAGIC, __trustm_sec_gov_setup);
+    }
+    pthread_mutex_unlock(&gov_init_mutex);
+
+    return gov_shm;
+}
+
+/**********************************************************************
+* __trustm_sec_gov_lock()
+**********************************************************************/
+static trustm_sec_gov_shm_t *__trustm_sec_gov_lock(int create)
+{
+    trustm_sec_gov_shm_t *shm;
+
+    if ((shm = __trustm_sec_gov_map(create)) == NULL)
+        return NULL;
+    if (pthread_mutex_lock(&shm->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&shm->lock);
+    return shm;
+}
+
+/**********************************************************************
+* __trustm_sec_gov_estimate()
+* Last reading less the decay since, plus the events seen since. Lock
+* held.
+**********************************************************************/
+static uint8_t __trustm_sec_gov_estimate(trustm_sec_gov_shm_t *shm, uint64_t now)
+{
+    uint64_t decayed = 0;
+    uint32_t sec;
+
+    if (shm->stamp != 0)
+        decayed = (now - shm->stamp) / ((uint64_t)TRUSTM_SEC_DECAY_MS * 1000);
+    sec = shm->stats.sampled;
+    sec = (decayed >= sec) ? 0 : (sec - (uint32_t)decayed);
+    sec += shm->pending;
+    return (sec > 0xFF) ? 0xFF : (uint8_t)sec;
+}
+
+/**********************************************************************
+* trustm_sec_gov_limits()
+* SEC from which low priority work is dropped and all work is delayed
+**********************************************************************/
+void trustm_sec_gov_limits(uint8_t shed, uint8_t queue)
+{
+    gov_shed = shed;
+    gov_queue = queue;
+}
+
+/**********************************************************************
+* trustm_sec_gov_due()
+* Returns 1 if 0xE0C5 should be read now. The caller holds the chip and
+* passes the value to trustm_sec_gov_sample().
+**********************************************************************/
+int trustm_sec_gov_due(void)
+{
+    trustm_sec_gov_shm_t *shm;
+    uint64_t now, age;
+    int due = 1;
+
+    if ((shm = __trustm_sec_gov_lock(1)) == NULL)
+        return 0;
+    if (shm->stamp != 0)
+    {
+        now = __trustm_sec_gov_now();
+        age = (now - shm->stamp) / 1000;
+        if ((__trustm_sec_gov_estimate(shm, now) != 0) || (shm->pending != 0))
+            due = (age >= TRUSTM_SEC_GOV_SAMPLE_MS);
+        else
+            due = (age >= TRUSTM_SEC_GOV_IDLE_MS);
+    }
+    pthread_mutex_unlock(&shm->lock);
+    return due;
+}
+
+/**********************************************************************
+* trustm_sec_gov_sample()
+**********************************************************************/
+void trustm_sec_gov_sample(uint8_t sec)
+{
+    trustm_sec_gov_shm_t *shm;
+
+    if ((shm = __trustm_sec_gov_lock(1)) == NULL)
+        return;
+    shm->stamp = __trustm_sec_gov_now();
+    shm->pending = 0;
+    shm->stats.sampled = sec;
+    shm->stats.sec = sec;
+    shm->stats.samples++;
+    pthread_mutex_unlock(&shm->lock);
+    TRUSTM_HELPER_DBGFN("SEC : %d", sec);
+}
+
+/**********************************************************************
+* trustm_sec_gov_result()
+* Status of a finished command, the errors for which the chip raises
+* the SEC are counted until the next reading.
+**********************************************************************/
+void trustm_sec_gov_result(optiga_lib_status_t status)
+{
+    trustm_sec_gov_shm_t *shm;
+
+    switch (status)
+    {
+        case 0x8002: // Invalid Password
+        case 0x8007: // Access Condition Not Satisfied
+        case 0x802D: // Integrity Validation Failure
+        case 0x802E: // Decryption Failure
+            break;
+        default:
+            return;
+    }
+
+    if ((shm = __trustm_sec_gov_lock(1)) == NULL)
+        return;
+    if (shm->pending < 0xFF)
+        shm->pending++;
+    shm->stats.events++;
+    pthread_mutex_unlock(&shm->lock);
+}
+
+/**********************************************************************
+* trustm_sec_gov_admit()
+* Decision for work of priority prio about to be submitted. For
+* TRUSTM_SEC_GOV_QUEUE_WORK wait is the time in ms until the estimate
+* is expected below the queue limit, the caller waits and asks again.
+**********************************************************************/
+int trustm_sec_gov_admit(uint8_t prio, uint32_t *wait)
+{
+    trustm_sec_gov_shm_t *shm;
+    uint8_t sec;
+    int decision = TRUSTM_SEC_GOV_SUBMIT;
+
+    *wait = 0;
+    if ((shm = __trustm_sec_gov_lock(1)) == NULL)
+        return decision;
+    sec = __trustm_sec_gov_estimate(shm, __trustm_sec_gov_now());
+    if ((prio == TRUSTM_SEC_GOV_LOW) && (sec >= gov_shed))
+    {
+        decision = TRUSTM_SEC_GOV_SHED_WORK;
+        shm->stats.shed++;
+    }
+    else if (sec >= gov_queue)
+    {
+        decision = TRUSTM_SEC_GOV_QUEUE_WORK;
+        *wait = (uint32_t)(sec - gov_queue + 1) * TRUSTM_SEC_DECAY_MS;
+        if (*wait > TRUSTM_SEC_WAIT_MAX_MS)
+            *wait = TRUSTM_SEC_WAIT_MAX_MS;
+        shm->stats.queued++;
+        shm->stats.queued_ms += *wait;
+    }
+    shm->stats.sec = sec;
+    shm->stats.state = (uint8_t)decision;
+    pthread_mutex_unlock(&shm->lock);
+    return decision;
+}
+
+/**********************************************************************
+* trustm_sec_gov_get()
+* Snapshot of the governor, -1 if no process used it yet
+**********************************************************************/
+int trustm_sec_gov_get(trustm_sec_gov_stats_t *stats)
+{
+    trustm_sec_gov_shm_t *shm;
+    uint64_t now;
+
+    memset(stats, 0, sizeof(trustm_sec_gov_stats_t));
+    if ((shm = __trustm_sec_gov_lock(0)) == NULL)
+        return -1;
+    now = __trustm_sec_gov_now();
+    memcpy(stats, &shm->stats, sizeof(trustm_sec_gov_stats_t));
+    stats->sec = __trustm_sec_gov_estimate(shm, now);
+    if (shm->stamp != 0)
+        stats->age = (uint32_t)((now - shm->stamp) / 1000);
+    pthread_mutex_unlock(&shm->lock);
+    return 0;
+}
@@ -0,0 +1,294 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_shm.h"
+#include "trustm_helper_ipc_lock.h"
+#include "trustm_helper_shield.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+static trustm_shield_shm_t *shield_shm = NULL;
+static pthread_mutex_t shield_init_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Channel of this process, the keys live in its comms instance
+static pthread_mutex_t shield_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t shield_session = 0;     // session generation of the channel
+static uint8_t  shield_fresh = 0;       // opened, not used yet
+static uint8_t  shield_broken = 0;      // comms error on the channel
+static uint32_t shield_count = 0;       // protected commands since the handshake
+static uint32_t shield_rekey = TRUSTM_SHIELD_REKEY;
+static uint8_t  shield_rekey_set = 0;
+
+// Command in flight on this thread
+static __thread uint8_t  shield_armed = 0;     // reason + 1
+static __thread uint64_t shield_t0 = 0;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __trustm_shield_now()
+* Monotonic time in us
+**********************************************************************/
+static uint64_t __trustm_shield_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __trustm_shield_setup()
+**********************************************************************/
+static void __trustm_shield_setup(void *shm)
+{
+    trustm_shm_mutex_init(&((trustm_shield_shm_t *)shm)->lock);
+}
+
+/**********************************************************************
+* __trustm_shield_map()
+* Maps the shared counters. Without create, NULL if no process has
+* created them yet.
+**********************************************************************/
+static trustm_shield_shm_t *__trustm_shield_map(int create)
+{
+    pthread_mutex_lock(&shield_init_mutex);
+    if (shield_shm == NULL)
+    {
+        // Other users add to the counters
+        shield_shm = trustm_shm_map(TRUSTM_SHIELD_SHM_NAME, sizeof(trustm_shield_shm_t), 0666, create,
+                                TRUSTM_SHIELD_MAGIC, __trustm_shield_setup);
+    }
+    pthread_mutex_unlock(&shield_init_mutex);
+
+    return shield_shm;
+}
+
+/**********************************************************************
+* __trustm_shield_lock()
+**********************************************************************/
+static trustm_shield_shm_t *__trustm_shield_lock(int create)
+{
+    trustm_shield_shm_t *shm;
+
+    if ((shm = __trustm_shield_map(create)) == NULL)
+        return NULL;
+    if (pthread_mutex_lock(&shm->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&shm->lock);
+    return shm;
+}
+
+/**********************************************************************
+* trustm_shield_rekey()
+* Protected commands between two handshakes, 0 : only when needed
+**********************************************************************/
+void trustm_shield_rekey(uint32_t commands)
+{
+    pthread_mutex_lock(&shield_mutex);
+    shield_rekey = commands;
+    shield_rekey_set = 1;
+    pthread_mutex_unlock(&shield_mutex);
+}
+
+/**********************************************************************
+* trustm_shield_opened()
+* The application was opened with session generation session, the
+* comms instance starts without channel and the next protected command
+* negotiates it.
+**********************************************************************/
+void trustm_shield_opened(uint32_t session)
+{
+    pthread_mutex_lock(&shield_mutex);
+    shield_session = session;
+    shield_fresh = 1;
+    shield_broken = 0;
+    shield_count = 0;
+    pthread_mutex_unlock(&shield_mutex);
+}
+
+/**********************************************************************
+* trustm_shield_level()
+* Protection level for the next command, issued by this thread right
+* after. The outcome is passed to trustm_shield_result().
+**********************************************************************/
+uint8_t trustm_shield_level(uint8_t level)
+{
+    trustm_shield_shm_t *shm;
+    uint32_t session;
+    uint8_t reason = TRUSTM_SHIELD_REUSE;
+    char *env;
+
+    if (level == OPTIGA_COMMS_NO_PROTECTION)
+        return level;
+
+    session = trustm_ipc_session_get();
+    pthread_mutex_lock(&shield_mutex);
+    if (shield_rekey_set == 0)
+    {
+        if ((env = getenv("TRUSTM_SHIELD_REKEY")) != NULL)
+            shield_rekey = (uint32_t)strtoul(env, NULL, 0);
+        shield_rekey_set = 1;
+    }
+
+    if ((shield_fresh != 0) || (shield_session == 0))
+        reason = TRUSTM_SHIELD_OPEN;
+    else if ((shield_broken != 0) || (shield_session != session))
+        reason = TRUSTM_SHIELD_RECOVER;
+    else if ((shield_rekey != 0) && (shield_count >= shield_rekey))
+        reason = TRUSTM_SHIELD_RENEW;
+
+    if (reason == TRUSTM_SHIELD_REUSE)
+        shield_count++;
+    else
+    {
+        // Claimed here, a concurrent thread reuses the new channel
+        shield_session = session;
+        shield_fresh = 0;
+        shield_broken = 0;
+        shield_count = 1;
+    }
+    pthread_mutex_unlock(&shield_mutex);
+
+    if ((shm = __trustm_shield_lock(1)) != NULL)
+    {
+        shm->stats.commands++;
+        if (reason == TRUSTM_SHIELD_OPEN)
+            shm->stats.opened++;
+        else if (reason == TRUSTM_SHIELD_RENEW)
+            shm->stats.renewed++;
+        else if (reason == TRUSTM_SHIELD_RECOVER)
+            shm->stats.recovered++;
+        pthread_mutex_unlock(&shm->lock);
+    }
+
+    shield_armed = reason + 1;
+    shield_t0 = __trustm_shield_now();
+    if ((reason == TRUSTM_SHIELD_RENEW) || (reason == TRUSTM_SHIELD_RECOVER))
+    {
+        TRUSTM_HELPER_DBGFN("Re-establish shielded connection (%s)",
+                            (reason == TRUSTM_SHIELD_RENEW) ? "rekey" : "recover");
+        level |= OPTIGA_COMMS_RE_ESTABLISH;
+    }
+    return level;
+}
+
+/**********************************************************************
+* trustm_shield_result()
+* Status of the command issued after trustm_shield_level() on this
+* thread. A comms error drops the channel, the next protected command
+* negotiates it again.
+**********************************************************************/
+void trustm_shield_result(optiga_lib_status_t status)
+{
+    trustm_shield_shm_t *shm;
+    uint64_t elapsed;
+    uint8_t reason;
+    int failed = 0;
+
+    if (shield_armed == 0)
+        return;
+    elapsed = __trustm_shield_now() - shield_t0;
+    reason = shield_armed - 1;
+    shield_armed = 0;
+
+    switch (status)
+    {
+        case OPTIGA_LIB_BUSY:   // timed out, the frame state is unknown
+        case OPTIGA_COMMS_ERROR:
+        case OPTIGA_COMMS_ERROR_FATAL:
+        case OPTIGA_COMMS_ERROR_HANDSHAKE:
+        case OPTIGA_COMMS_ERROR_SESSION:
+            failed = 1;
+            pthread_mutex_lock(&shield_mutex);
+            shield_broken = 1;
+            pthread_mutex_unlock(&shield_mutex);
+            break;
+        default:
+            break;
+    }
+
+    if ((shm = __trustm_shield_lock(1)) == NULL)
+        return;
+    if (failed)
+        shm->stats.errors++;
+    else if (status == OPTIGA_LIB_SUCCESS)
+    {
+        if (reason == TRUSTM_SHIELD_REUSE)
+        {
+            shm->stats.reuse_us += elapsed;
+            shm->stats.reuse_n++;
+        }
+        else
+        {
+            shm->stats.hs_us += elapsed;
+            shm->stats.hs_n++;
+        }
+    }
+    pthread_mutex_unlock(&shm->lock);
+}
+
+/**********************************************************************
+* trustm_shield_get()
+* Snapshot of the counters of all processes, -1 if no process used the
+* shielded connection yet
+**********************************************************************/
+int trustm_shield_get(trustm_shield_stats_t *stats)
+{
+    trustm_shield_shm_t *shm;
+
+    memset(stats, 0, sizeof(trustm_shield_stats_t));
+    if ((shm = __trustm_shield_lock(0)) == NULL)
+        return -1;
+    memcpy(stats, &shm->stats, sizeof(trustm_shield_stats_t));
+    pthread_mutex_unlock(&shm->lock);
+    return 0;
+}
+
+/**********************************************************************
+* trustm_shield_saved_us()
+* Estimated time saved by the commands run on a kept channel: the mean
+* time of the commands with handshake less the mean time of the others,
+* for each of the others. 0 until both kinds were seen.
+**********************************************************************/
+uint64_t trustm_shield_saved_us(const trustm_shield_stats_t *stats)
+{
+    uint64_t hs, reuse;
+
+    if ((stats->hs_n == 0) || (stats->reuse_n == 0))
+        return 0;
+    hs = stats->hs_us / stats->hs_n;
+    reuse = stats->reuse_us / stats->reuse_n;
+    return (hs > reuse) ? ((hs - reuse) * stats->reuse_n) : 0;
+}
@@ -0,0 +1,169 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_shm.h"
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __trustm_shm_setup()
+* Maps the segment open on fd and initializes it if needed, fd is
+* closed. Creation is serialized with flock() on the segment so that
+* only one process initializes it.
+**********************************************************************/
+static void *__trustm_shm_setup(int fd, const char *name, size_t size, mode_t mode,
+                                uint32_t magic, trustm_shm_init_t init)
+{
+    struct stat st;
+    void *shm;
+
+    if (fstat(fd, &st) != 0)
+    {
+        TRUSTM_HELPER_ERRFN("fstat %s : %s", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if ((mode & 077) == 0)
+    {
+        // Never use a segment somebody else created for us
+        if ((st.st_uid != getuid()) || ((st.st_mode & 077) != 0))
+        {
+            TRUSTM_HELPER_ERRFN("%s not private, not used", name);
+            close(fd);
+            return NULL;
+        }
+    }
+    else if (st.st_uid == geteuid())
+    {
+        // Created subject to the umask, other users must be able to map it
+        fchmod(fd, mode);
+    }
+    flock(fd, LOCK_EX);
+
+    // The creator may have sized it meanwhile
+    shm = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) &&
+        ((st.st_size >= (off_t)size) || (ftruncate(fd, size) == 0)))
+    {
+        shm = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (shm == MAP_FAILED)
+    {
+        TRUSTM_HELPER_ERRFN("Cannot map %s : %s", name, strerror(errno));
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+    }
+
+    if (*(uint32_t *)shm != magic)
+    {
+        TRUSTM_HELPER_DBGFN("Init %s %d", name, getpid());
+        memset(shm, 0, size);
+        if (init != NULL)
+            init(shm);
+        __atomic_store_n((uint32_t *)shm, magic, __ATOMIC_RELEASE);
+    }
+
+    flock(fd, LOCK_UN);
+    close(fd);
+    return shm;
+}
+
+/**********************************************************************
+* trustm_shm_map()
+* Maps the POSIX shared memory object name. Without create, NULL if no
+* process has created it yet.
+**********************************************************************/
+void *trustm_shm_map(const char *name, size_t size, mode_t mode, uint8_t create,
+                        uint32_t magic, trustm_shm_init_t init)
+{
+    int fd;
+
+    if ((fd = shm_open(name, create ? (O_RDWR|O_CREAT) : O_RDWR, mode)) == -1)
+    {
+        if (create || (errno != ENOENT))
+            TRUSTM_HELPER_ERRFN("shm_open %s : %s", name, strerror(errno));
+        return NULL;
+    }
+    return __trustm_shm_setup(fd, name, size, mode, magic, init);
+}
+
+/**********************************************************************
+* trustm_shm_map_file()
+* Maps the file path as a shared segment, creating it if needed
+**********************************************************************/
+void *trustm_shm_map_file(const char *path, size_t size, mode_t mode,
+                            uint32_t magic, trustm_shm_init_t init)
+{
+    int fd;
+
+    if ((fd = open(path, O_RDWR|O_CREAT, mode)) == -1)
+    {
+        TRUSTM_HELPER_ERRFN("Cannot open %s : %s", path, strerror(errno));
+        return NULL;
+    }
+    return __trustm_shm_setup(fd, path, size, mode, magic, init);
+}
+
+/**********************************************************************
+* trustm_shm_mutex_init()
+* Process shared and robust, lockers must handle EOWNERDEAD
+**********************************************************************/
+void trustm_shm_mutex_init(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t mattr;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+}
+
+/**********************************************************************
+* trustm_shm_cond_init()
+* Process shared, timed waits use CLOCK_MONOTONIC
+**********************************************************************/
+void trustm_shm_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t cattr;
+
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+}
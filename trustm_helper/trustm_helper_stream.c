@@ -0,0 +1,415 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_stream.h"
+#include "trustm_helper_shield.h"
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+// Position of a chunk in the command sequence
+#define STREAM_ONESHOT      0
+#define STREAM_START        1
+#define STREAM_CONTINUE     2
+#define STREAM_FINAL        3
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+static uint64_t __stream_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**********************************************************************
+* __stream_symmetric_issue()
+* Issues one symmetric command without waiting for completion.
+**********************************************************************/
+static optiga_lib_status_t __stream_symmetric_issue(uint8_t encrypt, uint8_t step,
+                                                    optiga_symmetric_encryption_mode_t mode,
+                                                    optiga_key_id_t key, const uint8_t *iv, uint16_t ivLen,
+                                                    uint8_t shielded, const uint8_t *in, uint32_t inLen,
+                                                    uint8_t *out, uint32_t *outLen)
+{
+    if (shielded)
+    {
+        // OPTIGA Comms Shielded connection settings to enable the protection
+        TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+    }
+
+    optiga_lib_status = OPTIGA_LIB_BUSY;
+    switch (step)
+    {
+        case STREAM_ONESHOT:
+            if (encrypt)
+                return optiga_crypt_symmetric_encrypt(me_crypt, mode, key, in, inLen,
+                                                        iv, ivLen, NULL, 0, out, outLen);
+            return optiga_crypt_symmetric_decrypt(me_crypt, mode, key, in, inLen,
+                                                    iv, ivLen, NULL, 0, out, outLen);
+        case STREAM_START:
+            if (encrypt)
+                return optiga_crypt_symmetric_encrypt_start(me_crypt, mode, key, in, inLen,
+                                                            iv, ivLen, NULL, 0, 0, out, outLen);
+            return optiga_crypt_symmetric_decrypt_start(me_crypt, mode, key, in, inLen,
+                                                        iv, ivLen, NULL, 0, 0, out, outLen);
+        case STREAM_CONTINUE:
+            if (encrypt)
+                return optiga_crypt_symmetric_encrypt_continue(me_crypt, in, inLen, out, outLen);
+            return optiga_crypt_symmetric_decrypt_continue(me_crypt, in, inLen, out, outLen);
+        default:
+            if (encrypt)
+                return optiga_crypt_symmetric_encrypt_final(me_crypt, in, inLen, out, outLen);
+            return optiga_crypt_symmetric_decrypt_final(me_crypt, in, inLen, out, outLen);
+    }
+}
+
+/**********************************************************************
+* __stream_symmetric_abort()
+* Ends a sequence the host gave up on with a final command on a dummy
+* block, so the next command does not find it open. The output is
+* dropped.
+**********************************************************************/
+static void __stream_symmetric_abort(uint8_t encrypt, uint8_t shielded)
+{
+    uint8_t block[16] = {0};
+    uint8_t out[32];
+    uint32_t outLen = sizeof(out);
+
+    TRUSTM_HELPER_DBGFN("Abort sequence");
+    if (__stream_symmetric_issue(encrypt, STREAM_FINAL, 0, 0, NULL, 0, shielded,
+                                    block, sizeof(block), out, &outLen) == OPTIGA_LIB_SUCCESS)
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+    memset(out, 0, sizeof(out));
+}
+
+/**********************************************************************
+* trustmSymmetricStream()
+* Encrypts or decrypts inFile into outFile with the chip. Inputs up to
+* one chunk use the single shot command, larger inputs the
+* start/continue/final sequence within the current session. The output
+* is written to a temporary file which only replaces outFile once
+* complete.
+**********************************************************************/
+optiga_lib_status_t trustmSymmetricStream(uint8_t encrypt, optiga_symmetric_encryption_mode_t mode,
+                                            optiga_key_id_t key, const uint8_t *iv, uint16_t ivLen,
+                                            uint8_t shielded, const char *inFile, const char *outFile,
+                                            trustm_stream_stats_t *stats)
+{
+    optiga_lib_status_t return_status = OPTIGA_CRYPT_ERROR;
+    uint8_t inBuf[2][TRUSTM_STREAM_CHUNK_SIZE];
+    uint8_t outBuf[2][TRUSTM_STREAM_CHUNK_SIZE + 16];
+    uint32_t inLen[2];
+    uint32_t outLen[2];
+    uint32_t pending = 0;   // output of the previous chunk not yet written
+    uint64_t total, offset = 0;
+    uint64_t start;
+    struct stat st;
+    char tmpName[PATH_MAX];
+    uint8_t step;
+    uint8_t inSequence = 0; // started, final not yet sent
+    int cur = 0;
+    int created = 0;
+    int out = -1;
+    FILE *in = NULL;
+
+    memset(stats, 0, sizeof(*stats));
+    start = __stream_now_us();
+
+    do
+    {
+        in = fopen(inFile, "rb");
+        if ((in == NULL) || (fstat(fileno(in), &st) != 0))
+        {
+            TRUSTM_HELPER_ERRFN("failed to open file %s", inFile);
+            break;
+        }
+        total = st.st_size;
+        if (total == 0)
+        {
+            TRUSTM_HELPER_ERRFN("%s is empty", inFile);
+            return_status = OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+            break;
+        }
+        out = trustmCreateTempFile(outFile, 0644, tmpName, sizeof(tmpName));
+        if (out < 0)
+            break;
+        created = 1;
+
+        inLen[cur] = fread(inBuf[cur], 1, sizeof(inBuf[cur]), in);
+        while (offset < total)
+        {
+            if (inLen[cur] == 0)
+            {
+                TRUSTM_HELPER_ERRFN("short read on %s", inFile);
+                return_status = OPTIGA_CRYPT_ERROR;
+                break;
+            }
+
+            if (total <= TRUSTM_STREAM_CHUNK_SIZE)
+                step = STREAM_ONESHOT;
+            else if (offset == 0)
+                step = STREAM_START;
+            else if (offset + inLen[cur] >= total)
+                step = STREAM_FINAL;
+            else
+                step = STREAM_CONTINUE;
+
+            outLen[cur] = sizeof(outBuf[cur]);
+            return_status = __stream_symmetric_issue(encrypt, step, mode, key, iv, ivLen, shielded,
+                                                        inBuf[cur], inLen[cur], outBuf[cur], &outLen[cur]);
+            if (OPTIGA_LIB_SUCCESS != return_status)
+                break;
+            offset += inLen[cur];
+            inSequence = (step == STREAM_START) || (step == STREAM_CONTINUE);
+
+            // Host I/O for the neighbouring chunks while the chip works
+            if (offset < total)
+                inLen[cur ^ 1] = fread(inBuf[cur ^ 1], 1, sizeof(inBuf[cur ^ 1]), in);
+            if (pending > 0)
+            {
+                if (trustmWriteTempFile(out, outBuf[cur ^ 1], pending) != 0)
+                {
+                    trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+                    if (optiga_lib_status != OPTIGA_LIB_SUCCESS)
+                        inSequence = 0;
+                    return_status = OPTIGA_CRYPT_ERROR;
+                    break;
+                }
+                pending = 0;
+            }
+
+            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+            return_status = optiga_lib_status;
+            if (return_status != OPTIGA_LIB_SUCCESS)
+            {
+                // The chip ended the sequence itself
+                inSequence = 0;
+                break;
+            }
+
+            pending = outLen[cur];
+            cur ^= 1;
+        }
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        if ((pending > 0) && (trustmWriteTempFile(out, outBuf[cur ^ 1], pending) != 0))
+        {
+            return_status = OPTIGA_CRYPT_ERROR;
+            break;
+        }
+        if (trustmCommitTempFile(out, tmpName, outFile) != 0)
+        {
+            out = -1;
+            return_status = OPTIGA_CRYPT_ERROR;
+            break;
+        }
+        out = -1;
+        created = 0;
+
+        stats->bytes = total;
+    }while(FALSE);
+
+    if (inSequence)
+        __stream_symmetric_abort(encrypt, shielded);
+    stats->us = __stream_now_us() - start;
+    if (in != NULL)
+        fclose(in);
+    if (out >= 0)
+        close(out);
+    if (created)
+        unlink(tmpName);
+    memset(inBuf, 0, sizeof(inBuf));
+    memset(outBuf, 0, sizeof(outBuf));
+
+    return return_status;
+}
+
+/**********************************************************************
+* __stream_hmac_issue()
+* Issues one HMAC command without waiting for completion.
+**********************************************************************/
+static optiga_lib_status_t __stream_hmac_issue(uint8_t step, optiga_hmac_type_t type, uint16_t secret,
+                                                uint8_t shielded, const uint8_t *in, uint32_t inLen,
+                                                uint8_t *mac, uint32_t *macLen)
+{
+    if (shielded)
+    {
+        // OPTIGA Comms Shielded connection settings to enable the protection
+        TRUSTM_SHIELD_CRYPT(me_crypt, OPTIGA_COMMS_FULL_PROTECTION);
+    }
+
+    optiga_lib_status = OPTIGA_LIB_BUSY;
+    switch (step)
+    {
+        case STREAM_ONESHOT:
+            return optiga_crypt_hmac(me_crypt, type, secret, in, inLen, mac, macLen);
+        case STREAM_START:
+            return optiga_crypt_hmac_start(me_crypt, type, secret, in, inLen);
+        case STREAM_CONTINUE:
+            return optiga_crypt_hmac_update(me_crypt, in, inLen);
+        default:
+            return optiga_crypt_hmac_finalize(me_crypt, in, inLen, mac, macLen);
+    }
+}
+
+/**********************************************************************
+* __stream_hmac_abort()
+* Ends a sequence the host gave up on, the MAC is dropped.
+**********************************************************************/
+static void __stream_hmac_abort(uint8_t shielded)
+{
+    uint8_t block[16] = {0};
+    uint8_t mac[64];
+    uint32_t macLen = sizeof(mac);
+
+    TRUSTM_HELPER_DBGFN("Abort sequence");
+    if (__stream_hmac_issue(STREAM_FINAL, 0, 0, shielded, block, sizeof(block),
+                            mac, &macLen) == OPTIGA_LIB_SUCCESS)
+        trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+    memset(mac, 0, sizeof(mac));
+}
+
+/**********************************************************************
+* trustmHmacStream()
+* MACs inFile with the secret in OID secret. Inputs up to one chunk use
+* the single shot command, larger inputs the start/update/finalize
+* sequence, reading the next chunk while the chip hashes the current one.
+**********************************************************************/
+optiga_lib_status_t trustmHmacStream(optiga_hmac_type_t type, uint16_t secret, uint8_t shielded,
+                                        const char *inFile, uint8_t *mac, uint32_t *macLen,
+                                        trustm_stream_stats_t *stats)
+{
+    optiga_lib_status_t return_status = OPTIGA_CRYPT_ERROR;
+    uint8_t inBuf[2][TRUSTM_STREAM_CHUNK_SIZE];
+    uint32_t inLen[2];
+    uint64_t total, offset = 0;
+    uint64_t start;
+    struct stat st;
+    uint8_t step;
+    uint8_t inSequence = 0; // started, finalize not yet sent
+    int cur = 0;
+    FILE *in = NULL;
+
+    memset(stats, 0, sizeof(*stats));
+    start = __stream_now_us();
+
+    do
+    {
+        in = fopen(inFile, "rb");
+        if ((in == NULL) || (fstat(fileno(in), &st) != 0))
+        {
+            TRUSTM_HELPER_ERRFN("failed to open file %s", inFile);
+            break;
+        }
+        total = st.st_size;
+        if (total == 0)
+        {
+            TRUSTM_HELPER_ERRFN("%s is empty", inFile);
+            return_status = OPTIGA_CRYPT_ERROR_INVALID_INPUT;
+            break;
+        }
+
+        inLen[cur] = fread(inBuf[cur], 1, sizeof(inBuf[cur]), in);
+        while (offset < total)
+        {
+            if (inLen[cur] == 0)
+            {
+                TRUSTM_HELPER_ERRFN("short read on %s", inFile);
+                return_status = OPTIGA_CRYPT_ERROR;
+                break;
+            }
+
+            if (total <= TRUSTM_STREAM_CHUNK_SIZE)
+                step = STREAM_ONESHOT;
+            else if (offset == 0)
+                step = STREAM_START;
+            else if (offset + inLen[cur] >= total)
+                step = STREAM_FINAL;
+            else
+                step = STREAM_CONTINUE;
+
+            return_status = __stream_hmac_issue(step, type, secret, shielded,
+                                                inBuf[cur], inLen[cur], mac, macLen);
+            if (OPTIGA_LIB_SUCCESS != return_status)
+                break;
+            offset += inLen[cur];
+            inSequence = (step == STREAM_START) || (step == STREAM_CONTINUE);
+
+            // Read the next chunk while the chip works
+            if (offset < total)
+                inLen[cur ^ 1] = fread(inBuf[cur ^ 1], 1, sizeof(inBuf[cur ^ 1]), in);
+
+            trustm_WaitForCompletion(BUSY_WAIT_TIME_OUT);
+            return_status = optiga_lib_status;
+            if (return_status != OPTIGA_LIB_SUCCESS)
+            {
+                // The chip ended the sequence itself
+                inSequence = 0;
+                break;
+            }
+
+            cur ^= 1;
+        }
+        if (return_status != OPTIGA_LIB_SUCCESS)
+            break;
+
+        stats->bytes = total;
+    }while(FALSE);
+
+    if (inSequence)
+        __stream_hmac_abort(shielded);
+    stats->us = __stream_now_us() - start;
+    if (in != NULL)
+        fclose(in);
+
+    return return_status;
+}
+
+/**********************************************************************
+* trustmPrintStreamStats()
+**********************************************************************/
+void trustmPrintStreamStats(const trustm_stream_stats_t *stats)
+{
+    printf("Processed        : %llu bytes in %llu.%03llu ms",
+            (unsigned long long)stats->bytes,
+            (unsigned long long)(stats->us / 1000), (unsigned long long)(stats->us % 1000));
+    if (stats->us > 0)
+        printf(" (%llu bytes/s)", (unsigned long long)(stats->bytes * 1000000 / stats->us));
+    printf("\n");
+}
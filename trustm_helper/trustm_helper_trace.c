@@ -0,0 +1,488 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trustm_helper.h"
+#include "trustm_helper_trace.h"
+
+#ifdef TRUSTM_TRACE_WRAP
+#include "optiga/pal/pal_i2c.h"
+#include "optiga/comms/optiga_comms.h"
+#endif
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+#define TRACE_MASK          (TRUSTM_TRACE_EVENTS - 1)
+
+uint8_t trustm_trace_on = 0;
+
+static trustm_trace_event_t *trace_buf = NULL;
+static uint64_t trace_head = 0;
+// Events before this index were cleared
+static uint64_t trace_base = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+// TRUSTM_TRACE, written at exit
+static char *trace_file = NULL;
+
+static __thread uint32_t trace_tid = 0;
+
+static const char *trace_cat_name[TRUSTM_TRACE_CAT_MAX] = {
+    "i2c", "frame", "apdu", "engine"
+};
+
+// Name of arg[0] (printed in hex) and arg[1], NULL : not used
+static const char *trace_arg_name[TRUSTM_TRACE_CAT_MAX][2] = {
+    {"reg", "len"}, {"fctr", "len"}, {"cmd", "len"}, {NULL, NULL}
+};
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+static uint64_t __trustm_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**********************************************************************
+* __trustm_trace_put()
+* Appends an event to the ring without locking. The sequence number is
+* cleared while the event is written, so that a concurrent dump skips
+* it instead of reading a partial event.
+**********************************************************************/
+static void __trustm_trace_put(uint8_t cat, uint8_t ph, const char *name, uint64_t ts,
+                                uint64_t dur, uint32_t id, uint16_t arg0, uint16_t arg1,
+                                uint32_t status)
+{
+    trustm_trace_event_t *buf;
+    trustm_trace_event_t *event;
+    uint64_t idx;
+
+    buf = __atomic_load_n(&trace_buf, __ATOMIC_ACQUIRE);
+    if (buf == NULL)
+        return;
+    if (trace_tid == 0)
+        trace_tid = (uint32_t)syscall(SYS_gettid);
+
+    idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    event = &buf[idx & TRACE_MASK];
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    event->ts = ts;
+    event->dur = dur;
+    event->tid = trace_tid;
+    event->id = id;
+    event->status = status;
+    event->arg[0] = arg0;
+    event->arg[1] = arg1;
+    event->cat = cat;
+    event->ph = ph;
+    strncpy(event->name, name, TRUSTM_TRACE_NAME_SIZE - 1);
+    event->name[TRUSTM_TRACE_NAME_SIZE - 1] = 0;
+
+    __atomic_store_n(&event->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**********************************************************************
+* __trustm_trace_atfork_child()
+* The child keeps the buffer but not the events of the parent
+**********************************************************************/
+static void __trustm_trace_atfork_child(void)
+{
+    pthread_mutex_init(&trace_mutex, NULL);
+    trace_tid = 0;
+    trustm_trace_clear();
+}
+
+/**********************************************************************
+* trustm_trace_enable()
+* Starts (on = 1) or stops recording, returns 0 if the buffer cannot
+* be allocated
+**********************************************************************/
+int trustm_trace_enable(uint8_t on)
+{
+    static uint8_t atfork = 0;
+    trustm_trace_event_t *buf;
+    int ret = 1;
+
+    pthread_mutex_lock(&trace_mutex);
+    do
+    {
+        if (on == 0)
+        {
+            __atomic_store_n(&trustm_trace_on, 0, __ATOMIC_RELEASE);
+            break;
+        }
+        if (trace_buf == NULL)
+        {
+            // Never freed, writers may still hold it
+            buf = calloc(TRUSTM_TRACE_EVENTS, sizeof(trustm_trace_event_t));
+            if (buf == NULL)
+            {
+                TRUSTM_HELPER_ERRFN("Cannot allocate the trace buffer");
+                ret = 0;
+                break;
+            }
+            __atomic_store_n(&trace_buf, buf, __ATOMIC_RELEASE);
+        }
+        if (atfork == 0)
+        {
+            pthread_atfork(NULL, NULL, __trustm_trace_atfork_child);
+            atfork = 1;
+        }
+        __atomic_store_n(&trustm_trace_on, 1, __ATOMIC_RELEASE);
+    }while(FALSE);
+    pthread_mutex_unlock(&trace_mutex);
+    return ret;
+}
+
+/**********************************************************************
+* trustm_trace_clear()
+* Drops the events recorded so far
+**********************************************************************/
+void trustm_trace_clear(void)
+{
+    __atomic_store_n(&trace_base, __atomic_load_n(&trace_head, __ATOMIC_RELAXED),
+                        __ATOMIC_RELAXED);
+}
+
+/**********************************************************************
+* trustm_trace_span()
+* Event from start to end, end 0 : now. Nothing is recorded if start
+* is 0, as returned by trustm_trace_clock() when not recording.
+**********************************************************************/
+void trustm_trace_span(uint8_t cat, const char *name, uint64_t start, uint64_t end,
+                        uint16_t arg0, uint16_t arg1, uint32_t status)
+{
+    if ((start == 0) || (__atomic_load_n(&trustm_trace_on, __ATOMIC_RELAXED) == 0))
+        return;
+    if (end == 0)
+        end = __trustm_trace_now();
+    __trustm_trace_put(cat, TRUSTM_TRACE_SPAN, name, start, (end > start) ? (end - start) : 0,
+                        0, arg0, arg1, status);
+}
+
+/**********************************************************************
+* trustm_trace_event()
+* Instant (TRUSTM_TRACE_INSTANT) or async begin/end event at now
+**********************************************************************/
+void trustm_trace_event(uint8_t cat, uint8_t ph, const char *name, uint32_t id,
+                        uint16_t arg0, uint16_t arg1, uint32_t status)
+{
+    if (__atomic_load_n(&trustm_trace_on, __ATOMIC_RELAXED) == 0)
+        return;
+    __trustm_trace_put(cat, ph, name, __trustm_trace_now(), 0, id, arg0, arg1, status);
+}
+
+/**********************************************************************
+* __trustm_trace_filename()
+* filename with "%p" replaced by the process id
+**********************************************************************/
+static void __trustm_trace_filename(const char *filename, char *buf, size_t size)
+{
+    const char *p = strstr(filename, "%p");
+
+    if (p == NULL)
+        snprintf(buf, size, "%s", filename);
+    else
+        snprintf(buf, size, "%.*s%d%s", (int)(p - filename), filename, getpid(), p + 2);
+}
+
+/**********************************************************************
+* trustm_trace_dump()
+* Writes the recorded events in the Chrome trace event format, returns
+* the number of events or -1. Recording goes on during the dump.
+**********************************************************************/
+int trustm_trace_dump(const char *filename)
+{
+    trustm_trace_event_t *buf;
+    trustm_trace_event_t event;
+    char name[256];
+    char comm[32] = "";
+    uint64_t head;
+    uint64_t idx;
+    uint64_t seq;
+    FILE *fp;
+    FILE *cf;
+    int count = 0;
+    int pid = getpid();
+
+    __trustm_trace_filename(filename, name, sizeof(name));
+    if ((fp = fopen(name, "w")) == NULL)
+    {
+        TRUSTM_HELPER_ERRFN("Cannot open %s", name);
+        return -1;
+    }
+
+    if ((cf = fopen("/proc/self/comm", "r")) != NULL)
+    {
+        if (fgets(comm, sizeof(comm), cf) != NULL)
+            comm[strcspn(comm, "\n\"\\")] = 0;
+        fclose(cf);
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}}", pid, pid, comm);
+
+    buf = __atomic_load_n(&trace_buf, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    idx = __atomic_load_n(&trace_base, __ATOMIC_RELAXED);
+    if (head - idx > TRUSTM_TRACE_EVENTS)
+        idx = head - TRUSTM_TRACE_EVENTS;
+
+    for (; (buf != NULL) && (idx < head); idx++)
+    {
+        seq = __atomic_load_n(&buf[idx & TRACE_MASK].seq, __ATOMIC_ACQUIRE);
+        memcpy(&event, &buf[idx & TRACE_MASK], sizeof(event));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq != idx + 1) ||
+            (__atomic_load_n(&buf[idx & TRACE_MASK].seq, __ATOMIC_RELAXED) != seq) ||
+            (event.cat >= TRUSTM_TRACE_CAT_MAX))
+            continue;
+
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,"
+                    "\"pid\":%d,\"tid\":%u", event.name, trace_cat_name[event.cat], event.ph,
+                    (unsigned long long)(event.ts / 1000), (unsigned long long)(event.ts % 1000),
+                    pid, event.tid);
+        if (event.ph == TRUSTM_TRACE_SPAN)
+            fprintf(fp, ",\"dur\":%llu.%03llu", (unsigned long long)(event.dur / 1000),
+                    (unsigned long long)(event.dur % 1000));
+        else if (event.ph == TRUSTM_TRACE_INSTANT)
+            fprintf(fp, ",\"s\":\"t\"");
+        else
+            fprintf(fp, ",\"id\":\"0x%x\"", event.id);
+
+        fprintf(fp, ",\"args\":{\"status\":\"0x%.4X\"", event.status);
+        if (trace_arg_name[event.cat][0] != NULL)
+            fprintf(fp, ",\"%s\":\"0x%.2X\",\"%s\":%u", trace_arg_name[event.cat][0], event.arg[0],
+                    trace_arg_name[event.cat][1], event.arg[1]);
+        fprintf(fp, "}}");
+        count++;
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0)
+    {
+        TRUSTM_HELPER_ERRFN("Cannot write %s", name);
+        return -1;
+    }
+    return count;
+}
+
+#ifdef TRUSTM_TRACE_WRAP
+/*************************************************************************
+*  I2C and IFX I2C protocol hooks
+*  The library is linked with -Wl,--wrap for these functions, so that
+*  the PAL and the comms layer of trustm_lib are traced unmodified.
+*************************************************************************/
+// IFX I2C registers
+#define TRACE_REG_DATA          0x80
+// Frame control : FTYPE, SEQCTR, FRNR, ACKNR
+#define TRACE_FCTR_CONTROL      0x80
+#define TRACE_FCTR_SEQCTR(x)    (((x) >> 5) & 0x03)
+// Transport layer chaining of the first data byte
+#define TRACE_PCTR_CHAIN(x)     ((x) & 0x07)
+#define TRACE_CHAIN_NONE        0x00
+#define TRACE_CHAIN_LAST        0x04
+
+pal_status_t __real_pal_i2c_write(const pal_i2c_t *p_i2c_context, uint8_t *p_data, uint16_t length);
+pal_status_t __real_pal_i2c_read(const pal_i2c_t *p_i2c_context, uint8_t *p_data, uint16_t length);
+optiga_lib_status_t __real_optiga_comms_transceive(optiga_comms_t *p_ctx, const uint8_t *p_tx_data,
+                                                    uint16_t tx_data_length, uint8_t *p_rx_data,
+                                                    uint16_t *p_rx_data_len);
+
+// Register addressed by the last write, the next reads return it
+static uint8_t trace_i2c_reg = 0;
+// APDU waiting for its response, 0 : none
+static uint32_t trace_apdu_id = 0;
+static uint32_t trace_apdu_last = 0;
+static const char *trace_apdu_pending = "apdu";
+
+static const struct
+{
+    uint8_t cmd;
+    const char *name;
+} trace_apdu_name[] = {
+    {0x01, "GetDataObject"},   {0x02, "SetDataObject"},   {0x03, "SetObjectProtected"},
+    {0x0C, "GetRandom"},       {0x14, "EncryptSym"},      {0x15, "DecryptSym"},
+    {0x1E, "EncryptAsym"},     {0x1F, "DecryptAsym"},     {0x30, "CalcHash"},
+    {0x31, "CalcSign"},        {0x32, "VerifySign"},      {0x33, "CalcSSec"},
+    {0x34, "DeriveKey"},       {0x38, "GenKeyPair"},      {0x39, "GenSymKey"},
+    {0x70, "OpenApplication"}, {0x71, "CloseApplication"}
+};
+
+/**********************************************************************
+* __trustm_trace_i2c_name()
+* Transfer name, NACK or bus busy are retried by the physical layer
+**********************************************************************/
+static const char *__trustm_trace_i2c_name(uint8_t write, pal_status_t status)
+{
+    if (status == PAL_STATUS_SUCCESS)
+        return write ? "i2c_write" : "i2c_read";
+    if (status == PAL_STATUS_I2C_BUSY)
+        return write ? "i2c_write_busy" : "i2c_read_busy";
+    return write ? "i2c_write_nack" : "i2c_read_nack";
+}
+
+/**********************************************************************
+* __trustm_trace_frame()
+* Data link layer frame sent or received, ends the pending APDU with
+* the last frame of its response
+**********************************************************************/
+static void __trustm_trace_frame(uint8_t tx, const uint8_t *frame, uint16_t length)
+{
+    static const char *ctrl_name[2][4] = {
+        {"ack_rx", "nak_rx", "resync_rx", "ctrl_rx"},
+        {"ack_tx", "nak_tx", "resync_tx", "ctrl_tx"}
+    };
+    uint16_t len;
+    uint32_t id;
+
+    if (length < 3)
+        return;
+    len = ((uint16_t)frame[1] << 8) | frame[2];
+    if (frame[0] & TRACE_FCTR_CONTROL)
+    {
+        trustm_trace_event(TRUSTM_TRACE_FRAME, TRUSTM_TRACE_INSTANT,
+                            ctrl_name[tx][TRACE_FCTR_SEQCTR(frame[0])], 0, frame[0], len, 0);
+        return;
+    }
+    trustm_trace_event(TRUSTM_TRACE_FRAME, TRUSTM_TRACE_INSTANT, tx ? "frame_tx" : "frame_rx",
+                        0, frame[0], len, 0);
+
+    if (tx || (len == 0) || (length < 4))
+        return;
+    if ((TRACE_PCTR_CHAIN(frame[3]) == TRACE_CHAIN_NONE) ||
+        (TRACE_PCTR_CHAIN(frame[3]) == TRACE_CHAIN_LAST))
+    {
+        if ((id = __atomic_exchange_n(&trace_apdu_id, 0, __ATOMIC_RELAXED)) != 0)
+            trustm_trace_event(TRUSTM_TRACE_APDU, TRUSTM_TRACE_END, trace_apdu_pending, id, 0, len, 0);
+    }
+}
+
+pal_status_t __wrap_pal_i2c_write(const pal_i2c_t *p_i2c_context, uint8_t *p_data, uint16_t length)
+{
+    uint64_t start = trustm_trace_clock();
+    pal_status_t status;
+    uint8_t reg;
+
+    if (start == 0)
+        return __real_pal_i2c_write(p_i2c_context, p_data, length);
+
+    reg = (length > 0) ? p_data[0] : 0;
+    trace_i2c_reg = reg;
+    if ((reg == TRACE_REG_DATA) && (length > 1))
+        __trustm_trace_frame(1, p_data + 1, length - 1);
+    status = __real_pal_i2c_write(p_i2c_context, p_data, length);
+    trustm_trace_span(TRUSTM_TRACE_I2C, __trustm_trace_i2c_name(1, status), start, 0,
+                        reg, length, status);
+    return status;
+}
+
+pal_status_t __wrap_pal_i2c_read(const pal_i2c_t *p_i2c_context, uint8_t *p_data, uint16_t length)
+{
+    uint64_t start = trustm_trace_clock();
+    pal_status_t status;
+    uint8_t reg;
+
+    if (start == 0)
+        return __real_pal_i2c_read(p_i2c_context, p_data, length);
+
+    reg = trace_i2c_reg;
+    status = __real_pal_i2c_read(p_i2c_context, p_data, length);
+    trustm_trace_span(TRUSTM_TRACE_I2C, __trustm_trace_i2c_name(0, status), start, 0,
+                        reg, length, status);
+    if ((status == PAL_STATUS_SUCCESS) && (reg == TRACE_REG_DATA))
+        __trustm_trace_frame(0, p_data, length);
+    return status;
+}
+
+optiga_lib_status_t __wrap_optiga_comms_transceive(optiga_comms_t *p_ctx, const uint8_t *p_tx_data,
+                                                    uint16_t tx_data_length, uint8_t *p_rx_data,
+                                                    uint16_t *p_rx_data_len)
+{
+    optiga_lib_status_t ret;
+    const char *name = "apdu";
+    uint32_t id;
+    uint8_t cmd;
+    uint16_t i;
+
+    if ((trustm_trace_clock() == 0) || (tx_data_length == 0))
+        return __real_optiga_comms_transceive(p_ctx, p_tx_data, tx_data_length,
+                                                p_rx_data, p_rx_data_len);
+
+    // Bit 7 of the command flushes the last error code
+    cmd = p_tx_data[0];
+    for (i = 0; i < sizeof(trace_apdu_name) / sizeof(trace_apdu_name[0]); i++)
+    {
+        if (trace_apdu_name[i].cmd == (cmd & 0x7F))
+            name = trace_apdu_name[i].name;
+    }
+    // A response that was not recognized ends with the next command
+    if ((id = __atomic_exchange_n(&trace_apdu_id, 0, __ATOMIC_RELAXED)) != 0)
+        trustm_trace_event(TRUSTM_TRACE_APDU, TRUSTM_TRACE_END, trace_apdu_pending, id, 0, 0, 0);
+    id = __atomic_add_fetch(&trace_apdu_last, 1, __ATOMIC_RELAXED);
+    trustm_trace_event(TRUSTM_TRACE_APDU, TRUSTM_TRACE_BEGIN, name, id, cmd, tx_data_length, 0);
+    trace_apdu_pending = name;
+    __atomic_store_n(&trace_apdu_id, id, __ATOMIC_RELEASE);
+
+    ret = __real_optiga_comms_transceive(p_ctx, p_tx_data, tx_data_length, p_rx_data, p_rx_data_len);
+    if ((ret != OPTIGA_LIB_SUCCESS) &&
+        __atomic_compare_exchange_n(&trace_apdu_id, &id, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        trustm_trace_event(TRUSTM_TRACE_APDU, TRUSTM_TRACE_END, name, id, 0, 0, ret);
+    return ret;
+}
+#endif
+
+/**********************************************************************
+* __trustm_trace_init()
+* Recording from the start of the process with TRUSTM_TRACE=<file>
+**********************************************************************/
+static void __trustm_trace_exit(void)
+{
+    trustm_trace_dump(trace_file);
+}
+
+static void __attribute__((constructor)) __trustm_trace_init(void)
+{
+    char *env = getenv("TRUSTM_TRACE");
+
+    if ((env == NULL) || (*env == 0))
+        return;
+    if ((trace_file = strdup(env)) == NULL)
+        return;
+    if (trustm_trace_enable(1))
+        atexit(__trustm_trace_exit);
+}
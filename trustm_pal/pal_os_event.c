@@ -0,0 +1,232 @@
+/**
+* MIT License
+*
+* Copyright (c) 2020 Infineon Technologies AG
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE
+
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/prctl.h>
+
+#include "optiga/pal/pal_os_event.h"
+
+// Event timer of the OPTIGA host library for Linux, in place of
+// trustm_lib/pal/linux/pal_os_event.c. The callbacks of the library are
+// run by one reactor thread waiting on a timerfd with epoll. The thread
+// and the timer are created once per process, registering a callback
+// only sets the timer, and the callback does not interrupt the thread
+// calling the library as a timer signal would.
+
+/*************************************************************************
+*  Global
+*************************************************************************/
+static pal_os_event_t pal_os_event_0 = {0};
+
+// Protects the registered callback and the timer setting
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t event_once = PTHREAD_ONCE_INIT;
+static int event_epoll = -1;
+static int event_timer = -1;
+
+/*************************************************************************
+*  functions
+*************************************************************************/
+
+/**********************************************************************
+* __pal_os_event_reactor()
+* Runs the registered callback when the timer expires
+**********************************************************************/
+static void *__pal_os_event_reactor(void *arg)
+{
+    struct epoll_event ev;
+    uint64_t expirations;
+    int n;
+
+    (void)arg;
+    // Wake up on time, the default slack of 50 us is in the range of the
+    // I2C guard and polling times
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+    while (1)
+    {
+        n = epoll_wait(event_epoll, &ev, 1, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "pal_os_event : epoll_wait %s\n", strerror(errno));
+            break;
+        }
+        if ((n == 0) || (read(event_timer, &expirations, sizeof(expirations)) != sizeof(expirations)))
+            continue;
+        pal_os_event_trigger_registered_callback();
+    }
+    return NULL;
+}
+
+/**********************************************************************
+* __pal_os_event_atfork_child()
+* The reactor does not survive fork, the child starts its own with its
+* first event
+**********************************************************************/
+static void __pal_os_event_atfork_child(void)
+{
+    pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    if (event_epoll != -1)
+        close(event_epoll);
+    if (event_timer != -1)
+        close(event_timer);
+    event_epoll = -1;
+    event_timer = -1;
+    event_once = once;
+    pthread_mutex_init(&event_mutex, NULL);
+    // A timer of the parent never expires here
+    pal_os_event_0.callback_registered = NULL;
+}
+
+/**********************************************************************
+* __pal_os_event_init()
+* Creates the timer and the reactor thread
+**********************************************************************/
+static void __pal_os_event_init(void)
+{
+    static uint8_t atfork = 0;
+    struct epoll_event ev;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (atfork == 0)
+    {
+        pthread_atfork(NULL, NULL, __pal_os_event_atfork_child);
+        atfork = 1;
+    }
+
+    do
+    {
+        event_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+        event_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if ((event_timer == -1) || (event_epoll == -1))
+        {
+            fprintf(stderr, "pal_os_event : cannot create timer %s\n", strerror(errno));
+            break;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = event_timer;
+        if (epoll_ctl(event_epoll, EPOLL_CTL_ADD, event_timer, &ev) == -1)
+        {
+            fprintf(stderr, "pal_os_event : epoll_ctl %s\n", strerror(errno));
+            break;
+        }
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, __pal_os_event_reactor, NULL) != 0)
+            fprintf(stderr, "pal_os_event : cannot start reactor %s\n", strerror(errno));
+        pthread_attr_destroy(&attr);
+    }while(0);
+}
+
+void pal_os_event_start(pal_os_event_t * p_pal_os_event, register_callback callback, void * callback_args)
+{
+    if (FALSE == p_pal_os_event->is_event_triggered)
+    {
+        p_pal_os_event->is_event_triggered = TRUE;
+        pal_os_event_register_callback_oneshot(p_pal_os_event, callback, callback_args, 1000);
+    }
+}
+
+void pal_os_event_stop(pal_os_event_t * p_pal_os_event)
+{
+    p_pal_os_event->is_event_triggered = FALSE;
+}
+
+pal_os_event_t * pal_os_event_create(register_callback callback, void * callback_args)
+{
+    pthread_once(&event_once, __pal_os_event_init);
+
+    if ((NULL != callback) && (NULL != callback_args))
+        pal_os_event_start(&pal_os_event_0, callback, callback_args);
+    return (&pal_os_event_0);
+}
+
+/**********************************************************************
+* pal_os_event_trigger_registered_callback()
+* Called by the reactor. A callback registered again after the timer
+* expired waits for its own expiry instead of running early.
+**********************************************************************/
+void pal_os_event_trigger_registered_callback(void)
+{
+    struct itimerspec its;
+    register_callback callback = NULL;
+    void *callback_ctx = NULL;
+
+    pthread_mutex_lock(&event_mutex);
+    if ((timerfd_gettime(event_timer, &its) == 0) &&
+        (its.it_value.tv_sec == 0) && (its.it_value.tv_nsec == 0))
+    {
+        callback = pal_os_event_0.callback_registered;
+        callback_ctx = pal_os_event_0.callback_ctx;
+        pal_os_event_0.callback_registered = NULL;
+    }
+    pthread_mutex_unlock(&event_mutex);
+
+    // Outside the lock, callbacks register the next event
+    if (callback != NULL)
+        callback(callback_ctx);
+}
+
+void pal_os_event_register_callback_oneshot(pal_os_event_t * p_pal_os_event,
+                                            register_callback callback,
+                                            void * callback_args,
+                                            uint32_t time_us)
+{
+    struct itimerspec its;
+
+    pthread_once(&event_once, __pal_os_event_init);
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = time_us / 1000000;
+    its.it_value.tv_nsec = (long)(time_us % 1000000) * 1000;
+    // 0 would disarm the timer
+    if (time_us == 0)
+        its.it_value.tv_nsec = 1;
+
+    pthread_mutex_lock(&event_mutex);
+    p_pal_os_event->callback_registered = callback;
+    p_pal_os_event->callback_ctx = callback_args;
+    if (timerfd_settime(event_timer, 0, &its, NULL) == -1)
+        fprintf(stderr, "pal_os_event : timerfd_settime %s\n", strerror(errno));
+    pthread_mutex_unlock(&event_mutex);
+}
+
+void pal_os_event_destroy(pal_os_event_t * pal_os_event)
+{
+    // The event and the reactor are shared by all instances of the
+    // library and live as long as the process
+    (void)pal_os_event;
+}